@@ -0,0 +1,561 @@
+// Copyright 2025 Michał Jankowski
+// Drives a set of c_comm daemons through their control sockets and reports
+// discovery convergence, packets per node, message delivery latency and,
+// optionally, bulk throughput from node 1 to node 2. Started by
+// netns_bench.sh, one daemon per network namespace.
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "control.h"
+
+#define CONN_BUFFER_SIZE (CTL_HEADER_SIZE + CTL_MAX_BODY)
+#define CONNECT_TIMEOUT_MS 30000
+#define POLL_INTERVAL_MS 10
+#define REPLY_TIMEOUT_MS 10000  // a node busy answering a scan storm is slow, not dead
+#define SAMPLE_TIMEOUT_MS 1000
+#define BULK_CHUNK (64 * 1024)  // CTL_SEND frames written per send()
+#define BULK_IDLE_MS 1000  // the receiver is done when nothing came for this long
+
+typedef struct {
+    int fd;
+    size_t len;
+    uint8_t buf[CONN_BUFFER_SIZE];
+    long int *peer_ids;  // node index -> peer id in this node's table, -1 = unknown
+    size_t peers_seen;
+    double converged_ms;  // < 0 = not yet
+    uint64_t tx_base;
+    uint64_t rx_base;
+} Conn;
+
+typedef struct {
+    uint8_t op;
+    uint8_t flags;
+    const uint8_t *body;
+    size_t body_length;
+} Frame;
+
+static inline void PutU16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+static inline uint16_t GetU16(const uint8_t *p) {
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static inline uint64_t GetU64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (unsigned int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static double NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1000.0 + (double) ts.tv_nsec / 1e6;
+}
+
+static int ConnOpen(Conn *c, const char *path, double deadline_ms) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    while (1) {
+        if ((c->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            return -1;
+        }
+        if (connect(c->fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            c->len = 0;
+            return 0;
+        }
+        close(c->fd);
+        if (NowMs() > deadline_ms) {
+            return -2;
+        }
+        usleep(POLL_INTERVAL_MS * 1000);  // the daemon is still starting
+    }
+}
+
+static int ConnSend(Conn *c, uint8_t op, uint8_t flags, const void *body, size_t body_length) {
+    uint8_t frame[CTL_HEADER_SIZE + 512];
+    if (body_length > sizeof(frame) - CTL_HEADER_SIZE) {
+        return -1;
+    }
+    PutU16(frame, (uint16_t) body_length);
+    frame[2] = op;
+    frame[3] = flags;
+    memcpy(frame + CTL_HEADER_SIZE, body, body_length);
+    size_t total = CTL_HEADER_SIZE + body_length;
+    return send(c->fd, frame, total, MSG_NOSIGNAL) == (ssize_t) total ? 0 : -1;
+}
+
+// Drops the frame returned by the previous ConnRead.
+static void ConnConsume(Conn *c, const Frame *f) {
+    size_t used = CTL_HEADER_SIZE + f->body_length;
+    memmove(c->buf, c->buf + used, c->len - used);
+    c->len -= used;
+}
+
+// Next frame, valid until ConnConsume. Returns 0 on timeout, -1 on error.
+static int ConnRead(Conn *c, Frame *f, int timeout_ms) {
+    double deadline = NowMs() + timeout_ms;
+    while (1) {
+        if (c->len >= CTL_HEADER_SIZE && c->len >= CTL_HEADER_SIZE + (size_t) GetU16(c->buf)) {
+            f->body_length = GetU16(c->buf);
+            f->op = c->buf[2];
+            f->flags = c->buf[3];
+            f->body = c->buf + CTL_HEADER_SIZE;
+            return 1;
+        }
+        int left = (int) (deadline - NowMs());
+        if (left <= 0) {
+            return 0;
+        }
+        struct pollfd pfd = {.fd = c->fd, .events = POLLIN};
+        if (poll(&pfd, 1, left) <= 0) {
+            continue;
+        }
+        ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        c->len += (size_t) n;
+    }
+}
+
+// Reads up to the reply for op, skipping message events.
+static int ConnReply(Conn *c, uint8_t op, Frame *f) {
+    while (1) {
+        int ret = ConnRead(c, f, REPLY_TIMEOUT_MS);
+        if (ret <= 0) {
+            return -1;
+        }
+        if (f->op == (op | CTL_REPLY)) {
+            return 0;
+        }
+        ConnConsume(c, f);
+    }
+}
+
+// Node identifiers are "n<index>@host", as netns_bench.sh names them.
+static long int NodeIndex(const uint8_t *identifier, size_t length, size_t count) {
+    if (length < 2 || identifier[0] != 'n') {
+        return -1;
+    }
+    long int index = 0;
+    for (size_t i = 1; i < length && identifier[i] != '@'; i++) {
+        if (identifier[i] < '0' || identifier[i] > '9') {
+            return -1;
+        }
+        index = index * 10 + (identifier[i] - '0');
+    }
+    return index >= 1 && (size_t) index <= count ? index - 1 : -1;
+}
+
+static int ListPeers(Conn *c, size_t count) {
+    uint8_t first[2] = {0, 0};
+    if (ConnSend(c, CTL_LIST_PEERS, 0, first, sizeof(first)) < 0) {
+        return -1;
+    }
+    c->peers_seen = 0;
+    for (size_t i = 0; i < count; i++) {
+        c->peer_ids[i] = -1;
+    }
+    Frame f;
+    while (ConnReply(c, CTL_LIST_PEERS, &f) == 0) {
+        uint8_t more = f.flags & CTL_FLAG_MORE;
+        if (!more && (f.flags & ~CTL_FLAG_MORE) == CTL_ERR_QUEUE_FULL && f.body_length == 2) {
+            memcpy(first, f.body, sizeof(first));  // the daemon's buffer was full, go on from there
+            ConnConsume(c, &f);
+            if (ConnSend(c, CTL_LIST_PEERS, 0, first, sizeof(first)) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (more && f.body_length >= 24 && 24 + (size_t) f.body[23] <= f.body_length) {
+            long int index = NodeIndex(f.body + 24, f.body[23], count);
+            if (index >= 0 && c->peer_ids[index] < 0) {
+                c->peer_ids[index] = GetU16(f.body);
+                c->peers_seen++;
+            }
+        }
+        ConnConsume(c, &f);
+        if (!more) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// All counters, the ones an older daemon does not have yet read as 0.
+static int ReadCounters(Conn *c, uint64_t counters[CTL_STAT_COUNT]) {
+    Frame f;
+    if (ConnSend(c, CTL_STATS, 0, NULL, 0) < 0 || ConnReply(c, CTL_STATS, &f) < 0) {
+        return -1;
+    }
+    size_t count = f.body_length >= 2 ? GetU16(f.body) : 0;
+    if (count <= CTL_STAT_TX_DATAGRAMS || f.body_length < 2 + 8 * count) {
+        ConnConsume(c, &f);
+        return -1;
+    }
+    for (size_t i = 0; i < CTL_STAT_COUNT; i++) {
+        counters[i] = i < count ? GetU64(f.body + 2 + 8 * i) : 0;
+    }
+    ConnConsume(c, &f);
+    return 0;
+}
+
+static int ReadTraffic(Conn *c, uint64_t *tx, uint64_t *rx) {
+    uint64_t counters[CTL_STAT_COUNT];
+    if (ReadCounters(c, counters) < 0) {
+        return -1;
+    }
+    *rx = counters[CTL_STAT_RX_DATAGRAMS];
+    *tx = counters[CTL_STAT_TX_DATAGRAMS];
+    return 0;
+}
+
+static int CompareDouble(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double Percentile(double *sorted, size_t count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t index = (size_t) (p * (double) (count - 1) + 0.5);
+    return sorted[index];
+}
+
+static int Scan(Conn *c) {
+    Frame f;
+    if (ConnSend(c, CTL_SCAN, 0, NULL, 0) < 0 || ConnReply(c, CTL_SCAN, &f) < 0) {
+        return -1;
+    }
+    ConnConsume(c, &f);
+    return 0;
+}
+
+// Every node has every other one in its peer table. Nodes still missing
+// some scan again every rescan_ms (0 = never), a scan storm loses datagrams
+// like any real network would. Returns the number of nodes that did not
+// get there before the timeout.
+static size_t Converge(Conn *conns, size_t count, double start_ms, int timeout_ms, int rescan_ms) {
+    size_t pending = count;
+    double next_scan_ms = start_ms + rescan_ms;
+    while (pending > 0 && NowMs() - start_ms < timeout_ms) {
+        int rescan = rescan_ms > 0 && NowMs() >= next_scan_ms;
+        if (rescan) {
+            next_scan_ms = NowMs() + rescan_ms;
+        }
+        for (size_t i = 0; i < count; i++) {
+            Conn *c = &conns[i];
+            if (c->converged_ms >= 0) {
+                continue;
+            }
+            if (rescan) {
+                Scan(c);
+            }
+            if (ListPeers(c, count) < 0) {
+                fprintf(stderr, "[FAIL] Node %zu stopped answering\n", i + 1);
+                return pending;
+            }
+            if (c->peers_seen >= count - 1) {
+                c->converged_ms = NowMs() - start_ms;
+                pending--;
+            }
+        }
+        usleep(POLL_INTERVAL_MS * 1000);
+    }
+    return pending;
+}
+
+// One message at a time between random pairs, timed from the CTL_SEND to
+// the receiver's event.
+static size_t MeasureLatency(Conn *conns, size_t count, size_t samples, double *latencies_us) {
+    size_t delivered = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t enable = 1;
+        Frame f;
+        if (ConnSend(&conns[i], CTL_SUBSCRIBE, 0, &enable, 1) < 0 || ConnReply(&conns[i], CTL_SUBSCRIBE, &f) < 0) {
+            return 0;
+        }
+        ConnConsume(&conns[i], &f);
+        ListPeers(&conns[i], count);
+    }
+
+    for (size_t s = 0; s < samples; s++) {
+        size_t from = (size_t) random() % count;
+        size_t to = (from + 1 + (size_t) random() % (count - 1)) % count;
+        if (conns[from].peer_ids[to] < 0) {
+            continue;
+        }
+        uint8_t body[64];
+        PutU16(body, (uint16_t) conns[from].peer_ids[to]);
+        int text_length = snprintf((char *) body + 2, sizeof(body) - 2, "bench %zu", s);
+
+        double sent_ms = NowMs();
+        if (ConnSend(&conns[from], CTL_SEND, CTL_FLAG_NO_REPLY, body, 2 + (size_t) text_length) < 0) {
+            continue;
+        }
+        Frame f;
+        while (ConnRead(&conns[to], &f, SAMPLE_TIMEOUT_MS) == 1) {
+            int match = f.op == CTL_EVENT_MESSAGE && f.body_length >= 3
+                && f.body_length >= 3 + (size_t) f.body[2] + (size_t) text_length
+                && memcmp(f.body + 3 + f.body[2], body + 2, (size_t) text_length) == 0;
+            ConnConsume(&conns[to], &f);
+            if (match) {
+                latencies_us[delivered++] = (NowMs() - sent_ms) * 1000.0;
+                break;
+            }
+        }
+    }
+    return delivered;
+}
+
+// Counts the message events in c's buffer, discarding everything.
+static size_t CountMessages(Conn *c) {
+    size_t messages = 0;
+    Frame f;
+    while (c->len >= CTL_HEADER_SIZE && c->len >= CTL_HEADER_SIZE + (size_t) GetU16(c->buf)) {
+        f.body_length = GetU16(c->buf);
+        messages += c->buf[2] == CTL_EVENT_MESSAGE;
+        ConnConsume(c, &f);
+    }
+    return messages;
+}
+
+// Pipelines messages of size bytes from conns[0] to conns[1] as fast as the
+// sender's control socket takes them, and counts what the receiver gets.
+// Timed from the first send to the last event.
+static void MeasureThroughput(Conn *conns, size_t count, size_t messages, size_t size) {
+    Conn *from = &conns[0];
+    Conn *to = &conns[1];
+    uint64_t tx_before[CTL_STAT_COUNT], rx_before[CTL_STAT_COUNT];
+    uint64_t tx_after[CTL_STAT_COUNT], rx_after[CTL_STAT_COUNT];
+    Frame f;
+    uint8_t enable = 1;
+    ListPeers(from, count);
+    if (from->peer_ids[1] < 0 || ConnSend(to, CTL_SUBSCRIBE, 0, &enable, 1) < 0
+        || ConnReply(to, CTL_SUBSCRIBE, &f) < 0) {
+        fprintf(stderr, "[FAIL] Node 2 is not a peer of node 1\n");
+        return;
+    }
+    ConnConsume(to, &f);
+    CountMessages(to);  // latency stragglers
+    if (ReadCounters(from, tx_before) < 0 || ReadCounters(to, rx_before) < 0) {
+        fprintf(stderr, "[FAIL] No stats for the throughput run\n");
+        return;
+    }
+
+    // every frame is the same: u16 peer_id | size bytes of payload
+    size_t frame_size = CTL_HEADER_SIZE + 2 + size;
+    size_t per_chunk = BULK_CHUNK / frame_size;
+    uint8_t *chunk = malloc(per_chunk * frame_size);
+    if (chunk == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < per_chunk; i++) {
+        uint8_t *frame = chunk + i * frame_size;
+        PutU16(frame, (uint16_t) (2 + size));
+        frame[2] = CTL_SEND;
+        frame[3] = CTL_FLAG_NO_REPLY;
+        PutU16(frame + CTL_HEADER_SIZE, (uint16_t) from->peer_ids[1]);
+        memset(frame + CTL_HEADER_SIZE + 2, 'x', size);
+    }
+
+    size_t written = 0;  // bytes of the whole stream
+    size_t total = messages * frame_size;
+    size_t delivered = 0, refused = 0;
+    double start_ms = NowMs(), last_ms = start_ms;
+    while (delivered < messages && NowMs() - last_ms < BULK_IDLE_MS) {
+        struct pollfd pfds[2] = {
+            {.fd = to->fd, .events = POLLIN},
+            {.fd = from->fd, .events = POLLIN | (written < total ? POLLOUT : 0)},
+        };
+        if (poll(pfds, 2, POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+        if (pfds[1].revents & POLLOUT) {
+            size_t off = written % (per_chunk * frame_size);
+            size_t len = per_chunk * frame_size - off;
+            len = len < total - written ? len : total - written;
+            ssize_t n = send(from->fd, chunk + off, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+            written += n > 0 ? (size_t) n : 0;
+        }
+        for (unsigned int i = 0; i < 2; i++) {
+            Conn *c = i == 0 ? to : from;
+            if (!(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, MSG_DONTWAIT);
+            if (n <= 0) {
+                continue;
+            }
+            c->len += (size_t) n;
+            if (c == to) {
+                size_t got = CountMessages(to);
+                delivered += got;
+                last_ms = got > 0 ? NowMs() : last_ms;
+            } else {
+                // only failed sends are answered
+                while (ConnRead(from, &f, 0) == 1) {
+                    refused += f.op == (CTL_SEND | CTL_REPLY);
+                    ConnConsume(from, &f);
+                }
+            }
+        }
+    }
+    double elapsed_s = (last_ms - start_ms) / 1000.0;
+    free(chunk);
+    if (ReadCounters(from, tx_after) < 0 || ReadCounters(to, rx_after) < 0) {
+        fprintf(stderr, "[FAIL] No stats after the throughput run\n");
+        return;
+    }
+    double tx_datagrams = (double) (tx_after[CTL_STAT_TX_DATAGRAMS] - tx_before[CTL_STAT_TX_DATAGRAMS]);
+    double tx_syscalls = (double) (tx_after[CTL_STAT_TRANSPORT_SYSCALLS] - tx_before[CTL_STAT_TRANSPORT_SYSCALLS]);
+    double rx_datagrams = (double) (rx_after[CTL_STAT_RX_DATAGRAMS] - rx_before[CTL_STAT_RX_DATAGRAMS]);
+    double rx_syscalls = (double) (rx_after[CTL_STAT_TRANSPORT_SYSCALLS] - rx_before[CTL_STAT_TRANSPORT_SYSCALLS]);
+    printf("throughput size %zu  delivered %zu/%zu (refused %zu, kernel drops %lu)  msgs/s %.0f  MB/s %.1f  "
+           "datagrams/syscall tx %.1f rx %.1f  syscalls/msg tx %.2f rx %.2f\n",
+           size, delivered, messages, refused,
+           (unsigned long) (rx_after[CTL_STAT_RX_KERNEL_DROPS] - rx_before[CTL_STAT_RX_KERNEL_DROPS]),
+           elapsed_s > 0 ? (double) delivered / elapsed_s : 0.0,
+           elapsed_s > 0 ? (double) (delivered * size) / elapsed_s / 1e6 : 0.0,
+           tx_syscalls > 0 ? tx_datagrams / tx_syscalls : 0.0, rx_syscalls > 0 ? rx_datagrams / rx_syscalls : 0.0,
+           delivered > 0 ? tx_syscalls / (double) delivered : 0.0, delivered > 0 ? rx_syscalls / (double) delivered : 0.0);
+}
+
+static void PrintUsage(void) {
+    printf("Usage: bench_driver [OPTIONS] SOCKET...\n");
+    printf("  -m scan|passive - scan: every node scans once all are up (default),\n");
+    printf("                    passive: the nodes discover each other on their own,\n");
+    printf("                    timed from the driver's start\n");
+    printf("  -t MS           - convergence timeout (default: 60000)\n");
+    printf("  -r MS           - scan mode: unconverged nodes scan again this often, 0 = once\n");
+    printf("                    (default: 1000)\n");
+    printf("  -l COUNT        - latency samples (default: 200)\n");
+    printf("  -b COUNT        - then send COUNT messages from node 1 to node 2 back to back\n");
+    printf("                    and report the throughput (default: 0, off)\n");
+    printf("  -z SIZE         - message size for -b (default: 1000)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int passive = 0;
+    int timeout_ms = 60000;
+    int rescan_ms = 1000;
+    long int samples = 200;
+    long int bulk_messages = 0;
+    long int bulk_size = 1000;
+    double driver_start_ms = NowMs();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:t:r:l:b:z:")) != -1) {
+        switch (opt) {
+            case 'm':
+                passive = strcmp(optarg, "passive") == 0;
+                break;
+            case 't':
+                timeout_ms = atoi(optarg);
+                break;
+            case 'r':
+                rescan_ms = atoi(optarg);
+                break;
+            case 'l':
+                samples = strtol(optarg, NULL, 10);
+                break;
+            case 'b':
+                bulk_messages = strtol(optarg, NULL, 10);
+                break;
+            case 'z':
+                bulk_size = strtol(optarg, NULL, 10);
+                break;
+            default:
+                PrintUsage();
+                return EXIT_FAILURE;
+        }
+    }
+    size_t count = (size_t) (argc - optind);
+    if (count < 2 || samples < 0 || bulk_messages < 0 || bulk_size < 1 || bulk_size > 1400) {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    Conn *conns = calloc(count, sizeof(Conn));
+    double *values = calloc(count + (size_t) samples, sizeof(double));
+    if (conns == NULL || values == NULL) {
+        fprintf(stderr, "[FAIL] Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < count; i++) {
+        Conn *c = &conns[i];
+        c->converged_ms = -1;
+        if ((c->peer_ids = calloc(count, sizeof(long int))) == NULL
+            || ConnOpen(c, argv[optind + i], driver_start_ms + CONNECT_TIMEOUT_MS) < 0) {
+            fprintf(stderr, "[FAIL] Could not reach %s\n", argv[optind + i]);
+            return EXIT_FAILURE;
+        }
+        if (!passive && ReadTraffic(c, &c->tx_base, &c->rx_base) < 0) {
+            fprintf(stderr, "[FAIL] No stats from %s\n", argv[optind + i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    double start_ms = driver_start_ms;
+    if (!passive) {
+        start_ms = NowMs();
+        for (size_t i = 0; i < count; i++) {
+            if (Scan(&conns[i]) < 0) {
+                fprintf(stderr, "[FAIL] Node %zu did not scan\n", i + 1);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    size_t unconverged = Converge(conns, count, start_ms, timeout_ms, passive ? 0 : rescan_ms);
+
+    double tx_total = 0, rx_total = 0, tx_max = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t tx, rx;
+        if (ReadTraffic(&conns[i], &tx, &rx) == 0) {
+            tx_total += (double) (tx - conns[i].tx_base);
+            rx_total += (double) (rx - conns[i].rx_base);
+            if ((double) (tx - conns[i].tx_base) > tx_max) {
+                tx_max = (double) (tx - conns[i].tx_base);
+            }
+        }
+        values[i] = conns[i].converged_ms >= 0 ? conns[i].converged_ms : (double) timeout_ms;
+    }
+    qsort(values, count, sizeof(double), CompareDouble);
+    printf("nodes %zu  converged %zu/%zu  time_ms p50 %.1f max %.1f  "
+           "packets/node tx %.1f (max %.0f) rx %.1f",
+           count, count - unconverged, count, Percentile(values, count, 0.5), values[count - 1],
+           tx_total / (double) count, tx_max, rx_total / (double) count);
+
+    size_t delivered = MeasureLatency(conns, count, (size_t) samples, values);
+    qsort(values, delivered, sizeof(double), CompareDouble);
+    printf("  latency_us p50 %.0f p99 %.0f max %.0f  delivered %zu/%ld\n",
+           Percentile(values, delivered, 0.5), Percentile(values, delivered, 0.99),
+           delivered > 0 ? values[delivered - 1] : 0.0, delivered, samples);
+    if (bulk_messages > 0) {
+        MeasureThroughput(conns, count, (size_t) bulk_messages, (size_t) bulk_size);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        close(conns[i].fd);
+        free(conns[i].peer_ids);
+    }
+    free(conns);
+    free(values);
+    return unconverged == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
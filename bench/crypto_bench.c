@@ -0,0 +1,193 @@
+// Copyright 2025 Michał Jankowski
+// Throughput of the in-tree ciphers behind sealed messages (secure.h):
+// ChaCha20 per implementation the CPU supports, Poly1305, and the
+// ChaCha20-Poly1305 seal/open that every sealed message costs, at message
+// sizes, in TSC cycles per byte, GB/s and messages per second on one core.
+// X25519 is timed per operation, one runs per peer and run.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "aead.h"
+#include "chacha20.h"
+#include "poly1305.h"
+#include "x25519.h"
+
+#define BUFFER_SIZE (64 * 1024)
+#define RUNS 5  // the best one is reported
+
+static const char *const IMPLEMENTATIONS[] = {"avx2", "sse2", "scalar"};
+
+typedef void (*Operation)(uint8_t *buf, size_t length);
+
+static ChaCha20Key key;
+static uint8_t nonce[CHACHA20_NONCE_SIZE];
+static uint8_t tag[AEAD_TAG_SIZE];
+
+static double NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static void OpChaCha20(uint8_t *buf, size_t length) {
+    ChaCha20Xor(&key, nonce, 1, buf, buf, length);
+}
+
+static void OpPoly1305(uint8_t *buf, size_t length) {
+    Poly1305 mac;
+    Poly1305Init(&mac, buf + length);  // any 32 bytes will do
+    Poly1305Update(&mac, buf, length);
+    Poly1305Final(&mac, tag);
+}
+
+static void OpSeal(uint8_t *buf, size_t length) {
+    AeadSeal(&key, nonce, NULL, 0, buf, length, tag);
+}
+
+// Opens what OpSeal() sealed last, the tag matches every time.
+static void OpOpen(uint8_t *buf, size_t length) {
+    if (AeadOpen(&key, nonce, NULL, 0, buf, length, tag) < 0) {
+        fprintf(stderr, "[FAIL] Tag mismatch\n");
+        exit(EXIT_FAILURE);
+    }
+    AeadSeal(&key, nonce, NULL, 0, buf, length, tag);  // back to ciphertext and its tag
+}
+
+// Runs op over length-byte messages until about total bytes went through,
+// best of RUNS.
+static void Measure(const char *name, Operation op, uint8_t *buf, size_t length, size_t total, int opens) {
+    size_t iterations = total / length > 0 ? total / length : 1;
+    double best_cycles = 0, best_ns = 0;
+    if (opens) {
+        OpSeal(buf, length);
+    }
+    for (unsigned int run = 0; run < RUNS; run++) {
+        double start_ns = NowNs();
+        unsigned long long start = __rdtsc();
+        for (size_t i = 0; i < iterations; i++) {
+            op(buf, length);
+        }
+        double cycles = (double) (__rdtsc() - start);
+        double ns = NowNs() - start_ns;
+        if (run == 0 || cycles < best_cycles) {
+            best_cycles = cycles;
+            best_ns = ns;
+        }
+    }
+    double bytes = (double) iterations * (double) length;
+    if (opens) {  // the re-seal doubles the work, half of it counts
+        best_cycles /= 2;
+        best_ns /= 2;
+    }
+    printf("%-18s %6zu B  %7.2f cycles/B  %6.2f GB/s  %10.0f msgs/s\n",
+           name, length, best_cycles / bytes, bytes / best_ns, (double) iterations / (best_ns / 1e9));
+}
+
+static void MeasureX25519(size_t iterations) {
+    uint8_t secret[X25519_KEY_SIZE], public_key[X25519_KEY_SIZE], shared[X25519_KEY_SIZE];
+    if (X25519Keypair(public_key, secret) < 0) {
+        fprintf(stderr, "[FAIL] No randomness\n");
+        exit(EXIT_FAILURE);
+    }
+    double start_ns = NowNs();
+    unsigned long long start = __rdtsc();
+    for (size_t i = 0; i < iterations; i++) {
+        X25519(shared, secret, public_key);
+        public_key[0] ^= shared[0];
+    }
+    double cycles = (double) (__rdtsc() - start);
+    double ns = NowNs() - start_ns;
+    printf("%-18s %9.0f cycles  %6.1f us  %10.0f ops/s\n",
+           "x25519", cycles / (double) iterations, ns / (double) iterations / 1e3, (double) iterations / (ns / 1e9));
+}
+
+static void PrintUsage(void) {
+    printf("Usage: crypto_bench [OPTIONS]\n");
+    printf("  -z \"SIZES\" - message sizes in bytes, at most %d (default: 64 256 1024 2000 16384)\n", BUFFER_SIZE);
+    printf("  -m MB      - data per measurement (default: 64)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *sizes_arg = "64 256 1024 2000 16384";
+    long int megabytes = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "z:m:")) != -1) {
+        switch (opt) {
+            case 'z':
+                sizes_arg = optarg;
+                break;
+            case 'm':
+                megabytes = strtol(optarg, NULL, 10);
+                break;
+            default:
+                PrintUsage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || megabytes < 1) {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    size_t sizes[32];
+    size_t size_count = 0;
+    char *end;
+    for (const char *p = sizes_arg; *p != '\0' && size_count < 32; p = end) {
+        long int size = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        } else if (size < 1 || size > BUFFER_SIZE) {
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+        sizes[size_count++] = (size_t) size;
+    }
+
+    uint8_t *buf = malloc(BUFFER_SIZE + 32);
+    uint8_t key_bytes[CHACHA20_KEY_SIZE];
+    if (buf == NULL) {
+        fprintf(stderr, "[FAIL] Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < BUFFER_SIZE + 32; i++) {
+        buf[i] = (uint8_t) rand();
+    }
+    for (size_t i = 0; i < sizeof(key_bytes); i++) {
+        key_bytes[i] = (uint8_t) rand();
+    }
+    ChaCha20KeyInit(&key, key_bytes);
+    size_t total = (size_t) megabytes * 1024 * 1024;
+    const char *chosen = ChaCha20Implementation();
+    printf("ChaCha20 implementation picked for this CPU: %s\n", chosen);
+
+    for (unsigned int i = 0; i < sizeof(IMPLEMENTATIONS) / sizeof(IMPLEMENTATIONS[0]); i++) {
+        if (ChaCha20SelectImplementation(IMPLEMENTATIONS[i]) < 0) {
+            printf("chacha20 %-9s not supported here\n", IMPLEMENTATIONS[i]);
+            continue;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "chacha20 %s", IMPLEMENTATIONS[i]);
+        for (size_t s = 0; s < size_count; s++) {
+            Measure(name, OpChaCha20, buf, sizes[s], total, 0);
+        }
+    }
+    ChaCha20SelectImplementation(chosen);
+
+    for (size_t s = 0; s < size_count; s++) {
+        Measure("poly1305", OpPoly1305, buf, sizes[s], total, 0);
+    }
+    for (size_t s = 0; s < size_count; s++) {
+        Measure("seal", OpSeal, buf, sizes[s], total, 0);
+    }
+    for (size_t s = 0; s < size_count; s++) {
+        Measure("open", OpOpen, buf, sizes[s], total, 1);
+    }
+    MeasureX25519(2000);
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+# Copyright 2025 Michał Jankowski
+#
+# Bulk throughput, plain sends against UDP GSO/GRO (-G): two nodes in
+# network namespaces joined over veth (netns_bench.sh -n 2), node 1 sends
+# COUNT messages to node 2 back to back through its control socket, for
+# each message size. Reports messages and payload per second, and how many
+# datagrams every send/receive syscall carried. Ingress rate limits are off
+# (-r 0), they would cap both modes alike.
+#
+# Usage: bench/gso_bench.sh [-b COUNT] [-z "SIZES"] [-- C_COMM OPTIONS]
+#   -b  messages per run (default: 200000)
+#   -z  message sizes (default: 100 500 1000 1400)
+
+set -u
+
+COUNT=200000
+SIZES="100 500 1000 1400"
+while getopts "b:z:" opt; do
+    case $opt in
+        b) COUNT=$OPTARG ;;
+        z) SIZES=$OPTARG ;;
+        *) sed -n '12,14p' "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+Run() {
+    local size=$1
+    shift
+    "$ROOT/bench/netns_bench.sh" -n 2 -l 0 -b "$COUNT" -z "$size" -- -r 0 "$@" | grep '^throughput' \
+        | sed -E 's/.*delivered ([0-9/]+).*msgs\/s ([0-9.]+)  MB\/s ([0-9.]+)  datagrams\/syscall tx ([0-9.]+) rx ([0-9.]+).*/\1 \2 \3 \4 \5/'
+}
+
+printf "%-6s %-8s %14s %10s %8s %8s %8s\n" size mode delivered msgs/s MB/s tx/call rx/call
+for size in $SIZES; do
+    PLAIN=$(Run "$size" "$@") || exit 1
+    GSO=$(Run "$size" "$@" -G) || exit 1
+    printf "%-6s %-8s %14s %10s %8s %8s %8s\n" "$size" plain $PLAIN
+    printf "%-6s %-8s %14s %10s %8s %8s %8s\n" "$size" "gso (-G)" $GSO
+done
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Copyright 2025 Michał Jankowski
+#
+# One-hop latency, default mode against low-latency mode (-L): two nodes in
+# network namespaces (netns_bench.sh -n 2), the same latency samples for
+# each mode, p50/p99 side by side. In low-latency mode each node busy-polls
+# on a core of its own and the driver runs on the rest, so it takes at
+# least three cores. With fewer, only the default mode is measured: spinning
+# nodes sharing a core with their peer measure the scheduler, not the mode.
+#
+# Usage: bench/latency_bench.sh [-l SAMPLES] [-c CPU] [-- C_COMM OPTIONS]
+#   -l  latency samples per mode (default: 1000)
+#   -c  first of the two cores for the low-latency nodes (default: the last
+#       two)
+
+set -u
+
+SAMPLES=1000
+CPU=$(($(nproc) - 2))
+while getopts "l:c:" opt; do
+    case $opt in
+        l) SAMPLES=$OPTARG ;;
+        c) CPU=$OPTARG ;;
+        *) sed -n '11,14p' "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+Run() {
+    "$ROOT/bench/netns_bench.sh" -n 2 -l "$SAMPLES" "$@" | grep '^nodes' \
+        | sed -E 's/.*latency_us p50 ([0-9.]+) p99 ([0-9.]+) max ([0-9.]+)  delivered ([0-9/]+).*/\1 \2 \3 \4/'
+}
+
+DEFAULT=$(Run -- "$@") || exit 1
+printf "%-14s %10s %10s %10s %12s\n" mode p50_us p99_us max_us delivered
+printf "%-14s %10s %10s %10s %12s\n" default $DEFAULT
+if [ "$(nproc)" -lt 3 ]; then
+    printf "%-14s %10s %10s %10s %12s\n" "busy (-L)" - - - -
+    echo "[WARN] $(nproc) CPU(s) online, low-latency mode needs 3: not measured" >&2
+    exit 0
+fi
+BUSY=$(Run -L "$CPU" -- "$@") || exit 1
+printf "%-14s %10s %10s %10s %12s\n" "busy ($CPU-$((CPU + 1)))" $BUSY
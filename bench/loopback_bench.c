@@ -0,0 +1,233 @@
+// Copyright 2025 Michał Jankowski
+// In-process benchmark over the loopback transport: N nodes in one process,
+// joined by a LoopbackHub instead of sockets and stepped round-robin by one
+// thread. Times discovery and a bulk run from node 1 to node 2 the way
+// netns_bench.sh does over veth, minus the kernel: what is left is the
+// protocol's own CPU time per message and the eventfd wakeups the backend
+// counts as its syscalls. Started by transport_bench.sh, or on its own.
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "c_comm.h"
+#include "net_func.h"
+#include "node.h"
+#include "transport.h"
+
+#define MAX_NODES 200
+#define CONVERGE_TIMEOUT_MS 10000
+#define BULK_IDLE_MS 1000  // the receiver is done when nothing came for this long
+#define SENDS_PER_STEP 32  // stays well inside a hub queue (256 datagrams)
+
+typedef struct {
+    size_t peers_found;
+    size_t delivered;
+    size_t errors;
+} NodeCounters;
+
+static double NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e3 + (double) ts.tv_nsec / 1e6;
+}
+
+static double CpuUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+}
+
+static void OnMessage(
+    Node *node,
+    long int peer_id,
+    const struct sockaddr_storage *src_addr,
+    const char *channel,
+    const char *msg,
+    size_t msg_length,
+    void *arg
+) {
+    (void) node, (void) peer_id, (void) src_addr, (void) channel, (void) msg, (void) msg_length;
+    ((NodeCounters *) arg)->delivered++;
+}
+
+static void OnPeerAdded(Node *node, long int peer_id, const char *identifier, int reason, void *arg) {
+    (void) node, (void) peer_id, (void) identifier, (void) reason;
+    ((NodeCounters *) arg)->peers_found++;
+}
+
+static void OnPeerRemoved(Node *node, long int peer_id, const char *identifier, int reason, void *arg) {
+    (void) node, (void) peer_id, (void) identifier, (void) reason, (void) arg;
+}
+
+static void OnError(Node *node, int error, const char *detail, void *arg) {
+    (void) node, (void) error, (void) detail;
+    ((NodeCounters *) arg)->errors++;
+}
+
+static void StepAll(Node **nodes, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        CommStep(nodes[i], 0);
+    }
+}
+
+static void PrintUsage(void) {
+    printf("Usage: loopback_bench [OPTIONS]\n");
+    printf("  -n NODES - nodes on the hub, 2 to %d (default: 2)\n", MAX_NODES);
+    printf("  -b COUNT - messages from node 1 to node 2 back to back (default: 100000)\n");
+    printf("  -z SIZE  - message size for -b (default: 1000)\n");
+    printf("  -E MODE  - encryption: 0 off, 1 preferred, 2 required (default: 1)\n");
+}
+
+int main(int argc, char *argv[]) {
+    long int n_nodes = 2;
+    long int messages = 100000;
+    long int size = 1000;
+    long int encrypt = COMM_ENCRYPT_PREFERRED;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:z:E:")) != -1) {
+        switch (opt) {
+            case 'n':
+                n_nodes = strtol(optarg, NULL, 10);
+                break;
+            case 'b':
+                messages = strtol(optarg, NULL, 10);
+                break;
+            case 'z':
+                size = strtol(optarg, NULL, 10);
+                break;
+            case 'E':
+                encrypt = strtol(optarg, NULL, 10);
+                break;
+            default:
+                PrintUsage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || n_nodes < 2 || n_nodes > MAX_NODES || messages < 1 || size < 1
+        || size > (long int) MESSAGE_MAX_LENGTH || encrypt < COMM_ENCRYPT_OFF || encrypt > COMM_ENCRYPT_REQUIRED) {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+    size_t n = (size_t) n_nodes;
+
+    LoopbackHub *hub = LoopbackHubCreate();
+    Node *nodes[MAX_NODES];
+    NodeCounters counters[MAX_NODES];
+    memset(counters, 0, sizeof(counters));
+    if (hub == NULL) {
+        fprintf(stderr, "[FAIL] Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < n; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "n%zu", i + 1);
+        struct in_addr addr4 = {.s_addr = htonl(0x0a4d0000 | (uint32_t) (i + 1))};  // 10.77.x.y, as in netns_bench.sh
+        struct in6_addr addr6 = IN6ADDR_ANY_INIT;
+        addr6.s6_addr[0] = 0xfe;
+        addr6.s6_addr[1] = 0x80;
+        addr6.s6_addr[14] = (uint8_t) ((i + 1) >> 8);
+        addr6.s6_addr[15] = (uint8_t) (i + 1);
+        Transport *t = TransportOpenLoopback(hub, &addr4, &addr6);
+
+        CommConfig config;
+        CommConfigDefaults(&config, "lo", name);  // the interface only has to exist
+        config.peers_size = n + 16;
+        config.rate_scale = 0;
+        config.encrypt = (int) encrypt;
+        config.on_message = OnMessage;
+        config.on_peer_added = OnPeerAdded;
+        config.on_peer_removed = OnPeerRemoved;
+        config.on_error = OnError;
+        config.arg = &counters[i];
+        if (t == NULL || (nodes[i] = NodeOpen(&config, t)) == NULL) {
+            fprintf(stderr, "[FAIL] Could not open node %zu\n", i + 1);
+            return EXIT_FAILURE;
+        }
+    }
+
+    double start_ms = NowMs();
+    for (size_t i = 0; i < n; i++) {
+        CommScan(nodes[i]);
+    }
+    size_t converged = 0;
+    while (converged < n && NowMs() - start_ms < CONVERGE_TIMEOUT_MS) {
+        StepAll(nodes, n);
+        converged = 0;
+        for (size_t i = 0; i < n; i++) {
+            converged += counters[i].peers_found >= n - 1;
+        }
+    }
+    printf("nodes %zu  converged %zu/%zu  time_ms %.1f\n", n, converged, n, NowMs() - start_ms);
+    long int peer = CommFindPeer(nodes[0], CommIdentifier(nodes[1]));
+    if (peer < 0) {
+        fprintf(stderr, "[FAIL] Node 2 is not a peer of node 1\n");
+        return EXIT_FAILURE;
+    }
+    if (encrypt != COMM_ENCRYPT_OFF) {  // the key exchange rides on the scans, give it a moment
+        double keys_ms = NowMs();
+        CommPeerInfo info;
+        while (CommReadPeer(nodes[0], peer, &info) == 1 && !info.sealed && NowMs() - keys_ms < CONVERGE_TIMEOUT_MS) {
+            StepAll(nodes, n);
+        }
+    }
+
+    char *msg = malloc((size_t) size);
+    if (msg == NULL) {
+        fprintf(stderr, "[FAIL] Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    memset(msg, 'x', (size_t) size);
+    TransportStats tx_before = nodes[0]->transport->stats;
+    TransportStats rx_before = nodes[1]->transport->stats;
+    unsigned long drops_before = TransportKernelDrops(nodes[1]->transport);
+    size_t delivered_before = counters[1].delivered;
+    double cpu_before = CpuUs();
+    start_ms = NowMs();
+
+    size_t sent = 0, refused = 0;
+    while (sent + refused < (size_t) messages) {
+        for (unsigned int i = 0; i < SENDS_PER_STEP && sent + refused < (size_t) messages; i++) {
+            int ret = CommSend(nodes[0], peer, msg, (size_t) size);
+            if (ret == -8) {
+                break;  // send queue full, let it drain
+            }
+            sent += ret >= 0;
+            refused += ret < 0;
+        }
+        StepAll(nodes, n);
+    }
+    size_t delivered = 0;
+    double last_ms = NowMs();
+    while (NowMs() - last_ms < BULK_IDLE_MS && delivered < sent) {
+        StepAll(nodes, n);
+        if (counters[1].delivered - delivered_before != delivered) {
+            delivered = counters[1].delivered - delivered_before;
+            last_ms = NowMs();
+        }
+    }
+    double elapsed_s = (NowMs() - start_ms) / 1e3;
+    double cpu_us = CpuUs() - cpu_before;
+    const TransportStats *tx_after = &nodes[0]->transport->stats;
+    const TransportStats *rx_after = &nodes[1]->transport->stats;
+    double tx_syscalls = (double) (tx_after->syscalls - tx_before.syscalls);
+    double rx_syscalls = (double) (rx_after->syscalls - rx_before.syscalls);
+    printf("throughput size %ld  delivered %zu/%ld (refused %zu, hub drops %lu)  msgs/s %.0f  MB/s %.1f  "
+           "cpu_us/msg %.2f  syscalls/msg tx %.2f rx %.2f\n",
+           size, delivered, messages, refused, TransportKernelDrops(nodes[1]->transport) - drops_before,
+           elapsed_s > 0 ? (double) delivered / elapsed_s : 0.0,
+           elapsed_s > 0 ? (double) delivered * (double) size / elapsed_s / 1e6 : 0.0,
+           delivered > 0 ? cpu_us / (double) delivered : 0.0,
+           delivered > 0 ? tx_syscalls / (double) delivered : 0.0,
+           delivered > 0 ? rx_syscalls / (double) delivered : 0.0);
+
+    free(msg);
+    for (size_t i = 0; i < n; i++) {
+        CommClose(nodes[i]);
+    }
+    LoopbackHubDestroy(hub);
+    return delivered > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
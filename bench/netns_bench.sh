@@ -0,0 +1,167 @@
+#!/bin/bash
+# Copyright 2025 Michał Jankowski
+#
+# Convergence benchmark: N c_comm daemons, each in its own network namespace,
+# all joined by veth pairs to one bridge. For every N, bench_driver times
+# full peer-table convergence, counts datagrams per node and samples message
+# delivery latency. Runs locally as root, nothing leaves the machine.
+#
+# Usage: bench/netns_bench.sh [-g] [-n "2 5 10 ..."] [-l SAMPLES] [-b COUNT [-z SIZE]]
+#                             [-L CPU] [-- C_COMM OPTIONS]
+#   -g  gossip: node 1 is the seed, the others join through it (-s) and no
+#       one scans the multicast group
+#   -n  node counts to run (default: 2 5 10 20 50 100 200)
+#   -l  latency samples per run (default: 200)
+#   -b  then time COUNT back-to-back messages from node 1 to node 2
+#   -z  message size for -b (default: 1000)
+#   -L  low-latency mode, node i busy-polls on core CPU + i - 1 and the
+#       driver runs on the other cores (needs N + 1 of them)
+
+set -u
+
+SIZES="2 5 10 20 50 100 200"
+SAMPLES=200
+GOSSIP=0
+BULK=0
+BULK_SIZE=1000
+BUSY_CPU=
+while getopts "gn:l:b:z:L:" opt; do
+    case $opt in
+        g) GOSSIP=1 ;;
+        n) SIZES=$OPTARG ;;
+        l) SAMPLES=$OPTARG ;;
+        b) BULK=$OPTARG ;;
+        z) BULK_SIZE=$OPTARG ;;
+        L) BUSY_CPU=$OPTARG ;;
+        *) sed -n '9,18p' "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+EXTRA_OPTS=("$@")
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+C_COMM=$ROOT/bin/c_comm
+DRIVER=$ROOT/bin/bench_driver
+PREFIX=ccb
+RUN_DIR=/run/c_comm_bench
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "[FAIL] Needs root for network namespaces" >&2
+    exit 1
+fi
+if [ ! -x "$C_COMM" ] || [ ! -x "$DRIVER" ]; then
+    echo "[FAIL] Build first: make && make bench" >&2
+    exit 1
+fi
+for n in $SIZES; do
+    if [ -n "$BUSY_CPU" ] && { [ "$BUSY_CPU" -lt 0 ] || [ $((BUSY_CPU + n)) -gt "$(nproc)" ] \
+                                || [ "$n" -ge "$(nproc)" ]; }; then
+        echo "[FAIL] -L $BUSY_CPU with $n nodes needs cores $BUSY_CPU-$((BUSY_CPU + n - 1))" \
+             "and one more for the driver, $(nproc) online" >&2
+        exit 1
+    fi
+done
+
+# Cores left to the driver with n busy-polling nodes, e.g. "0,5-7".
+DriverCpus() {
+    local n=$1
+    local cpus=()
+    for cpu in $(seq 0 $(($(nproc) - 1))); do
+        if [ "$cpu" -lt "$BUSY_CPU" ] || [ "$cpu" -ge $((BUSY_CPU + n)) ]; then
+            cpus+=("$cpu")
+        fi
+    done
+    local IFS=,
+    echo "${cpus[*]}"
+}
+
+# Neighbour tables are shared by all namespaces, N nodes need about N^2
+# entries per family (the default hard limit is 1024).
+NEIGH_KEYS="net.ipv4.neigh.default.gc_thresh2 net.ipv4.neigh.default.gc_thresh3
+            net.ipv6.neigh.default.gc_thresh2 net.ipv6.neigh.default.gc_thresh3"
+NEIGH_SAVED=$(sysctl -n $NEIGH_KEYS | tr '\n' ' ')
+
+RestoreNeigh() {
+    local values=($NEIGH_SAVED)
+    local i=0
+    for key in $NEIGH_KEYS; do
+        sysctl -qw "$key=${values[$i]}"
+        i=$((i + 1))
+    done
+}
+
+Teardown() {
+    local n=$1
+    pkill -TERM -f "$C_COMM -d .*-c $RUN_DIR/" 2>/dev/null
+    sleep 0.5
+    pkill -KILL -f "$C_COMM -d .*-c $RUN_DIR/" 2>/dev/null
+    for i in $(seq 1 "$n"); do
+        ip netns del "$PREFIX-$i" 2>/dev/null
+    done
+    ip netns del "$PREFIX-hub" 2>/dev/null
+    rm -rf "$RUN_DIR"
+}
+
+Setup() {
+    local n=$1
+    local entries=$((2 * n * n + 1024))
+    for key in $NEIGH_KEYS; do
+        sysctl -qw "$key=$entries"
+    done
+    mkdir -p "$RUN_DIR"
+    ip netns add "$PREFIX-hub"
+    ip -n "$PREFIX-hub" link add br0 type bridge mcast_snooping 0
+    ip -n "$PREFIX-hub" link set br0 up
+    for i in $(seq 1 "$n"); do
+        local ns=$PREFIX-$i
+        ip netns add "$ns"
+        # no duplicate address detection, link-local IPv6 is usable at once
+        ip netns exec "$ns" sysctl -qw net.ipv6.conf.default.accept_dad=0
+        ip link add "v$i" netns "$ns" type veth peer name "p$i" netns "$PREFIX-hub"
+        ip -n "$PREFIX-hub" link set "p$i" master br0 up
+        ip -n "$ns" addr add "10.77.$((i / 256)).$((i % 256))/16" dev "v$i"
+        ip -n "$ns" link set lo up
+        ip -n "$ns" link set "v$i" up
+    done
+}
+
+# Starts the daemons, node i is "n<i>" listening on $RUN_DIR/n<i>.sock.
+StartNodes() {
+    local n=$1
+    for i in $(seq 1 "$n"); do
+        local opts=(-d -P $((n + 16)) -c "$RUN_DIR/n$i.sock")
+        [ -n "$BUSY_CPU" ] && opts+=(-L $((BUSY_CPU + i - 1)))
+        if [ "$GOSSIP" -eq 1 ]; then
+            opts+=(-g)
+            [ "$i" -gt 1 ] && opts+=(-s 10.77.0.1)
+        fi
+        ip netns exec "$PREFIX-$i" "$C_COMM" "${opts[@]}" "${EXTRA_OPTS[@]}" "v$i" "n$i" \
+            > "$RUN_DIR/n$i.log" 2>&1 &
+        # the seed has to be up before anyone scans it
+        [ "$GOSSIP" -eq 1 ] && [ "$i" -eq 1 ] && sleep 0.2
+    done
+}
+
+trap 'Teardown 256; RestoreNeigh' EXIT
+Teardown 256
+
+for n in $SIZES; do
+    Setup "$n"
+    sockets=()
+    for i in $(seq 1 "$n"); do
+        sockets+=("$RUN_DIR/n$i.sock")
+    done
+    driver_cmd=("$DRIVER")
+    [ -n "$BUSY_CPU" ] && driver_cmd=(taskset -c "$(DriverCpus "$n")" "$DRIVER")
+    if [ "$GOSSIP" -eq 1 ]; then
+        # timed from the first daemon's start, joining is part of convergence
+        "${driver_cmd[@]}" -m passive -l "$SAMPLES" -b "$BULK" -z "$BULK_SIZE" "${sockets[@]}" &
+        driver=$!
+        StartNodes "$n"
+        wait $driver
+    else
+        StartNodes "$n"
+        "${driver_cmd[@]}" -m scan -l "$SAMPLES" -b "$BULK" -z "$BULK_SIZE" "${sockets[@]}"
+    fi
+    Teardown "$n"
+done
@@ -0,0 +1,102 @@
+#!/bin/bash
+# Copyright 2025 Michał Jankowski
+#
+# Scan storm benchmark: one c_comm daemon in a network namespace, joined
+# over veth to a second namespace where bin/scan_storm sends it SCANs as
+# fast as it answers them. Reports SCAN_RESPONSEs per second and the CPU
+# time the node spent per response (user + system, from /proc), RUNS times.
+# On a machine with few cores the flooder competes with the node, the CPU
+# time is the steadier figure. Ingress rate limits are off (-r 0), they
+# exist to cap exactly this.
+#
+# Usage: bench/scan_bench.sh [-t SECONDS] [-w WINDOW] [-n RUNS] [-x C_COMM]
+#                            [-- C_COMM OPTIONS]
+#   -t  seconds per run (default: 5)
+#   -w  scans in flight (default: 32)
+#   -n  runs (default: 3)
+#   -x  c_comm binary to test, e.g. an older build (default: bin/c_comm)
+
+set -u
+
+SECONDS_PER_RUN=5
+WINDOW=32
+RUNS=3
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+C_COMM=$ROOT/bin/c_comm
+while getopts "t:w:n:x:" opt; do
+    case $opt in
+        t) SECONDS_PER_RUN=$OPTARG ;;
+        w) WINDOW=$OPTARG ;;
+        n) RUNS=$OPTARG ;;
+        x) C_COMM=$(realpath "$OPTARG") ;;
+        *) sed -n '12,17p' "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+EXTRA_OPTS=("$@")
+
+STORM=$ROOT/bin/scan_storm
+PREFIX=ccs
+RUN_DIR=/run/c_comm_scan_bench
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "[FAIL] Needs root for network namespaces" >&2
+    exit 1
+fi
+if [ ! -x "$C_COMM" ] || [ ! -x "$STORM" ]; then
+    echo "[FAIL] Build first: make && make bench" >&2
+    exit 1
+fi
+
+Teardown() {
+    pkill -TERM -f "$C_COMM -d .*-c $RUN_DIR/" 2>/dev/null
+    sleep 0.5
+    pkill -KILL -f "$C_COMM -d .*-c $RUN_DIR/" 2>/dev/null
+    ip netns del "$PREFIX-node" 2>/dev/null
+    ip netns del "$PREFIX-storm" 2>/dev/null
+    rm -rf "$RUN_DIR"
+}
+
+Setup() {
+    mkdir -p "$RUN_DIR"
+    ip netns add "$PREFIX-node"
+    ip netns add "$PREFIX-storm"
+    ip link add v0 netns "$PREFIX-node" type veth peer name v0 netns "$PREFIX-storm"
+    ip -n "$PREFIX-node" addr add 10.78.0.1/24 dev v0
+    ip -n "$PREFIX-storm" addr add 10.78.0.2/24 dev v0
+    for ns in "$PREFIX-node" "$PREFIX-storm"; do
+        ip -n "$ns" link set lo up
+        ip -n "$ns" link set v0 up
+    done
+}
+
+# utime + stime of a process, in clock ticks
+CpuTicks() {
+    awk '{ print $14 + $15 }' "/proc/$1/stat"
+}
+
+trap Teardown EXIT
+Teardown
+
+for run in $(seq 1 "$RUNS"); do
+    Setup
+    ip netns exec "$PREFIX-node" "$C_COMM" -d -r 0 -c "$RUN_DIR/node.sock" "${EXTRA_OPTS[@]}" v0 node \
+        > "$RUN_DIR/node.log" 2>&1 &
+    node=$!
+    for _ in $(seq 1 50); do
+        [ -S "$RUN_DIR/node.sock" ] && break
+        sleep 0.1
+    done
+    if [ ! -S "$RUN_DIR/node.sock" ]; then
+        echo "[FAIL] c_comm did not start:" >&2
+        cat "$RUN_DIR/node.log" >&2
+        exit 1
+    fi
+    ticks_before=$(CpuTicks "$node")
+    result=$(ip netns exec "$PREFIX-storm" "$STORM" -t "$SECONDS_PER_RUN" -w "$WINDOW" 10.78.0.1) || exit 1
+    ticks=$(($(CpuTicks "$node") - ticks_before))
+    responses=$(echo "$result" | sed -E 's/.*responses ([0-9]+) .*/\1/')
+    echo "run $run  $result  node cpu/response $(awk -v t="$ticks" -v r="$responses" -v hz="$(getconf CLK_TCK)" \
+        'BEGIN { printf "%.2f us", (r > 0 ? t * 1e6 / hz / r : 0) }')"
+    Teardown
+done
@@ -0,0 +1,148 @@
+// Copyright 2025 Michał Jankowski
+// Scan storm: sends SCAN frames to one node as fast as it answers them and
+// counts the SCAN_RESPONSEs, for responses per second. At most WINDOW scans
+// are in flight, a response frees one. When nothing comes back for a while
+// the outstanding scans count as lost and the window opens again. Started
+// by scan_bench.sh from a network namespace next to the node's.
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "net_func.h"
+
+#define DEFAULT_PORT 8192  // PORT in sock_prep.c
+#define LOSS_TIMEOUT_MS 20
+#define IDENTIFIER "storm@scan_storm"
+
+static double NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e3 + (double) ts.tv_nsec / 1e6;
+}
+
+static void PrintUsage(void) {
+    printf("Usage: scan_storm [OPTIONS] ADDRESS\n");
+    printf("  -t SECONDS - how long to keep scanning (default: 5)\n");
+    printf("  -w WINDOW  - scans in flight (default: 32)\n");
+    printf("  -p PORT    - the node's port (default: %d)\n", DEFAULT_PORT);
+}
+
+int main(int argc, char *argv[]) {
+    long int seconds = 5;
+    long int window = 32;
+    long int port = DEFAULT_PORT;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:p:")) != -1) {
+        switch (opt) {
+            case 't':
+                seconds = strtol(optarg, NULL, 10);
+                break;
+            case 'w':
+                window = strtol(optarg, NULL, 10);
+                break;
+            case 'p':
+                port = strtol(optarg, NULL, 10);
+                break;
+            default:
+                PrintUsage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || seconds < 1 || window < 1 || port < 1 || port > 65535) {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_storage dest;
+    socklen_t dest_size;
+    memset(&dest, 0, sizeof(dest));
+    struct sockaddr_in *dest4 = (struct sockaddr_in *) &dest;
+    struct sockaddr_in6 *dest6 = (struct sockaddr_in6 *) &dest;
+    if (inet_pton(AF_INET, argv[optind], &dest4->sin_addr) == 1) {
+        dest4->sin_family = AF_INET;
+        dest4->sin_port = htons((uint16_t) port);
+        dest_size = sizeof(*dest4);
+    } else if (inet_pton(AF_INET6, argv[optind], &dest6->sin6_addr) == 1) {
+        dest6->sin6_family = AF_INET6;
+        dest6->sin6_port = htons((uint16_t) port);
+        dest_size = sizeof(*dest6);
+    } else {
+        fprintf(stderr, "[FAIL] %s is not an IP address\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    int fd = socket(dest.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        fprintf(stderr, "[FAIL] socket: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // a v2 scan from a session of our own, without a key
+    uint8_t scan[WIRE_V2_HEADER_SIZE + sizeof(IDENTIFIER) - 1];
+    uint32_t token = (uint32_t) getpid() | 1;
+    scan[0] = WIRE_VERSION_MARK | WIRE_V2;
+    scan[1] = SCAN;
+    scan[2] = 0;
+    scan[3] = WIRE_V2_HEADER_SIZE / 4;
+    scan[4] = 0;
+    scan[5] = (uint8_t) (sizeof(IDENTIFIER) - 1);
+    scan[6] = 0;
+    scan[7] = 0;
+    scan[8] = (uint8_t) (token >> 24);
+    scan[9] = (uint8_t) (token >> 16);
+    scan[10] = (uint8_t) (token >> 8);
+    scan[11] = (uint8_t) token;
+    memcpy(scan + WIRE_V2_HEADER_SIZE, IDENTIFIER, sizeof(IDENTIFIER) - 1);
+
+    unsigned long sent = 0, responses = 0, lost = 0, other = 0;
+    long int in_flight = 0;
+    uint8_t reply[2048];
+    double start_ms = NowMs();
+    double end_ms = start_ms + (double) seconds * 1e3;
+    double last_reply_ms = start_ms;
+    double now_ms = start_ms;
+    while (now_ms < end_ms) {
+        while (in_flight < window) {
+            if (sendto(fd, scan, sizeof(scan), 0, (struct sockaddr *) &dest, dest_size) < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                    break;
+                }
+                fprintf(stderr, "[FAIL] sendto: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+            }
+            sent++;
+            in_flight++;
+        }
+
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        poll(&pfd, 1, 1);
+        ssize_t length;
+        while ((length = recv(fd, reply, sizeof(reply), 0)) > 0) {
+            if (length >= 2 && reply[0] == (WIRE_VERSION_MARK | WIRE_V2) && reply[1] == SCAN_RESPONSE) {
+                responses++;
+                in_flight -= in_flight > 0;
+            } else {
+                other++;  // path probes and the like
+            }
+            last_reply_ms = NowMs();
+        }
+        now_ms = NowMs();
+        if (in_flight > 0 && now_ms - last_reply_ms > LOSS_TIMEOUT_MS) {
+            lost += (unsigned long) in_flight;
+            in_flight = 0;
+            last_reply_ms = now_ms;
+        }
+    }
+    double elapsed_s = (NowMs() - start_ms) / 1e3;
+    close(fd);
+
+    printf("scans sent %lu  responses %lu  lost %lu  other %lu  responses/s %.0f\n",
+           sent, responses, lost, other, (double) responses / elapsed_s);
+    return responses > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
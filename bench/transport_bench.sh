@@ -0,0 +1,50 @@
+#!/bin/bash
+# Copyright 2025 Michał Jankowski
+#
+# Transport backends side by side: COUNT messages from node 1 to node 2
+# back to back, over udp and uring (-t) between two network namespaces
+# (netns_bench.sh -n 2), and over the in-process loopback hub
+# (bin/loopback_bench). Reports messages per second and the syscalls the
+# backend issued per message delivered (TransportStats.syscalls, the
+# TRANSPORT_SYSCALLS stat), for the sender and the receiver. Loopback counts
+# its eventfd wakeups and has no kernel path otherwise, it is the protocol's
+# own cost. Ingress rate limits are off (-r 0).
+#
+# Usage: bench/transport_bench.sh [-b COUNT] [-z SIZE] [-- C_COMM OPTIONS]
+#   -b  messages per run (default: 100000)
+#   -z  message size (default: 1000)
+
+set -u
+
+COUNT=100000
+SIZE=1000
+while getopts "b:z:" opt; do
+    case $opt in
+        b) COUNT=$OPTARG ;;
+        z) SIZE=$OPTARG ;;
+        *) sed -n '13,15p' "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+PATTERN='s/.*delivered ([0-9/]+).*msgs\/s ([0-9.]+) .*syscalls\/msg tx ([0-9.]+) rx ([0-9.]+).*/\1 \2 \3 \4/'
+
+if [ ! -x "$ROOT/bin/loopback_bench" ]; then
+    echo "[FAIL] Build first: make && make bench" >&2
+    exit 1
+fi
+
+Run() {
+    "$ROOT/bench/netns_bench.sh" -n 2 -l 0 -b "$COUNT" -z "$SIZE" -- -r 0 "$@" | grep '^throughput' \
+        | sed -E "$PATTERN"
+}
+
+UDP=$(Run -t udp "$@") || exit 1
+URING=$(Run -t uring "$@") || exit 1
+LOOPBACK=$("$ROOT/bin/loopback_bench" -b "$COUNT" -z "$SIZE" | grep '^throughput' | sed -E "$PATTERN") || exit 1
+
+printf "%-10s %14s %10s %12s %12s\n" transport delivered msgs/s tx_calls/msg rx_calls/msg
+printf "%-10s %14s %10s %12s %12s\n" udp $UDP
+printf "%-10s %14s %10s %12s %12s\n" uring $URING
+printf "%-10s %14s %10s %12s %12s\n" loopback $LOOPBACK
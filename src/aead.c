@@ -0,0 +1,72 @@
+// Copyright 2025 Michał Jankowski
+#include <string.h>
+
+#include "aead.h"
+
+// The one-time Poly1305 key is the first 32 bytes of keystream block 0,
+// the message is encrypted from block 1 on.
+static void Authenticate(
+    const ChaCha20Key *key,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE],
+    const uint8_t *aad,
+    size_t aad_length,
+    const uint8_t *ciphertext,
+    size_t length,
+    uint8_t tag[AEAD_TAG_SIZE]
+) {
+    static const uint8_t ZEROS[16] = {0};
+    uint8_t block0[CHACHA20_BLOCK_SIZE] = {0};
+    ChaCha20Xor(key, nonce, 0, block0, block0, sizeof(block0));
+
+    Poly1305 mac;
+    Poly1305Init(&mac, block0);
+    Poly1305Update(&mac, aad, aad_length);
+    Poly1305Update(&mac, ZEROS, (16 - aad_length % 16) % 16);
+    Poly1305Update(&mac, ciphertext, length);
+    Poly1305Update(&mac, ZEROS, (16 - length % 16) % 16);
+    uint8_t lengths[16];
+    for (unsigned int i = 0; i < 8; i++) {
+        lengths[i] = (uint8_t) ((uint64_t) aad_length >> (8 * i));
+        lengths[8 + i] = (uint8_t) ((uint64_t) length >> (8 * i));
+    }
+    Poly1305Update(&mac, lengths, sizeof(lengths));
+    Poly1305Final(&mac, tag);
+    memset(block0, 0, sizeof(block0));
+}
+
+void AeadSeal(
+    const ChaCha20Key *key,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE],
+    const uint8_t *aad,
+    size_t aad_length,
+    uint8_t *buf,
+    size_t length,
+    uint8_t tag[AEAD_TAG_SIZE]
+) {
+    ChaCha20Xor(key, nonce, 1, buf, buf, length);
+    Authenticate(key, nonce, aad, aad_length, buf, length, tag);
+}
+
+// Checks the tag before anything is decrypted. Returns 0, or -1 with buf
+// untouched when the message was forged or damaged.
+int AeadOpen(
+    const ChaCha20Key *key,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE],
+    const uint8_t *aad,
+    size_t aad_length,
+    uint8_t *buf,
+    size_t length,
+    const uint8_t tag[AEAD_TAG_SIZE]
+) {
+    uint8_t expected[AEAD_TAG_SIZE];
+    Authenticate(key, nonce, aad, aad_length, buf, length, expected);
+    uint8_t diff = 0;
+    for (unsigned int i = 0; i < AEAD_TAG_SIZE; i++) {  // constant time
+        diff |= expected[i] ^ tag[i];
+    }
+    if (diff != 0) {
+        return -1;
+    }
+    ChaCha20Xor(key, nonce, 1, buf, buf, length);
+    return 0;
+}
@@ -0,0 +1,34 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_AEAD_H_
+#define SRC_AEAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chacha20.h"
+#include "poly1305.h"
+
+// ChaCha20-Poly1305 (RFC 8439), in place: the buffer holds the plaintext
+// going in and the ciphertext coming out, or the other way round. A
+// (key, nonce) pair must never seal two different messages.
+
+#define AEAD_TAG_SIZE POLY1305_TAG_SIZE
+
+void AeadSeal(
+    const ChaCha20Key *key,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE],
+    const uint8_t *aad,
+    size_t aad_length,
+    uint8_t *buf,
+    size_t length,
+    uint8_t tag[AEAD_TAG_SIZE]);
+int AeadOpen(
+    const ChaCha20Key *key,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE],
+    const uint8_t *aad,
+    size_t aad_length,
+    uint8_t *buf,
+    size_t length,
+    const uint8_t tag[AEAD_TAG_SIZE]);
+
+#endif  // SRC_AEAD_H_
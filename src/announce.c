@@ -0,0 +1,65 @@
+// Copyright 2025 Michał Jankowski
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "announce.h"
+#include "msgbuf.h"
+#include "net_func.h"
+#include "node.h"
+#include "secure.h"
+#include "sock_prep.h"
+
+// Payload: identifier, then our key (secure.h).
+static MsgBuf *EncodeScan(Node *node, int version, enum MessageType msg_type) {
+    char payload[sizeof(node->user_identifier) + SECURE_SCAN_EXTENSION];
+    size_t length = strlen(node->user_identifier);
+    memcpy(payload, node->user_identifier, length);
+    length += SecureScanExtension(&node->secure, (uint8_t *) payload + length);
+    return EncodeFrame(node, version, msg_type, payload, length);
+}
+
+// (Re)encodes everything from the node's current identity. Returns 0, or -1
+// with the previous frames kept.
+int AnnounceBuild(Node *node) {
+    Announcements fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    fresh.group4.sin_family = AF_INET;
+    fresh.group4.sin_port = htons(PORT);
+    fresh.group6.sin6_family = AF_INET6;
+    fresh.group6.sin6_port = htons(PORT);
+    fresh.group6.sin6_scope_id = node->ifindex;
+    if (inet_pton(AF_INET, MCAST_GROUP, &fresh.group4.sin_addr) <= 0
+        || inet_pton(AF_INET6, MCAST6_GROUP, &fresh.group6.sin6_addr) <= 0) {
+        return -1;
+    }
+
+    fresh.scan = EncodeScan(node, node->wire_version, SCAN);
+    fresh.responses[0] = EncodeScan(node, WIRE_V1, SCAN_RESPONSE);
+    fresh.responses[1] = EncodeScan(node, WIRE_V2, SCAN_RESPONSE);
+    if (fresh.scan == NULL || fresh.responses[0] == NULL || fresh.responses[1] == NULL) {
+        MsgBufPut(&node->pool, fresh.scan);
+        MsgBufPut(&node->pool, fresh.responses[0]);
+        MsgBufPut(&node->pool, fresh.responses[1]);
+        return -1;
+    }
+    AnnounceFree(node);  // queued sends keep their own references
+    node->announce = fresh;
+    return 0;
+}
+
+void AnnounceFree(Node *node) {
+    Announcements *a = &node->announce;
+    MsgBufPut(&node->pool, a->scan);
+    MsgBufPut(&node->pool, a->responses[0]);
+    MsgBufPut(&node->pool, a->responses[1]);
+    a->scan = a->responses[0] = a->responses[1] = NULL;
+}
+
+// The SCAN_RESPONSE for a scanner speaking version, NULL for versions we
+// don't answer.
+MsgBuf *AnnounceResponse(Node *node, int version) {
+    if (version != WIRE_V1 && version != WIRE_V2) {
+        return NULL;
+    }
+    return node->announce.responses[version - WIRE_V1];
+}
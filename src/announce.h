@@ -0,0 +1,30 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_ANNOUNCE_H_
+#define SRC_ANNOUNCE_H_
+
+#include <netinet/in.h>
+
+#include "msgbuf.h"
+
+// Scan frames, encoded ahead. What a node announces in SCAN and
+// SCAN_RESPONSE (identifier, session token, public key) is fixed for the
+// run, so the frames wait in pool buffers of their own: the scan in the
+// node's wire version, a response for each version a scanner may use. The
+// multicast groups are resolved along with them. A send hands the same
+// buffer to the send queue, answering a scan storm costs the sendto() and
+// nothing else. AnnounceBuild() runs again if any of it changes.
+
+typedef struct Node Node;
+
+typedef struct {
+    MsgBuf *scan;
+    MsgBuf *responses[2];  // WIRE_V1, WIRE_V2
+    struct sockaddr_in group4;
+    struct sockaddr_in6 group6;
+} Announcements;
+
+int AnnounceBuild(Node *node);
+void AnnounceFree(Node *node);
+MsgBuf *AnnounceResponse(Node *node, int version);
+
+#endif  // SRC_ANNOUNCE_H_
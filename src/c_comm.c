@@ -0,0 +1,376 @@
+// Copyright 2025 Michał Jankowski
+#define _GNU_SOURCE  // sched_setaffinity()
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "announce.h"
+#include "c_comm.h"
+#include "channel.h"
+#include "gossip.h"
+#include "msgbuf.h"
+#include "net_func.h"
+#include "node.h"
+#include "outbox.h"
+#include "outq.h"
+#include "path.h"
+#include "peer.h"
+#include "ratelimit.h"
+#include "secure.h"
+#include "send_cache.h"
+#include "session.h"
+#include "trace.h"
+#include "transport.h"
+
+#define COMM_STEP_MS 100  // CommRun() wakes up at least this often for the timers
+#define BUSY_POLL_US 50  // SO_BUSY_POLL, device queue polling per empty receive
+#define BUSY_SPIN_US 1000  // pure spinning after the last datagram
+#define BUSY_YIELD_US 20000  // then spinning with sched_yield(), then poll() blocks
+
+void CommConfigDefaults(CommConfig *config, const char *ifname, const char *user_name) {
+    memset(config, 0, sizeof(*config));
+    config->ifname = ifname;
+    config->user_name = user_name;
+    config->transport = "udp";
+    config->peers_size = 32;
+    config->outq_cap = OUTQ_DEFAULT_CAP;
+    config->send_cache_fds = SEND_CACHE_DEFAULT_FDS;
+    config->rate_scale = 1;
+    config->wire_version = WIRE_V2;
+    config->busy_poll_cpu = -1;
+    config->encrypt = COMM_ENCRYPT_PREFERRED;
+    config->outbox_cap = OUTBOX_DEFAULT_CAP;
+    config->outbox_ttl_s = OUTBOX_DEFAULT_TTL_S;
+}
+
+Node *CommOpen(const CommConfig *config) {
+    return NodeOpen(config, NULL);
+}
+
+Node *NodeOpen(const CommConfig *config, Transport *transport) {
+    Node *node = aligned_alloc(_Alignof(Node), sizeof(Node));  // the rate limiter's cache lines
+    if (node == NULL) {
+        TransportClose(transport);
+        return NULL;
+    }
+    // zeroed parts are what the cleanup at fail skips, the outbox's spill
+    // file aside
+    memset(node, 0, sizeof(*node));
+    node->outbox.spill_fd = -1;
+    node->transport = transport;
+    // set first, so the failures below already reach the application
+    node->on_message = config->on_message;
+    node->on_peer_added = config->on_peer_added;
+    node->on_peer_removed = config->on_peer_removed;
+    node->on_error = config->on_error;
+    node->hook_arg = config->arg;
+
+    char hostname[256];
+    if (config->ifname == NULL || (node->ifindex = if_nametoindex(config->ifname)) == 0) {
+        NodeError(node, COMM_ERR_OPEN, "%s: %s", config->ifname ? config->ifname : "(null)", strerror(errno));
+        goto fail;
+    }
+    if (config->user_name == NULL || strlen(config->user_name) > 62) {
+        NodeError(node, COMM_ERR_OPEN, "User name must be no longer than 62 bytes.");
+        goto fail;
+    }
+    if (config->peers_size == 0 || config->outq_cap == 0
+        || (config->wire_version != WIRE_V1 && config->wire_version != WIRE_V2)
+        || config->encrypt < COMM_ENCRYPT_OFF || config->encrypt > COMM_ENCRYPT_REQUIRED) {
+        NodeError(node, COMM_ERR_OPEN, "Invalid configuration");
+        goto fail;
+    }
+    if (gethostname(hostname, sizeof(hostname)) < 0) {
+        NodeError(node, COMM_ERR_OPEN, "Could not get hostname: %s", strerror(errno));
+        goto fail;
+    }
+    snprintf(node->user_identifier, sizeof(node->user_identifier), "%s@%s", config->user_name, hostname);
+    if (SecureInit(&node->secure, config->encrypt, 2 * config->peers_size) < 0) {
+        NodeError(node, COMM_ERR_OPEN, "Could not generate a key pair: %s", strerror(errno));
+        goto fail;
+    }
+    if (config->trace_events != 0 && TraceInit(config->trace_events) < 0) {
+        NodeError(node, COMM_ERR_OPEN, "Trace rings are limited to %u events", TRACE_MAX_EVENTS);
+        goto fail;
+    }
+
+    const char *transport_kind = config->transport != NULL ? config->transport : "udp";
+    if (node->transport == NULL && (node->transport = TransportOpenByName(transport_kind, config->ifname)) == NULL
+        && strcmp(transport_kind, "udp") != 0) {
+        NodeError(node, COMM_ERR_TRANSPORT, "Transport \"%s\" unavailable, falling back to udp", transport_kind);
+        node->transport = TransportOpenUDP(config->ifname);
+    }
+    if (node->transport == NULL) {
+        NodeError(node, COMM_ERR_OPEN, "Could not start UDP communication.");
+        goto fail;
+    }
+    node->peers_size = config->peers_size;
+    node->wire_version = config->wire_version;
+    node->session_token = NewSessionToken();
+    RateLimiterInit(&node->ratelimit, config->rate_scale);
+    MsgPoolInit(&node->pool, MSGPOOL_MAX_BUFFERS);
+    if ((node->peers = calloc(node->peers_size, sizeof(Peer))) == NULL
+        || SessionTableInit(&node->sessions, node->peers_size) < 0
+        || OutQueuesInit(&node->outq, node->peers_size, config->outq_cap, &node->pool) < 0) {
+        NodeError(node, COMM_ERR_OPEN, "Could not allocate the peer table, session table and send queues");
+        goto fail;
+    }
+    if (OutboxInit(&node->outbox, config->outbox_cap, config->outbox_ttl_s, config->outbox_spill) < 0) {
+        NodeError(node, COMM_ERR_OPEN, "%s: %s", config->outbox_spill, strerror(errno));
+        goto fail;
+    }
+    if (AnnounceBuild(node) < 0) {
+        NodeError(node, COMM_ERR_OPEN, "Could not encode the scan frames");
+        goto fail;
+    }
+    // only the plain udp backend pays a route lookup per sendto(), the
+    // others batch or never leave the process. With GSO on, bulk data has
+    // to go through the shared sockets to be coalesced.
+    size_t send_cache_fds = node->transport->kind == TRANSPORT_UDP ? config->send_cache_fds : 0;
+    if (config->gso && TransportOffload(node->transport, 1) < 0) {
+        NodeError(node, COMM_ERR_TRANSPORT, "UDP GSO/GRO not available, sending datagrams one by one");
+    } else if (config->gso) {
+        send_cache_fds = 0;
+    }
+    if (SendCacheInit(&node->send_cache, send_cache_fds, node->ifindex) < 0) {
+        NodeError(node, COMM_ERR_TRANSPORT, "Could not set up send contexts, using the shared sockets only");
+    }
+    GossipInit(&node->gossip, config->gossip);
+    node->busy.cpu = config->busy_poll_cpu < CPU_SETSIZE ? config->busy_poll_cpu : -1;
+    if (node->busy.cpu >= 0 && TransportBusyPoll(node->transport, BUSY_POLL_US) < 0) {
+        NodeError(node, COMM_ERR_TRANSPORT, "SO_BUSY_POLL not permitted, spinning in user space only");
+    }
+    if (node->busy.cpu >= 0 && sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        NodeError(node, COMM_ERR_TRANSPORT, "Low-latency mode on a single CPU delays everything else on it");
+    }
+    return node;
+
+fail:  // in reverse, each step is a no-op for what was never set up
+    AnnounceFree(node);
+    OutboxFree(&node->outbox);
+    OutQueuesFree(&node->outq);
+    SessionTableFree(&node->sessions);
+    free(node->peers);
+    MsgPoolFree(&node->pool);
+    TransportClose(node->transport);
+    SecureFree(&node->secure);
+    free(node);
+    return NULL;
+}
+
+void CommClose(Node *node) {
+    if (node == NULL) {
+        return;
+    }
+    SendDisconnectToAll(node);
+    OutDrainBlocking(node, 200);
+    LeaveAllChannels(node);
+    SendCacheClose(&node->send_cache);
+    SessionTableFree(&node->sessions);
+    OutQueuesFree(&node->outq);
+    OutboxFree(&node->outbox);
+    AnnounceFree(node);
+    MsgPoolFree(&node->pool);
+    TransportClose(node->transport);
+    SecureFree(&node->secure);
+    ClearAllPeers(node->peers, node->peers_size);  // their keys
+    free(node->peers);
+    free(node);
+}
+
+unsigned int CommPollFds(Node *node, struct pollfd *fds, unsigned int max_fds) {
+    unsigned int n = 0;
+    // a full socket reports POLLOUT once it has buffer space again, the
+    // batched backends free their send slots on every flush anyway
+    for (unsigned int i = 0; i < node->transport->n_poll_fds && n < max_fds; i++) {
+        int family = node->transport->poll_families[i];
+        fds[n].fd = node->transport->poll_fds[i];
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        if (family != AF_UNSPEC && (node->outq.blocked & OutFamilyBit(family))) {
+            fds[n].events |= POLLOUT;
+        }
+        n++;
+    }
+    return n;
+}
+
+// The poll() timeout for the next round: timeout_ms normally, 0 while
+// low-latency mode is spinning. Also pins the calling thread on first use.
+int CommPollTimeout(Node *node, int timeout_ms) {
+    BusyPoll *b = &node->busy;
+    if (b->cpu < 0) {
+        return timeout_ms;
+    }
+    if (!b->pinned) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(b->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            NodeError(node, COMM_ERR_TRANSPORT, "Could not pin to CPU %d: %s", b->cpu, strerror(errno));
+        }
+        b->pinned = 1;
+        b->last_activity_us = MonotonicUs();
+    }
+    uint64_t idle_us = MonotonicUs() - b->last_activity_us;
+    if (idle_us < BUSY_SPIN_US) {
+        return 0;
+    } else if (idle_us < BUSY_YIELD_US) {
+        sched_yield();  // anyone else on this core gets a turn
+        return 0;
+    }
+    return timeout_ms;
+}
+
+void CommDispatch(Node *node, const struct pollfd *fds, unsigned int nfds) {
+    int received = 0;
+    // fds may hold the application's own descriptors too, only ours are read
+    for (unsigned int i = 0; i < nfds && !received; i++) {
+        if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+        for (unsigned int j = 0; j < node->transport->n_poll_fds; j++) {
+            if (fds[i].fd == node->transport->poll_fds[j]) {
+                ListenUDP(node);  // reads all families
+                received = 1;
+                break;
+            }
+        }
+    }
+    if (node->busy.cpu >= 0 && !received) {
+        ListenUDP(node);  // the spinning receive, busy polls the device with SO_BUSY_POLL
+    }
+    PathTick(node);
+    GossipTick(node);
+    OutboxTick(node);
+    OutDrain(node);
+    if (TransportFlush(node->transport) == -EAGAIN) {  // batched backends only hit the wire here
+        node->outq.blocked |= OutFamilyBit(AF_INET) | OutFamilyBit(AF_INET6);
+    }
+
+    if (node->busy.cpu >= 0) {
+        const TransportStats *st = &node->transport->stats;
+        unsigned long datagrams = st->rx_datagrams + st->tx_datagrams + node->send_cache.sends;
+        if (datagrams != node->busy.last_datagrams) {
+            node->busy.last_datagrams = datagrams;
+            node->busy.last_activity_us = MonotonicUs();
+        }
+    }
+}
+
+int CommStep(Node *node, int timeout_ms) {
+    struct pollfd fds[COMM_MAX_POLL_FDS];
+    unsigned int nfds = CommPollFds(node, fds, COMM_MAX_POLL_FDS);
+    int ret = poll(fds, nfds, CommPollTimeout(node, timeout_ms));
+    if (ret < 0) {
+        if (errno != EINTR) {
+            return -errno;
+        }
+        ret = 0;
+    }
+    CommDispatch(node, fds, ret > 0 ? nfds : 0);
+    return ret;
+}
+
+int CommRun(Node *node) {
+    while (!node->stop) {
+        int ret = CommStep(node, COMM_STEP_MS);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    node->stop = 0;
+    return 0;
+}
+
+void CommStop(Node *node) {
+    node->stop = 1;
+}
+
+int CommScan(Node *node) {
+    return SendScan(node);
+}
+
+int CommSeed(Node *node, const char *address) {
+    return GossipSeed(node, address);
+}
+
+int CommSend(Node *node, long int peer_id, const void *msg, size_t msg_length) {
+    if (peer_id < 0) {
+        return -2;
+    }
+    return SendMsgToPeer(node, (size_t) peer_id, msg, msg_length);
+}
+
+int CommSendTo(Node *node, const char *identifier, const void *msg, size_t msg_length) {
+    return SendMsgToIdentifier(node, identifier, msg, msg_length);
+}
+
+int CommJoin(Node *node, const char *topic) {
+    return JoinChannel(node, topic);
+}
+
+int CommLeave(Node *node, const char *topic) {
+    return LeaveChannel(node, topic);
+}
+
+int CommPublish(Node *node, const char *topic, const void *msg, size_t msg_length) {
+    return PublishChannel(node, topic, msg, msg_length);
+}
+
+int CommDisconnect(Node *node, long int peer_id) {
+    if (peer_id < 0 || CommPeerIdentifier(node, peer_id) == NULL) {
+        return -1;
+    }
+    SendDisconnect(node, (size_t) peer_id);
+    GossipMemberLeft(node, (size_t) peer_id);
+    DropPeer(node, (size_t) peer_id, COMM_PEER_DROPPED);
+    return 0;
+}
+
+const char *CommIdentifier(const Node *node) {
+    return node->user_identifier;
+}
+
+const char *CommPeerIdentifier(const Node *node, long int peer_id) {
+    if (peer_id < 0 || (size_t) peer_id >= node->peers_size || node->peers[peer_id].user_identifier[0] == '\0') {
+        return NULL;
+    }
+    return node->peers[peer_id].user_identifier;
+}
+
+long int CommFindPeer(const Node *node, const char *identifier) {
+    return FindByUserIdentifier(node->peers, node->peers_size, identifier);
+}
+
+// Safe from any thread. Returns 1 with info filled in, 0 for a free slot,
+// -1 for an invalid peer_id.
+int CommReadPeer(const Node *node, long int peer_id, CommPeerInfo *info) {
+    if (peer_id < 0 || (size_t) peer_id >= node->peers_size) {
+        return -1;
+    }
+    PeerView view;
+    if (!PeerRead(&node->peers[peer_id], &view)) {
+        return 0;
+    }
+    memcpy(info->identifier, view.user_identifier, sizeof(info->identifier));
+    info->addr4 = view.inet4.addr4;
+    info->addr6 = view.inet6.addr6;
+    info->seen4 = view.inet4.seen;
+    info->seen6 = view.inet6.seen;
+    info->rtt4_us = view.inet4.path.srtt_us;
+    info->rtt6_us = view.inet6.path.srtt_us;
+    info->preferred_family = PathChooseFamily(&view.inet4, &view.inet6);
+    info->member = view.swim_status == SWIM_ALIVE || view.swim_status == SWIM_SUSPECT;
+    info->sealed = view.key_status == KEYS_READY;
+    return 1;
+}
+
+long int CommTraceDump(const char *path) {
+    return TraceDump(path);
+}
@@ -0,0 +1,157 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_C_COMM_H_
+#define SRC_C_COMM_H_
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// Embedding API, built as libc_comm.a / libc_comm.so (make lib).
+//
+// A node is opened on one interface and driven by the application, either
+// with CommRun() on a thread of its own, or step by step: CommStep() polls
+// the node's sockets itself, CommPollFds() + CommDispatch() fit it into an
+// existing poll loop (with the timeout from CommPollTimeout()). Nothing
+// blocks beyond the poll timeout, and all callbacks run inside these calls,
+// on the caller's thread. A node is not thread safe, sends from other
+// threads need the caller's own locking. CommReadPeer() is the exception:
+// any thread may take a consistent copy of a peer while another drives the
+// node, without stopping it.
+//
+// Low-latency mode (busy_poll_cpu >= 0) pins the thread driving the node to
+// one core and trades CPU for wakeup latency: after any traffic the loop
+// spins on non-blocking receives (with SO_BUSY_POLL on the sockets), then
+// spins yielding the core, and only after a quiet spell blocks in poll()
+// again.
+//
+// With gso set, consecutive messages to the same peer leave as one
+// segmentation-offloaded send at the end of the dispatch round, and a run
+// of received datagrams from one sender is read in one syscall.
+//
+// Direct messages are sealed (ChaCha20-Poly1305, keys from an X25519
+// exchange during discovery) for every peer that announced a key, see
+// secure.h; encrypt picks what happens with the others.
+//
+// Peers are named by their slot in the peer table (peer_id), valid from the
+// peer-added callback until the peer-removed one. Messages for a peer that
+// is unreachable or gone wait in the outbox (outbox_cap) and are sent when
+// it is seen again; CommSend() and CommSendTo() return 1 for those.
+
+#define COMM_API __attribute__((visibility("default")))
+#define COMM_MAX_POLL_FDS 2  // CommPollFds() never needs more
+
+typedef struct Node Node;
+
+enum CommError {
+    COMM_ERR_OPEN = 1,  // CommOpen() is about to return NULL
+    COMM_ERR_TRANSPORT,  // receiving failed, detail is strerror()
+    COMM_ERR_SCAN,
+    COMM_ERR_SEND,  // a message or disconnect could not be sent or queued
+    COMM_ERR_PUBLISH,
+    COMM_ERR_PATH,  // one address family failed, the other may still work
+};
+
+enum CommEncrypt {
+    COMM_ENCRYPT_OFF,
+    COMM_ENCRYPT_PREFERRED,  // sealed for peers with a key, cleartext for the others
+    COMM_ENCRYPT_REQUIRED,  // messages are never sent or accepted in cleartext
+};
+
+enum CommPeerReason {
+    COMM_PEER_FOUND,  // added: answered or sent a scan
+    COMM_PEER_GOSSIP,  // added: learned from another member
+    COMM_PEER_LEFT,  // removed: sent DISCONNECT
+    COMM_PEER_FAILED,  // removed: stopped answering gossip probes
+    COMM_PEER_REPLACED,  // removed: its address now belongs to someone else
+    COMM_PEER_DROPPED,  // removed: by the application
+};
+
+// Invoked for every received direct message (sealed or not) and subscribed CHANNEL_MESSAGE
+// (channel is NULL for direct messages), peer_id is -1 if the sender is not
+// in the peer table. When unset, messages are printed to stdout.
+typedef void (*MessageHook)(
+    Node *node,
+    long int peer_id,
+    const struct sockaddr_storage *src_addr,
+    const char *channel,
+    const char *msg,
+    size_t msg_length,
+    void *arg);
+
+// Peer added or removed, reason is a CommPeerReason. When unset, changes are
+// printed to stdout.
+typedef void (*PeerHook)(Node *node, long int peer_id, const char *identifier, int reason, void *arg);
+
+// Failures nobody gets a return value for. When unset, printed to stderr.
+typedef void (*ErrorHook)(Node *node, int error, const char *detail, void *arg);
+
+// One peer as CommReadPeer() found it.
+typedef struct {
+    char identifier[320];
+    struct in_addr addr4;
+    struct in6_addr addr6;
+    time_t seen4;  // 0 = no IPv4 address
+    time_t seen6;  // 0 = no IPv6 address
+    unsigned int rtt4_us;  // smoothed probe RTT, 0 = no sample
+    unsigned int rtt6_us;
+    int preferred_family;  // AF_INET or AF_INET6, where sends go first
+    int member;  // a gossip member, alive or suspected
+    int sealed;  // messages to it are encrypted
+} CommPeerInfo;
+
+typedef struct {
+    const char *ifname;
+    const char *user_name;  // the identifier is user_name@hostname
+    const char *transport;  // "udp" (default) or "uring", falls back to udp
+    size_t peers_size;
+    size_t outq_cap;  // bytes of queued outbound frames
+    size_t send_cache_fds;  // connected sockets for recent peers, udp only
+    unsigned int rate_scale;  // ingress rate limits, 0 disables
+    int wire_version;  // for announcements, 1 while old nodes remain
+    int gossip;  // SWIM membership with the discovered peers
+    int busy_poll_cpu;  // low-latency mode pinned to this core, -1 (default) off
+    int gso;  // coalesce bulk sends with UDP GSO and reads with GRO, udp only
+    int encrypt;  // CommEncrypt, default COMM_ENCRYPT_PREFERRED
+    size_t trace_events;  // binary event trace, ring size per thread, 0 (default) off
+    size_t outbox_cap;  // bytes of messages kept for unreachable peers, 0 disables
+    unsigned int outbox_ttl_s;  // undelivered messages are discarded after this
+    const char *outbox_spill;  // append-only file for messages beyond the cap, or NULL
+    MessageHook on_message;
+    PeerHook on_peer_added;
+    PeerHook on_peer_removed;
+    ErrorHook on_error;
+    void *arg;  // passed to every callback
+} CommConfig;
+
+COMM_API void CommConfigDefaults(CommConfig *config, const char *ifname, const char *user_name);
+COMM_API Node *CommOpen(const CommConfig *config);
+COMM_API void CommClose(Node *node);  // says goodbye to all peers first
+
+COMM_API int CommStep(Node *node, int timeout_ms);
+COMM_API int CommRun(Node *node);
+COMM_API void CommStop(Node *node);
+COMM_API unsigned int CommPollFds(Node *node, struct pollfd *fds, unsigned int max_fds);
+COMM_API int CommPollTimeout(Node *node, int timeout_ms);
+COMM_API void CommDispatch(Node *node, const struct pollfd *fds, unsigned int nfds);
+
+COMM_API int CommScan(Node *node);
+COMM_API int CommSeed(Node *node, const char *address);
+COMM_API int CommSend(Node *node, long int peer_id, const void *msg, size_t msg_length);
+COMM_API int CommSendTo(Node *node, const char *identifier, const void *msg, size_t msg_length);
+COMM_API int CommJoin(Node *node, const char *topic);
+COMM_API int CommLeave(Node *node, const char *topic);
+COMM_API int CommPublish(Node *node, const char *topic, const void *msg, size_t msg_length);
+COMM_API int CommDisconnect(Node *node, long int peer_id);
+
+COMM_API const char *CommIdentifier(const Node *node);
+COMM_API const char *CommPeerIdentifier(const Node *node, long int peer_id);
+COMM_API long int CommFindPeer(const Node *node, const char *identifier);
+COMM_API int CommReadPeer(const Node *node, long int peer_id, CommPeerInfo *info);
+
+// Writes the event trace of every thread to path (bin/trace2json reads it),
+// returns the number of events or -errno.
+COMM_API long int CommTraceDump(const char *path);
+
+#endif  // SRC_C_COMM_H_
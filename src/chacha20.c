@@ -0,0 +1,347 @@
+// Copyright 2025 Michał Jankowski
+#include <string.h>
+
+#include "chacha20.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHACHA20_X86 1
+#endif
+
+// XORs blocks whole 64-byte blocks of keystream into in, starting at the
+// counter in state[12]. Returns how many blocks it did, the rest is left to
+// a narrower implementation.
+typedef size_t (*BlocksFunction)(const uint32_t state[16], uint8_t *out, const uint8_t *in, size_t blocks);
+
+typedef struct {
+    const char *name;
+    BlocksFunction blocks;
+    int (*supported)(void);
+    size_t width;  // blocks per pass
+} Implementation;
+
+static inline uint32_t Load32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void Store32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTER_ROUND(a, b, c, d) \
+    do { \
+        a += b; d ^= a; d = ROTL32(d, 16); \
+        c += d; b ^= c; b = ROTL32(b, 12); \
+        a += b; d ^= a; d = ROTL32(d, 8); \
+        c += d; b ^= c; b = ROTL32(b, 7); \
+    } while (0)
+
+static void DoubleRounds(uint32_t x[16]) {
+    for (unsigned int i = 0; i < 10; i++) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+}
+
+static void Block(const uint32_t state[16], uint8_t out[CHACHA20_BLOCK_SIZE]) {
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    DoubleRounds(x);
+    for (unsigned int i = 0; i < 16; i++) {
+        Store32(out + 4 * i, x[i] + state[i]);
+    }
+}
+
+static size_t BlocksScalar(const uint32_t state[16], uint8_t *out, const uint8_t *in, size_t blocks) {
+    uint32_t s[16];
+    uint8_t keystream[CHACHA20_BLOCK_SIZE];
+    memcpy(s, state, sizeof(s));
+    for (size_t b = 0; b < blocks; b++) {
+        Block(s, keystream);
+        for (unsigned int i = 0; i < CHACHA20_BLOCK_SIZE; i++) {
+            out[i] = in[i] ^ keystream[i];
+        }
+        s[12]++;
+        out += CHACHA20_BLOCK_SIZE;
+        in += CHACHA20_BLOCK_SIZE;
+    }
+    return blocks;
+}
+
+static int AlwaysSupported(void) {
+    return 1;
+}
+
+#ifdef CHACHA20_X86
+// The SIMD versions keep word i of several consecutive blocks in one
+// register (lane j = block j), run the rounds on all of them at once and
+// transpose back to block order for the XOR.
+
+#define ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define QUARTER_ROUND_128(a, b, c, d) \
+    do { \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 16); \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 12); \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 8); \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 7); \
+    } while (0)
+
+__attribute__((target("sse2")))
+static size_t BlocksSse2(const uint32_t state[16], uint8_t *out, const uint8_t *in, size_t blocks) {
+    uint32_t counter = state[12];
+    size_t done = 0;
+    for (; done + 4 <= blocks; done += 4, counter += 4) {
+        __m128i s[16], x[16];
+        for (unsigned int i = 0; i < 16; i++) {
+            s[i] = _mm_set1_epi32((int) state[i]);
+        }
+        s[12] = _mm_add_epi32(_mm_set1_epi32((int) counter), _mm_setr_epi32(0, 1, 2, 3));
+        memcpy(x, s, sizeof(x));
+        for (unsigned int r = 0; r < 10; r++) {
+            QUARTER_ROUND_128(x[0], x[4], x[8], x[12]);
+            QUARTER_ROUND_128(x[1], x[5], x[9], x[13]);
+            QUARTER_ROUND_128(x[2], x[6], x[10], x[14]);
+            QUARTER_ROUND_128(x[3], x[7], x[11], x[15]);
+            QUARTER_ROUND_128(x[0], x[5], x[10], x[15]);
+            QUARTER_ROUND_128(x[1], x[6], x[11], x[12]);
+            QUARTER_ROUND_128(x[2], x[7], x[8], x[13]);
+            QUARTER_ROUND_128(x[3], x[4], x[9], x[14]);
+        }
+        for (unsigned int g = 0; g < 4; g++) {  // words 4g..4g+3 of the 4 blocks
+            __m128i a = _mm_add_epi32(x[4 * g], s[4 * g]);
+            __m128i b = _mm_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+            __m128i c = _mm_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+            __m128i d = _mm_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+            __m128i t0 = _mm_unpacklo_epi32(a, b);
+            __m128i t1 = _mm_unpacklo_epi32(c, d);
+            __m128i t2 = _mm_unpackhi_epi32(a, b);
+            __m128i t3 = _mm_unpackhi_epi32(c, d);
+            __m128i rows[4] = {
+                _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3),
+            };
+            for (unsigned int j = 0; j < 4; j++) {
+                size_t off = j * CHACHA20_BLOCK_SIZE + 16 * g;
+                __m128i m = _mm_loadu_si128((const __m128i *) (in + off));
+                _mm_storeu_si128((__m128i *) (out + off), _mm_xor_si128(m, rows[j]));
+            }
+        }
+        out += 4 * CHACHA20_BLOCK_SIZE;
+        in += 4 * CHACHA20_BLOCK_SIZE;
+    }
+    return done;
+}
+
+static int Sse2Supported(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+#define ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define QUARTER_ROUND_256(a, b, c, d) \
+    do { \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16); \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 12); \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8); \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 7); \
+    } while (0)
+
+__attribute__((target("avx2")))
+static size_t BlocksAvx2(const uint32_t state[16], uint8_t *out, const uint8_t *in, size_t blocks) {
+    // rotations by whole bytes are a byte shuffle
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    uint32_t counter = state[12];
+    size_t done = 0;
+    for (; done + 8 <= blocks; done += 8, counter += 8) {
+        __m256i s[16], x[16];
+        for (unsigned int i = 0; i < 16; i++) {
+            s[i] = _mm256_set1_epi32((int) state[i]);
+        }
+        s[12] = _mm256_add_epi32(_mm256_set1_epi32((int) counter), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        memcpy(x, s, sizeof(x));
+        for (unsigned int r = 0; r < 10; r++) {
+            QUARTER_ROUND_256(x[0], x[4], x[8], x[12]);
+            QUARTER_ROUND_256(x[1], x[5], x[9], x[13]);
+            QUARTER_ROUND_256(x[2], x[6], x[10], x[14]);
+            QUARTER_ROUND_256(x[3], x[7], x[11], x[15]);
+            QUARTER_ROUND_256(x[0], x[5], x[10], x[15]);
+            QUARTER_ROUND_256(x[1], x[6], x[11], x[12]);
+            QUARTER_ROUND_256(x[2], x[7], x[8], x[13]);
+            QUARTER_ROUND_256(x[3], x[4], x[9], x[14]);
+        }
+        // per 128-bit lane the 4x4 transpose of the SSE2 version: rows[g][j]
+        // holds words 4g..4g+3 of block j (low lane) and block j + 4 (high)
+        __m256i rows[4][4];
+        for (unsigned int g = 0; g < 4; g++) {
+            __m256i a = _mm256_add_epi32(x[4 * g], s[4 * g]);
+            __m256i b = _mm256_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+            __m256i c = _mm256_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+            __m256i d = _mm256_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+            __m256i t0 = _mm256_unpacklo_epi32(a, b);
+            __m256i t1 = _mm256_unpacklo_epi32(c, d);
+            __m256i t2 = _mm256_unpackhi_epi32(a, b);
+            __m256i t3 = _mm256_unpackhi_epi32(c, d);
+            rows[g][0] = _mm256_unpacklo_epi64(t0, t1);
+            rows[g][1] = _mm256_unpackhi_epi64(t0, t1);
+            rows[g][2] = _mm256_unpacklo_epi64(t2, t3);
+            rows[g][3] = _mm256_unpackhi_epi64(t2, t3);
+        }
+        for (unsigned int j = 0; j < 4; j++) {
+            for (unsigned int half = 0; half < 2; half++) {  // bytes 0..31, then 32..63
+                __m256i lo = rows[2 * half][j];
+                __m256i hi = rows[2 * half + 1][j];
+                size_t off_lo = j * CHACHA20_BLOCK_SIZE + 32 * half;
+                size_t off_hi = (j + 4) * CHACHA20_BLOCK_SIZE + 32 * half;
+                __m256i k_lo = _mm256_permute2x128_si256(lo, hi, 0x20);
+                __m256i k_hi = _mm256_permute2x128_si256(lo, hi, 0x31);
+                __m256i m_lo = _mm256_loadu_si256((const __m256i *) (in + off_lo));
+                __m256i m_hi = _mm256_loadu_si256((const __m256i *) (in + off_hi));
+                _mm256_storeu_si256((__m256i *) (out + off_lo), _mm256_xor_si256(m_lo, k_lo));
+                _mm256_storeu_si256((__m256i *) (out + off_hi), _mm256_xor_si256(m_hi, k_hi));
+            }
+        }
+        out += 8 * CHACHA20_BLOCK_SIZE;
+        in += 8 * CHACHA20_BLOCK_SIZE;
+    }
+    return done;
+}
+
+static int Avx2Supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+// widest first, the last one takes whatever the others leave
+static const Implementation IMPLEMENTATIONS[] = {
+#ifdef CHACHA20_X86
+    {"avx2", BlocksAvx2, Avx2Supported, 8},
+    {"sse2", BlocksSse2, Sse2Supported, 4},
+#endif
+    {"scalar", BlocksScalar, AlwaysSupported, 1},
+};
+#define IMPLEMENTATION_COUNT (sizeof(IMPLEMENTATIONS) / sizeof(IMPLEMENTATIONS[0]))
+
+static size_t selected = IMPLEMENTATION_COUNT;  // index of the widest one in use, COUNT = not picked yet
+
+static size_t Selected(void) {
+    size_t i = __atomic_load_n(&selected, __ATOMIC_RELAXED);
+    if (i < IMPLEMENTATION_COUNT) {
+        return i;
+    }
+    for (i = 0; !IMPLEMENTATIONS[i].supported(); i++) {
+    }
+    __atomic_store_n(&selected, i, __ATOMIC_RELAXED);
+    return i;
+}
+
+const char *ChaCha20Implementation(void) {
+    return IMPLEMENTATIONS[Selected()].name;
+}
+
+// For benchmarks: use name ("avx2", "sse2", "scalar") and everything
+// narrower. Returns -1 when the CPU can't run it.
+int ChaCha20SelectImplementation(const char *name) {
+    for (size_t i = 0; i < IMPLEMENTATION_COUNT; i++) {
+        if (strcmp(IMPLEMENTATIONS[i].name, name) == 0) {
+            if (!IMPLEMENTATIONS[i].supported()) {
+                return -1;
+            }
+            __atomic_store_n(&selected, i, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void ChaCha20KeyInit(ChaCha20Key *key, const uint8_t bytes[CHACHA20_KEY_SIZE]) {
+    key->state[0] = 0x61707865;  // "expand 32-byte k"
+    key->state[1] = 0x3320646e;
+    key->state[2] = 0x79622d32;
+    key->state[3] = 0x6b206574;
+    for (unsigned int i = 0; i < 8; i++) {
+        key->state[4 + i] = Load32(bytes + 4 * i);
+    }
+    key->state[12] = 0;
+    key->state[13] = 0;
+    key->state[14] = 0;
+    key->state[15] = 0;
+}
+
+// out = in XOR keystream starting at block counter, out may equal in.
+void ChaCha20Xor(
+    const ChaCha20Key *key,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE],
+    uint32_t counter,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t length
+) {
+    uint32_t state[16];
+    memcpy(state, key->state, sizeof(state));
+    state[12] = counter;
+    state[13] = Load32(nonce);
+    state[14] = Load32(nonce + 4);
+    state[15] = Load32(nonce + 8);
+
+    const Implementation *widest = &IMPLEMENTATIONS[Selected()];
+    size_t done = widest->blocks(state, out, in, length / CHACHA20_BLOCK_SIZE);
+    state[12] += (uint32_t) done;
+    out += done * CHACHA20_BLOCK_SIZE;
+    in += done * CHACHA20_BLOCK_SIZE;
+    length -= done * CHACHA20_BLOCK_SIZE;
+
+    // More than half a pass left (a message rarely is a multiple of it):
+    // one padded pass is cheaper than finishing block by block.
+    if (2 * length > widest->width * CHACHA20_BLOCK_SIZE) {
+        uint8_t pass[8 * CHACHA20_BLOCK_SIZE] = {0};
+        memcpy(pass, in, length);
+        widest->blocks(state, pass, pass, widest->width);
+        memcpy(out, pass, length);
+        return;
+    }
+    size_t blocks = length / CHACHA20_BLOCK_SIZE;
+    for (const Implementation *i = widest + 1; blocks > 0 && i < IMPLEMENTATIONS + IMPLEMENTATION_COUNT; i++) {
+        done = i->blocks(state, out, in, blocks);
+        state[12] += (uint32_t) done;
+        blocks -= done;
+        out += done * CHACHA20_BLOCK_SIZE;
+        in += done * CHACHA20_BLOCK_SIZE;
+    }
+    size_t tail = length % CHACHA20_BLOCK_SIZE;
+    if (tail > 0) {
+        uint8_t keystream[CHACHA20_BLOCK_SIZE];
+        Block(state, keystream);
+        for (size_t i = 0; i < tail; i++) {
+            out[i] = in[i] ^ keystream[i];
+        }
+    }
+}
+
+// Key derivation (the XChaCha20 subkey function): the rounds without the
+// final addition, words 0..3 and 12..15 of the result.
+void HChaCha20(uint8_t out[32], const uint8_t key[CHACHA20_KEY_SIZE], const uint8_t input[16]) {
+    ChaCha20Key k;
+    ChaCha20KeyInit(&k, key);
+    uint32_t x[16];
+    memcpy(x, k.state, sizeof(x));
+    for (unsigned int i = 0; i < 4; i++) {
+        x[12 + i] = Load32(input + 4 * i);
+    }
+    DoubleRounds(x);
+    for (unsigned int i = 0; i < 4; i++) {
+        Store32(out + 4 * i, x[i]);
+        Store32(out + 16 + 4 * i, x[12 + i]);
+    }
+}
@@ -0,0 +1,35 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_CHACHA20_H_
+#define SRC_CHACHA20_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ChaCha20 as in RFC 8439: 256-bit key, 96-bit nonce, 32-bit block counter.
+// Blocks are generated by the widest implementation the CPU supports, picked
+// on first use: AVX2 (8 blocks at a time), SSE2 (4) or portable C (1).
+// Every implementation produces the same keystream.
+
+#define CHACHA20_KEY_SIZE 32
+#define CHACHA20_NONCE_SIZE 12
+#define CHACHA20_BLOCK_SIZE 64
+
+// The per-key part of the block input (constants and key words), set up
+// once per key; counter and nonce words are filled in per call.
+typedef struct {
+    uint32_t state[16];
+} ChaCha20Key;
+
+void ChaCha20KeyInit(ChaCha20Key *key, const uint8_t bytes[CHACHA20_KEY_SIZE]);
+void ChaCha20Xor(
+    const ChaCha20Key *key,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE],
+    uint32_t counter,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t length);
+void HChaCha20(uint8_t out[32], const uint8_t key[CHACHA20_KEY_SIZE], const uint8_t input[16]);
+const char *ChaCha20Implementation(void);
+int ChaCha20SelectImplementation(const char *name);
+
+#endif  // SRC_CHACHA20_H_
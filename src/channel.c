@@ -0,0 +1,267 @@
+// Copyright 2025 Michał Jankowski
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "channel.h"
+#include "net_func.h"
+#include "node.h"
+#include "sock_prep.h"
+#include "transport.h"
+
+// FNV-1a, stable across builds and architectures so every node derives the
+// same group for a topic.
+uint32_t ChannelHash(const char *topic, size_t topic_length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < topic_length; i++) {
+        hash ^= (uint8_t) topic[i];
+        hash *= 16777619u;
+    }
+    return hash == 0 ? 1 : hash;  // 0 marks a free slot
+}
+
+// IPv4: 239.255.0.0/16 (site-local administrative scope).
+// IPv6: ff12::c0:0:0/96 (transient, link-local like MCAST6_GROUP).
+void ChannelGroups(uint32_t hash, struct in_addr *group4, struct in6_addr *group6) {
+    if (group4 != NULL) {
+        group4->s_addr = htonl(0xEFFF0000u | (hash & 0xFFFF));
+    }
+    if (group6 != NULL) {
+        memset(group6, 0, sizeof(*group6));
+        group6->s6_addr[0] = 0xFF;
+        group6->s6_addr[1] = 0x12;
+        group6->s6_addr[11] = 0xC0;
+        group6->s6_addr[12] = (uint8_t) (hash >> 24);
+        group6->s6_addr[13] = (uint8_t) (hash >> 16);
+        group6->s6_addr[14] = (uint8_t) (hash >> 8);
+        group6->s6_addr[15] = (uint8_t) hash;
+    }
+}
+
+long int FindChannel(const ChannelTable *table, const char *topic, size_t topic_length) {
+    uint32_t hash = ChannelHash(topic, topic_length);
+    for (size_t i = 0; i < MAX_CHANNELS; i++) {
+        const Channel *c = &table->channels[i];
+        if (c->hash == hash && strlen(c->topic) == topic_length && memcmp(c->topic, topic, topic_length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Whether another subscribed channel already holds c's group membership;
+// the kernel tracks one membership per group and socket, not a refcount.
+static int GroupShared(const ChannelTable *table, const Channel *c, int family) {
+    for (size_t i = 0; i < MAX_CHANNELS; i++) {
+        const Channel *other = &table->channels[i];
+        if (other == c || other->hash == 0) {
+            continue;
+        }
+        if (family == AF_INET && other->group4.s_addr == c->group4.s_addr) {
+            return 1;
+        } else if (family == AF_INET6 && memcmp(&other->group6, &c->group6, sizeof(c->group6)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int ChannelMembership(Node *node, const Channel *c, int join) {
+    int joined = 0;
+    if (node->transport->has_inet4 && GroupShared(&node->channels, c, AF_INET)) {
+        joined++;
+    } else if (node->transport->has_inet4) {
+        struct sockaddr_in group;
+        memset(&group, 0, sizeof(group));
+        group.sin_family = AF_INET;
+        group.sin_addr = c->group4;
+        if (TransportMembership(node->transport, (struct sockaddr *) &group, node->ifindex, join) == 0) {
+            joined++;
+        }
+    }
+    if (node->transport->has_inet6 && GroupShared(&node->channels, c, AF_INET6)) {
+        joined++;
+    } else if (node->transport->has_inet6) {
+        struct sockaddr_in6 group;
+        memset(&group, 0, sizeof(group));
+        group.sin6_family = AF_INET6;
+        group.sin6_addr = c->group6;
+        if (TransportMembership(node->transport, (struct sockaddr *) &group, node->ifindex, join) == 0) {
+            joined++;
+        }
+    }
+    return joined > 0 ? 0 : -1;
+}
+
+int JoinChannel(Node *node, const char *topic) {
+    ChannelTable *table = &node->channels;
+    size_t topic_length = strlen(topic);
+    if (topic_length == 0 || topic_length > MAX_TOPIC_LENGTH) {
+        return -1;
+    }
+    if (FindChannel(table, topic, topic_length) >= 0) {
+        return 0;
+    }
+
+    long int free_slot = -1;
+    for (size_t i = 0; i < MAX_CHANNELS; i++) {
+        if (table->channels[i].hash == 0) {
+            free_slot = i;
+            break;
+        }
+    }
+    if (free_slot < 0) {
+        return -2;
+    }
+
+    Channel *c = &table->channels[free_slot];
+    c->hash = ChannelHash(topic, topic_length);
+    memcpy(c->topic, topic, topic_length);
+    c->topic[topic_length] = '\0';
+    ChannelGroups(c->hash, &c->group4, &c->group6);
+
+    if (ChannelMembership(node, c, 1) < 0) {
+        memset(c, 0, sizeof(*c));
+        return -3;
+    }
+    table->count++;
+    return 0;
+}
+
+int LeaveChannel(Node *node, const char *topic) {
+    ChannelTable *table = &node->channels;
+    long int pos = FindChannel(table, topic, strlen(topic));
+    if (pos < 0) {
+        return -1;
+    }
+    Channel *c = &table->channels[pos];
+    ChannelMembership(node, c, 0);
+    memset(c, 0, sizeof(*c));
+    table->count--;
+    return 0;
+}
+
+void LeaveAllChannels(Node *node) {
+    for (size_t i = 0; i < MAX_CHANNELS; i++) {
+        if (node->channels.channels[i].hash != 0) {
+            LeaveChannel(node, node->channels.channels[i].topic);
+        }
+    }
+}
+
+int PublishChannel(Node *node, const char *topic, const char *msg, size_t msg_length) {
+    Transport *t = node->transport;
+    char msg_buf[2048];
+    size_t topic_length = strlen(topic);
+
+    if (topic_length == 0 || topic_length > MAX_TOPIC_LENGTH) {
+        return -1;
+    }
+    if (msg_length == 0 || 1 + topic_length + msg_length + WIRE_HEADER_MAX > sizeof(msg_buf)) {
+        return -2;
+    }
+    msg_buf[0] = (char) topic_length;
+    memcpy(msg_buf + 1, topic, topic_length);
+    memcpy(msg_buf + 1 + topic_length, msg, msg_length);
+
+    long int encap_length;
+    size_t payload_length = 1 + topic_length + msg_length;
+    if ((encap_length = EncapsulateFrame(
+            node, node->wire_version, CHANNEL_MESSAGE, msg_buf, payload_length, sizeof(msg_buf))) < 0) {
+        NodeError(node, COMM_ERR_PUBLISH, "Publish: failed to encapsulate message, error %li", encap_length);
+        return -3;
+    }
+
+    // one datagram per publish: IPv4 when available, subscribers join both groups
+    uint32_t hash = ChannelHash(topic, topic_length);
+    ssize_t result;
+    if (t->has_inet4) {
+        struct sockaddr_in group;
+        memset(&group, 0, sizeof(group));
+        group.sin_family = AF_INET;
+        group.sin_port = htons(PORT);
+        ChannelGroups(hash, &group.sin_addr, NULL);
+        result = OutSend(node, -1, OUT_BULK, msg_buf, (size_t) encap_length, (struct sockaddr *) &group, sizeof(group));
+    } else {
+        struct sockaddr_in6 group;
+        memset(&group, 0, sizeof(group));
+        group.sin6_family = AF_INET6;
+        group.sin6_port = htons(PORT);
+        group.sin6_scope_id = node->ifindex;
+        ChannelGroups(hash, NULL, &group.sin6_addr);
+        result = OutSend(node, -1, OUT_BULK, msg_buf, (size_t) encap_length, (struct sockaddr *) &group, sizeof(group));
+    }
+    if (result < 0) {
+        NodeError(node, COMM_ERR_PUBLISH, "Publish on #%s failed: %s", topic, strerror((int) -result));
+        node->stats.send_errors++;
+        return -4;
+    }
+    node->stats.msgs_sent++;
+    return 0;
+}
+
+int PublishMsg(Node *node, char *cmd) {
+    char *data = cmd + 5;
+
+    char *topic = strtok(data, " ");
+    if (!topic) {
+        fprintf(stderr, "[FAIL] Could not publish - invalid topic.\n");
+        return -1;
+    }
+    char *message = strtok(NULL, "");
+    if (!message || *message == '\0') {
+        printf("[FAIL] Could not publish - message not found.\n");
+        return -2;
+    }
+    return PublishChannel(node, topic, message, strlen(message));
+}
+
+void ProcessMessageChannel(
+    Node *node,
+    long int peer_id,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr
+) {
+    if (msg_length < 2) {
+        node->stats.rx_invalid++;
+        return;
+    }
+    size_t topic_length = (uint8_t) msg[0];
+    if (topic_length == 0 || topic_length > MAX_TOPIC_LENGTH || 1 + topic_length > msg_length) {
+        node->stats.rx_invalid++;
+        return;
+    }
+    long int channel = FindChannel(&node->channels, msg + 1, topic_length);
+    if (channel < 0) {
+        node->stats.rx_channel_filtered++;
+        return;
+    }
+
+    const char *topic = node->channels.channels[channel].topic;
+    char *body = msg + 1 + topic_length;
+    size_t body_length = msg_length - 1 - topic_length;
+    if (node->on_message != NULL) {
+        node->on_message(node, peer_id, src_addr, topic, body, body_length, node->hook_arg);
+    } else {
+        PrintReceivedMessage(node, peer_id, src_addr, topic, body);
+    }
+}
+
+void PrintChannels(const ChannelTable *table) {
+    if (table->count == 0) {
+        printf("Not subscribed to any channels.\n");
+        return;
+    }
+    for (size_t i = 0; i < MAX_CHANNELS; i++) {
+        const Channel *c = &table->channels[i];
+        if (c->hash == 0) {
+            continue;
+        }
+        char ipv4_str[INET_ADDRSTRLEN];
+        char ipv6_str[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET, &c->group4, ipv4_str, sizeof(ipv4_str));
+        inet_ntop(AF_INET6, &c->group6, ipv6_str, sizeof(ipv6_str));
+        printf("#%s (%s, %s)\n", c->topic, ipv4_str, ipv6_str);
+    }
+}
@@ -0,0 +1,50 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_CHANNEL_H_
+#define SRC_CHANNEL_H_
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define MAX_CHANNELS 64
+#define MAX_TOPIC_LENGTH 63
+
+// Topic channels: each topic hashes onto a multicast group, so a publish is
+// a single datagram regardless of the number of subscribers. The group is
+// only a coarse kernel-side filter, hash collisions are resolved by
+// comparing the topic carried in every CHANNEL_MESSAGE:
+//     u8 topic_length | topic | message
+
+typedef struct Node Node;
+
+typedef struct {
+    uint32_t hash;  // 0 = free slot
+    char topic[MAX_TOPIC_LENGTH + 1];
+    struct in_addr group4;
+    struct in6_addr group6;
+} Channel;
+
+typedef struct {
+    Channel channels[MAX_CHANNELS];
+    size_t count;
+} ChannelTable;
+
+uint32_t ChannelHash(const char *topic, size_t topic_length);
+void ChannelGroups(uint32_t hash, struct in_addr *group4, struct in6_addr *group6);
+long int FindChannel(const ChannelTable *table, const char *topic, size_t topic_length);
+int JoinChannel(Node *node, const char *topic);
+int LeaveChannel(Node *node, const char *topic);
+void LeaveAllChannels(Node *node);
+int PublishChannel(Node *node, const char *topic, const char *msg, size_t msg_length);
+int PublishMsg(Node *node, char *cmd);
+void ProcessMessageChannel(
+    Node *node,
+    long int peer_id,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr
+);
+void PrintChannels(const ChannelTable *table);
+
+#endif  // SRC_CHANNEL_H_
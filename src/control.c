@@ -0,0 +1,531 @@
+// Copyright 2025 Michał Jankowski
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "channel.h"
+#include "control.h"
+#include "net_func.h"
+#include "node.h"
+#include "peer.h"
+#include "trace.h"
+
+static inline void PutU16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+static inline uint16_t GetU16(const uint8_t *p) {
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static inline void PutU64(uint8_t *p, uint64_t v) {
+    for (int i = 7; i >= 0; i--) {
+        p[i] = (uint8_t) v;
+        v >>= 8;
+    }
+}
+
+static void CloseClient(ControlClient *c) {
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    free(c->in);
+    free(c->out);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+static size_t OutSpace(const ControlClient *c) {
+    return CONTROL_OUT_SIZE - c->out_len;
+}
+
+// Appends a frame to the client's output buffer, written out on POLLOUT.
+static int QueueFrame(ControlClient *c, uint8_t op, uint8_t flags, const uint8_t *body, size_t body_length) {
+    if (body_length > CTL_MAX_BODY) {
+        return -1;
+    }
+    if (CTL_HEADER_SIZE + body_length > CONTROL_OUT_SIZE - (c->out_len - c->out_off)) {
+        return -2;
+    }
+    if (c->out_len + CTL_HEADER_SIZE + body_length > CONTROL_OUT_SIZE) {
+        memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+        c->out_len -= c->out_off;
+        c->out_off = 0;
+    }
+    uint8_t *p = c->out + c->out_len;
+    PutU16(p, (uint16_t) body_length);
+    p[2] = op;
+    p[3] = flags;
+    if (body_length > 0) {
+        memcpy(p + CTL_HEADER_SIZE, body, body_length);
+    }
+    c->out_len += CTL_HEADER_SIZE + body_length;
+    return 0;
+}
+
+static void FlushClient(ControlClient *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                CloseClient(c);
+            }
+            return;
+        }
+        c->out_off += (size_t) n;
+    }
+    c->out_off = 0;
+    c->out_len = 0;
+}
+
+static void ReplyStatus(ControlClient *c, uint8_t op, enum CtlStatus status) {
+    QueueFrame(c, op | CTL_REPLY, (uint8_t) status, NULL, 0);
+}
+
+// Messages kept in the outbox count as sent.
+static enum CtlStatus SendStatus(int ret) {
+    if (ret == -2 || ret == -3) {
+        return CTL_ERR_INVALID_PEER;
+    } else if (ret == -4) {
+        return CTL_ERR_BAD_REQUEST;
+    } else if (ret == -8) {
+        return CTL_ERR_QUEUE_FULL;
+    } else if (ret < 0) {
+        return CTL_ERR_SEND_FAILED;
+    }
+    return CTL_OK;
+}
+
+static void HandleSend(ControlClient *c, Node *node, uint8_t flags, const uint8_t *body, size_t body_length) {
+    if (body_length < 3) {
+        ReplyStatus(c, CTL_SEND, CTL_ERR_BAD_REQUEST);
+        return;
+    }
+    size_t id = GetU16(body);
+    enum CtlStatus status = SendStatus(SendMsgToPeer(node, id, (const char *) body + 2, body_length - 2));
+    if (status != CTL_OK || !(flags & CTL_FLAG_NO_REPLY)) {
+        ReplyStatus(c, CTL_SEND, status);
+    }
+}
+
+static void HandleSendTo(ControlClient *c, Node *node, uint8_t flags, const uint8_t *body, size_t body_length) {
+    char identifier[sizeof(node->user_identifier)];
+    if (body_length < 2 || body[0] == 0 || 1 + (size_t) body[0] >= body_length
+        || memchr(body + 1, '\0', body[0]) != NULL) {
+        ReplyStatus(c, CTL_SEND_TO, CTL_ERR_BAD_REQUEST);
+        return;
+    }
+    memcpy(identifier, body + 1, body[0]);
+    identifier[body[0]] = '\0';
+    enum CtlStatus status = SendStatus(SendMsgToIdentifier(
+        node, identifier, (const char *) body + 1 + body[0], body_length - 1 - body[0]));
+    if (status != CTL_OK || !(flags & CTL_FLAG_NO_REPLY)) {
+        ReplyStatus(c, CTL_SEND_TO, status);
+    }
+}
+
+// A large table doesn't fit the output buffer in one go: the listing stops
+// where the buffer is full, and the final reply says where to resume.
+static void HandleListPeers(ControlClient *c, Node *node, const uint8_t *body_in, size_t body_length) {
+    uint8_t body[2 + 1 + 4 + 16 + 1 + 255];
+    size_t first = body_length >= 2 ? GetU16(body_in) : 0;
+    for (size_t i = first; i < node->peers_size; i++) {
+        PeerView view;
+        const PeerView *p = &view;
+        if (!PeerRead(&node->peers[i], &view)) {
+            continue;
+        }
+        size_t ident_length = strnlen(p->user_identifier, 255);
+        size_t room = CONTROL_OUT_SIZE - (c->out_len - c->out_off);
+        if (room < 2 * CTL_HEADER_SIZE + 24 + ident_length + 2) {  // this peer and the final reply
+            PutU16(body, (uint16_t) i);
+            QueueFrame(c, CTL_LIST_PEERS | CTL_REPLY, CTL_ERR_QUEUE_FULL, body, 2);
+            return;
+        }
+        PutU16(body, (uint16_t) i);
+        body[2] = (p->inet4.seen != 0 ? 0x01 : 0) | (p->inet6.seen != 0 ? 0x02 : 0);
+        memcpy(body + 3, &p->inet4.addr4, 4);
+        memcpy(body + 7, &p->inet6.addr6, 16);
+        body[23] = (uint8_t) ident_length;
+        memcpy(body + 24, p->user_identifier, ident_length);
+        QueueFrame(c, CTL_LIST_PEERS | CTL_REPLY, CTL_OK | CTL_FLAG_MORE, body, 24 + ident_length);
+    }
+    ReplyStatus(c, CTL_LIST_PEERS, CTL_OK);
+}
+
+static void HandleStats(ControlServer *srv, ControlClient *c, Node *node) {
+    uint64_t counters[CTL_STAT_COUNT];
+    counters[CTL_STAT_RX_DATAGRAMS] = node->transport->stats.rx_datagrams;
+    counters[CTL_STAT_TX_DATAGRAMS] = node->transport->stats.tx_datagrams + node->send_cache.sends;
+    counters[CTL_STAT_TRANSPORT_SYSCALLS] = node->transport->stats.syscalls + node->send_cache.sends;
+    counters[CTL_STAT_RX_SCAN] = node->stats.rx_by_type[SCAN];
+    counters[CTL_STAT_RX_SCAN_RESPONSE] = node->stats.rx_by_type[SCAN_RESPONSE];
+    counters[CTL_STAT_RX_CLEARTEXT] = node->stats.rx_by_type[CLEARTEXT_MESSAGE];
+    counters[CTL_STAT_RX_DISCONNECT] = node->stats.rx_by_type[DISCONNECT];
+    counters[CTL_STAT_RX_INVALID] = node->stats.rx_invalid;
+    counters[CTL_STAT_MSGS_SENT] = node->stats.msgs_sent;
+    counters[CTL_STAT_SEND_ERRORS] = node->stats.send_errors;
+    counters[CTL_STAT_CTL_FRAMES] = srv->frames;
+    counters[CTL_STAT_CTL_EVENTS_DROPPED] = srv->events_dropped;
+    counters[CTL_STAT_RX_CHANNEL] = node->stats.rx_by_type[CHANNEL_MESSAGE];
+    counters[CTL_STAT_RX_CHANNEL_FILTERED] = node->stats.rx_channel_filtered;
+    counters[CTL_STAT_SEND_CACHE_HITS] = node->send_cache.hits;
+    counters[CTL_STAT_SEND_CACHE_MISSES] = node->send_cache.misses;
+    counters[CTL_STAT_SEND_CACHE_EVICTIONS] = node->send_cache.evictions;
+    counters[CTL_STAT_RX_V1] = node->stats.rx_v1;
+    counters[CTL_STAT_OUTQ_QUEUED] = node->outq.queued;
+    counters[CTL_STAT_OUTQ_DROPPED] = node->outq.dropped;
+    counters[CTL_STAT_OUTQ_PENDING] = node->outq.pending;
+    counters[CTL_STAT_RX_RATE_LIMITED] = RateDroppedTotal(&node->ratelimit);
+    counters[CTL_STAT_RX_RATE_LIMITED_SCAN] = node->ratelimit.dropped[SCAN];
+    counters[CTL_STAT_GOSSIP_SENT] = node->gossip.messages_sent;
+    counters[CTL_STAT_GOSSIP_SUSPECTED] = node->gossip.suspected;
+    counters[CTL_STAT_GOSSIP_DEAD] = node->gossip.declared_dead;
+    counters[CTL_STAT_GOSSIP_REFUTED] = node->gossip.refuted;
+    counters[CTL_STAT_POOL_BUFFERS] = node->pool.buffers;
+    counters[CTL_STAT_POOL_IN_USE] = node->pool.in_use;
+    counters[CTL_STAT_POOL_PEAK] = node->pool.peak;
+    counters[CTL_STAT_POOL_EXHAUSTED] = node->pool.exhausted;
+    counters[CTL_STAT_RX_KERNEL_DROPS] = TransportKernelDrops(node->transport);
+    counters[CTL_STAT_OUTBOX_STORED] = node->outbox.stored;
+    counters[CTL_STAT_OUTBOX_DELIVERED] = node->outbox.delivered;
+    counters[CTL_STAT_OUTBOX_EXPIRED] = node->outbox.expired;
+    counters[CTL_STAT_OUTBOX_REFUSED] = node->outbox.dropped;
+    counters[CTL_STAT_OUTBOX_PENDING] = node->outbox.pending;
+    counters[CTL_STAT_TX_OFFLOADED] = node->transport->stats.tx_offloaded;
+    counters[CTL_STAT_RX_OFFLOADED] = node->transport->stats.rx_offloaded;
+    counters[CTL_STAT_SEALED] = node->secure.sealed;
+    counters[CTL_STAT_OPENED] = node->secure.opened;
+    counters[CTL_STAT_SEAL_REJECTED] = node->secure.rejected;
+    counters[CTL_STAT_SEAL_REPLAYED] = node->secure.replayed;
+    counters[CTL_STAT_CLEARTEXT_REFUSED] = node->secure.refused;
+    counters[CTL_STAT_KEY_EXCHANGES] = node->secure.key_exchanges;
+
+    uint8_t body[2 + 8 * CTL_STAT_COUNT];
+    PutU16(body, CTL_STAT_COUNT);
+    for (unsigned int i = 0; i < CTL_STAT_COUNT; i++) {
+        PutU64(body + 2 + 8 * i, counters[i]);
+    }
+    QueueFrame(c, CTL_STATS | CTL_REPLY, CTL_OK, body, sizeof(body));
+}
+
+// Topics arrive unterminated, copy them out so the channel API gets a C string.
+static int CopyTopic(char *topic, const uint8_t *src, size_t length) {
+    if (length == 0 || length > MAX_TOPIC_LENGTH || memchr(src, '\0', length) != NULL) {
+        return -1;
+    }
+    memcpy(topic, src, length);
+    topic[length] = '\0';
+    return 0;
+}
+
+static void HandleChannelOp(ControlClient *c, Node *node, uint8_t op, uint8_t flags, const uint8_t *body, size_t body_length) {
+    char topic[MAX_TOPIC_LENGTH + 1];
+    int ret;
+
+    if (op == CTL_PUBLISH) {
+        if (body_length < 1 || 1 + (size_t) body[0] > body_length || CopyTopic(topic, body + 1, body[0]) < 0) {
+            ReplyStatus(c, op, CTL_ERR_BAD_REQUEST);
+            return;
+        }
+        ret = PublishChannel(node, topic, (const char *) body + 1 + body[0], body_length - 1 - body[0]);
+        if (ret < 0 || !(flags & CTL_FLAG_NO_REPLY)) {
+            ReplyStatus(c, op, ret == -4 ? CTL_ERR_SEND_FAILED : ret < 0 ? CTL_ERR_BAD_REQUEST : CTL_OK);
+        }
+        return;
+    }
+
+    if (CopyTopic(topic, body, body_length) < 0) {
+        ReplyStatus(c, op, CTL_ERR_BAD_REQUEST);
+        return;
+    }
+    ret = op == CTL_JOIN ? JoinChannel(node, topic) : LeaveChannel(node, topic);
+    ReplyStatus(c, op, ret < 0 ? CTL_ERR_BAD_REQUEST : CTL_OK);
+}
+
+static void HandleTraceDump(ControlClient *c, const uint8_t *body, size_t body_length) {
+    char path[PATH_MAX];
+    if (body_length >= sizeof(path) || memchr(body, '\0', body_length) != NULL) {
+        ReplyStatus(c, CTL_TRACE_DUMP, CTL_ERR_BAD_REQUEST);
+        return;
+    }
+    if (body_length == 0) {
+        TraceDefaultPath(path, sizeof(path));
+    } else {
+        memcpy(path, body, body_length);
+        path[body_length] = '\0';
+    }
+    ReplyStatus(c, CTL_TRACE_DUMP, TraceDump(path) < 0 ? CTL_ERR_IO : CTL_OK);
+}
+
+static void HandleFrame(
+    ControlServer *srv,
+    ControlClient *c,
+    Node *node,
+    uint8_t op,
+    uint8_t flags,
+    const uint8_t *body,
+    size_t body_length
+) {
+    srv->frames++;
+    switch (op) {
+        case CTL_SEND:
+            HandleSend(c, node, flags, body, body_length);
+            break;
+        case CTL_LIST_PEERS:
+            HandleListPeers(c, node, body, body_length);
+            break;
+        case CTL_SCAN:
+            SendScan(node);
+            ReplyStatus(c, op, CTL_OK);
+            break;
+        case CTL_SUBSCRIBE:
+            if (body_length < 1) {
+                ReplyStatus(c, op, CTL_ERR_BAD_REQUEST);
+                break;
+            }
+            c->subscribed = body[0] != 0;
+            ReplyStatus(c, op, CTL_OK);
+            break;
+        case CTL_STATS:
+            HandleStats(srv, c, node);
+            break;
+        case CTL_JOIN:
+        case CTL_LEAVE:
+        case CTL_PUBLISH:
+            HandleChannelOp(c, node, op, flags, body, body_length);
+            break;
+        case CTL_TRACE_DUMP:
+            HandleTraceDump(c, body, body_length);
+            break;
+        case CTL_SEND_TO:
+            HandleSendTo(c, node, flags, body, body_length);
+            break;
+        default:
+            ReplyStatus(c, op, CTL_ERR_UNKNOWN_OP);
+            break;
+    }
+}
+
+static int ReplyRoom(const ControlClient *c) {
+    return OutSpace(c) + c->out_off >= 2 * (CTL_HEADER_SIZE + CTL_MAX_BODY);
+}
+
+// Executes every complete frame in the input buffer in one go. Parsing
+// pauses while the reply buffer is nearly full, which pushes back on the
+// client through the socket buffer instead of dropping replies.
+static void ParseFrames(ControlServer *srv, ControlClient *c, Node *node) {
+    size_t off = 0;
+    while (c->in_len - off >= CTL_HEADER_SIZE) {
+        const uint8_t *frame = c->in + off;
+        size_t body_length = GetU16(frame);
+        if (c->in_len - off < CTL_HEADER_SIZE + body_length) {
+            break;
+        }
+        if (!ReplyRoom(c)) {
+            break;
+        }
+        HandleFrame(srv, c, node, frame[2], frame[3], frame + CTL_HEADER_SIZE, body_length);
+        off += CTL_HEADER_SIZE + body_length;
+    }
+    if (off > 0) {
+        memmove(c->in, c->in + off, c->in_len - off);
+        c->in_len -= off;
+    }
+}
+
+static void ReadClient(ControlServer *srv, ControlClient *c, Node *node) {
+    if (c->in_len < CONTROL_IN_SIZE) {
+        ssize_t n = recv(c->fd, c->in + c->in_len, CONTROL_IN_SIZE - c->in_len, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            CloseClient(c);
+            return;
+        }
+        if (n > 0) {
+            c->in_len += (size_t) n;
+        }
+    }
+    ParseFrames(srv, c, node);
+}
+
+static void AcceptClient(ControlServer *srv) {
+    int fd = accept(srv->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    for (unsigned int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        ControlClient *c = &srv->clients[i];
+        if (c->fd >= 0) {
+            continue;
+        }
+        c->in = malloc(CONTROL_IN_SIZE);
+        c->out = malloc(CONTROL_OUT_SIZE);
+        if (c->in == NULL || c->out == NULL) {
+            free(c->in);
+            free(c->out);
+            c->in = NULL;
+            c->out = NULL;
+            break;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        c->fd = fd;
+        c->subscribed = 0;
+        c->in_len = 0;
+        c->out_off = 0;
+        c->out_len = 0;
+        return;
+    }
+    fprintf(stderr, "[WARN] Control socket: too many clients, connection refused\n");
+    close(fd);
+}
+
+int ControlOpen(ControlServer *srv, const char *path) {
+    struct sockaddr_un addr;
+
+    memset(srv, 0, sizeof(*srv));
+    srv->listen_fd = -1;
+    for (unsigned int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        srv->clients[i].fd = -1;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    if ((srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        return -2;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);  // stale socket from a previous run, the instance lock guards against live ones
+    if (bind(srv->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(srv->listen_fd);
+        srv->listen_fd = -1;
+        return -3;
+    }
+    if (listen(srv->listen_fd, CONTROL_MAX_CLIENTS) < 0) {
+        close(srv->listen_fd);
+        srv->listen_fd = -1;
+        unlink(path);
+        return -4;
+    }
+    strncpy(srv->path, path, sizeof(srv->path) - 1);
+    return 0;
+}
+
+void ControlClose(ControlServer *srv) {
+    for (unsigned int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (srv->clients[i].fd >= 0) {
+            FlushClient(&srv->clients[i]);
+            CloseClient(&srv->clients[i]);
+        }
+    }
+    if (srv->listen_fd >= 0) {
+        close(srv->listen_fd);
+        unlink(srv->path);
+        srv->listen_fd = -1;
+    }
+}
+
+unsigned int ControlPollFds(ControlServer *srv, struct pollfd *fds, unsigned int max_fds) {
+    unsigned int n = 0;
+    if (srv->listen_fd < 0) {
+        return 0;
+    }
+    if (n < max_fds) {
+        fds[n].fd = srv->listen_fd;
+        fds[n].events = POLLIN;
+        n++;
+    }
+    for (unsigned int i = 0; i < CONTROL_MAX_CLIENTS && n < max_fds; i++) {
+        ControlClient *c = &srv->clients[i];
+        if (c->fd < 0) {
+            continue;
+        }
+        fds[n].fd = c->fd;
+        fds[n].events = (c->in_len < CONTROL_IN_SIZE && ReplyRoom(c) ? POLLIN : 0)
+                        | (c->out_len > c->out_off ? POLLOUT : 0);
+        n++;
+    }
+    return n;
+}
+
+void ControlHandle(ControlServer *srv, Node *node, const struct pollfd *fds, unsigned int nfds) {
+    for (unsigned int i = 0; i < nfds; i++) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        if (fds[i].fd == srv->listen_fd) {
+            AcceptClient(srv);
+            continue;
+        }
+        for (unsigned int j = 0; j < CONTROL_MAX_CLIENTS; j++) {
+            ControlClient *c = &srv->clients[j];
+            if (c->fd != fds[i].fd) {
+                continue;
+            }
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ReadClient(srv, c, node);
+            }
+            if (c->fd >= 0) {
+                FlushClient(c);
+            }
+            if (c->fd >= 0 && c->in_len > 0) {
+                ParseFrames(srv, c, node);  // frames held back while replies were pending
+                FlushClient(c);
+            }
+            break;
+        }
+    }
+}
+
+void ControlMessageHook(
+    Node *node,
+    long int peer_id,
+    const struct sockaddr_storage *src_addr,
+    const char *channel,
+    const char *msg,
+    size_t msg_length,
+    void *arg
+) {
+    ControlServer *srv = arg;
+    const char *ident = peer_id >= 0 ? node->peers[peer_id].user_identifier : "";
+    size_t ident_length = strnlen(ident, 255);
+    size_t topic_length = channel != NULL ? strlen(channel) : 0;
+
+    if (srv->echo) {
+        PrintReceivedMessage(node, peer_id, src_addr, channel, msg);
+    }
+
+    uint8_t body[CTL_MAX_BODY];
+    size_t header_length = 3 + ident_length + (channel != NULL ? 1 + topic_length : 0);
+    if (header_length + msg_length > sizeof(body)) {
+        msg_length = sizeof(body) - header_length;
+    }
+    PutU16(body, peer_id >= 0 ? (uint16_t) peer_id : 0xFFFF);
+    body[2] = (uint8_t) ident_length;
+    memcpy(body + 3, ident, ident_length);
+    if (channel != NULL) {
+        body[3 + ident_length] = (uint8_t) topic_length;
+        memcpy(body + 4 + ident_length, channel, topic_length);
+    }
+    memcpy(body + header_length, msg, msg_length);
+    uint8_t op = channel != NULL ? CTL_EVENT_CHANNEL_MESSAGE : CTL_EVENT_MESSAGE;
+
+    for (unsigned int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        ControlClient *c = &srv->clients[i];
+        if (c->fd < 0 || !c->subscribed) {
+            continue;
+        }
+        if (QueueFrame(c, op, 0, body, header_length + msg_length) < 0) {
+            srv->events_dropped++;
+        }
+    }
+}
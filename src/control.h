@@ -0,0 +1,170 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_CONTROL_H_
+#define SRC_CONTROL_H_
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/un.h>
+
+#include "node.h"
+
+// Control socket protocol (Unix stream socket, integers are big-endian).
+//
+// Every frame, in both directions, is
+//     u16 body_length | u8 op | u8 flags | body[body_length]
+//
+// Requests:
+//     CTL_SEND        body = u16 peer_id | message bytes
+//     CTL_LIST_PEERS  body empty, or u16 first peer_id to resume from
+//     CTL_SCAN        body empty
+//     CTL_SUBSCRIBE   body = u8 enable
+//     CTL_STATS       body empty
+//     CTL_JOIN        body = topic
+//     CTL_LEAVE       body = topic
+//     CTL_PUBLISH     body = u8 topic_length | topic | message bytes
+//     CTL_TRACE_DUMP  body = path, empty for the default one
+//     CTL_SEND_TO     body = u8 identifier_length | identifier | message bytes
+//
+// Replies carry the request op with CTL_REPLY set and the status (CtlStatus)
+// in the flags byte. Requests may be pipelined freely, the daemon answers
+// them in order. A CTL_SEND with CTL_FLAG_NO_REPLY only gets a reply if it
+// fails, so bulk senders never have to read anything back. A message the
+// outbox took for an unreachable peer is answered CTL_OK.
+//
+// CTL_LIST_PEERS answers with one reply per peer, flagged CTL_FLAG_MORE, and
+// a final reply without it: empty with CTL_OK once every peer was listed,
+// CTL_ERR_QUEUE_FULL with body u16 peer_id when the daemon's output buffer
+// filled up first, to ask again from that peer_id. Peer body:
+//     u16 peer_id | u8 families (bit 0 = IPv4, bit 1 = IPv6)
+//     | u8 addr4[4] | u8 addr6[16] | u8 identifier_length | identifier
+//
+// CTL_STATS answers with u16 count | u64 counters[count], indexed by CtlStat.
+// New counters are only ever appended.
+//
+// Subscribed clients receive CTL_EVENT_MESSAGE frames:
+//     u16 peer_id (0xFFFF = unknown sender) | u8 identifier_length
+//     | identifier | message bytes
+// and, for channels they joined, CTL_EVENT_CHANNEL_MESSAGE frames:
+//     u16 peer_id | u8 identifier_length | identifier
+//     | u8 topic_length | topic | message bytes
+
+#define CTL_HEADER_SIZE 4
+#define CTL_MAX_BODY 65535
+#define CONTROL_MAX_CLIENTS 16
+#define CONTROL_IN_SIZE (2 * (CTL_HEADER_SIZE + CTL_MAX_BODY))
+#define CONTROL_OUT_SIZE (256 * 1024)
+
+enum CtlOp {
+    CTL_SEND = 1,
+    CTL_LIST_PEERS = 2,
+    CTL_SCAN = 3,
+    CTL_SUBSCRIBE = 4,
+    CTL_STATS = 5,
+    CTL_JOIN = 6,
+    CTL_LEAVE = 7,
+    CTL_PUBLISH = 8,
+    CTL_TRACE_DUMP = 9,
+    CTL_SEND_TO = 10,
+    CTL_REPLY = 0x40,
+    CTL_EVENT_MESSAGE = 0x80,
+    CTL_EVENT_CHANNEL_MESSAGE = 0x81,
+};
+
+enum CtlFlag {
+    CTL_FLAG_NO_REPLY = 0x01,  // requests
+    CTL_FLAG_MORE = 0x80,  // replies, more frames follow for the same request
+};
+
+enum CtlStatus {
+    CTL_OK = 0,
+    CTL_ERR_UNKNOWN_OP = 1,
+    CTL_ERR_BAD_REQUEST = 2,
+    CTL_ERR_INVALID_PEER = 3,
+    CTL_ERR_SEND_FAILED = 4,
+    CTL_ERR_QUEUE_FULL = 5,  // back off and retry: the peer's send queue, or the reply buffer, is full
+    CTL_ERR_IO = 6,  // the daemon could not write the file
+};
+
+enum CtlStat {
+    CTL_STAT_RX_DATAGRAMS,
+    CTL_STAT_TX_DATAGRAMS,
+    CTL_STAT_TRANSPORT_SYSCALLS,
+    CTL_STAT_RX_SCAN,
+    CTL_STAT_RX_SCAN_RESPONSE,
+    CTL_STAT_RX_CLEARTEXT,
+    CTL_STAT_RX_DISCONNECT,
+    CTL_STAT_RX_INVALID,
+    CTL_STAT_MSGS_SENT,
+    CTL_STAT_SEND_ERRORS,
+    CTL_STAT_CTL_FRAMES,
+    CTL_STAT_CTL_EVENTS_DROPPED,
+    CTL_STAT_RX_CHANNEL,
+    CTL_STAT_RX_CHANNEL_FILTERED,
+    CTL_STAT_SEND_CACHE_HITS,
+    CTL_STAT_SEND_CACHE_MISSES,
+    CTL_STAT_SEND_CACHE_EVICTIONS,
+    CTL_STAT_RX_V1,
+    CTL_STAT_OUTQ_QUEUED,
+    CTL_STAT_OUTQ_DROPPED,
+    CTL_STAT_OUTQ_PENDING,
+    CTL_STAT_RX_RATE_LIMITED,
+    CTL_STAT_RX_RATE_LIMITED_SCAN,
+    CTL_STAT_GOSSIP_SENT,
+    CTL_STAT_GOSSIP_SUSPECTED,
+    CTL_STAT_GOSSIP_DEAD,
+    CTL_STAT_GOSSIP_REFUTED,
+    CTL_STAT_POOL_BUFFERS,
+    CTL_STAT_POOL_IN_USE,
+    CTL_STAT_POOL_PEAK,
+    CTL_STAT_POOL_EXHAUSTED,
+    CTL_STAT_RX_KERNEL_DROPS,
+    CTL_STAT_OUTBOX_STORED,
+    CTL_STAT_OUTBOX_DELIVERED,
+    CTL_STAT_OUTBOX_EXPIRED,
+    CTL_STAT_OUTBOX_REFUSED,
+    CTL_STAT_OUTBOX_PENDING,
+    CTL_STAT_TX_OFFLOADED,
+    CTL_STAT_RX_OFFLOADED,
+    CTL_STAT_SEALED,
+    CTL_STAT_OPENED,
+    CTL_STAT_SEAL_REJECTED,
+    CTL_STAT_SEAL_REPLAYED,
+    CTL_STAT_CLEARTEXT_REFUSED,
+    CTL_STAT_KEY_EXCHANGES,
+    CTL_STAT_COUNT,
+};
+
+typedef struct {
+    int fd;  // -1 = free slot
+    int subscribed;
+    size_t in_len;
+    size_t out_off;
+    size_t out_len;
+    uint8_t *in;
+    uint8_t *out;
+} ControlClient;
+
+typedef struct {
+    int listen_fd;
+    int echo;  // also print received messages to stdout
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    ControlClient clients[CONTROL_MAX_CLIENTS];
+    unsigned long frames;
+    unsigned long events_dropped;
+} ControlServer;
+
+int ControlOpen(ControlServer *srv, const char *path);
+void ControlClose(ControlServer *srv);
+unsigned int ControlPollFds(ControlServer *srv, struct pollfd *fds, unsigned int max_fds);
+void ControlHandle(ControlServer *srv, Node *node, const struct pollfd *fds, unsigned int nfds);
+void ControlMessageHook(
+    Node *node,
+    long int peer_id,
+    const struct sockaddr_storage *src_addr,
+    const char *channel,
+    const char *msg,
+    size_t msg_length,
+    void *arg);
+
+#endif  // SRC_CONTROL_H_
@@ -0,0 +1,707 @@
+// Copyright 2025 Michał Jankowski
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gossip.h"
+#include "net_func.h"
+#include "node.h"
+#include "outq.h"
+#include "path.h"
+#include "peer.h"
+#include "session.h"
+#include "sock_prep.h"
+
+static inline void PutU32(uint8_t *p, uint32_t v) {
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static inline uint32_t GetU32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+const char *SwimStatusName(int status) {
+    static const char *NAMES[] = {"none", "alive", "suspect", "dead"};
+    return status >= SWIM_NONE && status <= SWIM_DEAD ? NAMES[status] : "?";
+}
+
+void GossipInit(GossipState *gossip, int enabled) {
+    memset(gossip, 0, sizeof(*gossip));
+    gossip->enabled = enabled;
+    gossip->probe_slot = -1;
+    gossip->stride = 1;
+    gossip->periods_to_sync = GOSSIP_SYNC_PERIODS;
+}
+
+static int IsMember(const Peer *p) {
+    return p->session_token != 0 && (p->swim.status == SWIM_ALIVE || p->swim.status == SWIM_SUSPECT);
+}
+
+static size_t MemberCount(const Node *node) {
+    size_t count = 0;
+    for (size_t i = 0; i < node->peers_size; i++) {
+        count += IsMember(&node->peers[i]);
+    }
+    return count;
+}
+
+static unsigned int Log2Ceil(size_t n) {
+    unsigned int log = 0;
+    while (((size_t) 1 << log) < n) {
+        log++;
+    }
+    return log > 0 ? log : 1;
+}
+
+// lambda * log N transmissions per update, N counts ourselves
+static uint8_t RetransmitBudget(const Node *node) {
+    unsigned int budget = GOSSIP_RETRANSMIT_MULT * Log2Ceil(MemberCount(node) + 1);
+    return (uint8_t) (budget < UINT8_MAX ? budget : UINT8_MAX);
+}
+
+// New member, by scan or gossip: spread the news.
+void GossipMemberSeen(Node *node, size_t slot) {
+    Peer *p = &node->peers[slot];
+    if (p->session_token == 0) {
+        return;  // v1 peers can't take part
+    }
+    if (p->swim.status != SWIM_ALIVE) {
+        uint8_t budget = RetransmitBudget(node);
+        PeerWriteBegin(p);
+        p->swim.status = SWIM_ALIVE;
+        p->swim.transmit_left = budget;
+        PeerWriteEnd(p);
+    }
+}
+
+static void AddDeadNotice(Node *node, uint32_t token, uint32_t incarnation) {
+    GossipState *g = &node->gossip;
+    DeadNotice *slot = &g->dead[0];
+    for (unsigned int i = 0; i < GOSSIP_DEAD_NOTICES; i++) {
+        DeadNotice *d = &g->dead[i];
+        if (d->token == token || d->token == 0) {
+            slot = d;
+            break;
+        } else if (d->transmit_left < slot->transmit_left) {
+            slot = d;  // the most spread notice makes room
+        }
+    }
+    slot->token = token;
+    slot->incarnation = incarnation;
+    slot->transmit_left = RetransmitBudget(node);
+}
+
+// Member departed (DISCONNECT) or declared dead, the caller drops the peer.
+void GossipMemberLeft(Node *node, size_t slot) {
+    Peer *p = &node->peers[slot];
+    if (p->session_token != 0 && p->swim.status != SWIM_NONE) {
+        AddDeadNotice(node, p->session_token, p->swim.incarnation);
+    }
+}
+
+static const DeadNotice *FindDeadNotice(const GossipState *g, uint32_t token) {
+    for (unsigned int i = 0; i < GOSSIP_DEAD_NOTICES; i++) {
+        if (g->dead[i].token == token) {
+            return &g->dead[i];
+        }
+    }
+    return NULL;
+}
+
+static size_t EncodeRecord(uint8_t *buf, size_t buf_size, uint8_t status, uint32_t incarnation,
+                           uint32_t token, const Peer *p) {
+    size_t id_length = p != NULL ? strnlen(p->user_identifier, 255) : 0;
+    size_t needed = 1 + 4 + 4 + 1 + 1 + id_length;
+    uint8_t families = 0;
+    if (p != NULL && p->inet4.seen != 0) {
+        families |= 1;
+        needed += 4;
+    }
+    if (p != NULL && p->inet6.seen != 0) {
+        families |= 2;
+        needed += 16;
+    }
+    if (needed > buf_size) {
+        return 0;
+    }
+    size_t off = 0;
+    buf[off++] = status;
+    PutU32(buf + off, incarnation);
+    off += 4;
+    PutU32(buf + off, token);
+    off += 4;
+    buf[off++] = families;
+    if (families & 1) {
+        memcpy(buf + off, &p->inet4.addr4, 4);
+        off += 4;
+    }
+    if (families & 2) {
+        memcpy(buf + off, &p->inet6.addr6, 16);
+        off += 16;
+    }
+    buf[off++] = (uint8_t) id_length;
+    if (id_length > 0) {
+        memcpy(buf + off, p->user_identifier, id_length);
+        off += id_length;
+    }
+    return off;
+}
+
+// Appends the freshest pending updates, returns the new payload length.
+static size_t Piggyback(Node *node, uint8_t *buf, size_t off, size_t buf_size) {
+    GossipState *g = &node->gossip;
+    size_t count_at = off++;
+    uint8_t count = 0;
+    if (!g->enabled) {
+        buf[count_at] = 0;
+        return off;
+    }
+
+    while (count < GOSSIP_MAX_UPDATES) {
+        // pick the update with the most transmissions left: -2 = self,
+        // -1 - i = dead notice i, i >= 0 = peer slot
+        long int best = 0;
+        int found = 0;
+        uint8_t best_left = 0;
+        if (g->self_transmit_left > best_left) {
+            best = -2;
+            best_left = g->self_transmit_left;
+            found = 1;
+        }
+        for (unsigned int i = 0; i < GOSSIP_DEAD_NOTICES; i++) {
+            if (g->dead[i].token != 0 && g->dead[i].transmit_left > best_left) {
+                best = -3 - (long int) i;
+                best_left = g->dead[i].transmit_left;
+                found = 1;
+            }
+        }
+        for (size_t i = 0; i < node->peers_size; i++) {
+            const Peer *p = &node->peers[i];
+            if (IsMember(p) && p->swim.transmit_left > best_left) {
+                best = (long int) i;
+                best_left = p->swim.transmit_left;
+                found = 1;
+            }
+        }
+        if (!found) {
+            break;
+        }
+
+        size_t written;
+        if (best == -2) {
+            written = EncodeRecord(buf + off, buf_size - off, SWIM_ALIVE, g->incarnation, node->session_token, NULL);
+            if (written != 0) {
+                g->self_transmit_left--;
+            }
+        } else if (best < -2) {
+            DeadNotice *d = &g->dead[-3 - best];
+            written = EncodeRecord(buf + off, buf_size - off, SWIM_DEAD, d->incarnation, d->token, NULL);
+            if (written != 0 && --d->transmit_left == 0) {
+                d->token = 0;
+            }
+        } else {
+            Peer *p = &node->peers[best];
+            written = EncodeRecord(buf + off, buf_size - off, p->swim.status, p->swim.incarnation,
+                                   p->session_token, p);
+            if (written != 0) {
+                p->swim.transmit_left--;
+            }
+        }
+        if (written == 0) {
+            break;  // full
+        }
+        off += written;
+        count++;
+    }
+    buf[count_at] = count;
+    return off;
+}
+
+static int SendGossip(Node *node, long int peer_id, const struct sockaddr *dest, socklen_t dest_size,
+                      uint8_t kind, uint32_t seq, uint32_t target_token) {
+    char frame[WIRE_HEADER_MAX + GOSSIP_MAX_PAYLOAD];
+    uint8_t *buf = (uint8_t *) frame;
+    size_t off = 0;
+    buf[off++] = kind;
+    PutU32(buf + off, seq);
+    off += 4;
+    if (kind == GOSSIP_PING_REQ) {
+        PutU32(buf + off, target_token);
+        off += 4;
+    }
+    off = Piggyback(node, buf, off, GOSSIP_MAX_PAYLOAD);
+
+    long int frame_length = EncapsulateFrame(node, WIRE_V2, GOSSIP, frame, off, sizeof(frame));
+    if (frame_length < 0) {
+        return -1;
+    }
+    node->gossip.messages_sent++;
+    ssize_t result = OutSend(node, peer_id, OUT_CONTROL, frame, (size_t) frame_length, dest, dest_size);
+    return result < 0 ? -2 : 0;
+}
+
+static int SendGossipToPeer(Node *node, size_t slot, uint8_t kind, uint32_t seq, uint32_t target_token) {
+    Peer *p = &node->peers[slot];
+    int family = PathSelectFamily(p);
+    if (family == AF_UNSPEC) {
+        return -1;
+    }
+    struct sockaddr_storage dest;
+    socklen_t dest_size = PeerAddress(node, p, family, &dest);
+    return SendGossip(node, (long int) slot, (struct sockaddr *) &dest, dest_size, kind, seq, target_token);
+}
+
+// Our whole view, in as many datagrams as it takes.
+void GossipSync(Node *node, size_t slot) {
+    if (!node->gossip.enabled || node->peers[slot].session_token == 0) {
+        return;
+    }
+    int family = PathSelectFamily(&node->peers[slot]);
+    if (family == AF_UNSPEC) {
+        return;
+    }
+    struct sockaddr_storage dest;
+    socklen_t dest_size = PeerAddress(node, &node->peers[slot], family, &dest);
+
+    char frame[WIRE_HEADER_MAX + GOSSIP_MAX_PAYLOAD];
+    uint8_t *buf = (uint8_t *) frame;
+    size_t i = 0;
+    int self_sent = 0;
+    while (!self_sent || i < node->peers_size) {
+        buf[0] = GOSSIP_SYNC;
+        PutU32(buf + 1, 0);
+        size_t off = 6;
+        uint8_t count = 0;
+        if (!self_sent) {
+            off += EncodeRecord(buf + off, GOSSIP_MAX_PAYLOAD - off, SWIM_ALIVE, node->gossip.incarnation,
+                                node->session_token, NULL);
+            count++;
+            self_sent = 1;
+        }
+        for (; i < node->peers_size && count < UINT8_MAX; i++) {
+            const Peer *p = &node->peers[i];
+            if (i == slot || !IsMember(p)) {
+                continue;
+            }
+            size_t written = EncodeRecord(buf + off, GOSSIP_MAX_PAYLOAD - off, p->swim.status, p->swim.incarnation,
+                                          p->session_token, p);
+            if (written == 0) {
+                break;  // the rest goes into the next datagram
+            }
+            off += written;
+            count++;
+        }
+        buf[5] = count;
+        long int frame_length = EncapsulateFrame(node, WIRE_V2, GOSSIP, frame, off, sizeof(frame));
+        if (frame_length < 0
+            || OutSend(node, (long int) slot, OUT_CONTROL, frame, (size_t) frame_length,
+                       (struct sockaddr *) &dest, dest_size) < 0) {
+            return;
+        }
+        node->gossip.messages_sent++;
+    }
+}
+
+static uint32_t NextSeq(GossipState *g) {
+    if (++g->next_seq == 0) {
+        g->next_seq = 1;
+    }
+    return g->next_seq;
+}
+
+static size_t Gcd(size_t a, size_t b) {
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Next member in a random round-robin order, -1 if there is none.
+static long int NextProbeTarget(Node *node) {
+    GossipState *g = &node->gossip;
+    size_t n = node->peers_size;
+    for (size_t tries = 0; tries < n; tries++) {
+        g->cursor = (g->cursor + g->stride) % n;
+        if (g->cursor < g->stride) {  // wrapped, new order for the next round
+            size_t stride = 1 + (size_t) random() % n;
+            while (Gcd(stride, n) != 1) {
+                stride = stride % n + 1;
+            }
+            g->stride = stride;
+        }
+        if (IsMember(&node->peers[g->cursor])) {
+            return (long int) g->cursor;
+        }
+    }
+    return -1;
+}
+
+static void SendIndirectProbes(Node *node) {
+    GossipState *g = &node->gossip;
+    size_t members = MemberCount(node);
+    if (members < 2) {
+        return;
+    }
+    unsigned int sent = 0;
+    size_t start = (size_t) random() % node->peers_size;
+    for (size_t n = 0; n < node->peers_size && sent < GOSSIP_INDIRECT_PROBES; n++) {
+        size_t i = (start + n) % node->peers_size;
+        if ((long int) i == g->probe_slot || !IsMember(&node->peers[i])
+            || node->peers[i].swim.status != SWIM_ALIVE) {
+            continue;
+        }
+        if (SendGossipToPeer(node, i, GOSSIP_PING_REQ, g->probe_seq, g->probe_token) == 0) {
+            sent++;
+        }
+    }
+}
+
+static void Suspect(Node *node, size_t slot, uint64_t now) {
+    Peer *p = &node->peers[slot];
+    if (p->swim.status != SWIM_ALIVE) {
+        return;
+    }
+    uint64_t deadline_us = now + (uint64_t) GOSSIP_SUSPECT_MULT * Log2Ceil(MemberCount(node) + 1)
+                                     * GOSSIP_PERIOD_US;
+    uint8_t budget = RetransmitBudget(node);
+    PeerWriteBegin(p);
+    p->swim.status = SWIM_SUSPECT;
+    p->swim.suspect_deadline_us = deadline_us;
+    p->swim.transmit_left = budget;
+    PeerWriteEnd(p);
+    node->gossip.suspected++;
+}
+
+static void DeclareDead(Node *node, size_t slot) {
+    node->gossip.declared_dead++;
+    GossipMemberLeft(node, slot);
+    DropPeer(node, slot, COMM_PEER_FAILED);
+}
+
+void GossipTick(Node *node) {
+    GossipState *g = &node->gossip;
+    if (!g->enabled) {
+        return;
+    }
+    uint64_t now = MonotonicUs();
+
+    if (g->probe_slot >= 0) {
+        Peer *p = &node->peers[g->probe_slot];
+        if (p->session_token != g->probe_token) {
+            g->probe_slot = -1;  // left while we were probing it
+        } else if (!g->probe_indirect && now - g->probe_sent_us >= GOSSIP_ACK_TIMEOUT_US) {
+            g->probe_indirect = 1;
+            SendIndirectProbes(node);
+        }
+    }
+
+    for (unsigned int i = 0; i < GOSSIP_RELAYS; i++) {
+        if (g->relays[i].seq != 0 && now >= g->relays[i].expires_us) {
+            g->relays[i].seq = 0;
+        }
+    }
+    for (size_t i = 0; i < node->peers_size; i++) {
+        Peer *p = &node->peers[i];
+        if (p->session_token != 0 && p->swim.status == SWIM_SUSPECT && now >= p->swim.suspect_deadline_us) {
+            DeclareDead(node, i);
+        }
+    }
+
+    if (now < g->next_period_us) {
+        return;
+    }
+    g->next_period_us = now + GOSSIP_PERIOD_US;
+    if (g->probe_slot >= 0) {  // the whole period went by without an ACK
+        Suspect(node, (size_t) g->probe_slot, now);
+        g->probe_slot = -1;
+    }
+
+    long int target = NextProbeTarget(node);
+    if (target < 0) {
+        return;
+    }
+    if (g->periods_to_sync == 0) {
+        g->periods_to_sync = GOSSIP_SYNC_PERIODS;
+        GossipSync(node, (size_t) target);
+    }
+    g->periods_to_sync--;
+    g->probe_slot = target;
+    g->probe_token = node->peers[target].session_token;
+    g->probe_seq = NextSeq(g);
+    g->probe_sent_us = now;
+    g->probe_indirect = 0;
+    SendGossipToPeer(node, (size_t) target, GOSSIP_PING, g->probe_seq, 0);
+}
+
+// Sends a unicast SCAN to a node outside multicast reach, gossip takes over
+// once it answers.
+int GossipSeed(Node *node, const char *address) {
+    struct sockaddr_storage dest;
+    socklen_t dest_size;
+    memset(&dest, 0, sizeof(dest));
+    struct sockaddr_in *dest4 = (struct sockaddr_in *) &dest;
+    struct sockaddr_in6 *dest6 = (struct sockaddr_in6 *) &dest;
+    if (inet_pton(AF_INET, address, &dest4->sin_addr) == 1) {
+        dest4->sin_family = AF_INET;
+        dest4->sin_port = htons(PORT);
+        dest_size = sizeof(*dest4);
+    } else if (inet_pton(AF_INET6, address, &dest6->sin6_addr) == 1) {
+        dest6->sin6_family = AF_INET6;
+        dest6->sin6_port = htons(PORT);
+        dest6->sin6_scope_id = node->ifindex;
+        dest_size = sizeof(*dest6);
+    } else {
+        return -1;
+    }
+    return SendScanTo(node, (struct sockaddr *) &dest, dest_size);
+}
+
+// Adds a member we only know from gossip, returns its slot or -1 when it
+// doesn't fit the view.
+static long int AddMember(Node *node, const char *identifier, uint32_t token,
+                          const struct in_addr *addr4, const struct in6_addr *addr6) {
+    if (identifier[0] == '\0') {
+        return -1;
+    }
+    long int location = UpdatePeer(node, addr4, addr6, identifier, COMM_PEER_GOSSIP, NULL);
+    if (location < 0) {
+        return -1;
+    }
+    Peer *p = &node->peers[location];
+    PeerWriteBegin(p);
+    p->wire_version = WIRE_V2;
+    int new_run = p->session_token != token;
+    if (new_run) {
+        p->session_token = token;
+        memset(&p->keys, 0, sizeof(p->keys));  // a new run has a new key pair
+    }
+    PeerWriteEnd(p);
+    if (new_run) {
+        SessionRegister(&node->sessions, node->peers, node->peers_size, token, (size_t) location);
+    }
+    return location;
+}
+
+static void Refute(Node *node, uint32_t incarnation) {
+    GossipState *g = &node->gossip;
+    if (incarnation >= g->incarnation) {
+        g->incarnation = incarnation + 1;
+        g->refuted++;
+    }
+    g->self_transmit_left = RetransmitBudget(node);
+}
+
+static void ApplyUpdate(Node *node, uint8_t status, uint32_t incarnation, uint32_t token, const char *identifier,
+                        const struct in_addr *addr4, const struct in6_addr *addr6, uint64_t now) {
+    if (token == 0 || status < SWIM_ALIVE || status > SWIM_DEAD) {
+        return;
+    }
+    if (token == node->session_token) {
+        if (status != SWIM_ALIVE) {
+            Refute(node, incarnation);
+        }
+        return;
+    }
+
+    long int slot = FindBySession(&node->sessions, node->peers, node->peers_size, token);
+    if (slot < 0) {
+        const DeadNotice *d = FindDeadNotice(&node->gossip, token);
+        if (status != SWIM_ALIVE || (d != NULL && incarnation <= d->incarnation)) {
+            return;  // nothing to learn about someone we don't track
+        }
+        if ((slot = AddMember(node, identifier, token, addr4, addr6)) < 0) {
+            return;
+        }
+        Peer *p = &node->peers[slot];
+        PeerWriteBegin(p);
+        p->swim.incarnation = incarnation;
+        PeerWriteEnd(p);
+        GossipMemberSeen(node, (size_t) slot);
+        return;
+    }
+
+    Peer *p = &node->peers[slot];
+    if (p->swim.status == SWIM_NONE) {
+        GossipMemberSeen(node, (size_t) slot);
+    }
+    switch (status) {
+        case SWIM_ALIVE:
+            if (incarnation > p->swim.incarnation) {
+                uint8_t budget = RetransmitBudget(node);
+                PeerWriteBegin(p);
+                p->swim.incarnation = incarnation;
+                p->swim.status = SWIM_ALIVE;
+                p->swim.transmit_left = budget;
+                PeerWriteEnd(p);
+            }
+            break;
+        case SWIM_SUSPECT:
+            if (incarnation > p->swim.incarnation
+                || (incarnation == p->swim.incarnation && p->swim.status == SWIM_ALIVE)) {
+                PeerWriteBegin(p);
+                p->swim.incarnation = incarnation;
+                p->swim.status = SWIM_ALIVE;  // so Suspect() takes it
+                PeerWriteEnd(p);
+                Suspect(node, (size_t) slot, now);
+            }
+            break;
+        case SWIM_DEAD:
+            if (incarnation >= p->swim.incarnation) {
+                PeerWriteBegin(p);
+                p->swim.incarnation = incarnation;
+                PeerWriteEnd(p);
+                DeclareDead(node, (size_t) slot);
+            }
+            break;
+    }
+}
+
+// Returns the offset after the updates, 0 on a malformed list.
+static size_t ProcessUpdates(Node *node, const uint8_t *buf, size_t len, size_t off,
+                             const struct sockaddr_storage *src_addr, uint32_t sender_token) {
+    if (off >= len) {
+        return 0;
+    }
+    uint8_t count = buf[off++];
+    uint64_t now = MonotonicUs();
+    for (uint8_t i = 0; i < count; i++) {
+        if (off + 10 > len) {
+            return 0;
+        }
+        uint8_t status = buf[off];
+        uint32_t incarnation = GetU32(buf + off + 1);
+        uint32_t token = GetU32(buf + off + 5);
+        uint8_t families = buf[off + 9];
+        off += 10;
+
+        struct in_addr addr4;
+        struct in6_addr addr6;
+        const struct in_addr *a4 = NULL;
+        const struct in6_addr *a6 = NULL;
+        if (families & 1) {
+            if (off + 4 > len) {
+                return 0;
+            }
+            memcpy(&addr4, buf + off, 4);
+            a4 = &addr4;
+            off += 4;
+        }
+        if (families & 2) {
+            if (off + 16 > len) {
+                return 0;
+            }
+            memcpy(&addr6, buf + off, 16);
+            a6 = &addr6;
+            off += 16;
+        }
+        if (off + 1 > len || off + 1 + buf[off] > len) {
+            return 0;
+        }
+        char identifier[256];
+        size_t id_length = buf[off++];
+        memcpy(identifier, buf + off, id_length);
+        identifier[id_length] = '\0';
+        off += id_length;
+
+        if (families == 0 && token == sender_token) {  // the sender's own record
+            if (src_addr->ss_family == AF_INET) {
+                addr4 = ((const struct sockaddr_in *) src_addr)->sin_addr;
+                a4 = &addr4;
+            } else if (src_addr->ss_family == AF_INET6) {
+                addr6 = ((const struct sockaddr_in6 *) src_addr)->sin6_addr;
+                a6 = &addr6;
+            }
+        }
+        ApplyUpdate(node, status, incarnation, token, identifier, a4, a6, now);
+    }
+    return off;
+}
+
+void ProcessMessageGossip(
+    Node *node,
+    long int peer_id,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr,
+    socklen_t src_addr_size,
+    const FrameInfo *frame
+) {
+    const uint8_t *buf = (const uint8_t *) msg;
+    GossipState *g = &node->gossip;
+    if (msg_length < 5 || frame->version != WIRE_V2 || frame->token == 0) {
+        node->stats.rx_invalid++;
+        return;
+    }
+    uint8_t kind = buf[0];
+    uint32_t seq = GetU32(buf + 1);
+    size_t off = 5;
+    uint32_t target_token = 0;
+    if (kind == GOSSIP_PING_REQ) {
+        if (msg_length < 9) {
+            node->stats.rx_invalid++;
+            return;
+        }
+        target_token = GetU32(buf + off);
+        off += 4;
+    }
+    if (ProcessUpdates(node, buf, msg_length, off, src_addr, frame->token) == 0) {
+        node->stats.rx_invalid++;
+        return;
+    }
+    if (peer_id < 0) {  // the updates may have introduced the sender
+        peer_id = FindBySession(&node->sessions, node->peers, node->peers_size, frame->token);
+    }
+
+    switch (kind) {
+        case GOSSIP_PING:
+            SendGossip(node, peer_id, (struct sockaddr *) src_addr, src_addr_size, GOSSIP_ACK, seq, 0);
+            break;
+        case GOSSIP_ACK:
+            if (g->probe_slot >= 0 && seq == g->probe_seq) {
+                g->probe_slot = -1;  // direct or relayed, the member is alive
+                return;
+            }
+            for (unsigned int i = 0; i < GOSSIP_RELAYS; i++) {
+                GossipRelay *r = &g->relays[i];
+                if (r->seq != 0 && r->seq == seq) {
+                    SendGossip(node, -1, (struct sockaddr *) &r->origin, r->origin_size,
+                               GOSSIP_ACK, r->origin_seq, 0);
+                    r->seq = 0;
+                    return;
+                }
+            }
+            break;
+        case GOSSIP_SYNC:
+            break;
+        case GOSSIP_PING_REQ: {
+            long int target = FindBySession(&node->sessions, node->peers, node->peers_size, target_token);
+            if (target < 0) {
+                return;
+            }
+            GossipRelay *r = &g->relays[0];
+            for (unsigned int i = 0; i < GOSSIP_RELAYS; i++) {
+                if (g->relays[i].seq == 0 || g->relays[i].expires_us < r->expires_us) {
+                    r = &g->relays[i];
+                    if (r->seq == 0) {
+                        break;
+                    }
+                }
+            }
+            r->seq = NextSeq(g);
+            r->origin_seq = seq;
+            memcpy(&r->origin, src_addr, src_addr_size);
+            r->origin_size = src_addr_size;
+            r->expires_us = MonotonicUs() + GOSSIP_PERIOD_US;
+            SendGossipToPeer(node, (size_t) target, GOSSIP_PING, r->seq, 0);
+            break;
+        }
+        default:
+            node->stats.rx_invalid++;
+            break;
+    }
+}
@@ -0,0 +1,113 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_GOSSIP_H_
+#define SRC_GOSSIP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// SWIM-style membership on top of the peer table, for v2 peers (members are
+// named by their session token).
+//
+// Every GOSSIP_PERIOD_US a node probes one member, walking the table in a
+// random order, with a direct PING. Without an ACK after
+// GOSSIP_ACK_TIMEOUT_US it asks GOSSIP_INDIRECT_PROBES other members to
+// probe on its behalf (PING_REQ). A member nobody could reach by the end of
+// the period becomes suspect, and dead GOSSIP_SUSPECT_MULT * log2(N)
+// periods later unless it refutes by raising its incarnation.
+//
+// Membership changes travel piggybacked on these messages, each one
+// GOSSIP_RETRANSMIT_MULT * log2(N) times, so news reaches everyone in
+// O(log N) periods while every node sends a constant number of messages per
+// period. The peer table is the (partial) view: members that don't fit are
+// still relayed onward, just not remembered.
+//
+// Piggybacking only carries news, so a node met by scanning gets our whole
+// view at once (SYNC), and every GOSSIP_SYNC_PERIODS one random member gets
+// it too, which heals whatever the retransmit budget missed.
+//
+// GOSSIP payload (integers big-endian):
+//     u8 kind | u32 seq | [PING_REQ: u32 target_token] | u8 update_count
+//     | updates
+// update:
+//     u8 status | u32 incarnation | u32 token | u8 families (bit 0 = IPv4,
+//     bit 1 = IPv6) | [u8 addr4[4]] | [u8 addr6[16]] | u8 identifier_length
+//     | identifier
+// A record without addresses describes the sender itself, or a dead member.
+
+#define GOSSIP_PERIOD_US 1000000
+#define GOSSIP_ACK_TIMEOUT_US 300000
+#define GOSSIP_INDIRECT_PROBES 3
+#define GOSSIP_MAX_UPDATES 6
+#define GOSSIP_MAX_PAYLOAD 1200
+#define GOSSIP_RETRANSMIT_MULT 3
+#define GOSSIP_SUSPECT_MULT 3
+#define GOSSIP_DEAD_NOTICES 32
+#define GOSSIP_RELAYS 16
+#define GOSSIP_SYNC_PERIODS 30
+
+typedef struct Node Node;
+typedef struct FrameInfo FrameInfo;
+
+enum GossipKind {
+    GOSSIP_PING,
+    GOSSIP_ACK,
+    GOSSIP_PING_REQ,
+    GOSSIP_SYNC,  // updates only, carries the sender's full view
+};
+
+typedef struct {
+    uint32_t token;  // 0 = free
+    uint32_t incarnation;
+    uint8_t transmit_left;
+} DeadNotice;
+
+// PING sent for someone else's PING_REQ, its ACK is passed back to origin.
+typedef struct {
+    uint32_t seq;  // 0 = free
+    uint32_t origin_seq;
+    struct sockaddr_storage origin;
+    socklen_t origin_size;
+    uint64_t expires_us;
+} GossipRelay;
+
+typedef struct {
+    int enabled;  // probing and dissemination, PINGs are answered regardless
+    uint32_t incarnation;
+    uint8_t self_transmit_left;
+    uint32_t next_seq;
+    uint64_t next_period_us;
+    unsigned int periods_to_sync;
+    size_t cursor;
+    size_t stride;  // the probe order visits slots cursor, cursor + stride, ...
+    long int probe_slot;  // -1 = no probe outstanding
+    uint32_t probe_token;
+    uint32_t probe_seq;
+    uint64_t probe_sent_us;
+    int probe_indirect;
+    DeadNotice dead[GOSSIP_DEAD_NOTICES];
+    GossipRelay relays[GOSSIP_RELAYS];
+    unsigned long messages_sent;
+    unsigned long suspected;
+    unsigned long declared_dead;
+    unsigned long refuted;
+} GossipState;
+
+void GossipInit(GossipState *gossip, int enabled);
+void GossipTick(Node *node);
+void GossipMemberSeen(Node *node, size_t slot);
+void GossipMemberLeft(Node *node, size_t slot);
+void GossipSync(Node *node, size_t slot);
+int GossipSeed(Node *node, const char *address);
+void ProcessMessageGossip(
+    Node *node,
+    long int peer_id,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr,
+    socklen_t src_addr_size,
+    const FrameInfo *frame
+);
+const char *SwimStatusName(int status);
+
+#endif  // SRC_GOSSIP_H_
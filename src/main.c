@@ -1,20 +1,79 @@
 // Copyright 2025 Michał Jankowski
+#define _GNU_SOURCE  // CPU_SETSIZE
+#include <errno.h>
 #include <fcntl.h>
-#include <net/if.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <poll.h>
+#include <sched.h>
 #include <unistd.h>
 
+#include "c_comm.h"
+#include "channel.h"
+#include "control.h"
+#include "gossip.h"
+#include "msgbuf.h"
 #include "net_func.h"
+#include "node.h"
+#include "outbox.h"
+#include "outq.h"
+#include "path.h"
+#include "ratelimit.h"
+#include "secure.h"
+#include "send_cache.h"
+#include "session.h"
 #include "peer.h"
 #include "sock_prep.h"
+#include "trace.h"
+#include "transport.h"
 
-const unsigned int MAX_POLL_FDS = 5;
+#define MAX_POLL_FDS (COMM_MAX_POLL_FDS + 1 + 1 + CONTROL_MAX_CLIENTS)
+#define MAX_SEEDS 8
+#define PEERS_DEFAULT_SIZE 32
 const unsigned int POLL_TIMEOUT_MS = 100;
 const char* LOCKFILE_DIR = "/var/lock";
+const char* CONTROL_SOCKET_DIR = "/run";
+
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t trace_dump_requested = 0;
+
+static void HandleStopSignal(int signum) {
+    (void) signum;
+    stop_requested = 1;
+}
+
+static void HandleTraceSignal(int signum) {
+    (void) signum;
+    trace_dump_requested = 1;
+}
+
+// path NULL or empty: the default path
+static void DumpTrace(const char *path) {
+    char default_path[64];
+    if (path == NULL || path[0] == '\0') {
+        TraceDefaultPath(default_path, sizeof(default_path));
+        path = default_path;
+    }
+    long int ret = TraceDump(path);
+    if (ret < 0) {
+        fprintf(stderr, "[FAIL] Could not write trace to %s: %s\n", path, strerror((int) -ret));
+    } else {
+        printf("Trace: %ld events written to %s\n", ret, path);
+    }
+}
+
+// Interfaces are per network namespace, so is the lock. 0 if unknown.
+static unsigned long NetnsId(void) {
+    struct stat st;
+    if (stat("/proc/self/ns/net", &st) < 0) {
+        return 0;
+    }
+    return (unsigned long) st.st_ino;
+}
 
 static inline void AddPollFd(
     struct pollfd *fds,
@@ -40,8 +99,14 @@ enum Command {
     CMD_SCAN,
     CMD_PRINT_PEERS,
     CMD_SEND,
+    CMD_SEND_TO,
     CMD_DISCONNECT_ALL,
     CMD_WHOAMI,
+    CMD_JOIN,
+    CMD_LEAVE,
+    CMD_PUBLISH,
+    CMD_CHANNELS,
+    CMD_TRACE_DUMP,
 };
 
 enum Command DetermineCommand(char *cmd_string) {
@@ -58,6 +123,11 @@ enum Command DetermineCommand(char *cmd_string) {
         output = CMD_SCAN;
     } else if (strncmp(cmd_string, "/send ", 6) == 0) {
         output = CMD_SEND;
+    } else if (strncmp(cmd_string, "/sendto ", 8) == 0) {
+        output = CMD_SEND_TO;
+    } else if (strncmp(cmd_string, "/sendto", 7) == 0) {
+        printf("Usage: /sendto [USER@HOST] [MESSAGE]\n");
+        output = CMD_SILENT;
     } else if (strncmp(cmd_string, "/send ", 5) == 0) {
         printf("Usage: /send [PEER ID] [MESSAGE]\n");
         output = CMD_SILENT;
@@ -65,6 +135,23 @@ enum Command DetermineCommand(char *cmd_string) {
         output = CMD_DISCONNECT_ALL;
     } else if (strcmp(cmd_string, "/whoami") == 0) {
         output = CMD_WHOAMI;
+    } else if (strncmp(cmd_string, "/join ", 6) == 0) {
+        output = CMD_JOIN;
+    } else if (strncmp(cmd_string, "/leave ", 7) == 0) {
+        output = CMD_LEAVE;
+    } else if (strncmp(cmd_string, "/pub ", 5) == 0) {
+        output = CMD_PUBLISH;
+    } else if (strcmp(cmd_string, "/channels") == 0) {
+        output = CMD_CHANNELS;
+    } else if (strcmp(cmd_string, "/trace dump") == 0 || strncmp(cmd_string, "/trace dump ", 12) == 0) {
+        output = CMD_TRACE_DUMP;
+    } else if (strncmp(cmd_string, "/trace", 6) == 0) {
+        printf("Usage: /trace dump [PATH]\n");
+        output = CMD_SILENT;
+    } else if (strncmp(cmd_string, "/join", 5) == 0 || strncmp(cmd_string, "/leave", 6) == 0
+               || strncmp(cmd_string, "/pub", 4) == 0) {
+        printf("Usage: /join [TOPIC], /leave [TOPIC], /pub [TOPIC] [MESSAGE]\n");
+        output = CMD_SILENT;
     }
     return output;
 }
@@ -78,46 +165,193 @@ void PrintHelp() {
     printf("/scan       - scans network in search of peers\n");
     printf("/send       - send message to peer\n");
     printf("      Usage: /send [PEER ID] [MESSAGE]\n");
-    printf("/whoami     - prints own user identifier");
+    printf("/sendto     - send message by identifier, kept in the outbox while the peer is away\n");
+    printf("      Usage: /sendto [USER@HOST] [MESSAGE]\n");
+    printf("/whoami     - prints own user identifier\n");
+    printf("/join       - subscribe to a channel\n");
+    printf("      Usage: /join [TOPIC]\n");
+    printf("/leave      - unsubscribe from a channel\n");
+    printf("      Usage: /leave [TOPIC]\n");
+    printf("/pub        - publish message to a channel\n");
+    printf("      Usage: /pub [TOPIC] [MESSAGE]\n");
+    printf("/channels   - prints subscribed channels\n");
+    printf("/trace dump - writes the event trace to a new file (also on SIGUSR1)\n");
+    printf("      Usage: /trace dump [PATH]");
     printf("\n");
 }
 
+void PrintUsage() {
+    printf("Usage: c_comm [OPTIONS] [INTERFACE NAME] [USER NAME]\n");
+    printf("  -t udp|uring - datagram transport (default: udp)\n");
+    printf("  -d           - daemon mode: no stdin, driven through the control socket\n");
+    printf("  -c PATH      - control socket path (daemon default: %s/c_comm_[INTERFACE NAME].sock)\n",
+           CONTROL_SOCKET_DIR);
+    printf("  -q BYTES     - memory cap for queued outbound frames (default: %d)\n", OUTQ_DEFAULT_CAP);
+    printf("  -r SCALE     - multiplies the per-source ingress rate limits, 0 disables (default: 1)\n");
+    printf("  -w 1|2       - wire format for announcements, 1 while old nodes remain (default: 2)\n");
+    printf("  -f COUNT     - sockets kept connected to recently messaged peers, 0 disables (default: %d)\n",
+           SEND_CACHE_DEFAULT_FDS);
+    printf("  -g           - gossip membership (SWIM) with the discovered peers\n");
+    printf("  -s ADDRESS   - scan this address directly and gossip from there, implies -g (repeatable)\n");
+    printf("  -P COUNT     - peer table size, the gossip view beyond it is partial (default: %d)\n",
+           PEERS_DEFAULT_SIZE);
+    printf("  -L CPU       - low-latency mode: pinned to CPU, busy polls the sockets while traffic flows\n");
+    printf("  -G           - coalesce bulk sends with UDP GSO and receives with GRO (udp transport)\n");
+    printf("  -E 0|1|2     - message encryption: off, preferred, required (default: 1)\n");
+    printf("  -T EVENTS    - event trace ring size per thread, 0 disables (default: %d)\n", TRACE_DEFAULT_EVENTS);
+    printf("  -o BYTES     - outbox for messages to unreachable peers, 0 disables (default: %d)\n",
+           OUTBOX_DEFAULT_CAP);
+    printf("  -O PATH      - spill outbox messages beyond -o to this append-only file\n");
+    printf("  -e SECONDS   - outbox messages expire after this long (default: %d)\n", OUTBOX_DEFAULT_TTL_S);
+}
+
 int main(int argc, char *argv[]) {
-    int udp4, udp6;
-    char hostname[256];
-    char user_identifier[320];
+    Node *node;
+    CommConfig config;
+    ControlServer control;
+    const char *transport_kind = "udp";
+    const char *control_path = NULL;
+    long int send_cache_fds = SEND_CACHE_DEFAULT_FDS;
+    int wire_version = WIRE_V2;
+    long int outq_cap = OUTQ_DEFAULT_CAP;
+    long int rate_scale = 1;
+    long int peers_size = PEERS_DEFAULT_SIZE;
+    int gossip = 0;
+    long int busy_poll_cpu = -1;
+    int gso = 0;
+    int encrypt = COMM_ENCRYPT_PREFERRED;
+    long int trace_ring_events = TRACE_DEFAULT_EVENTS;
+    long int outbox_cap = OUTBOX_DEFAULT_CAP;
+    long int outbox_ttl = OUTBOX_DEFAULT_TTL_S;
+    const char *outbox_spill = NULL;
+    const char *seeds[MAX_SEEDS];
+    unsigned int seed_count = 0;
+    char control_path_buf[108];
+    short daemon_mode = 0;
+    short stdin_open = 1;
     char stdin_buffer[2048];
     unsigned short run = 1;
 
     struct pollfd fds[MAX_POLL_FDS];
     unsigned int nfds = 0;  // also current length, but next id feels better
 
-    const size_t PEERS_SIZE = 32;
-    Peer peers[PEERS_SIZE];
-    memset(peers, 0, sizeof(peers));
-
-    if (argc != 3) {
-        printf("Usage: c_comm [INTERFACE NAME] [USER NAME]\n");
-        exit(EXIT_FAILURE);
-    }
-    int ifindex = if_nametoindex(argv[1]);
-    if (ifindex == 0) {
-        perror(argv[1]);
-        exit(EXIT_FAILURE);
-    }
+    memset(&control, 0, sizeof(control));
+    control.listen_fd = -1;
 
-    if (strlen(argv[2]) > 62) {
-        fprintf(stderr, "User name must be no longer than 62 bytes.\n");
-        exit(EXIT_FAILURE);
+    int opt;
+    while ((opt = getopt(argc, argv, "t:dc:f:q:r:w:gs:P:L:GE:T:o:O:e:")) != -1) {
+        switch (opt) {
+            case 't':
+                transport_kind = optarg;
+                break;
+            case 'd':
+                daemon_mode = 1;
+                break;
+            case 'c':
+                control_path = optarg;
+                break;
+            case 'f':
+                send_cache_fds = strtol(optarg, NULL, 10);
+                if (send_cache_fds < 0 || send_cache_fds > 4096) {
+                    fprintf(stderr, "[FAIL] -f expects a count between 0 and 4096\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'q':
+                outq_cap = strtol(optarg, NULL, 10);
+                if (outq_cap <= 0) {
+                    fprintf(stderr, "[FAIL] -q expects a positive byte count\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                rate_scale = strtol(optarg, NULL, 10);
+                if (rate_scale < 0 || rate_scale > 100) {
+                    fprintf(stderr, "[FAIL] -r expects a scale between 0 and 100\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                wire_version = atoi(optarg);
+                if (wire_version != WIRE_V1 && wire_version != WIRE_V2) {
+                    fprintf(stderr, "[FAIL] -w expects 1 or 2\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g':
+                gossip = 1;
+                break;
+            case 's':
+                if (seed_count == MAX_SEEDS) {
+                    fprintf(stderr, "[FAIL] At most %d seeds\n", MAX_SEEDS);
+                    exit(EXIT_FAILURE);
+                }
+                seeds[seed_count++] = optarg;
+                gossip = 1;
+                break;
+            case 'P':
+                peers_size = strtol(optarg, NULL, 10);
+                if (peers_size < 1 || peers_size > 65536) {
+                    fprintf(stderr, "[FAIL] -P expects a count between 1 and 65536\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'L':
+                busy_poll_cpu = strtol(optarg, NULL, 10);
+                if (busy_poll_cpu < 0 || busy_poll_cpu >= CPU_SETSIZE) {
+                    fprintf(stderr, "[FAIL] -L expects a CPU number\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'G':
+                gso = 1;
+                break;
+            case 'E':
+                encrypt = atoi(optarg);
+                if (encrypt < COMM_ENCRYPT_OFF || encrypt > COMM_ENCRYPT_REQUIRED) {
+                    fprintf(stderr, "[FAIL] -E expects 0, 1 or 2\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'T':
+                trace_ring_events = strtol(optarg, NULL, 10);
+                if (trace_ring_events < 0 || trace_ring_events > TRACE_MAX_EVENTS) {
+                    fprintf(stderr, "[FAIL] -T expects a count between 0 and %u\n", TRACE_MAX_EVENTS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                outbox_cap = strtol(optarg, NULL, 10);
+                if (outbox_cap < 0) {
+                    fprintf(stderr, "[FAIL] -o expects a byte count\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'O':
+                outbox_spill = optarg;
+                break;
+            case 'e':
+                outbox_ttl = strtol(optarg, NULL, 10);
+                if (outbox_ttl <= 0 || outbox_ttl > 86400 * 30) {
+                    fprintf(stderr, "[FAIL] -e expects seconds, at most 30 days\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                PrintUsage();
+                exit(EXIT_FAILURE);
+        }
     }
-    if (gethostname(hostname, sizeof(hostname)) < 0) {
-        perror("[FAIL] Could not get hostname");
+    if (argc - optind != 2) {
+        PrintUsage();
         exit(EXIT_FAILURE);
     }
+    const char *ifname = argv[optind];
+    const char *user_name = argv[optind + 1];
 
     int lock_fd = -1;
     char lockfile[256];
-    snprintf(lockfile, sizeof(lockfile), "%s/c_comm_%s_%d.lock", LOCKFILE_DIR, argv[1], PORT);
+    snprintf(lockfile, sizeof(lockfile), "%s/c_comm_%s_%d_%lu.lock", LOCKFILE_DIR, ifname, PORT, NetnsId());
     lock_fd = open(lockfile, O_CREAT | O_RDWR, 0644);
     if (lock_fd < 0) {
         perror("[FAIL] Could not obtain lockfile\n");
@@ -128,110 +362,173 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    snprintf(user_identifier, sizeof(user_identifier), "%s@%s", argv[2], hostname);
-    printf("This user/instance will be identified as: \"%s\"\n", user_identifier);
-    printf("For list of commands type \"/help\"\n\n");
-
-    AddPollFd(fds, &nfds, STDIN_FILENO, POLLIN);
-    if ((udp4 = GetInet4SocketUDP(argv[1])) < 0) {
-        fprintf(stderr, "[WARN] Failed to start IPv4/UDP communication, code %i\n", udp4);
-        udp4 = -999;  // to avoid issues in poll loop
-        // (can't think of how that problem would occur, just for peace of mind)
-    } else {
-        AddPollFd(fds, &nfds, udp4, POLLIN);
+    CommConfigDefaults(&config, ifname, user_name);
+    config.transport = transport_kind;
+    config.peers_size = (size_t) peers_size;
+    config.outq_cap = (size_t) outq_cap;
+    config.send_cache_fds = (size_t) send_cache_fds;
+    config.rate_scale = (unsigned int) rate_scale;
+    config.wire_version = wire_version;
+    config.gossip = gossip;
+    config.busy_poll_cpu = (int) busy_poll_cpu;
+    config.gso = gso;
+    config.encrypt = encrypt;
+    config.trace_events = (size_t) trace_ring_events;
+    config.outbox_cap = (size_t) outbox_cap;
+    config.outbox_ttl_s = (unsigned int) outbox_ttl;
+    config.outbox_spill = outbox_spill;
+    if ((node = CommOpen(&config)) == NULL) {
+        close(lock_fd);
+        exit(EXIT_FAILURE);
     }
-    if ((udp6 = GetInet6SocketUDP(argv[1])) < 0) {
-        fprintf(stderr, "[WARN] Failed to start IPv6/UDP communication, code %i\n", udp6);
-        udp6 = -999;  // to avoid issues in poll loop
-    } else {
-        AddPollFd(fds, &nfds, udp6, POLLIN);
+    printf("This user/instance will be identified as: \"%s\"\n", CommIdentifier(node));
+    if (!daemon_mode) {
+        printf("For list of commands type \"/help\"\n\n");
+    }
+    for (unsigned int i = 0; i < seed_count; i++) {
+        if (CommSeed(node, seeds[i]) == -1) {
+            fprintf(stderr, "[WARN] Seed %s is not an IP address\n", seeds[i]);
+        }
     }
 
-    if (udp4 < 0 && udp6 < 0) {
-        fprintf(stderr, "[FAIL] Could not start UDP communication. Exiting.\n");
-        exit(EXIT_FAILURE);
+    if (daemon_mode && control_path == NULL) {
+        snprintf(control_path_buf, sizeof(control_path_buf), "%s/c_comm_%s.sock", CONTROL_SOCKET_DIR, ifname);
+        control_path = control_path_buf;
+    }
+    if (control_path != NULL) {
+        int ret;
+        if ((ret = ControlOpen(&control, control_path)) < 0) {
+            fprintf(stderr, "[FAIL] Could not open control socket %s, code %i\n", control_path, ret);
+            CommClose(node);
+            exit(EXIT_FAILURE);
+        }
+        control.echo = !daemon_mode;
+        node->on_message = ControlMessageHook;
+        node->hook_arg = &control;
+        printf("Control socket listening on %s\n", control_path);
     }
 
-    while (run) {
-        int ret = poll(fds, nfds, POLL_TIMEOUT_MS);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = HandleStopSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = HandleTraceSignal;
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (run && !stop_requested) {
+        nfds = 0;
+        if (!daemon_mode && stdin_open) {
+            AddPollFd(fds, &nfds, STDIN_FILENO, POLLIN);
+        }
+        unsigned int node_first = nfds;
+        nfds += CommPollFds(node, fds + nfds, MAX_POLL_FDS - nfds);
+        unsigned int control_first = nfds;
+        nfds += ControlPollFds(&control, fds + nfds, MAX_POLL_FDS - nfds);
+
+        int ret = poll(fds, nfds, CommPollTimeout(node, POLL_TIMEOUT_MS));
 
         if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             perror("[FAIL] Poll");
             return EXIT_FAILURE;
         }
         if (ret > 0) {
-            for (unsigned int i = 0; i < nfds; i++) {
-                if (fds[i].revents & POLLIN) {
-                    if (fds[i].fd == STDIN_FILENO) {  // handle user input
-                        fgets(stdin_buffer, sizeof(stdin_buffer), stdin);
-                        stdin_buffer[strcspn(stdin_buffer, "\n")] = '\0';
-                        if (stdin_buffer[0] == '/') {
-                            switch (DetermineCommand(stdin_buffer)) {
-                                case CMD_UNKNOWN:
-                                    printf("Unknown command.\n");
-                                    break;
-                                case CMD_EXIT:
-                                    printf("Exiting...\n");
-                                    run = 0;
-                                    SendDisconnectToAll(udp4, udp6, peers, PEERS_SIZE);
-                                    printf("Sent disconnects to all peers.\n");
-                                    close(udp4);
-                                    close(udp6);
-                                    printf("Goodbye!\n");
-                                    return EXIT_SUCCESS;
-                                case CMD_HELP:
-                                    PrintHelp();
-                                    break;
-                                case CMD_CLEAR_ALL:
-                                    ClearAllPeers(peers, PEERS_SIZE);
-                                    printf("Cleared all peers.\n");
-                                    break;
-                                case CMD_PRINT_PEERS:
-                                    PrintPeers(peers, PEERS_SIZE);
-                                    break;
-                                case CMD_SCAN:
-                                    printf("Sent scans.\n");
-                                    SendScan(udp4, udp6, ifindex, user_identifier);
-                                    break;
-                                case CMD_SEND:
-                                    SendMsg(udp4, udp6, stdin_buffer, peers, PEERS_SIZE);
-                                    break;
-                                case CMD_DISCONNECT_ALL:
-                                    printf("Sending disconnects to all peers.\n");
-                                    SendDisconnectToAll(udp4, udp6, peers, PEERS_SIZE);
-                                    ClearAllPeers(peers, PEERS_SIZE);
-                                    printf("Cleared all peers.\n");
-                                    break;
-                                case CMD_WHOAMI:
-                                    printf("You are: \"%s\"\n", user_identifier);
-                                    break;
-                                default:
-                                    break;
-                            }
-                        }
-                        if (strcmp(stdin_buffer, "/exit") == 0) {
-                            break;
+            if (node_first > 0 && (fds[0].revents & (POLLIN | POLLHUP))) {  // handle user input
+                if (fgets(stdin_buffer, sizeof(stdin_buffer), stdin) == NULL) {
+                    stdin_open = 0;  // EOF, keep serving the network and control socket
+                } else {
+                    stdin_buffer[strcspn(stdin_buffer, "\n")] = '\0';
+                    if (stdin_buffer[0] == '/') {
+                        switch (DetermineCommand(stdin_buffer)) {
+                            case CMD_UNKNOWN:
+                                printf("Unknown command.\n");
+                                break;
+                            case CMD_EXIT:
+                                printf("Exiting...\n");
+                                run = 0;
+                                break;
+                            case CMD_HELP:
+                                PrintHelp();
+                                break;
+                            case CMD_CLEAR_ALL:
+                                ClearAllPeers(node->peers, node->peers_size);
+                                printf("Cleared all peers.\n");
+                                break;
+                            case CMD_PRINT_PEERS:
+                                PrintPeers(node->peers, node->peers_size);
+                                PrintOutQueues(&node->outq, node->peers);
+                                PrintMsgPool(&node->pool);
+                                PrintOutbox(&node->outbox);
+                                PrintSecure(node);
+                                break;
+                            case CMD_SCAN:
+                                printf("Sent scans.\n");
+                                SendScan(node);
+                                break;
+                            case CMD_SEND:
+                                SendMsg(node, stdin_buffer);
+                                break;
+                            case CMD_SEND_TO:
+                                SendMsgTo(node, stdin_buffer + 8);
+                                break;
+                            case CMD_DISCONNECT_ALL:
+                                printf("Sending disconnects to all peers.\n");
+                                SendDisconnectToAll(node);
+                                ClearAllPeers(node->peers, node->peers_size);
+                                printf("Cleared all peers.\n");
+                                break;
+                            case CMD_WHOAMI:
+                                printf("You are: \"%s\"\n", node->user_identifier);
+                                break;
+                            case CMD_JOIN:
+                                if (JoinChannel(node, stdin_buffer + 6) < 0) {
+                                    fprintf(stderr, "[FAIL] Could not join #%s\n", stdin_buffer + 6);
+                                } else {
+                                    printf("Joined #%s\n", stdin_buffer + 6);
+                                }
+                                break;
+                            case CMD_LEAVE:
+                                if (LeaveChannel(node, stdin_buffer + 7) < 0) {
+                                    fprintf(stderr, "[FAIL] Not in #%s\n", stdin_buffer + 7);
+                                } else {
+                                    printf("Left #%s\n", stdin_buffer + 7);
+                                }
+                                break;
+                            case CMD_PUBLISH:
+                                PublishMsg(node, stdin_buffer);
+                                break;
+                            case CMD_CHANNELS:
+                                PrintChannels(&node->channels);
+                                break;
+                            case CMD_TRACE_DUMP:
+                                DumpTrace(stdin_buffer[11] == ' ' ? stdin_buffer + 12 : NULL);
+                                break;
+                            default:
+                                break;
                         }
-                    } else if (fds[i].fd == udp4 || fds[i].fd == udp6) {  // handle IPv4/UDP and IPv6/UDP sockets
-                        ListenUDP(fds[i].fd, peers, PEERS_SIZE, user_identifier);
                     }
                 }
             }
+            ControlHandle(&control, node, fds + control_first, nfds - control_first);
         }
-
-        unsigned int j = 0;
-        for (unsigned int i = 0; i < nfds; i++) {
-            if (fds[i].fd != -1) {
-                if (i != j) {
-                    fds[j] = fds[i];
-                }
-                j++;
-            }
+        // the network last, so what the commands above queued goes out at once
+        CommDispatch(node, fds + node_first, ret > 0 ? control_first - node_first : 0);
+        if (trace_dump_requested) {
+            trace_dump_requested = 0;
+            DumpTrace(NULL);
         }
-        nfds = j;
     }
 
-    close(udp4);
-    close(udp6);
+    if (stop_requested) {
+        printf("Exiting...\n");
+    }
+    CommClose(node);
+    printf("Sent disconnects to all peers.\n");
+    ControlClose(&control);
+    printf("Goodbye!\n");
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,73 @@
+// Copyright 2025 Michał Jankowski
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msgbuf.h"
+
+int MsgPoolInit(MsgPool *pool, size_t max_buffers) {
+    memset(pool, 0, sizeof(*pool));
+    if (max_buffers == 0 || max_buffers > MSGPOOL_MAX_BUFFERS) {
+        max_buffers = MSGPOOL_MAX_BUFFERS;
+    }
+    pool->max_buffers = max_buffers;
+    return 0;
+}
+
+void MsgPoolFree(MsgPool *pool) {
+    for (size_t i = 0; i < pool->slab_count; i++) {
+        free(pool->slabs[i]);
+    }
+    memset(pool, 0, sizeof(*pool));
+}
+
+static int AddSlab(MsgPool *pool) {
+    if (pool->buffers + MSGPOOL_SLAB_BUFFERS > pool->max_buffers) {
+        return -1;
+    }
+    MsgBuf *slab = malloc(MSGPOOL_SLAB_BUFFERS * sizeof(MsgBuf));
+    if (slab == NULL) {
+        return -2;
+    }
+    for (size_t i = 0; i < MSGPOOL_SLAB_BUFFERS; i++) {
+        slab[i].next_free = pool->free_list;
+        pool->free_list = &slab[i];
+    }
+    pool->slabs[pool->slab_count++] = slab;
+    pool->buffers += MSGPOOL_SLAB_BUFFERS;
+    return 0;
+}
+
+// Returns a buffer holding one reference and no data, NULL when the pool is
+// at max_buffers (or out of memory).
+MsgBuf *MsgBufGet(MsgPool *pool) {
+    if (pool->free_list == NULL && AddSlab(pool) < 0) {
+        pool->exhausted++;
+        return NULL;
+    }
+    MsgBuf *buf = pool->free_list;
+    pool->free_list = buf->next_free;
+    buf->next_free = NULL;
+    buf->refs = 1;
+    buf->length = 0;
+    pool->gets++;
+    if (++pool->in_use > pool->peak) {
+        pool->peak = pool->in_use;
+    }
+    return buf;
+}
+
+// Drops one reference, the last one returns the buffer to the pool.
+void MsgBufPut(MsgPool *pool, MsgBuf *buf) {
+    if (buf == NULL || --buf->refs != 0) {
+        return;
+    }
+    buf->next_free = pool->free_list;
+    pool->free_list = buf;
+    pool->in_use--;
+}
+
+void PrintMsgPool(const MsgPool *pool) {
+    printf("Buffer pool: %zu of %zu buffers in use (peak %zu, limit %zu), %lu refused\n",
+           pool->in_use, pool->buffers, pool->peak, pool->max_buffers, pool->exhausted);
+}
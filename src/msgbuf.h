@@ -0,0 +1,49 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_MSGBUF_H_
+#define SRC_MSGBUF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MSGBUF_SIZE 2048  // one whole datagram, like the handlers' stack buffers
+#define MSGPOOL_SLAB_BUFFERS 64
+#define MSGPOOL_MAX_BUFFERS 8192  // 16 MiB, the send queue cap normally binds first
+
+// Reference-counted frame buffers. A frame is encoded once into a MsgBuf and
+// the same buffer then sits in every send queue it was handed to, and is
+// resent from there on EAGAIN, until the last holder puts it back. Buffers
+// come from slabs of MSGPOOL_SLAB_BUFFERS that are allocated as the pool
+// grows and kept until MsgPoolFree(), so a busy node stops calling malloc
+// once it has seen its peak.
+
+typedef struct MsgBuf {
+    struct MsgBuf *next_free;
+    uint32_t refs;
+    uint32_t length;  // bytes used in data
+    char data[MSGBUF_SIZE];
+} MsgBuf;
+
+typedef struct {
+    MsgBuf *slabs[MSGPOOL_MAX_BUFFERS / MSGPOOL_SLAB_BUFFERS];
+    size_t slab_count;
+    size_t max_buffers;
+    MsgBuf *free_list;
+    size_t buffers;  // in all slabs
+    size_t in_use;
+    size_t peak;
+    unsigned long gets;
+    unsigned long exhausted;  // gets refused at max_buffers
+} MsgPool;
+
+int MsgPoolInit(MsgPool *pool, size_t max_buffers);
+void MsgPoolFree(MsgPool *pool);
+MsgBuf *MsgBufGet(MsgPool *pool);
+void MsgBufPut(MsgPool *pool, MsgBuf *buf);
+void PrintMsgPool(const MsgPool *pool);
+
+static inline MsgBuf *MsgBufRef(MsgBuf *buf) {
+    buf->refs++;
+    return buf;
+}
+
+#endif  // SRC_MSGBUF_H_
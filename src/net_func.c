@@ -1,300 +1,609 @@
 // Copyright 2025 Michał Jankowski
 #include <arpa/inet.h>
+#include <errno.h>
 #include <net/if.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 
+#include "announce.h"
+#include "channel.h"
+#include "gossip.h"
+#include "msgbuf.h"
 #include "net_func.h"
+#include "node.h"
+#include "outbox.h"
+#include "outq.h"
+#include "path.h"
+#include "ratelimit.h"
 #include "peer.h"
+#include "secure.h"
+#include "send_cache.h"
+#include "session.h"
 #include "sock_prep.h"
-
-long int Encapsulate(const enum MessageType msg_type, char *msg, const size_t buf_size) {
-    uint16_t crc12, prefix;
-    size_t msg_length = strlen(msg);
+#include "trace.h"
+#include "transport.h"
+
+// Writes the header for a frame carrying payload_length bytes, returns its
+// size. token is ignored for v1.
+long int EncodeFrameHeader(
+    uint8_t *header,
+    size_t header_size,
+    int version,
+    uint32_t token,
+    const enum MessageType msg_type,
+    size_t payload_length
+) {
     if (msg_type > 15) {
         return -1;
-    } else if (msg_length + 2 > buf_size) {
+    }
+    if (version == WIRE_V1) {
+        if (header_size < WIRE_V1_HEADER_SIZE) {
+            return -2;
+        }
+        uint16_t crc12 = 0;  // TODO(.): Have this be calculated later
+        uint16_t prefix = (crc12 << 4) | msg_type;
+        header[0] = (prefix >> 8) & 0xFF;
+        header[1] = prefix & 0xFF;
+        return WIRE_V1_HEADER_SIZE;
+    }
+    if (header_size < WIRE_V2_HEADER_SIZE || payload_length > UINT16_MAX) {
+        return -2;
+    }
+    header[0] = WIRE_VERSION_MARK | WIRE_V2;
+    header[1] = (uint8_t) msg_type;
+    header[2] = 0;  // flags
+    header[3] = WIRE_V2_HEADER_SIZE / 4;
+    SetFramePayloadLength(header, payload_length);
+    header[6] = 0;
+    header[7] = 0;
+    header[8] = (token >> 24) & 0xFF;
+    header[9] = (token >> 16) & 0xFF;
+    header[10] = (token >> 8) & 0xFF;
+    header[11] = token & 0xFF;
+    return WIRE_V2_HEADER_SIZE;
+}
+
+// Only meaningful for v2, v1 frames carry no length.
+void SetFramePayloadLength(uint8_t *header, size_t payload_length) {
+    if (header[0] == (WIRE_VERSION_MARK | WIRE_V2)) {
+        header[4] = (payload_length >> 8) & 0xFF;
+        header[5] = payload_length & 0xFF;
+    }
+}
+
+// Prepends the header in place, msg holds msg_length payload bytes.
+long int EncapsulateFrame(
+    const Node *node,
+    int version,
+    const enum MessageType msg_type,
+    char *msg,
+    size_t msg_length,
+    const size_t buf_size
+) {
+    uint8_t header[WIRE_V2_HEADER_SIZE];
+    long int header_length = EncodeFrameHeader(
+        header, sizeof(header), version, node->session_token, msg_type, msg_length);
+    if (header_length < 0) {
+        return header_length;
+    } else if (msg_length + (size_t) header_length > buf_size) {
         return -2;
     }
-    crc12 = 0;  // TODO(.): Have this be calculated later
-    prefix = (crc12 << 4) | msg_type;
-    memmove(msg + 2, msg, msg_length + 1);
-    msg[0] = (prefix >> 8) & 0xFF;
-    msg[1] = prefix & 0xFF;
-    return msg_length + 2;
+    memmove(msg + header_length, msg, msg_length);
+    memcpy(msg, header, (size_t) header_length);
+    return (long int) msg_length + header_length;
+}
+
+// Encodes a frame straight into a pool buffer, one copy of the payload and
+// no header shuffle. NULL when the pool is exhausted or the frame too long.
+MsgBuf *EncodeFrame(Node *node, int version, const enum MessageType msg_type, const char *msg, size_t msg_length) {
+    MsgBuf *buf = MsgBufGet(&node->pool);
+    if (buf == NULL) {
+        return NULL;
+    }
+    long int header_length = EncodeFrameHeader(
+        (uint8_t *) buf->data, WIRE_HEADER_MAX, version, node->session_token, msg_type, msg_length);
+    if (header_length < 0 || msg_length > MSGBUF_SIZE - (size_t) header_length) {
+        MsgBufPut(&node->pool, buf);
+        return NULL;
+    }
+    if (msg_length > 0) {
+        memcpy(buf->data + header_length, msg, msg_length);
+    }
+    buf->length = (uint32_t) (header_length + msg_length);
+    return buf;
 }
 
-int Deencapsulate(char *msg, ssize_t msg_length) {
+// Strips the header in place and NUL-terminates the payload. Returns the
+// message type, frame describes the rest.
+int Deencapsulate(char *msg, ssize_t msg_length, FrameInfo *frame) {
+    memset(frame, 0, sizeof(*frame));
     if (msg_length < 2) {
         return -1;
     }
+    const uint8_t *bytes = (const uint8_t *) msg;
+
+    size_t header_length;
+    int msg_type;
+    if ((bytes[0] & 0xF0) != WIRE_VERSION_MARK) {
+        uint16_t prefix = (bytes[0] << 8) | bytes[1];
+        msg_type = prefix & 0x0F;
+        // TODO(.): Check CRC
+        frame->version = WIRE_V1;
+        header_length = WIRE_V1_HEADER_SIZE;
+        frame->payload_length = (size_t) msg_length - header_length;
+    } else {
+        if ((bytes[0] & 0x0F) != WIRE_V2 || msg_length < WIRE_V2_HEADER_SIZE) {
+            return -1;  // a version from the future, or garbage
+        }
+        header_length = (size_t) bytes[3] * 4;  // extensions sit between base header and payload
+        size_t payload_length = ((size_t) bytes[4] << 8) | bytes[5];
+        if (header_length < WIRE_V2_HEADER_SIZE || header_length + payload_length > (size_t) msg_length) {
+            return -1;
+        }
+        msg_type = bytes[1];
+        frame->version = WIRE_V2;
+        frame->flags = bytes[2];
+        frame->token = ((uint32_t) bytes[8] << 24) | ((uint32_t) bytes[9] << 16)
+                       | ((uint32_t) bytes[10] << 8) | bytes[11];
+        frame->payload_length = payload_length;
+    }
 
-    uint16_t prefix = ((uint8_t)msg[0] << 8) | (uint8_t)msg[1];
-    uint8_t msg_type = prefix & 0x0F;
-    uint16_t crc12 = prefix >> 4;
+    memmove(msg, msg + header_length, frame->payload_length);
+    msg[frame->payload_length] = '\0';
+    return msg_type;
+}
 
-    // TODO(.): Check CRC
+// Whether src_addr is the address we know the peer by. Tokens travel in
+// cleartext, a token alone doesn't make a sender.
+static int SentFromPeer(const Peer *p, const struct sockaddr_storage *src_addr) {
+    if (src_addr->ss_family == AF_INET) {
+        const struct sockaddr_in *addr4 = (const struct sockaddr_in *) src_addr;
+        return p->inet4.seen != 0 && p->inet4.addr4.s_addr == addr4->sin_addr.s_addr;
+    } else if (src_addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *) src_addr;
+        return p->inet6.seen != 0 && memcmp(&p->inet6.addr6, &addr6->sin6_addr, sizeof(struct in6_addr)) == 0;
+    }
+    return 0;
+}
+
+// The v2 session token resolves the sender without a table scan, as long as
+// the frame comes from the peer's address. The source address is the
+// fallback for v1, unknown tokens and tokens sent from elsewhere.
+long int FindSender(Node *node, const FrameInfo *frame, const struct sockaddr_storage *src_addr) {
+    long int location = FindBySession(&node->sessions, node->peers, node->peers_size, frame->token);
+    if (location >= 0 && SentFromPeer(&node->peers[location], src_addr)) {
+        return location;
+    }
+    if (src_addr->ss_family == AF_INET) {
+        struct in_addr addr4 = ((const struct sockaddr_in *) src_addr)->sin_addr;
+        return FindByInet4(node->peers, node->peers_size, &addr4);
+    } else if (src_addr->ss_family == AF_INET6) {
+        struct in6_addr addr6 = ((const struct sockaddr_in6 *) src_addr)->sin6_addr;
+        return FindByInet6(node->peers, node->peers_size, &addr6);
+    }
+    return -1;
+}
 
-    memmove(msg, msg + 2, msg_length - 2);
-    msg[msg_length - 2] = '\0';
-    return ((int) msg_type);
+int PeerWireVersion(const Node *node, const Peer *p) {
+    return p->wire_version != 0 ? p->wire_version : node->wire_version;
 }
 
-void ListenUDP(int udp, Peer peers[], const size_t peers_size, const char* user_identifier) {
-    size_t BUFFER_SIZE = 2048;
+void ListenUDP(Node *node) {
+    // bounded, so a flood on the sockets can't starve stdin
+    for (unsigned int i = 0; i < LISTEN_BUDGET; i++) {
+        if (ListenUDPOnce(node) <= 0) {
+            break;
+        }
+    }
+}
+
+int ListenUDPOnce(Node *node) {
+    size_t BUFFER_SIZE = MSGBUF_SIZE + 1;  // a whole frame and the NUL
     char buffer[BUFFER_SIZE];
     struct sockaddr_storage src_addr;
     socklen_t src_addr_size = sizeof(src_addr);
 
-    ssize_t recv_length = recvfrom(udp, buffer, BUFFER_SIZE - 1, 0, (struct sockaddr*) &src_addr, &src_addr_size);
+    ssize_t recv_length = TransportRecv(node->transport, buffer, BUFFER_SIZE - 1, &src_addr, &src_addr_size);
     if (recv_length < 0) {
-        return;
+        NodeError(node, COMM_ERR_TRANSPORT, "Receive failed: %s", strerror((int) -recv_length));
+    }
+    if (recv_length <= 0) {
+        return (int) recv_length;
     }
+    Trace(TRACE_RECV, src_addr.ss_family, -1, (uint64_t) recv_length, 0);
+    // policing first, a flood must not get as far as the peer table or replies
+    if (!RateAllow(&node->ratelimit, &src_addr, PeekMessageType(buffer, recv_length), MonotonicUs())) {
+        return 1;
+    }
+
     buffer[recv_length] = '\0';
-    int msg_type = Deencapsulate(buffer, recv_length);
-    size_t msg_length = strlen(buffer);
+    FrameInfo frame;
+    int msg_type = Deencapsulate(buffer, recv_length, &frame);
+    size_t msg_length = frame.payload_length;
 
     // debug things
     // printf("Received message of type: %i\n", msg_type);
     // printf("Contents: %s\n", buffer);
 
+    if (msg_type >= 0 && msg_type < MESSAGE_TYPES) {
+        node->stats.rx_by_type[msg_type]++;
+        if (frame.version == WIRE_V1) {
+            node->stats.rx_v1++;
+        }
+    }
+
+    uint64_t dispatch_start = TraceNow();
+    long int sender = -1;
+    if (msg_type > SCAN_RESPONSE) {  // scans (re)register the sender themselves
+        sender = FindSender(node, &frame, &src_addr);
+        if (sender >= 0 && node->peers[sender].wire_version != frame.version) {
+            PeerWriteBegin(&node->peers[sender]);
+            node->peers[sender].wire_version = frame.version;
+            PeerWriteEnd(&node->peers[sender]);
+        }
+    }
+
     switch (msg_type) {
         case SCAN:
             // send SCAN_RESPONSE and add to peers
             ProcessMessageScan(
-                udp,
-                user_identifier,
-                peers,
-                peers_size,
+                node,
                 buffer,
                 msg_length,
                 &src_addr,
-                src_addr_size);
+                src_addr_size,
+                &frame);
             break;
         case SCAN_RESPONSE:
             ProcessMessageScanResponse(
-                peers,
-                peers_size,
+                node,
                 buffer,
                 msg_length,
-                &src_addr);
+                &src_addr,
+                &frame);
             break;
         case CLEARTEXT_MESSAGE:
-            ProcessMessageCleartext(
-                peers,
-                peers_size,
-                buffer,
-                &src_addr);
+            if (SecureAcceptCleartext(node)) {
+                ProcessMessageCleartext(
+                    node,
+                    sender,
+                    buffer,
+                    msg_length,
+                    &src_addr);
+            }
             break;
         case DISCONNECT:
             ProcessMessageDisconnect(
-                peers,
-                peers_size,
+                node,
+                sender);
+            break;
+        case CHANNEL_MESSAGE:
+            ProcessMessageChannel(
+                node,
+                sender,
+                buffer,
+                msg_length,
                 &src_addr);
             break;
+        case PING:
+            ProcessMessagePing(
+                node,
+                buffer,
+                msg_length,
+                &src_addr,
+                src_addr_size,
+                &frame);
+            break;
+        case PONG:
+            ProcessMessagePong(
+                node,
+                sender,
+                buffer,
+                msg_length,
+                &src_addr);
+            break;
+        case GOSSIP:
+            ProcessMessageGossip(
+                node,
+                sender,
+                buffer,
+                msg_length,
+                &src_addr,
+                src_addr_size,
+                &frame);
+            break;
+        case BATCH:
+            if (SecureAcceptCleartext(node)) {
+                ProcessMessageBatch(
+                    node,
+                    sender,
+                    buffer,
+                    msg_length,
+                    &src_addr);
+            }
+            break;
+        case ENCRYPTED_MESSAGE:
+            ProcessMessageEncrypted(
+                node,
+                sender,
+                buffer,
+                msg_length,
+                &src_addr,
+                src_addr_size);
+            break;
         default:
-            return;
+            node->stats.rx_invalid++;
+            break;
     }
+    TraceSpan(dispatch_start, TRACE_DISPATCH, (unsigned int) msg_type, sender, msg_length);
+    return 1;
 }
 
-int SendScan(int udp4, int udp6, int ifindex, const char* user_identifier) {
-    const struct sockaddr *dest_addr;
-    size_t msg_length;
-
-    char msg[512];
-    if (strlen(user_identifier) > sizeof(msg)) {
-        fprintf(stderr, "[FAIL] Scan attempted to send excessively long user identifier\n");
-        exit(-1);
-    }
-    snprintf(msg, sizeof(msg), "%s", user_identifier);
-
-    long int encap_length;
-    const enum MessageType msg_type = SCAN;
-    if ((encap_length = Encapsulate(msg_type, msg, sizeof(msg))) < 0) {
-        fprintf(stderr, "[FAIL] Scan: failed to encapsulate message, error %li\n", encap_length);
-        return -1;
+// Unicast scan, for nodes beyond multicast reach.
+int SendScanTo(Node *node, const struct sockaddr *dest_addr, socklen_t dest_addr_size) {
+    ssize_t result = OutSendBuf(node, -1, OUT_CONTROL, node->announce.scan, dest_addr, dest_addr_size);
+    if (result < 0) {
+        NodeError(node, COMM_ERR_SCAN, "Scan failed: %s", strerror((int) -result));
+        return -2;
     }
-    msg_length = (size_t) encap_length;
-
-    if (udp4 >= 0) {
-        struct sockaddr_in ipv4_addr;
-        memset(&ipv4_addr, 0, sizeof(ipv4_addr));
-        ipv4_addr.sin_family = AF_INET;
-        ipv4_addr.sin_port = htons(PORT);
-        if (inet_pton(AF_INET, MCAST_GROUP, &ipv4_addr.sin_addr) <= 0) {
-            fprintf(stderr, "[FAIL] Scan failed during IPv4 address preparation\n");
-            exit(-1);
-        }
+    return 0;
+}
 
-        dest_addr = (const struct sockaddr *)&ipv4_addr;
-        if (sendto(udp4, msg, msg_length, 0, dest_addr, sizeof(ipv4_addr)) < 0) {
-            perror("[WARN] Scan failed for IPv4");
-        }
+// One frame for both groups, see announce.h.
+int SendScan(Node *node) {
+    Transport *t = node->transport;
+    Announcements *a = &node->announce;
+    ssize_t result;
+    if (t->has_inet4
+        && (result = OutSendBuf(node, -1, OUT_CONTROL, a->scan, (struct sockaddr *) &a->group4, sizeof(a->group4))) < 0) {
+        NodeError(node, COMM_ERR_SCAN, "Scan failed for IPv4: %s", strerror((int) -result));
     }
-
-    if (udp6 >= 0) {
-        struct sockaddr_in6 ipv6_addr;
-        memset(&ipv6_addr, 0, sizeof(ipv6_addr));
-        ipv6_addr.sin6_family = AF_INET6;
-        ipv6_addr.sin6_port = htons(PORT);
-        ipv6_addr.sin6_scope_id = ifindex;
-        if (inet_pton(AF_INET6, MCAST6_GROUP, &ipv6_addr.sin6_addr) <= 0) {
-            fprintf(stderr, "[FAIL] Scan failed during IPv6 address preparation\n");
-            exit(-1);
-        }
-
-        dest_addr = (const struct sockaddr *)&ipv6_addr;
-        if (sendto(udp6, msg, msg_length, 0, dest_addr, sizeof(ipv6_addr)) < 0) {
-            perror("[WARN] Scan failed for IPv6");
-        }
+    if (t->has_inet6
+        && (result = OutSendBuf(node, -1, OUT_CONTROL, a->scan, (struct sockaddr *) &a->group6, sizeof(a->group6))) < 0) {
+        NodeError(node, COMM_ERR_SCAN, "Scan failed for IPv6: %s", strerror((int) -result));
     }
-
     return 0;
 }
 
-int SendScanResponse(int udp, const char *user_identifier, struct sockaddr_storage* src_addr, socklen_t src_addr_size) {
-    char msg[512];
-    size_t msg_length;
-
-    if (strlen(user_identifier) > sizeof(msg)) {
-        fprintf(stderr, "[FAIL] Scan Response attempted to send excessively long user identifier\n");
-        exit(-1);
-    }
-    snprintf(msg, sizeof(msg), "%s", user_identifier);
-
-    long int encap_length;
-    const enum MessageType msg_type = SCAN_RESPONSE;
-    if ((encap_length = Encapsulate(msg_type, msg, sizeof(msg))) < 0) {
-        fprintf(stderr, "[FAIL] Scan Response: failed to encapsulate message, error %li\n", encap_length);
+int SendScanResponse(Node *node, struct sockaddr_storage* src_addr, socklen_t src_addr_size, int version) {
+    MsgBuf *frame = AnnounceResponse(node, version);
+    if (frame == NULL) {
         return -1;
     }
-    msg_length = (size_t) encap_length;
-
-    int bytes_sent;
-    bytes_sent = sendto(udp, msg, msg_length, 0, (struct sockaddr*) src_addr, src_addr_size);
+    ssize_t bytes_sent = OutSendBuf(node, -1, OUT_CONTROL, frame, (struct sockaddr*) src_addr, src_addr_size);
     return (bytes_sent < 0) ? -1 : 0;
 }
 
 void ProcessMessageScan(
-    int udp,
-    const char* user_identifier,
-    Peer peers[],
-    const size_t peers_size,
+    Node *node,
     char* msg,
     size_t msg_length,
     struct sockaddr_storage* src_addr,
-    socklen_t src_addr_size
+    socklen_t src_addr_size,
+    const FrameInfo *frame
 ) {
     SendScanResponse(
-        udp,
-        user_identifier,
+        node,
         src_addr,
-        src_addr_size);
+        src_addr_size,
+        frame->version);
 
-    char src_user_identifier[320];
-    size_t copy_len = msg_length < 320 ? msg_length : 320;
-    memcpy(src_user_identifier, msg, copy_len);
-    src_user_identifier[copy_len] = '\0';
-    if (src_addr->ss_family == AF_INET) {
-        struct sockaddr_in *addr4 = (struct sockaddr_in *)src_addr;
-        SetPeerInet4(peers, peers_size, &addr4->sin_addr, src_user_identifier);
-    } else if (src_addr->ss_family == AF_INET6) {
-        struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)src_addr;
-        SetPeerInet6(peers, peers_size, &addr6->sin6_addr, src_user_identifier);
-    }
-    return;
+    ProcessMessageScanResponse(node, msg, msg_length, src_addr, frame);
 }
 
 void ProcessMessageScanResponse(
-    Peer peers[],
-    const size_t peers_size,
+    Node *node,
     char* msg,
     size_t msg_length,
-    struct sockaddr_storage* src_addr
+    struct sockaddr_storage* src_addr,
+    const FrameInfo *frame
 ) {
-    char src_user_identifier[320];
-    size_t copy_len = msg_length < 320 ? msg_length : 320;
-    memcpy(src_user_identifier, msg, copy_len);
-    src_user_identifier[copy_len] = '\0';
+    // the key follows the identifier's NUL, taken before the cut below
+    uint8_t public_key[X25519_KEY_SIZE];
+    const uint8_t *announced_key = SecureScanKey(msg, msg_length, public_key) == 0 ? public_key : NULL;
+    // Deencapsulate() NUL-terminated the payload in the receive buffer already
+    if (msg_length > 319) {
+        msg[319] = '\0';
+    }
+    const char *src_user_identifier = msg;
+    long int location = -1;
     if (src_addr->ss_family == AF_INET) {
         struct sockaddr_in *addr4 = (struct sockaddr_in *)src_addr;
-        SetPeerInet4(peers, peers_size, &addr4->sin_addr, src_user_identifier);
+        location = UpdatePeer(node, &addr4->sin_addr, NULL, src_user_identifier, COMM_PEER_FOUND, announced_key);
     } else if (src_addr->ss_family == AF_INET6) {
         struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)src_addr;
-        SetPeerInet6(peers, peers_size, &addr6->sin6_addr, src_user_identifier);
+        location = UpdatePeer(node, NULL, &addr6->sin6_addr, src_user_identifier, COMM_PEER_FOUND, announced_key);
+    }
+    if (location < 0) {
+        return;
+    }
+    Peer *p = &node->peers[location];
+    int new_run = frame->token != 0 && p->session_token != frame->token;
+    if (announced_key == NULL && (new_run || p->keys.status != KEYS_READY)) {
+        // a keyless scan from the same run is not the peer taking its key back
+        SecurePeerKey(node, (size_t) location, NULL);
+    }
+    PeerWriteBegin(p);
+    p->wire_version = frame->version;
+    if (new_run) {
+        p->session_token = frame->token;
+        memset(&p->swim, 0, sizeof(p->swim));  // a new run starts over at incarnation 0
+    }
+    PeerWriteEnd(p);
+    if (new_run) {
+        SessionRegister(&node->sessions, node->peers, node->peers_size, frame->token, (size_t) location);
+    }
+    if (p->swim.status == SWIM_NONE) {
+        GossipMemberSeen(node, (size_t) location);
+        GossipSync(node, (size_t) location);
     }
-    return;
 }
 
 void ProcessMessageCleartext(
-    Peer peers[],
-    const size_t peers_size,
+    Node *node,
+    long int peer_id,
     char* msg,
+    size_t msg_length,
     struct sockaddr_storage* remote_addr
 ) {
-    size_t id;
-    if (remote_addr->ss_family == AF_INET) {
-        struct sockaddr_in *addr4 = (struct sockaddr_in *)remote_addr;
-        long int location = FindByInet4(peers, peers_size, &addr4->sin_addr);
-        if (location >= 0) {
-            id = (size_t) location;
-        } else {
-            char ip_str[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &(addr4->sin_addr), ip_str, sizeof(ip_str));;
-            printf("UNKNOWN USER (%s): %s\n", ip_str, msg);
-            return;
-        }
+    if (node->on_message != NULL) {
+        node->on_message(node, peer_id, remote_addr, NULL, msg, msg_length, node->hook_arg);
+    } else {
+        PrintReceivedMessage(node, peer_id, remote_addr, NULL, msg);
+    }
+}
+
+void PrintReceivedMessage(
+    Node *node,
+    long int peer_id,
+    const struct sockaddr_storage *remote_addr,
+    const char *channel,
+    const char *msg
+) {
+    if (channel != NULL) {
+        printf("#%s ", channel);
+    }
+    if (peer_id >= 0) {
+        printf("[%li] %s: %s\n", peer_id, node->peers[peer_id].user_identifier, msg);
+    } else if (remote_addr->ss_family == AF_INET) {
+        const struct sockaddr_in *addr4 = (const struct sockaddr_in *)remote_addr;
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(addr4->sin_addr), ip_str, sizeof(ip_str));
+        printf("UNKNOWN USER (%s): %s\n", ip_str, msg);
     } else if (remote_addr->ss_family == AF_INET6) {
-        struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)remote_addr;
-        long int location = FindByInet6(peers, peers_size, &addr6->sin6_addr);
-        if (location >= 0) {
-            id = (size_t) location;
-        } else {
-            char ip_str[INET6_ADDRSTRLEN];
-            inet_ntop(AF_INET6, &(addr6->sin6_addr), ip_str, sizeof(ip_str));
-            printf("UNKNOWN USER (%s): %s\n", ip_str, msg);
-            return;
-        }
+        const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *)remote_addr;
+        char ip_str[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, &(addr6->sin6_addr), ip_str, sizeof(ip_str));
+        printf("UNKNOWN USER (%s): %s\n", ip_str, msg);
+    }
+}
+
+void ProcessMessageDisconnect(
+    Node *node,
+    long int peer_id
+) {
+    if (peer_id < 0) {
+        return;
+    }
+    GossipMemberLeft(node, (size_t) peer_id);
+    DropPeer(node, (size_t) peer_id, COMM_PEER_LEFT);
+}
+
+void NodeError(Node *node, int error, const char *format, ...) {
+    char detail[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(detail, sizeof(detail), format, args);
+    va_end(args);
+    Trace(TRACE_ERROR, (unsigned int) error, -1, 0, 0);
+    if (node->on_error != NULL) {
+        node->on_error(node, error, detail, node->hook_arg);
+    } else {
+        int fatal = error == COMM_ERR_OPEN || error == COMM_ERR_SEND || error == COMM_ERR_PUBLISH;
+        fprintf(stderr, "[%s] %s\n", fatal ? "FAIL" : "WARN", detail);
+    }
+}
+
+static void PeerAdded(Node *node, size_t id, int reason) {
+    Trace(TRACE_PEER_INSERT, (unsigned int) reason, (long int) id, 0, 0);
+    if (node->on_peer_added != NULL) {
+        node->on_peer_added(node, (long int) id, node->peers[id].user_identifier, reason, node->hook_arg);
     } else {
+        printf("PEER LIST CHANGED: Added/changed [%zu]: %s\n", id, node->peers[id].user_identifier);
+    }
+}
+
+static void PeerRemoved(Node *node, size_t id, const char *user_identifier, int reason) {
+    Trace(TRACE_PEER_EVICT, (unsigned int) reason, (long int) id, 0, 0);
+    if (node->on_peer_removed != NULL) {
+        node->on_peer_removed(node, (long int) id, user_identifier, reason, node->hook_arg);
         return;
     }
-    printf("[%li] %s: %s\n", id, peers[id].user_identifier, msg);
+    if (reason == COMM_PEER_LEFT) {
+        printf("PEER LIST CHANGED: Disconnect request from peer [%zu]: %s\n", id, user_identifier);
+    } else if (reason == COMM_PEER_FAILED) {
+        printf("PEER LIST CHANGED: Peer [%zu] %s failed\n", id, user_identifier);
+    }
+    printf("PEER LIST CHANGED: Removed peer [%zu]: %s\n", id, user_identifier);
 }
 
-void ProcessMessageDisconnect(
-    Peer peers[],
-    const size_t peers_size,
-    struct sockaddr_storage* remote_addr
+// Records a sighting of user_identifier at addr4 and/or addr6 (either may be
+// NULL), with the public key it announced (or NULL). A peer whose only
+// address moves to the newcomer is dropped. Returns the slot, -1 if it could
+// not be stored.
+long int UpdatePeer(
+    Node *node,
+    const struct in_addr *addr4,
+    const struct in6_addr *addr6,
+    const char *user_identifier,
+    int reason,
+    const uint8_t *public_key
 ) {
-    size_t id;
-    if (remote_addr->ss_family == AF_INET) {
-        struct sockaddr_in *addr4 = (struct sockaddr_in *)remote_addr;
-        long int location = FindByInet4(peers, peers_size, &addr4->sin_addr);
-        if (location >= 0) {
-            id = (size_t) location;
+    long int known = FindByUserIdentifier(node->peers, node->peers_size, user_identifier);
+    long int location = -1;
+    for (unsigned int family = 0; family < 2; family++) {
+        struct in_addr a4;
+        struct in6_addr a6;
+        long int previous;
+        if (family == 0 && addr4 != NULL) {
+            a4 = *addr4;
+            previous = FindByInet4(node->peers, node->peers_size, &a4);
+        } else if (family == 1 && addr6 != NULL) {
+            a6 = *addr6;
+            previous = FindByInet6(node->peers, node->peers_size, &a6);
         } else {
-            return;
+            continue;
         }
-    } else if (remote_addr->ss_family == AF_INET6) {
-        struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)remote_addr;
-        long int location = FindByInet6(peers, peers_size, &addr6->sin6_addr);
-        if (location >= 0) {
-            id = (size_t) location;
+        Peer previous_peer;  // its keys can still open what is queued for it
+        if (previous >= 0) {
+            previous_peer = node->peers[previous];
+        }
+
+        if (family == 0) {
+            SetPeerInet4(node->peers, node->peers_size, &a4, user_identifier);
         } else {
-            return;
+            SetPeerInet6(node->peers, node->peers_size, &a6, user_identifier);
         }
-    } else {
-        return;
+
+        if (previous >= 0 && previous_peer.user_identifier[0] != '\0'
+            && node->peers[previous].user_identifier[0] == '\0') {
+            OutboxSalvage(node, (size_t) previous, &previous_peer);
+            OutDropPeer(&node->outq, (size_t) previous);
+            PeerRemoved(node, (size_t) previous, previous_peer.user_identifier, COMM_PEER_REPLACED);
+        }
+        if (location < 0) {
+            location = FindByUserIdentifier(node->peers, node->peers_size, user_identifier);
+        }
+    }
+    int keyed = location >= 0 && public_key != NULL && SecurePeerKey(node, (size_t) location, public_key) > 0;
+    if (known < 0 && location >= 0) {
+        PeerAdded(node, (size_t) location, reason);
+        OutboxFlush(node, (size_t) location);
+    } else if (keyed) {
+        OutboxFlush(node, (size_t) location);  // required mode held these back
+    }
+    return location;
+}
+
+// Forgets a peer along with everything cached for it. Queued messages move
+// to the outbox unless the application dropped the peer itself.
+void DropPeer(Node *node, size_t id, int reason) {
+    char user_identifier[sizeof(node->peers[id].user_identifier)];
+    memcpy(user_identifier, node->peers[id].user_identifier, sizeof(user_identifier));
+    SendCacheForgetPeer(&node->send_cache, &node->peers[id]);
+    if (reason != COMM_PEER_DROPPED) {
+        OutboxSalvage(node, id, &node->peers[id]);
     }
-    printf("PEER LIST CHANGED: Disconnect request from peer [%li]: %s\n", id, peers[id].user_identifier);
-    RemovePeerAddressAtPosition(peers, peers_size, id, 1, 1);
+    OutDropPeer(&node->outq, id);
+    RemovePeerAddressAtPosition(node->peers, node->peers_size, id, 1, 1);
+    PeerRemoved(node, id, user_identifier, reason);
 }
 
 
-// TODO(.): Rework SendMsg and SendDisconnect to try using the other IP version if preffered fails.
-int SendMsg(int udp4, int udp6, char* cmd, Peer peers[], size_t peers_size) {
+int SendMsg(Node *node, char* cmd) {
     char *data = cmd + 6;
 
     char *token = strtok(data, " ");
@@ -304,111 +613,131 @@ int SendMsg(int udp4, int udp6, char* cmd, Peer peers[], size_t peers_size) {
     }
 
     size_t id = (size_t)strtoul(token, NULL, 10);
-    if (id >= peers_size) {
-        fprintf(stderr, "[FAIL] Could not send - invalid Peer ID\n");
-        return -2;
+    char *message = strtok(NULL, "");
+    if (!message || *message == '\0') {
+        printf("[FAIL] Could not send - message not found.\n");
+        return -4;
     }
-    if (memcmp(&peers[id], (const uint8_t[sizeof(Peer)]){0}, sizeof(Peer)) == 0) {
+
+    int ret = SendMsgToPeer(node, id, message, strlen(message));
+    if (ret == 1) {
+        printf("Peer unreachable, the message waits in the outbox.\n");
+    } else if (ret == -2) {
+        fprintf(stderr, "[FAIL] Could not send - invalid Peer ID\n");
+    } else if (ret == -3) {
         fprintf(stderr, "[FAIL] Could not send - invalid Peer\n");
-        return -3;
     }
+    return ret;
+}
 
+// args is "USER@HOST MESSAGE", the part after "/sendto ".
+int SendMsgTo(Node *node, char *args) {
+    char *identifier = strtok(args, " ");
     char *message = strtok(NULL, "");
-    if (!message || *message == '\0') {
-        printf("[FAIL] Could not send - message not found.\n");
+    if (identifier == NULL || message == NULL || *message == '\0') {
+        printf("Usage: /sendto [USER@HOST] [MESSAGE]\n");
         return -4;
     }
+    int ret = SendMsgToIdentifier(node, identifier, message, strlen(message));
+    if (ret == 1) {
+        printf("%s is not reachable, the message waits in the outbox.\n", identifier);
+    } else if (ret == -3) {
+        fprintf(stderr, "[FAIL] Could not send - %s unknown and the outbox is off or full\n", identifier);
+    }
+    return ret;
+}
 
-    char msg_buf[2048];
-    memset(&msg_buf, 0, sizeof(msg_buf));
-    size_t message_len = strlen(message);
-    size_t copy_len = message_len < sizeof(msg_buf) - 1 ? message_len : sizeof(msg_buf) - 1;
-    memcpy(msg_buf, message, copy_len);
-    msg_buf[copy_len] = '\0';
-
-    const enum MessageType msg_type = CLEARTEXT_MESSAGE;
-    long int encap_length = 0;
-    if ((encap_length = Encapsulate(msg_type, msg_buf, sizeof(msg_buf))) < 0) {
-        fprintf(stderr, "[FAIL] SendMsg: failed to encapsulate message, error %li\n", encap_length);
-        return -7;
-    }
-    message_len = (size_t) encap_length;
-
-    long int result = 0;
-    if (peers[id].inet4.seen > peers[id].inet6.seen) {  // 4.seen > 0 so addr is set, use IPv4
-        struct sockaddr_in remote;
-        memset(&remote, 0, sizeof(remote));
-        remote.sin_family = AF_INET;
-        remote.sin_addr = peers[id].inet4.addr4;
-        remote.sin_port = htons(PORT);
-        if ((result = sendto(udp4, msg_buf, message_len, 0, (struct sockaddr *)&remote, sizeof(remote))) < 0) {
-            perror("[FAIL] IPv4: Could not send");
-        }
+int SendMsgToPeer(Node *node, size_t id, const char *message, size_t message_len) {
+    Peer *peers = node->peers;
+
+    if (id >= node->peers_size) {
+        return -2;
+    }
+    if (!PeerInUse(&peers[id])) {
+        return -3;
+    }
+    if (message_len == 0) {
+        return -4;
     }
 
-    if (result <= 0 &&peers[id].inet6.seen != 0) {  // 6.seen != 0, so addr is set, use IPv6
-        struct sockaddr_in6 remote;
-        memset(&remote, 0, sizeof(remote));
-        remote.sin6_family = AF_INET6;
-        remote.sin6_addr = peers[id].inet6.addr6;
-        remote.sin6_port = htons(PORT);
-        if (sendto(udp6, msg_buf, message_len, 0, (struct sockaddr *)&remote, sizeof(remote)) < 0) {
-            perror("[FAIL] IPv6: Could not send");
-            return -6;
-        }
-    } else {  // I don't think this should ever happen
-        printf("[FAIL] Could not send - Peer has no associated IPv4/IPv6 address. Somehow.\n");
+    size_t copy_len = message_len < MESSAGE_MAX_LENGTH ? message_len : MESSAGE_MAX_LENGTH;
+    int result = PathSend(node, id, CLEARTEXT_MESSAGE, message, copy_len);
+    if (result == -1) {  // I don't think this should ever happen
+        NodeError(node, COMM_ERR_SEND, "Could not send - Peer has no associated IPv4/IPv6 address. Somehow.");
+        node->stats.send_errors++;
         return -5;
+    } else if (result == -4) {
+        NodeError(node, COMM_ERR_SEND, "Could not send - send queue full");
+        node->stats.send_errors++;
+        return -8;
+    } else if (result < 0) {
+        if (OutboxStore(&node->outbox, peers[id].user_identifier, message, copy_len, MonotonicUs()) == 0) {
+            return 1;  // goes out once the peer is back, or has a key
+        }
+        NodeError(node, COMM_ERR_SEND, result == -6 ? "Could not send - no session key with peer yet"
+                                                    : "Could not send - no working path to peer");
+        node->stats.send_errors++;
+        return -6;
     }
+    node->stats.msgs_sent++;
     return 0;
 }
 
-int SendDisconnect(int udp4, int udp6, Peer peers[], size_t peers_size, size_t id) {
-    if (id >= peers_size) {
+// SendMsgToPeer() by identifier, for peers that may have left the table.
+// Unknown identifiers go to the outbox (1), -3 if it is off or full.
+int SendMsgToIdentifier(Node *node, const char *user_identifier, const char *message, size_t message_len) {
+    long int id = FindByUserIdentifier(node->peers, node->peers_size, user_identifier);
+    if (id >= 0) {
+        return SendMsgToPeer(node, (size_t) id, message, message_len);
+    } else if (message_len == 0) {
+        return -4;
+    }
+    size_t copy_len = message_len < MESSAGE_MAX_LENGTH ? message_len : MESSAGE_MAX_LENGTH;
+    return OutboxStore(&node->outbox, user_identifier, message, copy_len, MonotonicUs()) == 0 ? 1 : -3;
+}
+
+// frame is a prepared DISCONNECT for the peer's wire version, or NULL.
+static int SendDisconnectFrame(Node *node, size_t id, MsgBuf *frame) {
+    Peer *peers = node->peers;
+    if (id >= node->peers_size) {
         return -1;
-    } else if (memcmp(&peers[id], (const uint8_t[sizeof(Peer)]){0}, sizeof(Peer)) == 0) {
+    } else if (!PeerInUse(&peers[id])) {
         return -2;
     }
 
-    char msg_buf[2];
-    size_t message_len;
-    const enum MessageType msg_type = DISCONNECT;
-    long int encap_length = 0;
-    if ((encap_length = Encapsulate(msg_type, msg_buf, sizeof(msg_buf))) < 0) {
-        fprintf(stderr, "[FAIL] Disconnect: failed to encapsulate message, error %li\n", encap_length);
-        return -7;
-    }
-    message_len = (size_t) encap_length;
-
-    long int result = 0;
-    if (peers[id].inet4.seen > peers[id].inet6.seen) {
-        struct sockaddr_in remote;
-        memset(&remote, 0, sizeof(remote));
-        remote.sin_family = AF_INET;
-        remote.sin_addr = peers[id].inet4.addr4;
-        remote.sin_port = htons(PORT);
-        result = sendto(udp4, msg_buf, message_len, 0, (struct sockaddr *)&remote, sizeof(remote));
-    }
-
-    if (result <= 0 && peers[id].inet6.seen != 0) {
-        struct sockaddr_in6 remote;
-        memset(&remote, 0, sizeof(remote));
-        remote.sin6_family = AF_INET6;
-        remote.sin6_addr = peers[id].inet6.addr6;
-        remote.sin6_port = htons(PORT);
-        result = sendto(udp6, msg_buf, message_len, 0, (struct sockaddr *)&remote, sizeof(remote));
-    } else {  // shouldn't happen
-        printf("[FAIL] Could not send disconnect - Peer has no associated IPv4/IPv6 address. Somehow.\n");
+    int result = frame != NULL ? PathSendFrame(node, id, DISCONNECT, frame) : PathSend(node, id, DISCONNECT, NULL, 0);
+    if (result == -1) {  // shouldn't happen
+        NodeError(node, COMM_ERR_SEND, "Could not send disconnect - Peer has no associated IPv4/IPv6 address. Somehow.");
         return -3;
+    } else if (result < 0) {
+        NodeError(node, COMM_ERR_SEND, "Could not send disconnect");
     }
-    if (result <= 0) {
-        perror("[FAIL] Could not send disconnect");
-    }
+    SendCacheForgetPeer(&node->send_cache, &peers[id]);
     return 0;
 }
 
-void SendDisconnectToAll(int udp4, int udp6, Peer peers[], size_t peers_size) {
-    for (size_t i = 0; i < peers_size; i++) {
-        SendDisconnect(udp4, udp6, peers, peers_size, i);
+int SendDisconnect(Node *node, size_t id) {
+    return SendDisconnectFrame(node, id, NULL);
+}
+
+void SendDisconnectToAll(Node *node) {
+    // the frame only differs by wire version, every peer queues the same one
+    MsgBuf *frames[WIRE_V2 + 1] = {NULL};
+    for (size_t i = 0; i < node->peers_size; i++) {
+        if (node->peers[i].user_identifier[0] == '\0') {
+            continue;
+        }
+        int version = PeerWireVersion(node, &node->peers[i]);
+        if (version != WIRE_V1 && version != WIRE_V2) {
+            SendDisconnectFrame(node, i, NULL);
+            continue;
+        }
+        if (frames[version] == NULL) {
+            frames[version] = EncodeFrame(node, version, DISCONNECT, NULL, 0);
+        }
+        SendDisconnectFrame(node, i, frames[version]);
+    }
+    for (unsigned int v = 0; v <= WIRE_V2; v++) {
+        MsgBufPut(&node->pool, frames[v]);
     }
 }
@@ -3,50 +3,122 @@
 #define SRC_NET_FUNC_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 
+#include "msgbuf.h"
+#include "node.h"
 #include "peer.h"
+#include "transport.h"
+
+#define LISTEN_BUDGET 64  // datagrams handled per ListenUDP call
 
 enum MessageType {
     SCAN,
     SCAN_RESPONSE,
     CLEARTEXT_MESSAGE,
     DISCONNECT,
+    CHANNEL_MESSAGE,
+    PING,
+    PONG,
+    GOSSIP,
+    BATCH,  // outbox backlog, several CLEARTEXT_MESSAGEs (outbox.h)
+    ENCRYPTED_MESSAGE,  // a sealed CLEARTEXT_MESSAGE or BATCH (secure.h)
 };
+#define MESSAGE_TYPE_MAX ENCRYPTED_MESSAGE  // the socket filter drops frames of higher types
+
+// Wire format. v1 frames are a bare u16 (crc12 << 4 | type), the CRC was
+// never filled in, so their first byte is always 0x00. v2 frames start with
+// WIRE_VERSION_MARK | version and are sniffed on that:
+//     u8 0xC0 | version | u8 type | u8 flags | u8 header_words
+//     | u16 payload_length | u16 reserved | u32 sender_session_token
+//     | extensions[(header_words - 3) * 4] | payload[payload_length]
+// header_words counts 4-byte words, receivers skip extensions they don't
+// know. The session token is random per run and announced with every frame,
+// receivers learn it from SCAN/SCAN_RESPONSE and resolve senders by it.
+#define WIRE_V1 1
+#define WIRE_V2 2
+#define WIRE_VERSION_MARK 0xC0
+#define WIRE_V1_HEADER_SIZE 2
+#define WIRE_V2_HEADER_SIZE 12
+#define WIRE_HEADER_MAX WIRE_V2_HEADER_SIZE  // what we send, we accept longer
+#define MESSAGE_MAX_LENGTH (MSGBUF_SIZE - WIRE_HEADER_MAX - SECURE_OVERHEAD)  // longer ones are cut
 
-long int Encapsulate(const enum MessageType msg_type, char* msg, const size_t buf_size);
-int Deencapsulate(char* msg, ssize_t msg_length);
-void ListenUDP(int udp, Peer peers[], const size_t peers_size, const char* user_identifier);
-int SendScan(int udp4, int udp6, int ifindex, const char *user_identifier);
-int SendScanResponse(int udp, const char *user_identifier, struct sockaddr_storage* src_addr, socklen_t src_addr_size);
+typedef struct FrameInfo {
+    uint8_t version;
+    uint8_t flags;
+    uint32_t token;  // 0 = none (v1)
+    size_t payload_length;
+} FrameInfo;
+
+long int EncodeFrameHeader(
+    uint8_t *header,
+    size_t header_size,
+    int version,
+    uint32_t token,
+    const enum MessageType msg_type,
+    size_t payload_length);
+void SetFramePayloadLength(uint8_t *header, size_t payload_length);
+MsgBuf *EncodeFrame(Node *node, int version, const enum MessageType msg_type, const char *msg, size_t msg_length);
+long int EncapsulateFrame(
+    const Node *node,
+    int version,
+    const enum MessageType msg_type,
+    char* msg,
+    size_t msg_length,
+    const size_t buf_size);
+int Deencapsulate(char* msg, ssize_t msg_length, FrameInfo *frame);
+long int FindSender(Node *node, const FrameInfo *frame, const struct sockaddr_storage *src_addr);
+int PeerWireVersion(const Node *node, const Peer *p);
+void ListenUDP(Node *node);
+int ListenUDPOnce(Node *node);
+int SendScan(Node *node);
+int SendScanTo(Node *node, const struct sockaddr *dest_addr, socklen_t dest_addr_size);
+int SendScanResponse(Node *node, struct sockaddr_storage* src_addr, socklen_t src_addr_size, int version);
 void ProcessMessageScan(
-    int udp,
-    const char* user_idenitifer,
-    Peer peers[],
-    const size_t peers_size,
+    Node *node,
     char* msg,
     size_t msg_length,
     struct sockaddr_storage* src_addr,
-    socklen_t src_addr_size
+    socklen_t src_addr_size,
+    const FrameInfo *frame
 );
 void ProcessMessageScanResponse(
-    Peer peers[],
-    const size_t peers_size,
+    Node *node,
     char* msg,
     size_t msg_length,
-    struct sockaddr_storage* src_addr
+    struct sockaddr_storage* src_addr,
+    const FrameInfo *frame
 );
 void ProcessMessageCleartext(
-    Peer peers[],
-    const size_t peers_size,
+    Node *node,
+    long int peer_id,
     char* msg,
+    size_t msg_length,
     struct sockaddr_storage* remote_addr
 );
+void PrintReceivedMessage(
+    Node *node,
+    long int peer_id,
+    const struct sockaddr_storage *remote_addr,
+    const char *channel,
+    const char *msg);
 void ProcessMessageDisconnect(
-    Peer peers[],
-    const size_t peers_size,
-    struct sockaddr_storage* remote_addr
+    Node *node,
+    long int peer_id
 );
-int SendMsg(int udp4, int udp6, char* cmd, Peer peers[], size_t peers_size);
-int SendDisconnect(int udp4, int udp6, Peer peers[], size_t peers_size, size_t id);
-void SendDisconnectToAll(int udp4, int udp6, Peer peers[], size_t peers_size);
+void NodeError(Node *node, int error, const char *format, ...) __attribute__((format(printf, 3, 4)));
+long int UpdatePeer(
+    Node *node,
+    const struct in_addr *addr4,
+    const struct in6_addr *addr6,
+    const char *user_identifier,
+    int reason,
+    const uint8_t *public_key);
+void DropPeer(Node *node, size_t id, int reason);
+int SendMsg(Node *node, char* cmd);
+int SendMsgTo(Node *node, char *args);
+int SendMsgToPeer(Node *node, size_t id, const char *message, size_t message_len);
+int SendMsgToIdentifier(Node *node, const char *user_identifier, const char *message, size_t message_len);
+int SendDisconnect(Node *node, size_t id);
+void SendDisconnectToAll(Node *node);
 #endif  // SRC_NET_FUNC_H_
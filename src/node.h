@@ -0,0 +1,78 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_NODE_H_
+#define SRC_NODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "announce.h"
+#include "c_comm.h"
+#include "channel.h"
+#include "gossip.h"
+#include "msgbuf.h"
+#include "outbox.h"
+#include "outq.h"
+#include "peer.h"
+#include "ratelimit.h"
+#include "secure.h"
+#include "send_cache.h"
+#include "session.h"
+#include "transport.h"
+
+#define MESSAGE_TYPES 16  // the type nibble in the frame header
+
+typedef struct {
+    unsigned long rx_by_type[MESSAGE_TYPES];
+    unsigned long rx_v1;  // frames in the old wire format
+    unsigned long rx_invalid;
+    unsigned long rx_channel_filtered;  // channel messages for topics we are not in
+    unsigned long msgs_sent;
+    unsigned long send_errors;
+} NodeStats;
+
+// Low-latency mode state, see CommPollTimeout().
+typedef struct {
+    int cpu;  // the network thread's core, -1 = mode off
+    int pinned;
+    uint64_t last_activity_us;  // last datagram in or out
+    unsigned long last_datagrams;
+} BusyPoll;
+
+// Everything the protocol handlers need, shared by the stdin front-end and
+// the control socket. Opaque to library users (c_comm.h).
+struct Node {
+    Transport *transport;
+    Peer *peers;
+    size_t peers_size;
+    int ifindex;
+    char user_identifier[320];
+    ChannelTable channels;
+    SessionTable sessions;
+    uint32_t session_token;
+    int wire_version;  // for multicast and peers we have not heard from yet
+    SendCache send_cache;
+    MsgPool pool;
+    OutQueues outq;
+    Outbox outbox;
+    RateLimiter ratelimit;
+    GossipState gossip;
+    SecureState secure;
+    Announcements announce;
+    NodeStats stats;
+    BusyPoll busy;
+    uint32_t next_probe_nonce;
+    MessageHook on_message;
+    PeerHook on_peer_added;
+    PeerHook on_peer_removed;
+    ErrorHook on_error;
+    void *hook_arg;  // passed to every hook
+    volatile int stop;  // CommRun() returns once set
+};
+
+// CommOpen() over a transport the caller opened, such as an in-process
+// loopback endpoint, or over config->transport when NULL. The node owns the
+// transport from then on and closes it, also when opening fails.
+Node *NodeOpen(const CommConfig *config, Transport *transport);
+
+#endif  // SRC_NODE_H_
@@ -0,0 +1,322 @@
+// Copyright 2025 Michał Jankowski
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "net_func.h"
+#include "node.h"
+#include "outbox.h"
+#include "outq.h"
+#include "path.h"
+#include "peer.h"
+#include "secure.h"
+
+#define OUTBOX_MAX_MESSAGE MESSAGE_MAX_LENGTH
+
+int OutboxInit(Outbox *ob, size_t cap, unsigned int ttl_s, const char *spill_path) {
+    memset(ob, 0, sizeof(*ob));
+    ob->cap = cap;
+    ob->ttl_us = (uint64_t) ttl_s * 1000000;
+    ob->spill_fd = -1;
+    if (cap != 0 && spill_path != NULL
+        && (ob->spill_fd = open(spill_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void FreeEntries(OutboxRecipient *r) {
+    while (r->head != NULL) {
+        OutboxEntry *e = r->head;
+        r->head = e->next;
+        free(e);
+    }
+    r->tail = NULL;
+    r->count = 0;
+}
+
+void OutboxFree(Outbox *ob) {
+    for (size_t i = 0; i < ob->recipients_count; i++) {
+        FreeEntries(&ob->recipients[i]);
+    }
+    free(ob->recipients);
+    if (ob->spill_fd >= 0) {
+        close(ob->spill_fd);
+    }
+    memset(ob, 0, sizeof(*ob));
+    ob->spill_fd = -1;
+}
+
+static OutboxRecipient *FindRecipient(Outbox *ob, const char *user_identifier, int create) {
+    OutboxRecipient *unused = NULL;
+    for (size_t i = 0; i < ob->recipients_count; i++) {
+        if (strcmp(ob->recipients[i].user_identifier, user_identifier) == 0) {
+            return &ob->recipients[i];
+        } else if (unused == NULL && ob->recipients[i].count == 0) {
+            unused = &ob->recipients[i];
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (unused == NULL) {
+        if (ob->recipients_count == OUTBOX_MAX_RECIPIENTS) {
+            return NULL;
+        }
+        // grown one at a time, a node rarely has many peers away at once
+        OutboxRecipient *grown = realloc(ob->recipients, (ob->recipients_count + 1) * sizeof(OutboxRecipient));
+        if (grown == NULL) {
+            return NULL;
+        }
+        ob->recipients = grown;
+        unused = &ob->recipients[ob->recipients_count++];
+    }
+    memset(unused, 0, sizeof(*unused));
+    snprintf(unused->user_identifier, sizeof(unused->user_identifier), "%s", user_identifier);
+    return unused;
+}
+
+static size_t EntrySize(const OutboxEntry *e) {
+    return sizeof(OutboxEntry) + (e->spill_offset < 0 ? e->length : 0);
+}
+
+// Returns 0 when the message was kept, -1 when the outbox is off, -2 when
+// the message is empty or too long for a frame, -3 when it is full.
+int OutboxStore(Outbox *ob, const char *user_identifier, const char *msg, size_t msg_length, uint64_t now_us) {
+    if (ob->cap == 0) {
+        return -1;
+    } else if (msg_length == 0 || msg_length > OUTBOX_MAX_MESSAGE || user_identifier[0] == '\0') {
+        return -2;
+    }
+    OutboxRecipient *r = FindRecipient(ob, user_identifier, 1);
+    if (r == NULL) {
+        ob->dropped++;
+        return -3;
+    }
+
+    long int spill_offset = -1;
+    size_t size = sizeof(OutboxEntry) + msg_length;
+    if (ob->bytes + size > ob->cap) {
+        if (ob->spill_fd < 0 || ob->bytes + sizeof(OutboxEntry) > ob->cap
+            || ob->spill_bytes + msg_length > OUTBOX_SPILL_MAX) {
+            ob->dropped++;
+            return -3;
+        }
+        ssize_t written = write(ob->spill_fd, msg, msg_length);
+        if (written != (ssize_t) msg_length) {
+            off_t end = lseek(ob->spill_fd, 0, SEEK_END);  // a short write still moved the end
+            ob->spill_bytes = end > 0 ? (size_t) end : ob->spill_bytes;
+            ob->dropped++;
+            return -3;
+        }
+        spill_offset = (long int) ob->spill_bytes;
+        ob->spill_bytes += msg_length;
+        size = sizeof(OutboxEntry);
+    }
+
+    OutboxEntry *e = malloc(size);
+    if (e == NULL) {
+        ob->dropped++;
+        return -3;
+    }
+    e->next = NULL;
+    e->expires_us = now_us + ob->ttl_us;
+    e->spill_offset = spill_offset;
+    e->length = (uint32_t) msg_length;
+    if (spill_offset < 0) {
+        memcpy(e->msg, msg, msg_length);
+    } else {
+        ob->spill_pending++;
+        ob->spilled++;
+    }
+    if (r->tail != NULL) {
+        r->tail->next = e;
+    } else {
+        r->head = e;
+    }
+    r->tail = e;
+    r->count++;
+    ob->bytes += size;
+    ob->pending++;
+    ob->stored++;
+    return 0;
+}
+
+static void PopEntry(Outbox *ob, OutboxRecipient *r) {
+    OutboxEntry *e = r->head;
+    r->head = e->next;
+    if (r->head == NULL) {
+        r->tail = NULL;
+    }
+    r->count--;
+    ob->pending--;
+    ob->bytes -= EntrySize(e);
+    if (e->spill_offset >= 0 && --ob->spill_pending == 0 && ftruncate(ob->spill_fd, 0) == 0) {
+        ob->spill_bytes = 0;
+    }
+    free(e);
+}
+
+static int LoadMessage(const Outbox *ob, const OutboxEntry *e, char *dest) {
+    if (e->spill_offset < 0) {
+        memcpy(dest, e->msg, e->length);
+        return 0;
+    }
+    return pread(ob->spill_fd, dest, e->length, e->spill_offset) == (ssize_t) e->length ? 0 : -1;
+}
+
+// Sends the backlog for the peer now at peer_id, batched for v2 peers.
+// Stops at the first failed send, the rest waits for the next OutboxTick().
+// Returns the number of messages sent.
+int OutboxFlush(Node *node, size_t peer_id) {
+    Outbox *ob = &node->outbox;
+    const Peer *p = &node->peers[peer_id];
+    OutboxRecipient *r;
+    if (ob->pending == 0 || (r = FindRecipient(ob, p->user_identifier, 0)) == NULL) {
+        return 0;
+    }
+    int batching = PeerWireVersion(node, p) == WIRE_V2;
+    char payload[OUTBOX_MAX_MESSAGE];
+    int sent = 0;
+
+    while (r->head != NULL) {
+        size_t length = 0;
+        size_t count = 0;
+        int loaded = 0;
+        for (OutboxEntry *e = r->head; e != NULL && (batching || count == 0); e = e->next) {
+            if (length + 2 + e->length > sizeof(payload)) {
+                break;
+            }
+            if ((loaded = LoadMessage(ob, e, payload + length + 2)) < 0) {
+                break;
+            }
+            payload[length] = (char) (e->length >> 8);
+            payload[length + 1] = (char) (e->length & 0xFF);
+            length += 2 + e->length;
+            count++;
+        }
+        if (loaded < 0 && count == 0) {  // the spill file lost it
+            PopEntry(ob, r);
+            ob->dropped++;
+            continue;
+        }
+
+        int result;
+        if (count > 1) {
+            result = PathSend(node, peer_id, BATCH, payload, length);
+        } else if (count == 1) {
+            result = PathSend(node, peer_id, CLEARTEXT_MESSAGE, payload + 2, length - 2);
+        } else {  // too long to carry a length prefix, goes alone
+            if (LoadMessage(ob, r->head, payload) < 0) {
+                PopEntry(ob, r);
+                ob->dropped++;
+                continue;
+            }
+            count = 1;
+            result = PathSend(node, peer_id, CLEARTEXT_MESSAGE, payload, r->head->length);
+        }
+        if (result < 0) {
+            break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            PopEntry(ob, r);
+        }
+        ob->delivered += count;
+        ob->batches += count > 1;
+        node->stats.msgs_sent += count;
+        sent += (int) count;
+    }
+    return sent;
+}
+
+// Moves the messages still queued for a peer that is being dropped into
+// the outbox, before OutDropPeer() discards them. p is the peer as it was,
+// sealed frames are opened with its keys.
+void OutboxSalvage(Node *node, size_t peer_id, const Peer *p) {
+    OutQueues *outq = &node->outq;
+    if (node->outbox.cap == 0 || outq->queues == NULL || peer_id >= outq->count - 1) {
+        return;
+    }
+    const char *user_identifier = p->user_identifier;
+    uint64_t now_us = MonotonicUs();
+    char frame_copy[MSGBUF_SIZE + 1];
+    for (OutFrame *f = outq->queues[peer_id].lanes[OUT_BULK].head; f != NULL; f = f->next) {
+        memcpy(frame_copy, f->buf->data, f->buf->length);
+        FrameInfo frame;
+        int msg_type = Deencapsulate(frame_copy, f->buf->length, &frame);
+        if (msg_type == ENCRYPTED_MESSAGE) {
+            msg_type = SecureUnsealOwn(&p->keys, frame_copy, &frame.payload_length);
+        }
+        if (msg_type == CLEARTEXT_MESSAGE) {
+            OutboxStore(&node->outbox, user_identifier, frame_copy, frame.payload_length, now_us);
+        } else if (msg_type == BATCH) {
+            for (size_t off = 0; off + 2 <= frame.payload_length;) {
+                size_t length = ((size_t) (uint8_t) frame_copy[off] << 8) | (uint8_t) frame_copy[off + 1];
+                if (off + 2 + length > frame.payload_length) {
+                    break;
+                }
+                OutboxStore(&node->outbox, user_identifier, frame_copy + off + 2, length, now_us);
+                off += 2 + length;
+            }
+        }
+    }
+}
+
+// Expires old entries, and retries flushes for recipients that are in the
+// peer table but still have a backlog (a full send queue interrupted them).
+void OutboxTick(Node *node) {
+    Outbox *ob = &node->outbox;
+    uint64_t now_us = MonotonicUs();
+    if (ob->pending == 0 || now_us < ob->next_tick_us) {
+        return;
+    }
+    ob->next_tick_us = now_us + OUTBOX_TICK_US;
+    for (size_t i = 0; i < ob->recipients_count; i++) {
+        OutboxRecipient *r = &ob->recipients[i];
+        while (r->head != NULL && r->head->expires_us <= now_us) {  // same TTL for all, oldest first
+            PopEntry(ob, r);
+            ob->expired++;
+        }
+        if (r->count == 0) {
+            continue;
+        }
+        long int peer_id = FindByUserIdentifier(node->peers, node->peers_size, r->user_identifier);
+        if (peer_id >= 0) {
+            OutboxFlush(node, (size_t) peer_id);
+        }
+    }
+}
+
+void ProcessMessageBatch(Node *node, long int peer_id, char *msg, size_t msg_length, struct sockaddr_storage *src_addr) {
+    char part[MSGBUF_SIZE + 1];
+    size_t off = 0;
+    while (off + 2 <= msg_length) {
+        size_t length = ((size_t) (uint8_t) msg[off] << 8) | (uint8_t) msg[off + 1];
+        if (length == 0 || off + 2 + length > msg_length) {
+            break;
+        }
+        memcpy(part, msg + off + 2, length);
+        part[length] = '\0';  // printed as a string without a message hook
+        ProcessMessageCleartext(node, peer_id, part, length, src_addr);
+        off += 2 + length;
+    }
+    if (off != msg_length) {
+        node->stats.rx_invalid++;
+    }
+}
+
+void PrintOutbox(const Outbox *ob) {
+    if (ob->cap == 0) {
+        return;
+    }
+    size_t recipients = 0;
+    for (size_t i = 0; i < ob->recipients_count; i++) {
+        recipients += ob->recipients[i].count > 0;
+    }
+    printf("Outbox: %zu messages for %zu peers, %zu of %zu B (%zu spilled), "
+           "%lu delivered (%lu batches), %lu expired, %lu refused\n",
+           ob->pending, recipients, ob->bytes, ob->cap, ob->spill_pending,
+           ob->delivered, ob->batches, ob->expired, ob->dropped);
+}
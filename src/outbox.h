@@ -0,0 +1,79 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_OUTBOX_H_
+#define SRC_OUTBOX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "peer.h"
+
+// Store-and-forward for peers that are gone for a while (reboot, new DHCP
+// lease). Messages that found no working path, were still queued when their
+// peer was dropped, or were sent to an identifier not in the peer table are
+// kept here by user identifier. Once UpdatePeer() sees that identifier
+// again, the backlog goes out packed into as few BATCH frames as fit.
+// Entries older than the TTL are discarded, undelivered.
+//
+// Memory is bounded by the cap, counting every entry with its bookkeeping.
+// With a spill file, messages beyond the cap are appended to it and only
+// their bookkeeping stays in memory; the file is truncated whenever nothing
+// in it is pending any more, so it only grows while peers stay away.
+//
+// BATCH payload: one or more of
+//     u16 message_length | message bytes
+// each delivered like a CLEARTEXT_MESSAGE. v1 peers get the messages one by
+// one. Both are sealed for peers with a key like any other message.
+
+#define OUTBOX_DEFAULT_CAP (256 * 1024)
+#define OUTBOX_DEFAULT_TTL_S 300
+#define OUTBOX_SPILL_MAX (64 * 1024 * 1024)
+#define OUTBOX_MAX_RECIPIENTS 1024
+#define OUTBOX_TICK_US 1000000  // expiry and retries of interrupted flushes
+
+typedef struct Node Node;
+
+typedef struct OutboxEntry {
+    struct OutboxEntry *next;
+    uint64_t expires_us;
+    long int spill_offset;  // -1 = message is in msg
+    uint32_t length;
+    char msg[];
+} OutboxEntry;
+
+typedef struct {
+    char user_identifier[320];
+    OutboxEntry *head;
+    OutboxEntry *tail;
+    size_t count;
+} OutboxRecipient;
+
+typedef struct {
+    OutboxRecipient *recipients;
+    size_t recipients_count;
+    size_t cap;  // bytes, 0 = outbox off
+    size_t bytes;
+    uint64_t ttl_us;
+    int spill_fd;  // -1 = no spill file
+    size_t spill_bytes;
+    size_t spill_pending;  // entries whose message is in the file
+    uint64_t next_tick_us;
+    size_t pending;
+    unsigned long stored;
+    unsigned long delivered;
+    unsigned long expired;
+    unsigned long dropped;  // refused, over the cap
+    unsigned long spilled;
+    unsigned long batches;
+} Outbox;
+
+int OutboxInit(Outbox *ob, size_t cap, unsigned int ttl_s, const char *spill_path);
+void OutboxFree(Outbox *ob);
+int OutboxStore(Outbox *ob, const char *user_identifier, const char *msg, size_t msg_length, uint64_t now_us);
+int OutboxFlush(Node *node, size_t peer_id);
+void OutboxSalvage(Node *node, size_t peer_id, const Peer *p);
+void OutboxTick(Node *node);
+void ProcessMessageBatch(Node *node, long int peer_id, char *msg, size_t msg_length, struct sockaddr_storage *src_addr);
+void PrintOutbox(const Outbox *ob);
+
+#endif  // SRC_OUTBOX_H_
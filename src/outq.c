@@ -0,0 +1,304 @@
+// Copyright 2025 Michał Jankowski
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_func.h"
+#include "node.h"
+#include "outq.h"
+#include "path.h"
+#include "trace.h"
+#include "transport.h"
+
+int OutQueuesInit(OutQueues *outq, size_t peers_size, size_t cap, MsgPool *pool) {
+    memset(outq, 0, sizeof(*outq));
+    if ((outq->queues = calloc(peers_size + 1, sizeof(OutQueue))) == NULL) {
+        return -1;
+    }
+    outq->count = peers_size + 1;
+    outq->cap = cap;
+    outq->pool = pool;
+    return 0;
+}
+
+// Unlinked frames go to the spare list, their buffer back to the pool.
+static void ReleaseFrame(OutQueues *outq, OutFrame *f) {
+    outq->bytes -= f->buf->length;
+    outq->pending--;
+    MsgBufPut(outq->pool, f->buf);
+    f->next = outq->spare;
+    outq->spare = f;
+}
+
+static void FreeLane(OutQueues *outq, OutLaneQueue *lane) {
+    OutFrame *f = lane->head;
+    while (f != NULL) {
+        OutFrame *next = f->next;
+        ReleaseFrame(outq, f);
+        f = next;
+    }
+    lane->head = NULL;
+    lane->tail = NULL;
+    lane->depth = 0;
+    lane->bytes = 0;
+}
+
+void OutQueuesFree(OutQueues *outq) {
+    for (size_t i = 0; i < outq->count; i++) {
+        for (unsigned int l = 0; l < OUT_LANES; l++) {
+            FreeLane(outq, &outq->queues[i].lanes[l]);
+        }
+    }
+    while (outq->spare != NULL) {
+        OutFrame *next = outq->spare->next;
+        free(outq->spare);
+        outq->spare = next;
+    }
+    free(outq->queues);
+    memset(outq, 0, sizeof(*outq));
+}
+
+enum OutLane LaneForType(int msg_type) {
+    int bulk = msg_type == CLEARTEXT_MESSAGE || msg_type == CHANNEL_MESSAGE || msg_type == BATCH
+               || msg_type == ENCRYPTED_MESSAGE;
+    return bulk ? OUT_BULK : OUT_CONTROL;
+}
+
+static OutLaneQueue *Lane(const OutQueues *outq, long int peer_id, enum OutLane lane) {
+    size_t index = peer_id >= 0 && (size_t) peer_id < outq->count - 1 ? (size_t) peer_id : outq->count - 1;
+    return &outq->queues[index].lanes[lane];
+}
+
+int OutLaneBusy(const OutQueues *outq, long int peer_id, enum OutLane lane) {
+    return outq->queues != NULL && Lane(outq, peer_id, lane)->depth != 0;
+}
+
+static int HasRoom(const OutQueues *outq, const OutLaneQueue *q, enum OutLane lane, size_t frame_length) {
+    size_t limit = lane == OUT_CONTROL ? outq->cap + OUTQ_CONTROL_RESERVE : outq->cap;
+    return q->depth < OUTQ_MAX_FRAMES && outq->bytes + frame_length <= limit;
+}
+
+// Queues a reference to frame, the caller keeps its own.
+static ssize_t Enqueue(
+    OutQueues *outq,
+    OutLaneQueue *q,
+    enum OutLane lane,
+    MsgBuf *frame,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size
+) {
+    size_t frame_length = frame->length;
+    if (!HasRoom(outq, q, lane, frame_length) || dest_addr_size > sizeof(struct sockaddr_storage)) {
+        q->dropped++;
+        outq->dropped++;
+        return -ENOSPC;
+    }
+    OutFrame *f = outq->spare;
+    if (f != NULL) {
+        outq->spare = f->next;
+    } else if ((f = malloc(sizeof(OutFrame))) == NULL) {
+        q->dropped++;
+        outq->dropped++;
+        return -ENOMEM;
+    }
+    f->next = NULL;
+    memcpy(&f->dest, dest_addr, dest_addr_size);
+    f->dest_size = dest_addr_size;
+    f->buf = MsgBufRef(frame);
+
+    if (q->tail != NULL) {
+        q->tail->next = f;
+    } else {
+        q->head = f;
+    }
+    q->tail = f;
+    q->depth++;
+    q->bytes += frame_length;
+    outq->bytes += frame_length;
+    outq->pending++;
+    outq->queued++;
+    return (ssize_t) frame_length;
+}
+
+// Bulk frames may be held back by the transport to leave coalesced with
+// the next ones (UDP GSO), control frames go out as they are.
+static ssize_t LaneSend(Node *node, enum OutLane lane, const char *frame, size_t frame_length,
+                        const struct sockaddr *dest_addr, socklen_t dest_addr_size) {
+    if (lane == OUT_BULK) {
+        return TransportSendBulk(node->transport, frame, frame_length, dest_addr, dest_addr_size);
+    }
+    return TransportSend(node->transport, frame, frame_length, dest_addr, dest_addr_size);
+}
+
+// Sends a frame now if its lane is empty, otherwise (or when the socket is
+// full) queues it behind the others. Returns frame_length when the frame was
+// sent or queued, -ENOSPC when the queue is full, or another -errno.
+ssize_t OutSend(
+    Node *node,
+    long int peer_id,
+    enum OutLane lane,
+    const char *frame,
+    size_t frame_length,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size
+) {
+    OutQueues *outq = &node->outq;
+    if (outq->queues == NULL) {
+        Trace(TRACE_SEND, lane, peer_id, frame_length, 0);
+        return LaneSend(node, lane, frame, frame_length, dest_addr, dest_addr_size);
+    }
+    OutLaneQueue *q = Lane(outq, peer_id, lane);
+    Trace(TRACE_SEND, lane, peer_id, frame_length, q->depth);
+    if (q->depth == 0) {
+        ssize_t result = LaneSend(node, lane, frame, frame_length, dest_addr, dest_addr_size);
+        if (result != -EAGAIN && result != -EWOULDBLOCK && result != -ENOBUFS) {
+            return result;
+        }
+        outq->blocked |= OutFamilyBit(dest_addr->sa_family);
+    }
+    // only now does the frame need a buffer of its own
+    if (!HasRoom(outq, q, lane, frame_length) || frame_length > MSGBUF_SIZE) {
+        q->dropped++;
+        outq->dropped++;
+        return -ENOSPC;
+    }
+    MsgBuf *buf = MsgBufGet(outq->pool);
+    if (buf == NULL) {
+        q->dropped++;
+        outq->dropped++;
+        return -ENOMEM;
+    }
+    memcpy(buf->data, frame, frame_length);
+    buf->length = (uint32_t) frame_length;
+    ssize_t result = Enqueue(outq, q, lane, buf, dest_addr, dest_addr_size);
+    MsgBufPut(outq->pool, buf);
+    return result;
+}
+
+// OutSend() for a frame already in a pool buffer, queueing takes a
+// reference instead of a copy. The caller still owns its reference.
+ssize_t OutSendBuf(
+    Node *node,
+    long int peer_id,
+    enum OutLane lane,
+    MsgBuf *frame,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size
+) {
+    OutQueues *outq = &node->outq;
+    if (outq->queues == NULL) {
+        Trace(TRACE_SEND, lane, peer_id, frame->length, 0);
+        return LaneSend(node, lane, frame->data, frame->length, dest_addr, dest_addr_size);
+    }
+    OutLaneQueue *q = Lane(outq, peer_id, lane);
+    Trace(TRACE_SEND, lane, peer_id, frame->length, q->depth);
+    if (q->depth == 0) {
+        ssize_t result = LaneSend(node, lane, frame->data, frame->length, dest_addr, dest_addr_size);
+        if (result != -EAGAIN && result != -EWOULDBLOCK && result != -ENOBUFS) {
+            return result;
+        }
+        outq->blocked |= OutFamilyBit(dest_addr->sa_family);
+    }
+    return Enqueue(outq, q, lane, frame, dest_addr, dest_addr_size);
+}
+
+// Sends from the head of q until it is empty or the socket is full again.
+// Returns 0 when the socket is full.
+static int DrainLane(Node *node, OutLaneQueue *q, enum OutLane lane) {
+    OutQueues *outq = &node->outq;
+    while (q->head != NULL) {
+        OutFrame *f = q->head;
+        ssize_t result = LaneSend(
+            node, lane, f->buf->data, f->buf->length, (struct sockaddr *) &f->dest, f->dest_size);
+        if (result == -EAGAIN || result == -EWOULDBLOCK || result == -ENOBUFS) {
+            outq->blocked |= OutFamilyBit(f->dest.ss_family);
+            return 0;
+        } else if (result < 0) {
+            q->dropped++;  // the path broke while queued, don't retry forever
+            outq->dropped++;
+        }
+        q->head = f->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        q->depth--;
+        q->bytes -= f->buf->length;
+        ReleaseFrame(outq, f);
+    }
+    return 1;
+}
+
+// Called from the main loop, returns the number of frames still queued.
+size_t OutDrain(Node *node) {
+    OutQueues *outq = &node->outq;
+    outq->blocked = 0;
+    if (outq->pending == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < outq->count; i++) {
+        if (!DrainLane(node, &outq->queues[i].lanes[OUT_CONTROL], OUT_CONTROL)) {
+            return outq->pending;
+        }
+    }
+    // bulk round robin, a peer with a deep backlog only gets its turn
+    for (size_t n = 0; n < outq->count; n++) {
+        size_t i = (outq->next_drain + n) % outq->count;
+        if (!DrainLane(node, &outq->queues[i].lanes[OUT_BULK], OUT_BULK)) {
+            outq->next_drain = i + 1;
+            break;
+        }
+    }
+    return outq->pending;
+}
+
+// Shutdown helper, gives queued frames (disconnects) a chance to leave.
+void OutDrainBlocking(Node *node, int timeout_ms) {
+    for (int waited = 0; waited < timeout_ms; waited += 10) {
+        size_t left = OutDrain(node);
+        TransportFlush(node->transport);
+        if (left == 0) {
+            return;
+        }
+        poll(NULL, 0, 10);
+    }
+}
+
+void OutDropPeer(OutQueues *outq, size_t peer_id) {
+    if (outq->queues == NULL || peer_id >= outq->count - 1) {
+        return;
+    }
+    for (unsigned int l = 0; l < OUT_LANES; l++) {
+        FreeLane(outq, &outq->queues[peer_id].lanes[l]);
+        outq->queues[peer_id].lanes[l].dropped = 0;  // the slot gets reused
+    }
+}
+
+static void PrintQueue(const OutQueue *q) {
+    const OutLaneQueue *c = &q->lanes[OUT_CONTROL];
+    const OutLaneQueue *b = &q->lanes[OUT_BULK];
+    printf("control %zu, bulk %zu (%zu B), dropped %lu\n",
+           c->depth, b->depth, c->bytes + b->bytes, c->dropped + b->dropped);
+}
+
+void PrintOutQueues(const OutQueues *outq, Peer peers[]) {
+    if (outq->queues == NULL) {
+        return;
+    }
+    printf("Send queues: %zu frames, %zu of %zu B, %lu dropped\n",
+           outq->pending, outq->bytes, outq->cap, outq->dropped);
+    for (size_t i = 0; i < outq->count; i++) {
+        const OutQueue *q = &outq->queues[i];
+        if (q->lanes[OUT_CONTROL].depth + q->lanes[OUT_BULK].depth == 0
+            && q->lanes[OUT_CONTROL].dropped + q->lanes[OUT_BULK].dropped == 0) {
+            continue;
+        }
+        if (i == outq->count - 1) {
+            printf("  non-peers: ");
+        } else {
+            printf("  [%zu] %s: ", i, peers[i].user_identifier);
+        }
+        PrintQueue(q);
+    }
+}
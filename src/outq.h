@@ -0,0 +1,104 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_OUTQ_H_
+#define SRC_OUTQ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "msgbuf.h"
+#include "peer.h"
+
+#define OUTQ_DEFAULT_CAP (1024 * 1024)  // bytes of queued frames, all peers
+#define OUTQ_MAX_FRAMES 256  // per peer and lane
+#define OUTQ_CONTROL_RESERVE (64 * 1024)  // control frames may exceed the cap by this much
+
+// Outbound queues. A send that the kernel (or the io_uring send slots)
+// refuses with EAGAIN/ENOBUFS is queued instead of lost, and retried from
+// the main loop once the socket is writable again.
+//
+// Every peer has two lanes. The control lane (DISCONNECT, SCAN_RESPONSE,
+// PING/PONG) is always drained first, so it never waits behind bulk
+// messages. Frames to addresses that are not peers (scan replies to
+// strangers, multicast) use one extra queue.
+//
+// Queued frames hold a reference to a pool buffer (msgbuf.h) rather than a
+// copy, frames sent as a MsgBuf are never copied at all.
+//
+// Overflow: a bulk frame is refused, and counted as dropped, when its lane
+// holds OUTQ_MAX_FRAMES or the queued bytes reach the cap. The sender sees
+// the error, nothing already queued is discarded. Control frames have
+// OUTQ_CONTROL_RESERVE of headroom above the cap, so a bulk backlog can't
+// lock them out.
+
+typedef struct Node Node;
+
+enum OutLane {
+    OUT_CONTROL,
+    OUT_BULK,
+    OUT_LANES,
+};
+
+typedef struct OutFrame {
+    struct OutFrame *next;
+    struct sockaddr_storage dest;
+    socklen_t dest_size;
+    MsgBuf *buf;
+} OutFrame;
+
+typedef struct {
+    OutFrame *head;
+    OutFrame *tail;
+    size_t depth;
+    size_t bytes;
+    unsigned long dropped;
+} OutLaneQueue;
+
+typedef struct {
+    OutLaneQueue lanes[OUT_LANES];
+} OutQueue;
+
+typedef struct {
+    OutQueue *queues;  // one per peer slot, plus one for non-peers
+    size_t count;
+    MsgPool *pool;
+    OutFrame *spare;  // sent frames, reused before malloc()
+    size_t cap;
+    size_t bytes;
+    size_t pending;  // frames over all queues
+    size_t next_drain;  // round robin start for bulk lanes
+    unsigned int blocked;  // OutFamilyBit of families whose socket is full
+    unsigned long queued;
+    unsigned long dropped;
+} OutQueues;
+
+static inline unsigned int OutFamilyBit(int family) {
+    return family == AF_INET ? 1u : 2u;
+}
+
+int OutQueuesInit(OutQueues *outq, size_t peers_size, size_t cap, MsgPool *pool);
+void OutQueuesFree(OutQueues *outq);
+enum OutLane LaneForType(int msg_type);
+int OutLaneBusy(const OutQueues *outq, long int peer_id, enum OutLane lane);
+ssize_t OutSend(
+    Node *node,
+    long int peer_id,
+    enum OutLane lane,
+    const char *frame,
+    size_t frame_length,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size);
+ssize_t OutSendBuf(
+    Node *node,
+    long int peer_id,
+    enum OutLane lane,
+    MsgBuf *frame,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size);
+size_t OutDrain(Node *node);
+void OutDrainBlocking(Node *node, int timeout_ms);
+void OutDropPeer(OutQueues *outq, size_t peer_id);
+void PrintOutQueues(const OutQueues *outq, Peer peers[]);
+
+#endif  // SRC_OUTQ_H_
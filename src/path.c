@@ -0,0 +1,334 @@
+// Copyright 2025 Michał Jankowski
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "msgbuf.h"
+#include "net_func.h"
+#include "node.h"
+#include "outq.h"
+#include "path.h"
+#include "peer.h"
+#include "secure.h"
+#include "send_cache.h"
+#include "sock_prep.h"
+#include "trace.h"
+#include "transport.h"
+
+uint64_t MonotonicUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000u + (uint64_t) ts.tv_nsec / 1000u;
+}
+
+void PathReset(PathStats *path) {
+    memset(path, 0, sizeof(*path));
+}
+
+int PathSelectFamily(const Peer *p) {
+    return PathChooseFamily(&p->inet4, &p->inet6);
+}
+
+// PathSelectFamily() for addresses copied out of the table (PeerRead()).
+int PathChooseFamily(const SeenInet4 *inet4, const SeenInet6 *inet6) {
+    int has4 = inet4->seen != 0;
+    int has6 = inet6->seen != 0;
+    if (!has4 && !has6) {
+        return AF_UNSPEC;
+    } else if (!has6) {
+        return AF_INET;
+    } else if (!has4) {
+        return AF_INET6;
+    }
+
+    const PathStats *p4 = &inet4->path;
+    const PathStats *p6 = &inet6->path;
+    int up4 = p4->state == PATH_UP;
+    int up6 = p6->state == PATH_UP;
+    if (up4 && up6) {
+        // IPv4 has to be clearly faster to win, so similar paths don't flap
+        return (uint64_t) p4->srtt_us * 5 < (uint64_t) p6->srtt_us * 4 ? AF_INET : AF_INET6;
+    } else if (up4 != up6) {
+        return up4 ? AF_INET : AF_INET6;
+    }
+
+    int degraded4 = p4->state == PATH_DEGRADED;
+    int degraded6 = p6->state == PATH_DEGRADED;
+    if (degraded4 != degraded6) {
+        return degraded4 ? AF_INET6 : AF_INET;
+    }
+    return inet4->seen > inet6->seen ? AF_INET : AF_INET6;
+}
+
+socklen_t PeerAddress(const Node *node, const Peer *p, int family, struct sockaddr_storage *dest) {
+    memset(dest, 0, sizeof(*dest));
+    if (family == AF_INET) {
+        struct sockaddr_in *remote = (struct sockaddr_in *) dest;
+        remote->sin_family = AF_INET;
+        remote->sin_addr = p->inet4.addr4;
+        remote->sin_port = htons(PORT);
+        return sizeof(*remote);
+    }
+    struct sockaddr_in6 *remote = (struct sockaddr_in6 *) dest;
+    remote->sin6_family = AF_INET6;
+    remote->sin6_addr = p->inet6.addr6;
+    remote->sin6_port = htons(PORT);
+    remote->sin6_scope_id = node->ifindex;
+    return sizeof(*remote);
+}
+
+static PathStats *PeerPath(Peer *p, int family) {
+    return family == AF_INET ? &p->inet4.path : &p->inet6.path;
+}
+
+// Sends one datagram to dest. Cleartext messages go through the peer's
+// cached connected socket when possible, which needs no frame copy; the
+// frame is only assembled for the shared socket, into a pool buffer that the
+// send queue and a retry on the other family can share. Sealed messages
+// arrive as such a frame already.
+static ssize_t PathSendOnce(
+    Node *node,
+    size_t id,
+    int version,
+    enum MessageType msg_type,
+    const char *msg,
+    size_t msg_length,
+    MsgBuf **frame,
+    const struct sockaddr *dest,
+    socklen_t dest_size
+) {
+    enum OutLane lane = LaneForType(msg_type);
+    if (msg_type == CLEARTEXT_MESSAGE && msg != NULL && node->send_cache.fd_budget != 0
+        && !OutLaneBusy(&node->outq, (long int) id, lane)) {  // must not overtake queued messages
+        Trace(TRACE_SEND, lane, (long int) id, msg_length, 0);
+        ssize_t result = SendCacheSendMessage(
+            &node->send_cache, dest, dest_size, version, node->session_token, msg, msg_length);
+        if (result >= 0 || result == -ECONNREFUSED) {
+            return result;
+        }
+        // could not set up a context (fd limit, ...) or its buffer is full,
+        // the shared socket and the queue behind it still work
+    }
+
+    if (*frame == NULL) {
+        if (msg_length > MSGBUF_SIZE - WIRE_HEADER_MAX) {
+            return -EMSGSIZE;
+        }
+        if ((*frame = EncodeFrame(node, version, msg_type, msg, msg_length)) == NULL) {
+            return -ENOMEM;
+        }
+    }
+    return OutSendBuf(node, (long int) id, lane, *frame, dest, dest_size);
+}
+
+// Tries the preferred family, then the other. *frame is encoded on first
+// use when NULL, the caller puts it afterwards.
+static int SendOverPaths(
+    Node *node,
+    size_t id,
+    enum MessageType msg_type,
+    const char *msg,
+    size_t msg_length,
+    MsgBuf **frame
+) {
+    Peer *p = &node->peers[id];
+    int first = PathSelectFamily(p);
+    if (first == AF_UNSPEC) {
+        return -1;
+    }
+
+    int families[2] = {first, first == AF_INET ? AF_INET6 : AF_INET};
+    for (unsigned int i = 0; i < 2; i++) {
+        int family = families[i];
+        if ((family == AF_INET ? p->inet4.seen : p->inet6.seen) == 0) {
+            continue;
+        }
+        struct sockaddr_storage dest;
+        socklen_t dest_size = PeerAddress(node, p, family, &dest);
+        ssize_t result = PathSendOnce(
+            node, id, PeerWireVersion(node, p), msg_type, msg, msg_length, frame, (struct sockaddr *) &dest, dest_size);
+        if (result >= 0) {
+            return family;
+        } else if (result == -ENOSPC || result == -ENOMEM) {
+            return -4;  // backpressure, not a path failure
+        }
+
+        PathStats *path = PeerPath(p, family);
+        PeerWriteBegin(p);
+        path->state = PATH_DEGRADED;
+        path->next_probe_us = 0;  // find out quickly whether it recovers
+        PeerWriteEnd(p);
+        NodeError(node, COMM_ERR_PATH, "%s: Could not send: %s",
+                  family == AF_INET ? "IPv4" : "IPv6", strerror((int) -result));
+    }
+    return -2;
+}
+
+// Sends (or queues) a msg_type frame over the preferred path, retrying once
+// on the other family. Messages are sealed for peers with a key. Returns the
+// family used, -4 when the send queue is full, -6 when the message may only
+// go sealed and the peer has no key yet, or another negative value.
+int PathSend(Node *node, size_t id, enum MessageType msg_type, const char *msg, size_t msg_length) {
+    MsgBuf *frame = NULL;
+    if ((msg_type == CLEARTEXT_MESSAGE || msg_type == BATCH) && node->secure.mode != COMM_ENCRYPT_OFF) {
+        int sealed = SecureSealFrame(node, id, msg_type, msg, msg_length, &frame);
+        if (sealed < 0) {
+            return sealed;
+        } else if (frame != NULL) {
+            msg_type = ENCRYPTED_MESSAGE;
+            msg = NULL;
+            msg_length = 0;
+        }
+    }
+    int result = SendOverPaths(node, id, msg_type, msg, msg_length, &frame);
+    MsgBufPut(&node->pool, frame);
+    return result;
+}
+
+// PathSend() of a frame encoded beforehand (EncodeFrame() with the peer's
+// wire version), e.g. one shared by many peers. The caller keeps its
+// reference.
+int PathSendFrame(Node *node, size_t id, enum MessageType msg_type, MsgBuf *frame) {
+    return SendOverPaths(node, id, msg_type, NULL, 0, &frame);
+}
+
+static void SendProbe(Node *node, Peer *p, int family, PathStats *path, uint64_t now) {
+    char msg_buf[WIRE_HEADER_MAX + 4];
+    uint32_t nonce = ++node->next_probe_nonce;
+    if (nonce == 0) {
+        nonce = ++node->next_probe_nonce;
+    }
+    uint32_t nonce_be = htonl(nonce);
+    memcpy(msg_buf, &nonce_be, sizeof(nonce_be));
+
+    long int encap_length = EncapsulateFrame(
+        node, PeerWireVersion(node, p), PING, msg_buf, sizeof(nonce_be), sizeof(msg_buf));
+    if (encap_length < 0) {
+        return;
+    }
+    struct sockaddr_storage dest;
+    socklen_t dest_size = PeerAddress(node, p, family, &dest);
+    OutSend(node, p - node->peers, OUT_CONTROL, msg_buf, (size_t) encap_length, (struct sockaddr *) &dest, dest_size);
+
+    PeerWriteBegin(p);
+    path->probe_nonce = nonce;
+    path->probe_sent_us = now;
+    if (path->state == PATH_UP || path->consecutive_lost >= PATH_DEGRADED_AFTER) {
+        path->next_probe_us = now + PATH_PROBE_INTERVAL_US;
+    } else {
+        path->next_probe_us = now + PATH_PROBE_RETRY_US;
+    }
+    PeerWriteEnd(p);
+}
+
+static void TickPath(Node *node, Peer *p, int family, uint64_t now) {
+    PathStats *path = PeerPath(p, family);
+    if (path->probe_nonce != 0 && now - path->probe_sent_us > PATH_PROBE_TIMEOUT_US) {
+        PeerWriteBegin(p);
+        path->probe_nonce = 0;
+        path->loss = path->loss * 0.875f + 0.125f;
+        if (path->consecutive_lost < UINT8_MAX) {
+            path->consecutive_lost++;
+        }
+        if (path->consecutive_lost >= PATH_DEGRADED_AFTER) {
+            path->state = PATH_DEGRADED;
+        }
+        PeerWriteEnd(p);
+    }
+    if (path->probe_nonce == 0 && now >= path->next_probe_us) {
+        SendProbe(node, p, family, path, now);
+    }
+}
+
+// Called once per main loop iteration. A peer that just appeared has
+// next_probe_us == 0 on both families, so both get probed right away.
+void PathTick(Node *node) {
+    uint64_t now = MonotonicUs();
+    for (size_t i = 0; i < node->peers_size; i++) {
+        Peer *p = &node->peers[i];
+        if (p->inet4.seen != 0 && node->transport->has_inet4) {
+            TickPath(node, p, AF_INET, now);
+        }
+        if (p->inet6.seen != 0 && node->transport->has_inet6) {
+            TickPath(node, p, AF_INET6, now);
+        }
+    }
+}
+
+void ProcessMessagePing(
+    Node *node,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr,
+    socklen_t src_addr_size,
+    const FrameInfo *frame
+) {
+    char msg_buf[WIRE_HEADER_MAX + 4];
+    if (msg_length != 4) {
+        node->stats.rx_invalid++;
+        return;
+    }
+    memcpy(msg_buf, msg, 4);
+    long int encap_length = EncapsulateFrame(node, frame->version, PONG, msg_buf, 4, sizeof(msg_buf));
+    if (encap_length < 0) {
+        return;
+    }
+    OutSend(node, -1, OUT_CONTROL, msg_buf, (size_t) encap_length, (struct sockaddr *) src_addr, src_addr_size);
+}
+
+void ProcessMessagePong(
+    Node *node,
+    long int peer_id,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr
+) {
+    if (msg_length != 4) {
+        node->stats.rx_invalid++;
+        return;
+    }
+    uint32_t nonce_be;
+    memcpy(&nonce_be, msg, sizeof(nonce_be));
+    uint32_t nonce = ntohl(nonce_be);
+
+    int family = src_addr->ss_family;
+    if (peer_id < 0 || (family != AF_INET && family != AF_INET6)) {
+        return;
+    }
+
+    Peer *p = &node->peers[peer_id];
+    PathStats *path = PeerPath(p, family);
+    if (nonce == 0 || path->probe_nonce != nonce) {
+        return;  // late or unsolicited
+    }
+
+    uint64_t sample = MonotonicUs() - path->probe_sent_us;
+    if (sample > UINT32_MAX) {
+        sample = UINT32_MAX;
+    }
+    PeerWriteBegin(p);
+    if (path->srtt_us == 0) {
+        path->srtt_us = (uint32_t) sample;
+        path->rttvar_us = (uint32_t) sample / 2;
+    } else {
+        uint32_t delta = path->srtt_us > sample ? path->srtt_us - (uint32_t) sample : (uint32_t) sample - path->srtt_us;
+        path->rttvar_us = (uint32_t) ((3 * (uint64_t) path->rttvar_us + delta) / 4);
+        path->srtt_us = (uint32_t) ((7 * (uint64_t) path->srtt_us + sample) / 8);
+    }
+    path->loss *= 0.875f;
+    path->consecutive_lost = 0;
+    path->state = PATH_UP;
+    path->probe_nonce = 0;
+    PeerWriteEnd(p);
+}
+
+void PrintPath(const PathStats *path, int preferred) {
+    static const char *STATE_NAMES[] = {"unknown", "up", "degraded"};
+    printf("    path: %s", STATE_NAMES[path->state <= PATH_DEGRADED ? path->state : PATH_UNKNOWN]);
+    if (path->srtt_us != 0) {
+        printf(", rtt %.2f ms (+/- %.2f)", path->srtt_us / 1000.0, path->rttvar_us / 1000.0);
+    }
+    printf(", loss %.0f%%%s\n", path->loss * 100.0f, preferred ? " [preferred]" : "");
+}
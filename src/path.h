@@ -0,0 +1,54 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_PATH_H_
+#define SRC_PATH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "msgbuf.h"
+#include "net_func.h"
+#include "peer.h"
+
+// Dual-stack path manager. Every address family of every peer is probed
+// with PING/PONG (payload: u32 nonce, echoed back), which yields a smoothed
+// RTT and a loss estimate per path. Sends go over the faster healthy path,
+// and fall over to the other family when the chosen one fails.
+//
+// A fresh peer is probed on both families at once, whichever answers first
+// becomes the preferred path (happy eyeballs). Until then, and for peers
+// that never answer probes, the most recently seen family is used.
+
+#define PATH_PROBE_INTERVAL_US 5000000  // healthy paths
+#define PATH_PROBE_RETRY_US 1000000  // unknown or degraded paths
+#define PATH_PROBE_TIMEOUT_US 1000000
+#define PATH_DEGRADED_AFTER 3  // consecutive lost probes
+
+typedef struct Node Node;
+
+uint64_t MonotonicUs(void);
+void PathReset(PathStats *path);
+int PathSelectFamily(const Peer *p);
+int PathChooseFamily(const SeenInet4 *inet4, const SeenInet6 *inet6);
+socklen_t PeerAddress(const Node *node, const Peer *p, int family, struct sockaddr_storage *dest);
+void PathTick(Node *node);
+int PathSend(Node *node, size_t id, enum MessageType msg_type, const char *msg, size_t msg_length);
+int PathSendFrame(Node *node, size_t id, enum MessageType msg_type, MsgBuf *frame);
+void ProcessMessagePing(
+    Node *node,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr,
+    socklen_t src_addr_size,
+    const FrameInfo *frame
+);
+void ProcessMessagePong(
+    Node *node,
+    long int peer_id,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr
+);
+void PrintPath(const PathStats *path, int preferred);
+
+#endif  // SRC_PATH_H_
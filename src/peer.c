@@ -1,9 +1,13 @@
 // Copyright 2025 Michał Jankowski
 
 #include <arpa/inet.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "gossip.h"
+#include "path.h"
 #include "peer.h"
 
 long int FindByInet4(Peer peers[], const size_t peers_size, struct in_addr *addr4) {
@@ -23,6 +27,18 @@ long int FindByInet6(Peer peers[], const size_t peers_size, struct in6_addr *add
     return -1;
 }
 
+long int FindByUserIdentifier(Peer peers[], const size_t peers_size, const char *user_identifier) {
+    if (user_identifier[0] == '\0') {
+        return -1;
+    }
+    for (size_t i = 0; i < peers_size; i++) {
+        if (strncmp(peers[i].user_identifier, user_identifier, sizeof(peers[i].user_identifier)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 int SetPeerInet4(Peer peers[], const size_t peers_size, struct in_addr *addr4, const char *user_identifier) {
     int pos_by_ui = -1;
     int pos_by_addr = -1;
@@ -54,13 +70,18 @@ int SetPeerInet4(Peer peers[], const size_t peers_size, struct in_addr *addr4, c
         return CreatePeerAtPosition(peers, peers_size, first_free, addr4, NULL, user_identifier);
     } else {
         if (pos_by_addr == pos_by_ui) {
+            PeerWriteBegin(&peers[pos_by_addr]);
             peers[pos_by_addr].inet4.seen = time(NULL);
+            PeerWriteEnd(&peers[pos_by_addr]);
         } else {
             if (pos_by_addr != -1) {
                 RemovePeerAddressAtPosition(peers, peers_size, pos_by_addr, 1, 0);
             }
+            PeerWriteBegin(&peers[pos_by_ui]);
             peers[pos_by_ui].inet4.seen = time(NULL);
             memcpy(&peers[pos_by_ui].inet4.addr4, addr4, sizeof(struct in_addr));
+            PathReset(&peers[pos_by_ui].inet4.path);
+            PeerWriteEnd(&peers[pos_by_ui]);
         }
     }
     return 0;
@@ -97,18 +118,37 @@ int SetPeerInet6(Peer peers[], const size_t peers_size, struct in6_addr *addr6,
         return CreatePeerAtPosition(peers, peers_size, first_free, NULL, addr6, user_identifier);
     } else {
         if (pos_by_addr == pos_by_ui) {
+            PeerWriteBegin(&peers[pos_by_addr]);
             peers[pos_by_addr].inet6.seen = time(NULL);
+            PeerWriteEnd(&peers[pos_by_addr]);
         } else {
             if (pos_by_addr != -1) {
                 RemovePeerAddressAtPosition(peers, peers_size, pos_by_addr, 0, 1);
             }
+            PeerWriteBegin(&peers[pos_by_ui]);
             peers[pos_by_ui].inet6.seen = time(NULL);
             memcpy(&peers[pos_by_ui].inet6.addr6, addr6, sizeof(struct in6_addr));
+            PathReset(&peers[pos_by_ui].inet6.path);
+            PeerWriteEnd(&peers[pos_by_ui]);
         }
     }
     return 0;
 }
 
+// Part of a write: clears the addresses, and the whole slot (but its seq)
+// once it has none left.
+static void ClearAddresses(Peer *p, short remove_ipv4, short remove_ipv6) {
+    if (remove_ipv4) {
+        memset(&p->inet4, 0, sizeof(p->inet4));
+    }
+    if (remove_ipv6) {
+        memset(&p->inet6, 0, sizeof(p->inet6));
+    }
+    if (p->inet4.seen == 0 && p->inet6.seen == 0) {
+        memset(p->user_identifier, 0, sizeof(Peer) - offsetof(Peer, user_identifier));
+    }
+}
+
 int CreatePeerAtPosition(
     Peer peers[],
     const size_t peers_size,
@@ -127,6 +167,7 @@ int CreatePeerAtPosition(
     time_t now = time(NULL);
 
     Peer *p = &peers[actual_position];
+    PeerWriteBegin(p);
 
     strncpy(p->user_identifier, user_identifier, sizeof(p->user_identifier) - 1);
     p->user_identifier[sizeof(p->user_identifier) - 1] = '\0';
@@ -137,6 +178,7 @@ int CreatePeerAtPosition(
     if (addr4 != NULL) {
         p->inet4.addr4 = *addr4;
         p->inet4.seen = now;
+        PathReset(&p->inet4.path);
     } else {
         remove_ipv4 = 1;
     }
@@ -144,14 +186,15 @@ int CreatePeerAtPosition(
     if (addr6 != NULL) {
         p->inet6.addr6 = *addr6;
         p->inet6.seen = now;
+        PathReset(&p->inet6.path);
     } else {
         remove_ipv6 = 1;
     }
 
-    printf("PEER LIST CHANGED: Added/changed [%li]: %s\n", actual_position, p->user_identifier);
     if (remove_ipv4 + remove_ipv6 != 0) {
-        return RemovePeerAddressAtPosition(peers, peers_size, actual_position, remove_ipv4, remove_ipv6);
+        ClearAddresses(p, remove_ipv4, remove_ipv6);
     }
+    PeerWriteEnd(p);
     return 0;
 }
 
@@ -166,31 +209,68 @@ int RemovePeerAddressAtPosition(
     }
 
     Peer *p = &peers[pos];
-    if (remove_ipv4) {
-        memset(&p->inet4, 0, sizeof(p->inet4));
-    }
-    if (remove_ipv6) {
-        memset(&p->inet6, 0, sizeof(p->inet6));
-    }
-    if (p->inet4.seen == 0 && p->inet6.seen == 0) {
-        printf("PEER LIST CHANGED: Removed peer [%li]: %s\n", pos, p->user_identifier);
-        memset(p, 0, sizeof(Peer));
-    }
+    PeerWriteBegin(p);
+    ClearAddresses(p, remove_ipv4, remove_ipv6);
+    PeerWriteEnd(p);
     return 0;
 }
 
+int PeerRead(const Peer *p, PeerView *view) {
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();  // the writer may be off the CPU mid-write
+            continue;
+        }
+        memcpy(view->user_identifier, p->user_identifier, sizeof(view->user_identifier));
+        view->inet4 = p->inet4;
+        view->inet6 = p->inet6;
+        view->session_token = p->session_token;
+        view->wire_version = p->wire_version;
+        view->swim_status = p->swim.status;
+        view->incarnation = p->swim.incarnation;
+        view->key_status = p->keys.status;
+        memcpy(view->public_key, p->keys.public_key, sizeof(view->public_key));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);  // the copy before the second look at seq
+        if (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+    }
+    view->sealed_sent = __atomic_load_n(&p->keys.sealed, __ATOMIC_RELAXED);
+    view->user_identifier[sizeof(view->user_identifier) - 1] = '\0';
+    return view->inet4.seen != 0 || view->inet6.seen != 0;
+}
+
 void PrintPeers(Peer peers[], const size_t peers_size) {
     short none_seen = 1;
     for (size_t i = 0; i < peers_size; ++i) {
-        Peer *p = &peers[i];
+        PeerView view;
+        const PeerView *p = &view;
 
-        if (p->inet4.seen == 0 && p->inet6.seen == 0) {
+        if (!PeerRead(&peers[i], &view)) {
             continue;
         }
         none_seen = 0;
 
+        int preferred = PathChooseFamily(&p->inet4, &p->inet6);
         printf("Peer %zu:\n", i);
         printf("  User Identifier: %s\n", p->user_identifier);
+        if (p->wire_version != 0) {
+            printf("  Wire format: v%u", p->wire_version);
+            if (p->session_token != 0) {
+                printf(", session %08x", p->session_token);
+            }
+            printf("\n");
+        }
+        if (p->swim_status != SWIM_NONE) {
+            printf("  Membership: %s, incarnation %u\n", SwimStatusName(p->swim_status), p->incarnation);
+        }
+        if (p->key_status == KEYS_READY) {
+            printf("  Sealed: key %02x%02x%02x%02x%02x%02x%02x%02x, %llu sent\n",
+                   p->public_key[0], p->public_key[1], p->public_key[2], p->public_key[3],
+                   p->public_key[4], p->public_key[5], p->public_key[6], p->public_key[7],
+                   (unsigned long long) p->sealed_sent);
+        }
 
         if (p->inet4.seen != 0) {
             char ipv4_str[INET_ADDRSTRLEN];
@@ -198,6 +278,7 @@ void PrintPeers(Peer peers[], const size_t peers_size) {
             printf("  IPv4 Address: %s (seen: ", ipv4_str);
             PrintHumanReadableTime(p->inet4.seen);
             printf(")\n");
+            PrintPath(&p->inet4.path, preferred == AF_INET);
         }
 
         if (p->inet6.seen != 0) {
@@ -206,6 +287,7 @@ void PrintPeers(Peer peers[], const size_t peers_size) {
             printf("  IPv6 Address: %s (seen: ", ipv6_str);
             PrintHumanReadableTime(p->inet6.seen);
             printf(")\n");
+            PrintPath(&p->inet6.path, preferred == AF_INET6);
         }
 
         printf("\n");
@@ -232,5 +314,9 @@ void ClearAllPeers(Peer peers[], const size_t peers_size) {
     if (peers == NULL || peers_size == 0) {
         return;
     }
-    memset(peers, 0, sizeof(Peer) * peers_size);
+    for (size_t i = 0; i < peers_size; i++) {
+        PeerWriteBegin(&peers[i]);
+        memset(peers[i].user_identifier, 0, sizeof(Peer) - offsetof(Peer, user_identifier));
+        PeerWriteEnd(&peers[i]);
+    }
 }
@@ -3,29 +3,127 @@
 #define SRC_PEER_H_
 
 #include <netinet/in.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <time.h>
 
+#include "chacha20.h"
+#include "x25519.h"
+
+enum PathState {
+    PATH_UNKNOWN,  // never answered a probe
+    PATH_UP,
+    PATH_DEGRADED,  // several probes in a row went unanswered
+};
+
+// Per address family health, maintained by path.c from PING/PONG probes.
+typedef struct {
+    uint32_t srtt_us;  // smoothed RTT, 0 = no sample yet
+    uint32_t rttvar_us;
+    float loss;  // EWMA of probe loss, 0..1
+    uint8_t state;
+    uint8_t consecutive_lost;
+    uint32_t probe_nonce;  // outstanding probe, 0 = none
+    uint64_t probe_sent_us;
+    uint64_t next_probe_us;
+} PathStats;
+
 typedef struct {
     time_t seen;  // 0 = addr4 not assigned
     struct in_addr addr4;  // s_addr = 0 = addr4 not assigned
+    PathStats path;
 } SeenInet4;
 
 typedef struct {
     time_t seen;  // 0 = addr6 not assigned
     struct in6_addr addr6;  // __in6_u.__u6_addr32[0] = 0 = addr6 not assigned
+    PathStats path;
 } SeenInet6;
 
+enum SwimStatus {
+    SWIM_NONE,  // not a gossip member (yet)
+    SWIM_ALIVE,
+    SWIM_SUSPECT,
+    SWIM_DEAD,
+};
+
+// Membership as seen by gossip.c.
+typedef struct {
+    uint32_t incarnation;
+    uint8_t status;
+    uint8_t transmit_left;  // piggyback this member's state that many more times
+    uint64_t suspect_deadline_us;
+} SwimState;
+
+enum KeyStatus {
+    KEYS_NONE,  // no scan from the peer yet
+    KEYS_UNSUPPORTED,  // its scan announced no key
+    KEYS_READY,
+};
+
+// Session keys, maintained by secure.c. The nonce counters and the replay
+// window belong to the public key, not the slot, and live in
+// SecureState.history so that wiping the slot can't reset them.
+typedef struct {
+    uint8_t status;
+    uint8_t public_key[X25519_KEY_SIZE];
+    ChaCha20Key tx;
+    ChaCha20Key rx;
+    uint32_t history;  // the key's entry in SecureState.history
+    uint64_t sealed;  // frames sealed for this slot
+    uint64_t requested_us;  // last time we asked for its key
+} PeerKeys;
+
 // a list might be more flexible, but an array is more predictable
+//
+// Slots are written by the thread driving the node only, and every change
+// happens between PeerWriteBegin() and PeerWriteEnd(), which make seq odd
+// for its duration (a per-slot seqlock). Other threads copy a slot with
+// PeerRead(), which retries until it got one between two writes. The
+// writer never waits for readers. What only the writer needs (gossip
+// retransmit budgets, key request times) is left out of the view and may
+// change outside a write.
 typedef struct {
+    uint32_t seq;
     char user_identifier[320];
     SeenInet4 inet4;
     SeenInet6 inet6;
+    uint32_t session_token;  // 0 = peer speaks v1 only
+    uint8_t wire_version;  // of the last frame received, replies use the same
+    SwimState swim;
+    PeerKeys keys;
 } Peer;
 
+// What PeerRead() copies out of a slot.
+typedef struct {
+    char user_identifier[320];
+    SeenInet4 inet4;
+    SeenInet6 inet6;
+    uint32_t session_token;
+    uint8_t wire_version;
+    uint8_t swim_status;
+    uint32_t incarnation;
+    uint8_t key_status;
+    uint8_t public_key[X25519_KEY_SIZE];
+    uint64_t sealed_sent;  // read on its own, it counts up outside writes
+} PeerView;
+
+static inline void PeerWriteBegin(Peer *p) {
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);  // odd before any of the data changes
+}
+
+static inline void PeerWriteEnd(Peer *p) {
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline int PeerInUse(const Peer *p) {
+    return p->inet4.seen != 0 || p->inet6.seen != 0;
+}
+
 long int FindByInet4(Peer peers[], const size_t peers_size, struct in_addr *addr4);
 long int FindByInet6(Peer peers[], const size_t peers_size, struct in6_addr *addr6);
-// int FindByUserIdentifier(Peer peers[], const size_t peers_size, const char *user_identifier);
+long int FindByUserIdentifier(Peer peers[], const size_t peers_size, const char *user_identifier);
 int SetPeerInet4(Peer peers[], const size_t peers_size, struct in_addr *addr4, const char *user_identifier);
 int SetPeerInet6(Peer peers[], const size_t peers_size, struct in6_addr *addr6, const char *user_identifier);
 int CreatePeerAtPosition(
@@ -42,6 +140,8 @@ int RemovePeerAddressAtPosition(
     short remove_ipv4,
     short remove_ipv6);
 
+int PeerRead(const Peer *p, PeerView *view);
+
 void PrintPeers(Peer peers[], const size_t peers_size);
 void PrintHumanReadableTime(time_t t);
 void ClearAllPeers(Peer peers[], const size_t peers_size);
@@ -0,0 +1,159 @@
+// Copyright 2025 Michał Jankowski
+#include <string.h>
+
+#include "poly1305.h"
+
+#define MASK44 0xfffffffffffULL
+#define MASK42 0x3ffffffffffULL
+
+typedef unsigned __int128 u128;
+
+static inline uint64_t Load64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static inline void Store64(uint8_t *p, uint64_t v) {
+    for (unsigned int i = 0; i < 8; i++) {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+void Poly1305Init(Poly1305 *st, const uint8_t key[POLY1305_KEY_SIZE]) {
+    uint64_t t0 = Load64(key);
+    uint64_t t1 = Load64(key + 8);
+    // r is clamped as the spec requires
+    st->r[0] = t0 & 0xffc0fffffffULL;
+    st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    st->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+    st->h[0] = st->h[1] = st->h[2] = 0;
+    st->pad[0] = Load64(key + 16);
+    st->pad[1] = Load64(key + 24);
+    st->leftover = 0;
+}
+
+// h = (h + m) * r for every 16-byte block, hibit is 2^128 for whole blocks.
+static void Blocks(Poly1305 *st, const uint8_t *m, size_t length, uint64_t hibit) {
+    uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+    uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+    while (length >= 16) {
+        uint64_t t0 = Load64(m);
+        uint64_t t1 = Load64(m + 8);
+        h0 += t0 & MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+        h2 += ((t1 >> 24) & MASK42) | hibit;
+
+        u128 d0 = (u128) h0 * r0 + (u128) h1 * s2 + (u128) h2 * s1;
+        u128 d1 = (u128) h0 * r1 + (u128) h1 * r0 + (u128) h2 * s2;
+        u128 d2 = (u128) h0 * r2 + (u128) h1 * r1 + (u128) h2 * r0;
+        uint64_t c = (uint64_t) (d0 >> 44);
+        h0 = (uint64_t) d0 & MASK44;
+        d1 += c;
+        c = (uint64_t) (d1 >> 44);
+        h1 = (uint64_t) d1 & MASK44;
+        d2 += c;
+        c = (uint64_t) (d2 >> 42);
+        h2 = (uint64_t) d2 & MASK42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= MASK44;
+        h1 += c;
+        m += 16;
+        length -= 16;
+    }
+    st->h[0] = h0;
+    st->h[1] = h1;
+    st->h[2] = h2;
+}
+
+void Poly1305Update(Poly1305 *st, const uint8_t *m, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (st->leftover > 0) {
+        size_t want = 16 - st->leftover;
+        want = want < length ? want : length;
+        memcpy(st->buffer + st->leftover, m, want);
+        st->leftover += want;
+        m += want;
+        length -= want;
+        if (st->leftover < 16) {
+            return;
+        }
+        Blocks(st, st->buffer, 16, 1ULL << 40);
+        st->leftover = 0;
+    }
+    size_t whole = length & ~(size_t) 15;
+    if (whole > 0) {
+        Blocks(st, m, whole, 1ULL << 40);
+        m += whole;
+        length -= whole;
+    }
+    if (length > 0) {
+        memcpy(st->buffer, m, length);
+        st->leftover = length;
+    }
+}
+
+void Poly1305Final(Poly1305 *st, uint8_t tag[POLY1305_TAG_SIZE]) {
+    if (st->leftover > 0) {  // padded with a 1 byte, so no 2^128 bit
+        st->buffer[st->leftover] = 1;
+        memset(st->buffer + st->leftover + 1, 0, 16 - st->leftover - 1);
+        Blocks(st, st->buffer, 16, 0);
+    }
+
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+    uint64_t c = h1 >> 44;
+    h1 &= MASK44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= MASK42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= MASK44;
+    h1 += c;
+    c = h1 >> 44;
+    h1 &= MASK44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= MASK42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= MASK44;
+    h1 += c;
+
+    // g = h - p = h + 5 - 2^130, taken when it does not go negative
+    uint64_t g0 = h0 + 5;
+    c = g0 >> 44;
+    g0 &= MASK44;
+    uint64_t g1 = h1 + c;
+    c = g1 >> 44;
+    g1 &= MASK44;
+    uint64_t g2 = h2 + c - (1ULL << 42);
+    c = (g2 >> 63) - 1;  // all ones when g2 did not underflow
+    g0 &= c;
+    g1 &= c;
+    g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    // tag = (h + pad) mod 2^128
+    uint64_t t0 = st->pad[0], t1 = st->pad[1];
+    h0 += t0 & MASK44;
+    c = h0 >> 44;
+    h0 &= MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & MASK44) + c;
+    c = h1 >> 44;
+    h1 &= MASK44;
+    h2 += ((t1 >> 24) & MASK42) + c;
+    h2 &= MASK42;
+    Store64(tag, h0 | (h1 << 44));
+    Store64(tag + 8, (h1 >> 20) | (h2 << 24));
+    memset(st, 0, sizeof(*st));
+}
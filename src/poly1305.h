@@ -0,0 +1,27 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_POLY1305_H_
+#define SRC_POLY1305_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Poly1305 one-time authenticator (RFC 8439), 44/44/42-bit limbs with
+// 128-bit products. A key must never authenticate two messages, the AEAD
+// derives a fresh one per nonce.
+
+#define POLY1305_KEY_SIZE 32
+#define POLY1305_TAG_SIZE 16
+
+typedef struct {
+    uint64_t r[3];
+    uint64_t h[3];
+    uint64_t pad[2];
+    size_t leftover;
+    uint8_t buffer[16];
+} Poly1305;
+
+void Poly1305Init(Poly1305 *st, const uint8_t key[POLY1305_KEY_SIZE]);
+void Poly1305Update(Poly1305 *st, const uint8_t *m, size_t length);
+void Poly1305Final(Poly1305 *st, uint8_t tag[POLY1305_TAG_SIZE]);
+
+#endif  // SRC_POLY1305_H_
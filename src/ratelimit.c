@@ -0,0 +1,167 @@
+// Copyright 2025 Michał Jankowski
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "net_func.h"
+#include "path.h"
+#include "ratelimit.h"
+
+// Per source and type. Scans are cheap to send and expensive to answer,
+// messages are what the node is for.
+static const RateBudget DEFAULT_BUDGETS[RATE_TYPES] = {
+    [SCAN] = {1, 4},
+    [SCAN_RESPONSE] = {4, 16},
+    [CLEARTEXT_MESSAGE] = {5000, 10000},
+    [DISCONNECT] = {1, 4},
+    [CHANNEL_MESSAGE] = {5000, 10000},
+    [PING] = {10, 20},
+    [PONG] = {10, 20},
+    [GOSSIP] = {20, 40},
+    [BATCH] = {1000, 2000},
+    [ENCRYPTED_MESSAGE] = {5000, 10000},
+    [RATE_TYPES - 1] = {10, 10},
+};
+
+void RateLimiterInit(RateLimiter *rl, unsigned int scale) {
+    memset(rl, 0, sizeof(*rl));
+    rl->enabled = scale != 0;
+    if (getrandom(&rl->seed, sizeof(rl->seed), 0) != sizeof(rl->seed)) {
+        rl->seed = (uint32_t) time(NULL);
+    }
+    rl->epoch_us = MonotonicUs();
+    for (unsigned int i = 0; i < RATE_TYPES; i++) {
+        rl->budgets[i].rate = DEFAULT_BUDGETS[i].rate * scale;
+        rl->budgets[i].burst = DEFAULT_BUDGETS[i].burst * scale;
+    }
+}
+
+// Reads the type without decoding anything, -1 if this is not a frame.
+int PeekMessageType(const char *frame, ssize_t frame_length) {
+    const uint8_t *bytes = (const uint8_t *) frame;
+    if (frame_length < 2) {
+        return -1;
+    } else if ((bytes[0] & 0xF0) == WIRE_VERSION_MARK) {
+        return bytes[1];
+    }
+    return bytes[1] & 0x0F;
+}
+
+static void SourceKey(const struct sockaddr_storage *src_addr, uint8_t key[16]) {
+    if (src_addr->ss_family == AF_INET) {
+        memset(key, 0, 10);
+        key[10] = 0xFF;
+        key[11] = 0xFF;
+        memcpy(key + 12, &((const struct sockaddr_in *) src_addr)->sin_addr, 4);
+    } else if (src_addr->ss_family == AF_INET6) {
+        memcpy(key, &((const struct sockaddr_in6 *) src_addr)->sin6_addr, 16);
+    } else {
+        memset(key, 0, 16);
+    }
+}
+
+static uint32_t KeyHash(const uint8_t key[16], uint32_t seed) {
+    uint32_t h = seed;
+    for (unsigned int i = 0; i < 16; i += 4) {
+        uint32_t word;
+        memcpy(&word, key + i, sizeof(word));
+        h = (h ^ word) * 0x9E3779B1u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+static int TakeToken(const RateLimiter *rl, RateEntry *e, int type, uint32_t now_ms) {
+    uint32_t elapsed = now_ms - e->stamp_ms;
+    e->stamp_ms = now_ms;
+    for (unsigned int i = 0; i < RATE_TYPES; i++) {
+        uint64_t tokens = e->milli_tokens[i] + (uint64_t) elapsed * rl->budgets[i].rate;  // rate/s = milli/ms
+        uint64_t burst = (uint64_t) rl->budgets[i].burst * 1000;
+        e->milli_tokens[i] = (uint32_t) (tokens < burst ? tokens : burst);
+    }
+    if (e->milli_tokens[type] < 1000) {
+        return 0;
+    }
+    e->milli_tokens[type] -= 1000;
+    return 1;
+}
+
+static int SketchAllow(RateLimiter *rl, uint32_t hash, int type, uint32_t now_ms) {
+    if (now_ms - rl->window_start_ms >= RATE_WINDOW_MS) {
+        memset(rl->sketch, 0, sizeof(rl->sketch));
+        rl->window_start_ms = now_ms;
+    }
+    rl->sketch_checks++;
+    uint32_t h = hash ^ ((uint32_t) type * 0x85EBCA6Bu);
+    uint16_t estimate = UINT16_MAX;
+    uint16_t *cells[RATE_SKETCH_ROWS];
+    for (unsigned int row = 0; row < RATE_SKETCH_ROWS; row++) {
+        h = (h ^ (h >> 13)) * 0xC2B2AE35u + row;
+        cells[row] = &rl->sketch[row][h % RATE_SKETCH_WIDTH];
+        if (*cells[row] < estimate) {
+            estimate = *cells[row];
+        }
+    }
+    uint32_t budget = rl->budgets[type].burst < UINT16_MAX ? rl->budgets[type].burst : UINT16_MAX;
+    if (estimate >= budget) {
+        return 0;
+    }
+    for (unsigned int row = 0; row < RATE_SKETCH_ROWS; row++) {
+        if (*cells[row] == estimate) {  // conservative update keeps overestimates down
+            (*cells[row])++;
+        }
+    }
+    return 1;
+}
+
+// Returns 1 if the datagram may be processed. Drops are counted per type.
+int RateAllow(RateLimiter *rl, const struct sockaddr_storage *src_addr, int msg_type, uint64_t now_us) {
+    if (!rl->enabled) {
+        return 1;
+    }
+    int type = msg_type >= 0 && msg_type < RATE_TYPES - 1 ? msg_type : RATE_TYPES - 1;
+    uint32_t now_ms = (uint32_t) ((now_us - rl->epoch_us) / 1000) + 1;
+
+    uint8_t key[16];
+    SourceKey(src_addr, key);
+    uint32_t hash = KeyHash(key, rl->seed);
+    RateEntry *set = &rl->entries[(hash % RATE_SETS) * RATE_WAYS];
+
+    RateEntry *slot = NULL;
+    for (unsigned int w = 0; w < RATE_WAYS; w++) {
+        RateEntry *e = &set[w];
+        if (e->stamp_ms != 0 && memcmp(e->addr, key, sizeof(key)) == 0) {
+            slot = e;
+            break;
+        }
+    }
+    if (slot == NULL) {
+        for (unsigned int w = 0; w < RATE_WAYS; w++) {
+            RateEntry *e = &set[w];
+            if (e->stamp_ms == 0 || now_ms - e->stamp_ms >= RATE_IDLE_MS) {
+                memcpy(e->addr, key, sizeof(key));
+                e->stamp_ms = now_ms;
+                for (unsigned int i = 0; i < RATE_TYPES; i++) {
+                    e->milli_tokens[i] = rl->budgets[i].burst * 1000;
+                }
+                slot = e;
+                break;
+            }
+        }
+    }
+
+    int allowed = slot != NULL ? TakeToken(rl, slot, type, now_ms) : SketchAllow(rl, hash, type, now_ms);
+    if (!allowed) {
+        rl->dropped[type]++;
+    }
+    return allowed;
+}
+
+unsigned long RateDroppedTotal(const RateLimiter *rl) {
+    unsigned long total = 0;
+    for (unsigned int i = 0; i < RATE_TYPES; i++) {
+        total += rl->dropped[i];
+    }
+    return total;
+}
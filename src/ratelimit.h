@@ -0,0 +1,61 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_RATELIMIT_H_
+#define SRC_RATELIMIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// Ingress policing, applied to every datagram before it is decoded, so a
+// flood costs one hash lookup per packet and never reaches the peer table
+// or triggers replies.
+//
+// Each source address gets a token bucket per message type, kept in a
+// fixed-size set-associative table (RATE_WAYS entries of one cache line per
+// set). Buckets idle for RATE_IDLE_MS are reclaimed. When a set is full of
+// active sources, newcomers are policed by a count-min sketch instead: per
+// type, a source may send at most the bucket's burst per RATE_WINDOW_MS.
+
+#define RATE_TYPES 11  // message types 0..9, everything else shares the last one
+#define RATE_SETS 256
+#define RATE_WAYS 4
+#define RATE_IDLE_MS 10000
+#define RATE_SKETCH_ROWS 4
+#define RATE_SKETCH_WIDTH 512
+#define RATE_WINDOW_MS 1000
+#define RATE_LINE_SIZE 64
+
+typedef struct {
+    uint32_t rate;  // tokens per second
+    uint32_t burst;
+} RateBudget;
+
+// Aligned, so a lookup touches one line per way. The Node holding the
+// limiter is allocated with its alignment (NodeOpen()).
+typedef struct {
+    uint8_t addr[16];  // IPv4 as v4-mapped IPv6
+    uint32_t stamp_ms;  // last refill, 0 = free entry
+    uint32_t milli_tokens[RATE_TYPES];
+} __attribute__((aligned(RATE_LINE_SIZE))) RateEntry;
+
+_Static_assert(sizeof(RateEntry) == RATE_LINE_SIZE, "RATE_TYPES has outgrown a cache line per entry");
+
+typedef struct {
+    int enabled;
+    uint32_t seed;
+    uint64_t epoch_us;  // stamps are ms since this, never 0
+    RateBudget budgets[RATE_TYPES];
+    RateEntry entries[RATE_SETS * RATE_WAYS];
+    uint32_t window_start_ms;
+    uint16_t sketch[RATE_SKETCH_ROWS][RATE_SKETCH_WIDTH];
+    unsigned long dropped[RATE_TYPES];
+    unsigned long sketch_checks;
+} RateLimiter;
+
+void RateLimiterInit(RateLimiter *rl, unsigned int scale);
+int PeekMessageType(const char *frame, ssize_t frame_length);
+int RateAllow(RateLimiter *rl, const struct sockaddr_storage *src_addr, int msg_type, uint64_t now_us);
+unsigned long RateDroppedTotal(const RateLimiter *rl);
+
+#endif  // SRC_RATELIMIT_H_
@@ -0,0 +1,377 @@
+// Copyright 2025 Michał Jankowski
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aead.h"
+#include "announce.h"
+#include "c_comm.h"
+#include "chacha20.h"
+#include "msgbuf.h"
+#include "net_func.h"
+#include "node.h"
+#include "outbox.h"
+#include "path.h"
+#include "peer.h"
+#include "secure.h"
+#include "x25519.h"
+
+static const uint8_t SECURE_KDF_LABEL[16] = "c_comm sealed v1";
+
+int SecureInit(SecureState *s, int mode, size_t history_size) {
+    memset(s, 0, sizeof(*s));
+    s->mode = mode;
+    if (mode == COMM_ENCRYPT_OFF) {
+        return 0;
+    }
+    if ((s->history = calloc(history_size, sizeof(KeyHistory))) == NULL) {
+        return -1;
+    }
+    s->history_size = history_size;
+    if (X25519Keypair(s->public_key, s->secret_key) < 0) {
+        SecureFree(s);
+        return -1;
+    }
+    return 0;
+}
+
+void SecureFree(SecureState *s) {
+    memset(s->secret_key, 0, sizeof(s->secret_key));
+    free(s->history);
+    s->history = NULL;
+    s->history_size = s->history_used = 0;
+}
+
+// Appends our key to a scan payload, returns its length (0 with
+// encryption off).
+size_t SecureScanExtension(const SecureState *s, uint8_t *out) {
+    if (s->mode == COMM_ENCRYPT_OFF) {
+        return 0;
+    }
+    out[0] = '\0';  // ends the identifier
+    out[1] = SECURE_KEY_X25519;
+    memcpy(out + 2, s->public_key, X25519_KEY_SIZE);
+    return SECURE_SCAN_EXTENSION;
+}
+
+// Copies the key a scan payload announces, -1 when it has none.
+int SecureScanKey(const char *msg, size_t msg_length, uint8_t public_key[X25519_KEY_SIZE]) {
+    size_t identifier_length = strnlen(msg, msg_length);
+    if (msg_length - identifier_length < SECURE_SCAN_EXTENSION
+        || (uint8_t) msg[identifier_length + 1] != SECURE_KEY_X25519) {
+        return -1;
+    }
+    memcpy(public_key, msg + identifier_length + 2, X25519_KEY_SIZE);
+    return 0;
+}
+
+static void RequestPeerKey(Node *node, Peer *p);
+
+// A new key pair for a full history. Every key derived from the old one is
+// retired, so the counters that went with them can go: the keyed peers get
+// a scan with the new key and derive again.
+static int RotateKeys(Node *node) {
+    SecureState *s = &node->secure;
+    uint8_t secret_key[X25519_KEY_SIZE];
+    uint8_t public_key[X25519_KEY_SIZE];
+    memcpy(secret_key, s->secret_key, sizeof(secret_key));
+    memcpy(public_key, s->public_key, sizeof(public_key));
+    if (X25519Keypair(s->public_key, s->secret_key) < 0 || AnnounceBuild(node) < 0) {
+        memcpy(s->secret_key, secret_key, sizeof(secret_key));
+        memcpy(s->public_key, public_key, sizeof(public_key));
+        memset(secret_key, 0, sizeof(secret_key));
+        return -1;
+    }
+    memset(secret_key, 0, sizeof(secret_key));
+    memset(s->history, 0, s->history_size * sizeof(KeyHistory));
+    s->history_used = 0;
+    for (size_t i = 0; i < node->peers_size; i++) {
+        Peer *p = &node->peers[i];
+        if (p->keys.status != KEYS_READY) {
+            continue;
+        }
+        PeerWriteBegin(p);
+        memset(&p->keys, 0, sizeof(p->keys));
+        PeerWriteEnd(p);
+        RequestPeerKey(node, p);
+    }
+    s->rotations++;
+    return 0;
+}
+
+// The history entry for a remote key, added if new. NULL when the history
+// is full and our key pair could not be replaced.
+static KeyHistory *FindHistory(Node *node, const uint8_t *public_key) {
+    SecureState *s = &node->secure;
+    for (size_t i = 0; i < s->history_used; i++) {
+        if (memcmp(s->history[i].public_key, public_key, X25519_KEY_SIZE) == 0) {
+            return &s->history[i];
+        }
+    }
+    if (s->history_used == s->history_size && RotateKeys(node) < 0) {
+        return NULL;
+    }
+    KeyHistory *h = &s->history[s->history_used++];
+    memcpy(h->public_key, public_key, X25519_KEY_SIZE);
+    return h;
+}
+
+// Records what the peer in slot id announced in its scan: a public key, or
+// NULL for none. Returns 1 when the peer has keys it did not have before.
+int SecurePeerKey(Node *node, size_t id, const uint8_t *public_key) {
+    SecureState *s = &node->secure;
+    PeerKeys *k = &node->peers[id].keys;
+    if (public_key == NULL) {
+        PeerWriteBegin(&node->peers[id]);
+        memset(k, 0, sizeof(*k));
+        k->status = KEYS_UNSUPPORTED;
+        PeerWriteEnd(&node->peers[id]);
+        return 0;
+    } else if (s->mode == COMM_ENCRYPT_OFF) {
+        return 0;
+    } else if (k->status == KEYS_READY && memcmp(k->public_key, public_key, X25519_KEY_SIZE) == 0) {
+        return 0;  // deriving again would restart the counters under the same keys
+    }
+
+    static const uint8_t ZEROS[64] = {0};
+    uint8_t shared[X25519_KEY_SIZE];
+    X25519(shared, s->secret_key, public_key);
+    if (memcmp(s->public_key, public_key, X25519_KEY_SIZE) == 0
+        || memcmp(shared, ZEROS, sizeof(shared)) == 0) {  // our own key, or a low-order point
+        PeerWriteBegin(&node->peers[id]);
+        memset(k, 0, sizeof(*k));
+        k->status = KEYS_UNSUPPORTED;
+        PeerWriteEnd(&node->peers[id]);
+        return 0;
+    }
+    unsigned long rotations = s->rotations;
+    KeyHistory *h = FindHistory(node, public_key);
+    if (h == NULL) {
+        memset(shared, 0, sizeof(shared));
+        return 0;  // stays without keys, we ask again on the next message
+    } else if (s->rotations != rotations) {
+        X25519(shared, s->secret_key, public_key);  // under the new key pair
+    }
+    int order = memcmp(s->public_key, public_key, X25519_KEY_SIZE);
+
+    uint8_t session_key[CHACHA20_KEY_SIZE];
+    uint8_t keys[64] = {0};
+    ChaCha20Key kdf;
+    HChaCha20(session_key, shared, SECURE_KDF_LABEL);
+    ChaCha20KeyInit(&kdf, session_key);
+    ChaCha20Xor(&kdf, ZEROS, 0, keys, keys, sizeof(keys));
+    PeerWriteBegin(&node->peers[id]);
+    memset(k, 0, sizeof(*k));
+    memcpy(k->public_key, public_key, X25519_KEY_SIZE);
+    ChaCha20KeyInit(&k->tx, order < 0 ? keys : keys + 32);
+    ChaCha20KeyInit(&k->rx, order < 0 ? keys + 32 : keys);
+    k->history = (uint32_t) (h - s->history);
+    k->status = KEYS_READY;
+    PeerWriteEnd(&node->peers[id]);
+    s->key_exchanges++;
+
+    memset(shared, 0, sizeof(shared));
+    memset(session_key, 0, sizeof(session_key));
+    memset(keys, 0, sizeof(keys));
+    memset(&kdf, 0, sizeof(kdf));
+    return 1;
+}
+
+static void MakeNonce(uint8_t nonce[CHACHA20_NONCE_SIZE], uint64_t counter) {
+    memset(nonce, 0, 4);
+    for (unsigned int i = 0; i < 8; i++) {
+        nonce[4 + i] = (uint8_t) (counter >> (8 * i));
+    }
+}
+
+static uint64_t LoadCounter(const uint8_t *p) {
+    uint64_t counter = 0;
+    for (unsigned int i = 0; i < 8; i++) {
+        counter = (counter << 8) | p[i];
+    }
+    return counter;
+}
+
+// A unicast scan carries our key, the answer brings back theirs. Rate
+// limited, last_us is the peer's or the one shared by all strangers.
+static void RequestKey(Node *node, uint64_t *last_us, const struct sockaddr *dest, socklen_t dest_size) {
+    uint64_t now = MonotonicUs();
+    if (*last_us != 0 && now - *last_us < SECURE_REQUEST_INTERVAL_US) {
+        return;
+    }
+    *last_us = now;
+    SendScanTo(node, dest, dest_size);
+}
+
+static void RequestPeerKey(Node *node, Peer *p) {
+    int family = PathSelectFamily(p);
+    if (family == AF_UNSPEC) {
+        return;
+    }
+    struct sockaddr_storage dest;
+    socklen_t dest_size = PeerAddress(node, p, family, &dest);
+    RequestKey(node, &p->keys.requested_us, (struct sockaddr *) &dest, dest_size);
+}
+
+// Seals msg (a msg_type payload) for the peer in slot id into a new pool
+// buffer. Returns 0 with *frame set, 0 with *frame NULL when the message
+// goes in cleartext (preferred mode, the peer has no key), -6 when it can't
+// go yet (required mode), -4 when the pool is exhausted.
+int SecureSealFrame(Node *node, size_t id, int msg_type, const char *msg, size_t msg_length, MsgBuf **frame) {
+    SecureState *s = &node->secure;
+    Peer *p = &node->peers[id];
+    PeerKeys *k = &p->keys;
+    *frame = NULL;
+    if (k->status != KEYS_READY) {
+        if (k->status == KEYS_NONE) {
+            RequestPeerKey(node, p);
+        }
+        return s->mode == COMM_ENCRYPT_REQUIRED ? -6 : 0;
+    }
+
+    MsgBuf *buf = MsgBufGet(&node->pool);
+    if (buf == NULL) {
+        return -4;
+    }
+    size_t payload_length = SECURE_OVERHEAD + msg_length;
+    long int header_length = EncodeFrameHeader(
+        (uint8_t *) buf->data, WIRE_HEADER_MAX, PeerWireVersion(node, p), node->session_token,
+        ENCRYPTED_MESSAGE, payload_length);
+    if (header_length < 0 || payload_length > MSGBUF_SIZE - (size_t) header_length) {
+        MsgBufPut(&node->pool, buf);
+        return -2;
+    }
+
+    uint8_t *payload = (uint8_t *) buf->data + header_length;
+    uint64_t counter = s->history[k->history].tx_counter++;
+    __atomic_store_n(&k->sealed, k->sealed + 1, __ATOMIC_RELAXED);  // PeerRead() takes it without a write
+    for (unsigned int i = 0; i < 8; i++) {
+        payload[i] = (uint8_t) (counter >> (56 - 8 * i));
+    }
+    payload[8] = (uint8_t) msg_type;
+    if (msg_length > 0) {
+        memcpy(payload + 9, msg, msg_length);
+    }
+    uint8_t nonce[CHACHA20_NONCE_SIZE];
+    MakeNonce(nonce, counter);
+    AeadSeal(&k->tx, nonce, NULL, 0, payload + 8, 1 + msg_length, payload + 9 + msg_length);
+    buf->length = (uint32_t) ((size_t) header_length + payload_length);
+    s->sealed++;
+    *frame = buf;
+    return 0;
+}
+
+// Opens an ENCRYPTED_MESSAGE payload we sealed ourselves (keys are the
+// recipient's), for messages salvaged from a send queue. Moves the inner
+// payload to the front of msg and returns its type, -1 if it won't open.
+int SecureUnsealOwn(const PeerKeys *keys, char *msg, size_t *msg_length) {
+    if (keys->status != KEYS_READY || *msg_length < SECURE_OVERHEAD) {
+        return -1;
+    }
+    uint8_t nonce[CHACHA20_NONCE_SIZE];
+    MakeNonce(nonce, LoadCounter((const uint8_t *) msg));
+    uint8_t *sealed = (uint8_t *) msg + 8;
+    size_t sealed_length = *msg_length - 8 - AEAD_TAG_SIZE;
+    if (AeadOpen(&keys->tx, nonce, NULL, 0, sealed, sealed_length, sealed + sealed_length) < 0) {
+        return -1;
+    }
+    int inner_type = sealed[0];
+    *msg_length = sealed_length - 1;
+    memmove(msg, sealed + 1, *msg_length);
+    return inner_type;
+}
+
+// Cleartext messages are dropped in required mode.
+int SecureAcceptCleartext(Node *node) {
+    if (node->secure.mode != COMM_ENCRYPT_REQUIRED) {
+        return 1;
+    }
+    node->secure.refused++;
+    return 0;
+}
+
+static int Replayed(const KeyHistory *k, uint64_t counter) {
+    if (counter > k->rx_highest) {
+        return 0;
+    }
+    uint64_t age = k->rx_highest - counter;
+    return age >= SECURE_REPLAY_WINDOW || (k->rx_window >> age) & 1;
+}
+
+static void AcceptCounter(KeyHistory *k, uint64_t counter) {
+    if (counter > k->rx_highest) {
+        uint64_t shift = counter - k->rx_highest;
+        k->rx_window = shift < SECURE_REPLAY_WINDOW ? k->rx_window << shift : 0;
+        k->rx_highest = counter;
+    }
+    k->rx_window |= 1ULL << (k->rx_highest - counter);
+}
+
+void ProcessMessageEncrypted(
+    Node *node,
+    long int peer_id,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr,
+    socklen_t src_addr_size
+) {
+    SecureState *s = &node->secure;
+    if (msg_length < SECURE_OVERHEAD) {
+        node->stats.rx_invalid++;
+        return;
+    } else if (s->mode == COMM_ENCRYPT_OFF) {
+        s->rejected++;
+        return;
+    }
+    if (peer_id < 0 || node->peers[peer_id].keys.status != KEYS_READY) {
+        s->rejected++;
+        uint64_t *last_us = peer_id < 0 ? &s->stranger_request_us : &node->peers[peer_id].keys.requested_us;
+        RequestKey(node, last_us, (struct sockaddr *) src_addr, src_addr_size);
+        return;
+    }
+
+    PeerKeys *k = &node->peers[peer_id].keys;
+    KeyHistory *h = &s->history[k->history];
+    uint64_t counter = LoadCounter((const uint8_t *) msg);
+    if (Replayed(h, counter)) {
+        s->replayed++;
+        return;
+    }
+    uint8_t nonce[CHACHA20_NONCE_SIZE];
+    MakeNonce(nonce, counter);
+    uint8_t *sealed = (uint8_t *) msg + 8;
+    size_t sealed_length = msg_length - 8 - AEAD_TAG_SIZE;
+    if (AeadOpen(&k->rx, nonce, NULL, 0, sealed, sealed_length, sealed + sealed_length) < 0) {
+        s->rejected++;
+        // most likely the peer restarted with a new key pair
+        RequestKey(node, &k->requested_us, (struct sockaddr *) src_addr, src_addr_size);
+        return;
+    }
+    AcceptCounter(h, counter);
+    s->opened++;
+
+    char *payload = (char *) sealed + 1;
+    size_t payload_length = sealed_length - 1;
+    payload[payload_length] = '\0';  // over the tag, checked already
+    if (sealed[0] == CLEARTEXT_MESSAGE) {
+        ProcessMessageCleartext(node, peer_id, payload, payload_length, src_addr);
+    } else if (sealed[0] == BATCH) {
+        ProcessMessageBatch(node, peer_id, payload, payload_length, src_addr);
+    } else {
+        node->stats.rx_invalid++;
+    }
+}
+
+void PrintSecure(const Node *node) {
+    static const char *MODE_NAMES[] = {"off", "preferred", "required"};
+    const SecureState *s = &node->secure;
+    size_t keyed = 0;
+    for (size_t i = 0; i < node->peers_size; i++) {
+        keyed += node->peers[i].keys.status == KEYS_READY;
+    }
+    printf("Encryption: %s (ChaCha20 %s), %zu peers keyed, %zu/%zu keys remembered, "
+           "%lu key pair rotations, %lu sealed, %lu opened, %lu rejected, %lu replayed, "
+           "%lu cleartext refused\n",
+           MODE_NAMES[s->mode], ChaCha20Implementation(), keyed, s->history_used, s->history_size,
+           s->rotations, s->sealed, s->opened, s->rejected, s->replayed, s->refused);
+}
@@ -0,0 +1,102 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_SECURE_H_
+#define SRC_SECURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "aead.h"
+#include "msgbuf.h"
+#include "peer.h"
+#include "x25519.h"
+
+// Sealed messages. Every node makes an X25519 key pair per run and announces
+// the public half in its SCAN/SCAN_RESPONSE. Two nodes that have seen each
+// other's derive a pair of directional ChaCha20-Poly1305 keys from the
+// shared secret, and CLEARTEXT_MESSAGE and BATCH frames between them travel
+// as ENCRYPTED_MESSAGE instead. The key schedules are set up once per peer
+// (Peer.keys), frames are sealed in place in their pool buffer.
+//
+// Scan payload: identifier | u8 0 | u8 key_type (1 = X25519) | public_key[32]
+// Old nodes read the identifier up to the NUL and ignore the rest.
+//
+// ENCRYPTED_MESSAGE payload:
+//     u64 counter | sealed(u8 inner_type | inner payload) | tag[16]
+// The nonce is 4 zero bytes and the counter, little-endian. Counters count
+// up per direction, receivers keep a window of the last
+// SECURE_REPLAY_WINDOW and drop anything older or seen before.
+//
+// Keys: k = HChaCha20(X25519(secret, peer_public), SECURE_KDF_LABEL). The
+// first 32 bytes of k's keystream seal frames from the lesser public key
+// (memcmp) to the greater, the next 32 the other way.
+//
+// The same two key pairs always derive the same keys, so the counters and
+// the replay window are kept per remote public key (KeyHistory) for as long
+// as our key pair lasts, not in the peer slot: a slot wiped by /clear, a
+// disconnect or gossip picks up where the last one stopped when the key
+// comes back. When the history is full we make a new key pair, which
+// retires every key derived from the old one, and ask the keyed peers for
+// theirs again.
+//
+// Nothing vouches for the public keys: this keeps passive listeners out,
+// not someone who can answer scans in the peer's place. Channel messages,
+// gossip and probes stay cleartext.
+//
+// Modes (CommEncrypt): off announces no key and sends cleartext. Preferred
+// seals for every peer with a key and sends cleartext to the others, asking
+// those we never had a scan from for their key. Required never sends
+// cleartext messages, those for peers without a key wait in the outbox, and
+// drops the cleartext messages it receives.
+
+#define SECURE_KEY_X25519 1
+#define SECURE_SCAN_EXTENSION (2 + X25519_KEY_SIZE)
+#define SECURE_OVERHEAD (8 + 1 + AEAD_TAG_SIZE)
+#define SECURE_REPLAY_WINDOW 64
+#define SECURE_REQUEST_INTERVAL_US 1000000  // per peer, and once for all strangers
+
+typedef struct Node Node;
+
+typedef struct {
+    uint8_t public_key[X25519_KEY_SIZE];  // the remote one
+    uint64_t tx_counter;  // the next one to use
+    uint64_t rx_highest;
+    uint64_t rx_window;  // bit i set: rx_highest - i was received
+} KeyHistory;
+
+typedef struct {
+    int mode;  // CommEncrypt
+    uint8_t secret_key[X25519_KEY_SIZE];
+    uint8_t public_key[X25519_KEY_SIZE];
+    KeyHistory *history;  // per remote key, under our current key pair
+    size_t history_size;
+    size_t history_used;
+    uint64_t stranger_request_us;  // last key request to a sender not in the peer table
+    unsigned long sealed;
+    unsigned long opened;
+    unsigned long rejected;  // forged, damaged, or under a key we don't have
+    unsigned long replayed;
+    unsigned long refused;  // cleartext messages dropped in required mode
+    unsigned long key_exchanges;
+    unsigned long rotations;  // new key pairs for a full history
+} SecureState;
+
+int SecureInit(SecureState *s, int mode, size_t history_size);
+void SecureFree(SecureState *s);
+size_t SecureScanExtension(const SecureState *s, uint8_t *out);
+int SecureScanKey(const char *msg, size_t msg_length, uint8_t public_key[X25519_KEY_SIZE]);
+int SecurePeerKey(Node *node, size_t id, const uint8_t *public_key);
+int SecureSealFrame(Node *node, size_t id, int msg_type, const char *msg, size_t msg_length, MsgBuf **frame);
+int SecureUnsealOwn(const PeerKeys *keys, char *msg, size_t *msg_length);
+int SecureAcceptCleartext(Node *node);
+void ProcessMessageEncrypted(
+    Node *node,
+    long int peer_id,
+    char *msg,
+    size_t msg_length,
+    struct sockaddr_storage *src_addr,
+    socklen_t src_addr_size
+);
+void PrintSecure(const Node *node);
+
+#endif  // SRC_SECURE_H_
@@ -0,0 +1,180 @@
+// Copyright 2025 Michał Jankowski
+#include <errno.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "net_func.h"
+#include "peer.h"
+#include "send_cache.h"
+
+int SendCacheInit(SendCache *cache, size_t fd_budget, int ifindex) {
+    memset(cache, 0, sizeof(*cache));
+    if (fd_budget == 0) {
+        return 0;
+    }
+    if (if_indextoname(ifindex, cache->ifname) == NULL) {
+        return -1;
+    }
+    if ((cache->contexts = calloc(fd_budget, sizeof(SendContext))) == NULL) {
+        return -2;
+    }
+    for (size_t i = 0; i < fd_budget; i++) {
+        cache->contexts[i].fd = -1;
+    }
+    cache->fd_budget = fd_budget;
+    cache->ifindex = ifindex;
+    return 0;
+}
+
+static void CloseContext(SendContext *ctx) {
+    if (ctx->fd >= 0) {
+        close(ctx->fd);
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->fd = -1;
+}
+
+void SendCacheClose(SendCache *cache) {
+    for (size_t i = 0; i < cache->fd_budget; i++) {
+        CloseContext(&cache->contexts[i]);
+    }
+    free(cache->contexts);
+    cache->contexts = NULL;
+    cache->fd_budget = 0;
+}
+
+static int ContextMatches(const SendContext *ctx, const struct sockaddr *addr) {
+    if (ctx->fd < 0 || ctx->family != addr->sa_family) {
+        return 0;
+    } else if (addr->sa_family == AF_INET) {
+        return ctx->addr4.s_addr == ((const struct sockaddr_in *) addr)->sin_addr.s_addr;
+    }
+    return memcmp(&ctx->addr6, &((const struct sockaddr_in6 *) addr)->sin6_addr, sizeof(ctx->addr6)) == 0;
+}
+
+// Returns the free or least recently used slot.
+static SendContext *VictimContext(SendCache *cache) {
+    SendContext *victim = &cache->contexts[0];
+    for (size_t i = 0; i < cache->fd_budget; i++) {
+        SendContext *ctx = &cache->contexts[i];
+        if (ctx->fd < 0) {
+            return ctx;
+        } else if (ctx->last_used < victim->last_used) {
+            victim = ctx;
+        }
+    }
+    return victim;
+}
+
+static int OpenContext(SendCache *cache, SendContext *ctx, const struct sockaddr *dest_addr, socklen_t dest_addr_size) {
+    int fd = socket(dest_addr->sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+    // same egress as the shared sockets, link-local peers are only reachable there
+    if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, cache->ifname, strlen(cache->ifname) + 1) < 0
+        || connect(fd, dest_addr, dest_addr_size) < 0) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
+    ctx->fd = fd;
+    ctx->family = dest_addr->sa_family;
+    if (ctx->family == AF_INET) {
+        ctx->addr4 = ((const struct sockaddr_in *) dest_addr)->sin_addr;
+    } else {
+        ctx->addr6 = ((const struct sockaddr_in6 *) dest_addr)->sin6_addr;
+    }
+    return 0;
+}
+
+static int BuildHeader(SendContext *ctx, int version, uint32_t token) {
+    long int header_length = EncodeFrameHeader(
+        ctx->header, sizeof(ctx->header), version, token, CLEARTEXT_MESSAGE, 0);
+    if (header_length < 0) {
+        ctx->header_length = 0;
+        return -EINVAL;
+    }
+    ctx->version = version;
+    ctx->header_length = (size_t) header_length;
+    return 0;
+}
+
+// Sends a CLEARTEXT_MESSAGE carrying msg. Returns the datagram length,
+// -ENOTCONN when the cache is disabled, or another -errno on failure.
+ssize_t SendCacheSendMessage(
+    SendCache *cache,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size,
+    int version,
+    uint32_t token,
+    const char *msg,
+    size_t msg_length
+) {
+    if (cache->fd_budget == 0) {
+        return -ENOTCONN;
+    }
+
+    SendContext *ctx = NULL;
+    for (size_t i = 0; i < cache->fd_budget; i++) {
+        if (ContextMatches(&cache->contexts[i], dest_addr)) {
+            ctx = &cache->contexts[i];
+            break;
+        }
+    }
+    if (ctx != NULL) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+        ctx = VictimContext(cache);
+        if (ctx->fd >= 0) {
+            cache->evictions++;
+            CloseContext(ctx);
+        }
+        int ret;
+        if ((ret = OpenContext(cache, ctx, dest_addr, dest_addr_size)) < 0) {
+            return ret;
+        }
+    }
+    ctx->last_used = ++cache->clock;
+    if (ctx->header_length == 0 || ctx->version != version) {
+        int ret;
+        if ((ret = BuildHeader(ctx, version, token)) < 0) {
+            return ret;
+        }
+    }
+    SetFramePayloadLength(ctx->header, msg_length);
+
+    struct iovec iov[2] = {
+        {.iov_base = ctx->header, .iov_len = ctx->header_length},
+        {.iov_base = (void *) msg, .iov_len = msg_length},
+    };
+    struct msghdr mh = {.msg_iov = iov, .msg_iovlen = 2};
+    ssize_t sent = sendmsg(ctx->fd, &mh, 0);
+    if (sent < 0) {
+        return -errno;  // includes ECONNREFUSED from an earlier ICMP unreachable
+    }
+    cache->sends++;
+    return sent;
+}
+
+// Drops the contexts of a peer that is going away.
+void SendCacheForgetPeer(SendCache *cache, const Peer *p) {
+    for (size_t i = 0; i < cache->fd_budget; i++) {
+        SendContext *ctx = &cache->contexts[i];
+        if (ctx->fd < 0) {
+            continue;
+        }
+        if ((ctx->family == AF_INET && p->inet4.seen != 0 && ctx->addr4.s_addr == p->inet4.addr4.s_addr)
+            || (ctx->family == AF_INET6 && p->inet6.seen != 0
+                && memcmp(&ctx->addr6, &p->inet6.addr6, sizeof(ctx->addr6)) == 0)) {
+            CloseContext(ctx);
+        }
+    }
+}
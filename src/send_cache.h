@@ -0,0 +1,64 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_SEND_CACHE_H_
+#define SRC_SEND_CACHE_H_
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "peer.h"
+
+#define SEND_CACHE_DEFAULT_FDS 16
+#define SEND_HEADER_MAX 16
+
+// Cached send contexts for peers we talk to directly. Each context is a UDP
+// socket connect()-ed to one peer address, so the kernel keeps the route
+// instead of looking it up on every sendto(), plus the message header
+// already encoded for that peer. Payloads are sent straight from the
+// caller's buffer with sendmsg(), header and payload as separate iovecs.
+//
+// The sockets use an ephemeral source port and are never read, the peer
+// identifies us by address only. At most fd_budget contexts are open, the
+// least recently used one is closed to make room for a new one.
+
+typedef struct {
+    int fd;  // -1 = free slot
+    int family;
+    union {
+        struct in_addr addr4;
+        struct in6_addr addr6;
+    };
+    uint64_t last_used;
+    int version;  // the header template is rebuilt when the peer's version changes
+    uint8_t header[SEND_HEADER_MAX];
+    size_t header_length;
+} SendContext;
+
+typedef struct {
+    SendContext *contexts;
+    size_t fd_budget;  // 0 = cache disabled
+    int ifindex;
+    char ifname[IF_NAMESIZE];
+    uint64_t clock;
+    unsigned long sends;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} SendCache;
+
+int SendCacheInit(SendCache *cache, size_t fd_budget, int ifindex);
+void SendCacheClose(SendCache *cache);
+ssize_t SendCacheSendMessage(
+    SendCache *cache,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size,
+    int version,
+    uint32_t token,
+    const char *msg,
+    size_t msg_length);
+void SendCacheForgetPeer(SendCache *cache, const Peer *p);
+
+#endif  // SRC_SEND_CACHE_H_
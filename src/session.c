@@ -0,0 +1,93 @@
+// Copyright 2025 Michał Jankowski
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "peer.h"
+#include "session.h"
+
+uint32_t NewSessionToken(void) {
+    uint32_t token = 0;
+    while (token == 0) {
+        if (getrandom(&token, sizeof(token), 0) != sizeof(token)) {
+            token = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+        }
+    }
+    return token;
+}
+
+static size_t SessionHash(uint32_t token, size_t capacity) {
+    return (size_t) ((token * 2654435761u) & (capacity - 1));  // Knuth multiplicative
+}
+
+int SessionTableInit(SessionTable *table, size_t peers_size) {
+    size_t capacity = 8;
+    while (capacity < 4 * peers_size) {
+        capacity *= 2;
+    }
+    memset(table, 0, sizeof(*table));
+    if ((table->entries = calloc(capacity, sizeof(SessionEntry))) == NULL) {
+        return -1;
+    }
+    table->capacity = capacity;
+    return 0;
+}
+
+void SessionTableFree(SessionTable *table) {
+    free(table->entries);
+    memset(table, 0, sizeof(*table));
+}
+
+static void Insert(SessionTable *table, uint32_t token, size_t slot) {
+    size_t i = SessionHash(token, table->capacity);
+    while (table->entries[i].token != 0 && table->entries[i].token != token) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    if (table->entries[i].token == 0) {
+        table->used++;
+    }
+    table->entries[i].token = token;
+    table->entries[i].slot = (uint32_t) slot;
+}
+
+static void Rebuild(SessionTable *table, Peer peers[], const size_t peers_size) {
+    memset(table->entries, 0, table->capacity * sizeof(SessionEntry));
+    table->used = 0;
+    for (size_t i = 0; i < peers_size; i++) {
+        if (peers[i].session_token != 0) {
+            Insert(table, peers[i].session_token, i);
+        }
+    }
+}
+
+// Records that slot now speaks for token, peers[slot].session_token has to
+// be set by the caller.
+void SessionRegister(SessionTable *table, Peer peers[], const size_t peers_size, uint32_t token, size_t slot) {
+    if (table->entries == NULL || token == 0) {
+        return;
+    }
+    if (2 * (table->used + 1) > table->capacity) {
+        Rebuild(table, peers, peers_size);
+    }
+    Insert(table, token, slot);
+}
+
+long int FindBySession(const SessionTable *table, Peer peers[], const size_t peers_size, uint32_t token) {
+    if (table->entries == NULL || token == 0) {
+        return -1;
+    }
+    size_t i = SessionHash(token, table->capacity);
+    while (table->entries[i].token != 0) {
+        if (table->entries[i].token == token) {
+            size_t slot = table->entries[i].slot;
+            if (slot < peers_size && peers[slot].session_token == token) {
+                return (long int) slot;
+            }
+            return -1;
+        }
+        i = (i + 1) & (table->capacity - 1);
+    }
+    return -1;
+}
@@ -0,0 +1,32 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_SESSION_H_
+#define SRC_SESSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "peer.h"
+
+// Session token -> peer slot index, open addressing with linear probing.
+// Entries are not removed when a peer goes away, a lookup only trusts an
+// entry whose slot still carries the same token. Stale entries are dropped
+// by rebuilding the table from the peer array once it gets too full.
+
+typedef struct {
+    uint32_t token;  // 0 = empty
+    uint32_t slot;
+} SessionEntry;
+
+typedef struct {
+    SessionEntry *entries;
+    size_t capacity;  // power of two
+    size_t used;
+} SessionTable;
+
+uint32_t NewSessionToken(void);
+int SessionTableInit(SessionTable *table, size_t peers_size);
+void SessionTableFree(SessionTable *table);
+void SessionRegister(SessionTable *table, Peer peers[], const size_t peers_size, uint32_t token, size_t slot);
+long int FindBySession(const SessionTable *table, Peer peers[], const size_t peers_size, uint32_t token);
+
+#endif  // SRC_SESSION_H_
@@ -1,19 +1,126 @@
 // Copyright 2025 Michał Jankowski
 #include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
 #include <netinet/in.h>
 #include <net/if.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "net_func.h"
 #include "sock_prep.h"
 
 const char* MCAST_GROUP = "224.0.0.192";
 const char* MCAST6_GROUP = "ff02::C0";
 const unsigned int PORT = 8192;
 
+#define UDP_HEADER 8  // socket filters see the datagram from the UDP header on
+
+// Classic BPF run by the kernel before a datagram is queued on the socket,
+// so junk costs neither a wakeup nor a copy. It mirrors the checks of
+// Deencapsulate(), a frame passes when it is
+//   v1: at least 2 bytes, first byte 0x00 (the CRC was never filled in),
+//       known type in the low nibble of the second byte
+//   v2: first byte 0xC0 | WIRE_V2, at least the base header, known type,
+//       header_words >= 3 and header + payload_length within the datagram
+// Rejected datagrams show up in the socket's drop counter (SocketDrops()).
+static const struct sock_filter FRAME_FILTER[] = {
+    /*  0 */ BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+    /*  1 */ BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, UDP_HEADER + WIRE_V1_HEADER_SIZE, 0, 20),  // short: drop
+    /*  2 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, UDP_HEADER),
+    /*  3 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, WIRE_VERSION_MARK | WIRE_V2, 4, 0),  // v2: 8
+    /*  4 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x00, 0, 17),  // other version: drop
+    /*  5 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, UDP_HEADER + 1),
+    /*  6 */ BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0F),
+    /*  7 */ BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, MESSAGE_TYPE_MAX, 14, 15),  // drop / accept
+    /*  8 */ BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+    /*  9 */ BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, UDP_HEADER + WIRE_V2_HEADER_SIZE, 0, 12),
+    /* 10 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, UDP_HEADER + 1),
+    /* 11 */ BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, MESSAGE_TYPE_MAX, 10, 0),
+    /* 12 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, UDP_HEADER + 3),
+    /* 13 */ BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, WIRE_V2_HEADER_SIZE / 4, 0, 8),
+    /* 14 */ BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),
+    /* 15 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    /* 16 */ BPF_STMT(BPF_LD | BPF_H | BPF_ABS, UDP_HEADER + 4),
+    /* 17 */ BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    /* 18 */ BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, UDP_HEADER),
+    /* 19 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    /* 20 */ BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+    /* 21 */ BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, 1, 0),  // header + payload fit: accept
+    /* 22 */ BPF_STMT(BPF_RET | BPF_K, 0),  // drop
+    /* 23 */ BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),  // accept, whole datagram
+};
+
+// Non-fatal when it fails, ListenUDPOnce() still checks every frame.
+int AttachFrameFilter(int sockfd) {
+    struct sock_fprog prog = {
+        .len = sizeof(FRAME_FILTER) / sizeof(FRAME_FILTER[0]),
+        .filter = (struct sock_filter *) FRAME_FILTER,
+    };
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69  // Linux 5.11, older libc headers lack it
+#endif
+
+// Lets a receive on an empty socket poll the device queue for up to usecs
+// instead of returning at once, and asks the kernel to prefer that over
+// interrupts (SO_PREFER_BUSY_POLL, ignored where unsupported). Raising
+// SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN.
+int SetBusyPoll(int sockfd, unsigned int usecs) {
+    int value = (int) usecs;
+    const int optval1 = 1;
+    if (sockfd < 0) {
+        return 0;
+    }
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) < 0) {
+        return -1;
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &optval1, sizeof(optval1));
+    return 0;
+}
+
+// Lets the kernel hand consecutive datagrams from one sender over as one
+// read, with their segment size in a UDP_GRO cmsg.
+int SetUdpGro(int sockfd, int enable) {
+    int value = enable != 0;
+    if (sockfd < 0) {
+        return 0;
+    }
+    return setsockopt(sockfd, SOL_UDP, UDP_GRO, &value, sizeof(value));
+}
+
+// MTU of ifname, -1 when it can't be read.
+int InterfaceMtu(int sockfd, const char *ifname) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+    if (sockfd < 0 || ioctl(sockfd, SIOCGIFMTU, &ifr) < 0) {
+        return -1;
+    }
+    return ifr.ifr_mtu;
+}
+
+// Datagrams the kernel dropped for this socket: rejected by the filter or
+// arriving to a full receive buffer. 0 when unknown.
+unsigned long SocketDrops(int sockfd) {
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t size = sizeof(meminfo);
+    if (sockfd < 0 || getsockopt(sockfd, SOL_SOCKET, SO_MEMINFO, meminfo, &size) < 0
+        || size <= SK_MEMINFO_DROPS * sizeof(uint32_t)) {
+        return 0;
+    }
+    return meminfo[SK_MEMINFO_DROPS];
+}
+
 int GetInet4SocketUDP(const char *ifname) {
     int sockfd;
     struct sockaddr_in bind_addr;
@@ -36,6 +143,9 @@ int GetInet4SocketUDP(const char *ifname) {
         return -5;
     }
 
+    // before bind, nothing unfiltered gets queued in between
+    AttachFrameFilter(sockfd);
+
     if ((bind(sockfd, (const struct sockaddr *) &bind_addr, sizeof(bind_addr))) < 0) {
         close(sockfd);
         return -2;
@@ -68,6 +178,8 @@ int GetInet4SocketUDP(const char *ifname) {
 
 
     setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &optval0, sizeof(optval0));
+    // only deliver groups joined on this socket, not every group joined on the host
+    setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_ALL, &optval0, sizeof(optval0));
 
     return sockfd;
 }
@@ -99,6 +211,9 @@ int GetInet6SocketUDP(const char *ifname) {
         // => no need to disable IPv6 communication if this fails
     }
 
+    // before bind, nothing unfiltered gets queued in between
+    AttachFrameFilter(sockfd);
+
     if ((bind(sockfd, (const struct sockaddr *) &bind_addr, sizeof(bind_addr))) < 0) {
         close(sockfd);
         return -2;
@@ -133,6 +248,29 @@ int GetInet6SocketUDP(const char *ifname) {
     }
 
     setsockopt(sockfd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &optval0, sizeof(optval0));
+    setsockopt(sockfd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &optval0, sizeof(optval0));
 
     return sockfd;
 }
+
+int SetInet4Membership(int sockfd, const struct in_addr *group, int ifindex, int join) {
+    struct ip_mreqn mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr = *group;
+    mreq.imr_ifindex = ifindex;
+    if (setsockopt(sockfd, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int SetInet6Membership(int sockfd, const struct in6_addr *group, int ifindex, int join) {
+    struct ipv6_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.ipv6mr_multiaddr = *group;
+    mreq.ipv6mr_interface = ifindex;
+    if (setsockopt(sockfd, IPPROTO_IPV6, join ? IPV6_JOIN_GROUP : IPV6_LEAVE_GROUP, &mreq, sizeof(mreq)) < 0) {
+        return -1;
+    }
+    return 0;
+}
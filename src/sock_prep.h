@@ -2,11 +2,32 @@
 #ifndef SRC_SOCK_PREP_H_
 #define SRC_SOCK_PREP_H_
 
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+// Older libc headers predate UDP GSO/GRO (Linux 4.18 / 5.0)
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
 extern const char* MCAST_GROUP;
 extern const char* MCAST6_GROUP;
 extern const unsigned int PORT;
 
 int GetInet4SocketUDP(const char *ifname);
 int GetInet6SocketUDP(const char *ifname);
+int SetInet4Membership(int sockfd, const struct in_addr *group, int ifindex, int join);
+int SetInet6Membership(int sockfd, const struct in6_addr *group, int ifindex, int join);
+int AttachFrameFilter(int sockfd);
+int SetBusyPoll(int sockfd, unsigned int usecs);
+int SetUdpGro(int sockfd, int enable);
+int InterfaceMtu(int sockfd, const char *ifname);
+unsigned long SocketDrops(int sockfd);
 
 #endif  // SRC_SOCK_PREP_H_
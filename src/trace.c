@@ -0,0 +1,159 @@
+// Copyright 2025 Michał Jankowski
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+__thread TraceRing *trace_ring;
+size_t trace_events;
+
+static TraceRing *rings;  // every thread's ring, pushed with CAS
+static uint64_t start_ticks;
+static uint64_t start_ns;
+
+uint64_t TraceClockNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// Enables tracing with rings of events (rounded up to a power of two), 0
+// stops new threads from getting a ring. Rings already handed out keep their
+// size.
+int TraceInit(size_t events) {
+    if (events == 0) {
+        trace_events = 0;
+        return 0;
+    }
+    if (events > TRACE_MAX_EVENTS) {
+        return -1;
+    }
+    size_t size = 1;
+    while (size < events) {
+        size <<= 1;
+    }
+    if (start_ns == 0) {
+        start_ticks = TraceNow();
+        start_ns = TraceClockNs();
+    }
+    trace_events = size;
+    return 0;
+}
+
+// The calling thread's ring, allocated on its first event.
+TraceRing *TraceRingAttach(void) {
+    size_t size = trace_events;
+    if (trace_ring != NULL || size == 0) {
+        return trace_ring;
+    }
+    TraceRing *r = calloc(1, sizeof(TraceRing) + size * sizeof(TraceEvent));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->mask = (uint32_t) (size - 1);
+    r->tid = (uint32_t) syscall(SYS_gettid);
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    trace_ring = r;
+    return r;
+}
+
+// Copies the live part of r into events, returns how many are valid. The
+// owner keeps recording meanwhile, so whatever it may have overwritten
+// during the copy is cut off the old end afterwards: every event up to
+// head_after - size, the last one being the slot it may be filling now.
+static size_t SnapshotRing(const TraceRing *r, TraceEvent *events, uint64_t *first) {
+    uint64_t size = (uint64_t) r->mask + 1;
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t start = head > size ? head - size : 0;
+    for (uint64_t i = start; i < head; i++) {
+        events[i - start] = r->events[i & r->mask];
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);  // the copy before the second look at head
+    uint64_t head_after = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    uint64_t valid_from = head_after >= size ? head_after - size + 1 : 0;
+    size_t skip = valid_from > start ? (size_t) (valid_from - start) : 0;
+    if (skip > head - start) {
+        skip = (size_t) (head - start);
+    }
+    memmove(events, events + skip, (size_t) (head - start - skip) * sizeof(TraceEvent));
+    *first = start + skip;
+    return (size_t) (head - start - skip);
+}
+
+// Writes every thread's ring to path, a new file readable by its owner only:
+// the daemon runs as root and the default path is in /tmp, so an existing
+// file or a link someone put there is refused. Safe to call from any thread
+// while the others keep tracing. Returns the number of events written or
+// -errno.
+long int TraceDump(const char *path) {
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+#if defined(__x86_64__) || defined(__i386__)
+    header.clock = TRACE_CLOCK_TSC;
+#else
+    header.clock = TRACE_CLOCK_MONOTONIC_NS;
+#endif
+    header.event_size = sizeof(TraceEvent);
+    header.start_ticks = start_ticks;
+    header.start_ns = start_ns;
+    header.end_ticks = TraceNow();
+    header.end_ns = TraceClockNs();
+
+    TraceRing *head = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    size_t largest = 0;
+    for (TraceRing *r = head; r != NULL; r = r->next) {
+        header.rings++;
+        if (r->mask + 1 > largest) {
+            largest = r->mask + 1;
+        }
+    }
+    TraceEvent *events = malloc((largest > 0 ? largest : 1) * sizeof(TraceEvent));
+    if (events == NULL) {
+        return -ENOMEM;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (f == NULL) {
+        int err = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(events);
+        return -err;
+    }
+
+    long int written = 0;
+    int failed = fwrite(&header, sizeof(header), 1, f) != 1;
+    for (TraceRing *r = head; r != NULL && !failed; r = r->next) {
+        TraceRingHeader ring_header;
+        uint64_t first;
+        size_t count = SnapshotRing(r, events, &first);
+        ring_header.tid = r->tid;
+        ring_header.events = (uint32_t) count;
+        ring_header.overwritten = first;
+        failed = fwrite(&ring_header, sizeof(ring_header), 1, f) != 1
+                 || (count > 0 && fwrite(events, sizeof(TraceEvent), count, f) != count);
+        written += (long int) count;
+    }
+    free(events);
+    if (fclose(f) != 0 || failed) {
+        return -EIO;
+    }
+    return written;
+}
+
+// A new name for every dump, TraceDump() won't replace a file.
+void TraceDefaultPath(char *path, size_t path_size) {
+    static unsigned int dumps;
+    snprintf(path, path_size, "/tmp/c_comm.%d.%u.trace", (int) getpid(), dumps++);
+}
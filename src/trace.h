@@ -0,0 +1,126 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_TRACE_H_
+#define SRC_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Binary event trace. Every thread that records an event gets a ring of its
+// own on first use, so recording is a few stores into thread-local memory,
+// no locks and no atomics beyond a release store of the head. Old events are
+// overwritten. TraceDump() copies all rings into a file, bin/trace2json turns
+// that into Chrome trace JSON (chrome://tracing, Perfetto).
+//
+// Timestamps are TSC ticks on x86 and CLOCK_MONOTONIC nanoseconds elsewhere,
+// the dump carries two (ticks, ns) pairs to convert them.
+//
+// Dump file, host byte order:
+//     TraceFileHeader | per ring: TraceRingHeader | TraceEvent[events]
+// with each ring's events oldest first.
+
+#define TRACE_DEFAULT_EVENTS 65536  // per thread, 2 MiB
+#define TRACE_MAX_EVENTS (1u << 24)
+#define TRACE_MAGIC "CCTRACE"
+#define TRACE_VERSION 1
+
+enum TraceType {
+    TRACE_RECV = 1,  // code = address family, a = datagram length
+    TRACE_DISPATCH,  // code = message type, a = payload length, b = duration, ts = start
+    TRACE_PEER_INSERT,  // code = CommPeerReason
+    TRACE_PEER_EVICT,  // code = CommPeerReason
+    TRACE_SEND,  // code = OutLane, a = frame length, b = frames queued ahead of it
+    TRACE_ERROR,  // code = CommError
+};
+
+enum TraceClock {
+    TRACE_CLOCK_MONOTONIC_NS,
+    TRACE_CLOCK_TSC,
+};
+
+typedef struct {
+    uint64_t ts;
+    uint16_t type;
+    uint16_t code;
+    int32_t peer;  // -1 if none
+    uint64_t a;
+    uint64_t b;
+} TraceEvent;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t clock;  // TraceClock
+    uint32_t rings;
+    uint32_t event_size;
+    uint64_t start_ticks;  // TraceInit()
+    uint64_t start_ns;
+    uint64_t end_ticks;  // TraceDump()
+    uint64_t end_ns;
+} TraceFileHeader;
+
+typedef struct {
+    uint32_t tid;
+    uint32_t events;
+    uint64_t overwritten;  // older events already lost
+} TraceRingHeader;
+
+typedef struct TraceRing {
+    struct TraceRing *next;
+    uint64_t head;  // events ever recorded, only the owner writes it
+    uint32_t mask;
+    uint32_t tid;
+    TraceEvent events[];
+} TraceRing;
+
+extern __thread TraceRing *trace_ring;
+extern size_t trace_events;  // ring size, 0 = tracing off
+
+int TraceInit(size_t events);
+TraceRing *TraceRingAttach(void);
+long int TraceDump(const char *path);
+void TraceDefaultPath(char *path, size_t path_size);
+uint64_t TraceClockNs(void);
+
+static inline uint64_t TraceNow(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return TraceClockNs();
+#endif
+}
+
+static inline void TraceAt(uint64_t ts, enum TraceType type, unsigned int code, long int peer, uint64_t a, uint64_t b) {
+    TraceRing *r = trace_ring;
+    if (__builtin_expect(r == NULL, 0)) {
+        if (trace_events == 0 || (r = TraceRingAttach()) == NULL) {
+            return;
+        }
+    }
+    uint64_t head = r->head;
+    TraceEvent *e = &r->events[head & r->mask];
+    e->ts = ts;
+    e->type = (uint16_t) type;
+    e->code = (uint16_t) code;
+    e->peer = (int32_t) peer;
+    e->a = a;
+    e->b = b;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);  // a dump reads up to here
+}
+
+static inline void Trace(enum TraceType type, unsigned int code, long int peer, uint64_t a, uint64_t b) {
+    if (trace_ring != NULL || trace_events != 0) {
+        TraceAt(TraceNow(), type, code, peer, a, b);
+    }
+}
+
+// An event that started at start (from TraceNow()), b = its duration.
+static inline void TraceSpan(uint64_t start, enum TraceType type, unsigned int code, long int peer, uint64_t a) {
+    if (trace_ring != NULL || trace_events != 0) {
+        TraceAt(start, type, code, peer, a, TraceNow() - start);
+    }
+}
+
+#endif  // SRC_TRACE_H_
@@ -0,0 +1,433 @@
+// Copyright 2025 Michał Jankowski
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sock_prep.h"
+#include "transport.h"
+
+// Plain syscall backend: one non-blocking recvfrom/sendto per datagram.
+//
+// With offload on, send_bulk coalesces consecutive datagrams to the same
+// address into one buffer that leaves with a single sendmsg() carrying a
+// UDP_SEGMENT cmsg; the kernel (or the NIC) cuts it back into datagrams of
+// the first one's size, so only the last may be shorter. Receiving, UDP_GRO
+// lets the kernel return a run of datagrams from one sender in one read,
+// which recv hands out again one datagram per call.
+#define GSO_MAX_SEGMENTS 64  // UDP_MAX_SEGMENTS in the kernel
+#define GSO_MAX_BYTES 65000  // one IP datagram, headers included
+#define GRO_BUF_SIZE 65536
+#define UDP4_OVERHEAD 28  // IPv4 + UDP headers
+#define UDP6_OVERHEAD 48  // IPv6 + UDP headers
+
+typedef struct {
+    char *buf;  // GSO_MAX_BYTES
+    size_t len;
+    size_t seg_size;  // every segment but the last is this long
+    unsigned int segments;
+    int closed;  // the last segment is short, nothing more fits behind it
+    struct sockaddr_storage dest;
+    socklen_t dest_size;
+} GsoBatch;
+
+typedef struct {
+    int udp4;  // -1 = IPv4 not available
+    int udp6;  // -1 = IPv6 not available
+    unsigned int next_recv;  // alternates between families so neither starves
+    int mtu;
+    int gso;
+    int gro;
+    GsoBatch batch;
+    char *gro_buf;  // GRO_BUF_SIZE, a coalesced read being handed out
+    size_t gro_len;
+    size_t gro_off;
+    size_t gro_seg;
+    struct sockaddr_storage gro_src;
+    socklen_t gro_src_size;
+} UdpTransport;
+
+// The next datagram of a coalesced read, truncated to buf_size like
+// recvfrom() would.
+static ssize_t GroNext(Transport *t, char *buf, size_t buf_size, struct sockaddr_storage *src_addr,
+                       socklen_t *src_addr_size) {
+    UdpTransport *u = t->impl;
+    size_t len = u->gro_len - u->gro_off < u->gro_seg ? u->gro_len - u->gro_off : u->gro_seg;
+    memcpy(buf, u->gro_buf + u->gro_off, len < buf_size ? len : buf_size);
+    u->gro_off += len;
+    socklen_t addr_size = u->gro_src_size < *src_addr_size ? u->gro_src_size : *src_addr_size;
+    memcpy(src_addr, &u->gro_src, addr_size);
+    *src_addr_size = u->gro_src_size;
+    t->stats.rx_datagrams++;
+    return (ssize_t) (len < buf_size ? len : buf_size);
+}
+
+// recvfrom() for a socket with UDP_GRO: reads into the GRO buffer and
+// returns its first datagram. Returns -EAGAIN when nothing is pending.
+static ssize_t GroRecv(Transport *t, int fd, char *buf, size_t buf_size, struct sockaddr_storage *src_addr,
+                       socklen_t *src_addr_size) {
+    UdpTransport *u = t->impl;
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {u->gro_buf, GRO_BUF_SIZE};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &u->gro_src;
+    msg.msg_namelen = sizeof(u->gro_src);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    t->stats.syscalls++;
+    ssize_t len = recvmsg(fd, &msg, MSG_DONTWAIT);
+    if (len < 0) {
+        return -errno;
+    }
+    u->gro_len = (size_t) len;
+    u->gro_off = 0;
+    u->gro_seg = (size_t) len;
+    u->gro_src_size = msg.msg_namelen;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        int gso_size;
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+            u->gro_seg = gso_size > 0 ? (size_t) gso_size : u->gro_seg;
+        }
+    }
+    if (u->gro_seg < u->gro_len) {
+        t->stats.rx_offloaded += (u->gro_len + u->gro_seg - 1) / u->gro_seg;
+    }
+    return GroNext(t, buf, buf_size, src_addr, src_addr_size);
+}
+
+static ssize_t UdpRecv(
+    Transport *t,
+    char *buf,
+    size_t buf_size,
+    struct sockaddr_storage *src_addr,
+    socklen_t *src_addr_size
+) {
+    UdpTransport *u = t->impl;
+    int fds[2] = {u->udp4, u->udp6};
+    if (u->gro_off < u->gro_len) {
+        return GroNext(t, buf, buf_size, src_addr, src_addr_size);
+    }
+
+    for (unsigned int i = 0; i < 2; i++) {
+        int fd = fds[(u->next_recv + i) % 2];
+        if (fd < 0) {
+            continue;
+        }
+        if (u->gro) {
+            ssize_t len = GroRecv(t, fd, buf, buf_size, src_addr, src_addr_size);
+            if (len >= 0) {
+                u->next_recv = (u->next_recv + i + 1) % 2;
+                return len;
+            } else if (len != -EAGAIN && len != -EWOULDBLOCK) {
+                return len;
+            }
+            continue;
+        }
+        socklen_t addr_size = *src_addr_size;
+        t->stats.syscalls++;
+        ssize_t len = recvfrom(fd, buf, buf_size, MSG_DONTWAIT, (struct sockaddr *) src_addr, &addr_size);
+        if (len >= 0) {
+            u->next_recv = (u->next_recv + i + 1) % 2;
+            *src_addr_size = addr_size;
+            t->stats.rx_datagrams++;
+            return len;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+static ssize_t UdpSend(
+    Transport *t,
+    const char *buf,
+    size_t len,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size
+) {
+    UdpTransport *u = t->impl;
+    int fd = dest_addr->sa_family == AF_INET ? u->udp4 : u->udp6;
+    if (fd < 0) {
+        return -EAFNOSUPPORT;
+    }
+    t->stats.syscalls++;
+    ssize_t sent = sendto(fd, buf, len, MSG_DONTWAIT, dest_addr, dest_addr_size);
+    if (sent < 0) {
+        return -errno;
+    }
+    t->stats.tx_datagrams++;
+    return sent;
+}
+
+// Sends the batch one datagram per sendto(). On a full socket the unsent
+// rest stays in the batch and -EAGAIN is returned.
+static int GsoFlushPlain(Transport *t) {
+    UdpTransport *u = t->impl;
+    GsoBatch *b = &u->batch;
+    size_t off = 0;
+    int ret = 0;
+    while (off < b->len) {
+        size_t len = b->len - off < b->seg_size ? b->len - off : b->seg_size;
+        ssize_t sent = UdpSend(t, b->buf + off, len, (struct sockaddr *) &b->dest, b->dest_size);
+        if (sent == -EAGAIN || sent == -EWOULDBLOCK || sent == -ENOBUFS) {
+            memmove(b->buf, b->buf + off, b->len - off);
+            b->len -= off;
+            b->segments = (unsigned int) ((b->len + b->seg_size - 1) / b->seg_size);
+            return -EAGAIN;
+        } else if (sent < 0) {
+            ret = (int) sent;  // lost like any datagram, the rest still goes
+        }
+        off += len;
+    }
+    b->len = 0;
+    b->segments = 0;
+    b->closed = 0;
+    return ret;
+}
+
+// Sends the batch as one UDP_SEGMENT super-buffer. Devices that can't
+// offload the checksum refuse it, then GSO is turned off for good and the
+// batch goes out datagram by datagram.
+static int UdpFlush(Transport *t) {
+    UdpTransport *u = t->impl;
+    GsoBatch *b = &u->batch;
+    if (b->segments == 0) {
+        return 0;
+    } else if (b->segments == 1 || !u->gso) {
+        return GsoFlushPlain(t);
+    }
+    int fd = b->dest.ss_family == AF_INET ? u->udp4 : u->udp6;
+    uint16_t seg_size = (uint16_t) b->seg_size;
+    char control[CMSG_SPACE(sizeof(seg_size))];
+    struct iovec iov = {b->buf, b->len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_name = &b->dest;
+    msg.msg_namelen = b->dest_size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(seg_size));
+    memcpy(CMSG_DATA(cm), &seg_size, sizeof(seg_size));
+
+    t->stats.syscalls++;
+    if (sendmsg(fd, &msg, MSG_DONTWAIT) < 0) {
+        int err = errno;
+        if (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS) {
+            return -EAGAIN;
+        } else if (err == EIO || err == EINVAL || err == EOPNOTSUPP) {
+            fprintf(stderr, "[WARN] UDP GSO refused (%s), sending datagrams one by one\n", strerror(err));
+            u->gso = 0;
+            return GsoFlushPlain(t);
+        }
+        b->len = 0;
+        b->segments = 0;
+        b->closed = 0;
+        return -err;
+    }
+    t->stats.tx_datagrams += b->segments;
+    t->stats.tx_offloaded += b->segments;
+    b->len = 0;
+    b->segments = 0;
+    b->closed = 0;
+    return 0;
+}
+
+static int SameAddress(const struct sockaddr_storage *a, socklen_t a_size, const struct sockaddr *b, socklen_t b_size) {
+    return a_size == b_size && memcmp(a, b, b_size) == 0;
+}
+
+// Appends to the batch when the datagram can follow the ones in it, else
+// flushes the batch first. Returns -EAGAIN when that flush found the socket
+// full, the caller queues the datagram then.
+static ssize_t UdpSendBulk(
+    Transport *t,
+    const char *buf,
+    size_t len,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size
+) {
+    UdpTransport *u = t->impl;
+    GsoBatch *b = &u->batch;
+    size_t max_segment = (size_t) u->mtu - (dest_addr->sa_family == AF_INET ? UDP4_OVERHEAD : UDP6_OVERHEAD);
+    if (!u->gso && b->segments == 0) {
+        return UdpSend(t, buf, len, dest_addr, dest_addr_size);
+    }
+    int fits = u->gso && b->segments > 0 && !b->closed && len <= b->seg_size && b->segments < GSO_MAX_SEGMENTS
+               && b->len + len <= GSO_MAX_BYTES && SameAddress(&b->dest, b->dest_size, dest_addr, dest_addr_size);
+    if (!fits && b->segments > 0 && UdpFlush(t) == -EAGAIN) {
+        return -EAGAIN;
+    }
+    if (!u->gso || len == 0 || len > max_segment) {
+        return UdpSend(t, buf, len, dest_addr, dest_addr_size);
+    }
+    if (b->segments == 0) {
+        memcpy(&b->dest, dest_addr, dest_addr_size);
+        b->dest_size = dest_addr_size;
+        b->seg_size = len;
+    }
+    memcpy(b->buf + b->len, buf, len);
+    b->len += len;
+    b->segments++;
+    b->closed = len < b->seg_size;
+    return (ssize_t) len;
+}
+
+static int UdpOffload(Transport *t, int enable) {
+    UdpTransport *u = t->impl;
+    const int off = 0;
+    if (!enable) {
+        int ret = UdpFlush(t);
+        u->gso = 0;
+        u->gro = 0;
+        SetUdpGro(u->udp4, 0);
+        SetUdpGro(u->udp6, 0);
+        return ret;
+    }
+    if (u->batch.buf == NULL) {
+        u->batch.buf = malloc(GSO_MAX_BYTES);
+    }
+    if (u->gro_buf == NULL) {
+        u->gro_buf = malloc(GRO_BUF_SIZE);
+    }
+    if (u->batch.buf == NULL || u->gro_buf == NULL) {
+        return -1;
+    }
+    // the segment size goes with every send, this only asks whether the
+    // kernel knows UDP_SEGMENT at all
+    int fd = u->udp4 >= 0 ? u->udp4 : u->udp6;
+    if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &off, sizeof(off)) < 0
+        || SetUdpGro(u->udp4, 1) < 0 || SetUdpGro(u->udp6, 1) < 0) {
+        SetUdpGro(u->udp4, 0);
+        SetUdpGro(u->udp6, 0);
+        return -1;
+    }
+    u->gso = 1;
+    u->gro = 1;
+    return 0;
+}
+
+static int UdpMembership(Transport *t, const struct sockaddr *group, int ifindex, int join) {
+    UdpTransport *u = t->impl;
+    if (group->sa_family == AF_INET && u->udp4 >= 0) {
+        return SetInet4Membership(u->udp4, &((const struct sockaddr_in *) group)->sin_addr, ifindex, join);
+    } else if (group->sa_family == AF_INET6 && u->udp6 >= 0) {
+        return SetInet6Membership(u->udp6, &((const struct sockaddr_in6 *) group)->sin6_addr, ifindex, join);
+    }
+    return -1;
+}
+
+static void UdpClose(Transport *t) {
+    UdpTransport *u = t->impl;
+    UdpFlush(t);
+    free(u->batch.buf);
+    free(u->gro_buf);
+    if (u->udp4 >= 0) {
+        close(u->udp4);
+    }
+    if (u->udp6 >= 0) {
+        close(u->udp6);
+    }
+    free(u);
+    free(t);
+}
+
+static unsigned long UdpKernelDrops(Transport *t) {
+    UdpTransport *u = t->impl;
+    return SocketDrops(u->udp4) + SocketDrops(u->udp6);
+}
+
+static int UdpBusyPoll(Transport *t, unsigned int usecs) {
+    UdpTransport *u = t->impl;
+    return SetBusyPoll(u->udp4, usecs) < 0 || SetBusyPoll(u->udp6, usecs) < 0 ? -1 : 0;
+}
+
+static const TransportOps UDP_OPS = {
+    .recv = UdpRecv,
+    .send = UdpSend,
+    .flush = UdpFlush,
+    .close = UdpClose,
+    .membership = UdpMembership,
+    .kernel_drops = UdpKernelDrops,
+    .busy_poll = UdpBusyPoll,
+    .send_bulk = UdpSendBulk,
+    .offload = UdpOffload,
+};
+
+Transport *TransportOpenUDP(const char *ifname) {
+    Transport *t = calloc(1, sizeof(Transport));
+    UdpTransport *u = calloc(1, sizeof(UdpTransport));
+    if (t == NULL || u == NULL) {
+        free(t);
+        free(u);
+        return NULL;
+    }
+
+    if ((u->udp4 = GetInet4SocketUDP(ifname)) < 0) {
+        fprintf(stderr, "[WARN] Failed to start IPv4/UDP communication, code %i\n", u->udp4);
+        u->udp4 = -1;
+    }
+    if ((u->udp6 = GetInet6SocketUDP(ifname)) < 0) {
+        fprintf(stderr, "[WARN] Failed to start IPv6/UDP communication, code %i\n", u->udp6);
+        u->udp6 = -1;
+    }
+    if (u->udp4 < 0 && u->udp6 < 0) {
+        free(u);
+        free(t);
+        return NULL;
+    }
+    if ((u->mtu = InterfaceMtu(u->udp4 >= 0 ? u->udp4 : u->udp6, ifname)) < UDP6_OVERHEAD + 1) {
+        u->mtu = 1500;
+    }
+
+    t->kind = TRANSPORT_UDP;
+    t->ops = &UDP_OPS;
+    t->impl = u;
+    t->has_inet4 = u->udp4 >= 0;
+    t->has_inet6 = u->udp6 >= 0;
+    if (u->udp4 >= 0) {
+        t->poll_families[t->n_poll_fds] = AF_INET;
+        t->poll_fds[t->n_poll_fds++] = u->udp4;
+    }
+    if (u->udp6 >= 0) {
+        t->poll_families[t->n_poll_fds] = AF_INET6;
+        t->poll_fds[t->n_poll_fds++] = u->udp6;
+    }
+    return t;
+}
+
+Transport *TransportOpenByName(const char *kind, const char *ifname) {
+    if (kind == NULL || strcmp(kind, "udp") == 0) {
+        return TransportOpenUDP(ifname);
+    } else if (strcmp(kind, "uring") == 0 || strcmp(kind, "io_uring") == 0) {
+        return TransportOpenUring(ifname);
+    }
+    fprintf(stderr, "[FAIL] Unknown transport \"%s\" (expected udp or uring)\n", kind);
+    return NULL;
+}
+
+const char *TransportKindName(enum TransportKind kind) {
+    switch (kind) {
+        case TRANSPORT_UDP:
+            return "udp";
+        case TRANSPORT_URING:
+            return "io_uring";
+        case TRANSPORT_LOOPBACK:
+            return "loopback";
+        default:
+            return "unknown";
+    }
+}
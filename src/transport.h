@@ -0,0 +1,147 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_TRANSPORT_H_
+#define SRC_TRANSPORT_H_
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+enum TransportKind {
+    TRANSPORT_UDP,
+    TRANSPORT_URING,
+    TRANSPORT_LOOPBACK,
+};
+
+typedef struct Transport Transport;
+
+// Backend hooks. recv returns the datagram length, 0 when nothing is pending
+// and a negative value on error. send returns the number of bytes accepted
+// (not necessarily on the wire yet, see flush) or -errno.
+typedef struct {
+    ssize_t (*recv)(
+        Transport *t,
+        char *buf,
+        size_t buf_size,
+        struct sockaddr_storage *src_addr,
+        socklen_t *src_addr_size);
+    ssize_t (*send)(
+        Transport *t,
+        const char *buf,
+        size_t len,
+        const struct sockaddr *dest_addr,
+        socklen_t dest_addr_size);
+    int (*flush)(Transport *t);
+    void (*close)(Transport *t);
+    // Joins (join = 1) or leaves a multicast group, NULL when the backend
+    // has no kernel membership to manage.
+    int (*membership)(Transport *t, const struct sockaddr *group, int ifindex, int join);
+    // Datagrams the kernel dropped before we could read them (socket filter,
+    // full receive buffer), NULL when there is no kernel socket.
+    unsigned long (*kernel_drops)(Transport *t);
+    // Enables SO_BUSY_POLL on the sockets, NULL when there are none.
+    int (*busy_poll)(Transport *t, unsigned int usecs);
+    // send for bulk data: may hold the datagram back to coalesce it with
+    // the following ones to the same address, until flush. NULL when the
+    // backend has nothing better than send.
+    ssize_t (*send_bulk)(
+        Transport *t,
+        const char *buf,
+        size_t len,
+        const struct sockaddr *dest_addr,
+        socklen_t dest_addr_size);
+    // Turns segmentation offload (UDP GSO for send_bulk, GRO for recv) on
+    // or off, NULL when the backend has none.
+    int (*offload)(Transport *t, int enable);
+} TransportOps;
+
+typedef struct {
+    unsigned long rx_datagrams;
+    unsigned long tx_datagrams;
+    unsigned long syscalls;  // recv/send/submit syscalls issued by the backend
+    unsigned long tx_offloaded;  // of tx_datagrams, sent as part of a GSO super-buffer
+    unsigned long rx_offloaded;  // of rx_datagrams, read as part of a GRO super-buffer
+} TransportStats;
+
+struct Transport {
+    enum TransportKind kind;
+    const TransportOps *ops;
+    int has_inet4;
+    int has_inet6;
+    int poll_fds[2];  // what the caller should poll() for POLLIN
+    int poll_families[2];  // family a poll fd sends for, AF_UNSPEC if it is not a socket
+    unsigned int n_poll_fds;
+    TransportStats stats;
+    void *impl;
+};
+
+typedef struct LoopbackHub LoopbackHub;
+
+Transport *TransportOpenUDP(const char *ifname);
+Transport *TransportOpenUring(const char *ifname);
+Transport *TransportOpenLoopback(LoopbackHub *hub, const struct in_addr *addr4, const struct in6_addr *addr6);
+Transport *TransportOpenByName(const char *kind, const char *ifname);
+const char *TransportKindName(enum TransportKind kind);
+
+LoopbackHub *LoopbackHubCreate(void);
+void LoopbackHubDestroy(LoopbackHub *hub);
+
+static inline ssize_t TransportRecv(
+    Transport *t,
+    char *buf,
+    size_t buf_size,
+    struct sockaddr_storage *src_addr,
+    socklen_t *src_addr_size
+) {
+    return t->ops->recv(t, buf, buf_size, src_addr, src_addr_size);
+}
+
+static inline ssize_t TransportSend(
+    Transport *t,
+    const char *buf,
+    size_t len,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size
+) {
+    return t->ops->send(t, buf, len, dest_addr, dest_addr_size);
+}
+
+static inline ssize_t TransportSendBulk(
+    Transport *t,
+    const char *buf,
+    size_t len,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size
+) {
+    if (t->ops->send_bulk == NULL) {
+        return t->ops->send(t, buf, len, dest_addr, dest_addr_size);
+    }
+    return t->ops->send_bulk(t, buf, len, dest_addr, dest_addr_size);
+}
+
+static inline int TransportFlush(Transport *t) {
+    return t->ops->flush ? t->ops->flush(t) : 0;
+}
+
+static inline int TransportMembership(Transport *t, const struct sockaddr *group, int ifindex, int join) {
+    return t->ops->membership ? t->ops->membership(t, group, ifindex, join) : 0;
+}
+
+static inline unsigned long TransportKernelDrops(Transport *t) {
+    return t->ops->kernel_drops != NULL ? t->ops->kernel_drops(t) : 0;
+}
+
+static inline int TransportBusyPoll(Transport *t, unsigned int usecs) {
+    return t->ops->busy_poll != NULL ? t->ops->busy_poll(t, usecs) : -1;
+}
+
+static inline int TransportOffload(Transport *t, int enable) {
+    return t->ops->offload != NULL ? t->ops->offload(t, enable) : -1;
+}
+
+static inline void TransportClose(Transport *t) {
+    if (t != NULL) {
+        t->ops->close(t);
+    }
+}
+
+#endif  // SRC_TRANSPORT_H_
@@ -0,0 +1,235 @@
+// Copyright 2025 Michał Jankowski
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "sock_prep.h"
+#include "transport.h"
+
+// In-process backend: every endpoint registered on a hub gets a fixed-size
+// datagram queue, sends are memcpy's into the destination queues. Multicast
+// destinations are delivered to every other endpoint of the same family,
+// mirroring IP_MULTICAST_LOOP being disabled on the real sockets.
+
+#define LOOPBACK_MAX_ENDPOINTS 256
+#define LOOPBACK_QUEUE_LEN 256
+#define LOOPBACK_DATAGRAM_SIZE 2048
+
+typedef struct {
+    struct sockaddr_storage src;
+    socklen_t src_size;
+    size_t len;
+    char data[LOOPBACK_DATAGRAM_SIZE];
+} LoopbackDatagram;
+
+typedef struct {
+    LoopbackHub *hub;
+    struct in_addr addr4;
+    struct in6_addr addr6;
+    int event_fd;
+    unsigned int head;
+    unsigned int tail;
+    unsigned long dropped;
+    LoopbackDatagram *queue;
+} LoopbackEndpoint;
+
+struct LoopbackHub {
+    Transport *endpoints[LOOPBACK_MAX_ENDPOINTS];
+    size_t n_endpoints;
+};
+
+static void LoopbackDeliver(Transport *dst, Transport *src, const char *buf, size_t len, int family) {
+    LoopbackEndpoint *d = dst->impl;
+    const LoopbackEndpoint *s = src->impl;
+    if (d->tail - d->head >= LOOPBACK_QUEUE_LEN) {
+        d->dropped++;
+        return;
+    }
+    LoopbackDatagram *dg = &d->queue[d->tail % LOOPBACK_QUEUE_LEN];
+    memset(&dg->src, 0, sizeof(dg->src));
+    if (family == AF_INET) {
+        struct sockaddr_in *a = (struct sockaddr_in *) &dg->src;
+        a->sin_family = AF_INET;
+        a->sin_port = htons(PORT);
+        a->sin_addr = s->addr4;
+        dg->src_size = sizeof(*a);
+    } else {
+        struct sockaddr_in6 *a = (struct sockaddr_in6 *) &dg->src;
+        a->sin6_family = AF_INET6;
+        a->sin6_port = htons(PORT);
+        a->sin6_addr = s->addr6;
+        dg->src_size = sizeof(*a);
+    }
+    dg->len = len;
+    memcpy(dg->data, buf, len);
+    d->tail++;
+    if (d->event_fd >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(d->event_fd, &one, sizeof(one));
+        (void) ignored;
+        src->stats.syscalls++;  // the only ones this backend makes
+    }
+}
+
+static ssize_t LoopbackRecv(
+    Transport *t,
+    char *buf,
+    size_t buf_size,
+    struct sockaddr_storage *src_addr,
+    socklen_t *src_addr_size
+) {
+    LoopbackEndpoint *e = t->impl;
+    if (e->head == e->tail) {
+        if (e->event_fd >= 0) {
+            uint64_t count;
+            ssize_t ignored = read(e->event_fd, &count, sizeof(count));
+            (void) ignored;
+            t->stats.syscalls++;
+        }
+        return 0;
+    }
+    LoopbackDatagram *dg = &e->queue[e->head % LOOPBACK_QUEUE_LEN];
+    size_t len = dg->len < buf_size ? dg->len : buf_size;
+    memcpy(buf, dg->data, len);
+    socklen_t src_size = dg->src_size < *src_addr_size ? dg->src_size : *src_addr_size;
+    memcpy(src_addr, &dg->src, src_size);
+    *src_addr_size = src_size;
+    e->head++;
+    t->stats.rx_datagrams++;
+    return (ssize_t) len;
+}
+
+static ssize_t LoopbackSend(
+    Transport *t,
+    const char *buf,
+    size_t len,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size
+) {
+    LoopbackEndpoint *e = t->impl;
+    LoopbackHub *hub = e->hub;
+    int family = dest_addr->sa_family;
+    int multicast;
+
+    if (len > LOOPBACK_DATAGRAM_SIZE) {
+        return -EMSGSIZE;
+    }
+    if (family == AF_INET && dest_addr_size >= sizeof(struct sockaddr_in) && t->has_inet4) {
+        const struct sockaddr_in *a = (const struct sockaddr_in *) dest_addr;
+        multicast = IN_MULTICAST(ntohl(a->sin_addr.s_addr));
+        for (size_t i = 0; i < hub->n_endpoints; i++) {
+            Transport *dst = hub->endpoints[i];
+            LoopbackEndpoint *d = dst->impl;
+            if (dst == t || !dst->has_inet4) {
+                continue;
+            }
+            if (multicast || d->addr4.s_addr == a->sin_addr.s_addr) {
+                LoopbackDeliver(dst, t, buf, len, AF_INET);
+            }
+        }
+    } else if (family == AF_INET6 && dest_addr_size >= sizeof(struct sockaddr_in6) && t->has_inet6) {
+        const struct sockaddr_in6 *a = (const struct sockaddr_in6 *) dest_addr;
+        multicast = IN6_IS_ADDR_MULTICAST(&a->sin6_addr);
+        for (size_t i = 0; i < hub->n_endpoints; i++) {
+            Transport *dst = hub->endpoints[i];
+            LoopbackEndpoint *d = dst->impl;
+            if (dst == t || !dst->has_inet6) {
+                continue;
+            }
+            if (multicast || memcmp(&d->addr6, &a->sin6_addr, sizeof(struct in6_addr)) == 0) {
+                LoopbackDeliver(dst, t, buf, len, AF_INET6);
+            }
+        }
+    } else {
+        return -EAFNOSUPPORT;
+    }
+    t->stats.tx_datagrams++;
+    return (ssize_t) len;
+}
+
+// A full queue is the hub's stand-in for a full receive buffer.
+static unsigned long LoopbackDrops(Transport *t) {
+    return ((LoopbackEndpoint *) t->impl)->dropped;
+}
+
+static void LoopbackClose(Transport *t) {
+    LoopbackEndpoint *e = t->impl;
+    LoopbackHub *hub = e->hub;
+    for (size_t i = 0; i < hub->n_endpoints; i++) {
+        if (hub->endpoints[i] == t) {
+            hub->endpoints[i] = hub->endpoints[--hub->n_endpoints];
+            break;
+        }
+    }
+    if (e->event_fd >= 0) {
+        close(e->event_fd);
+    }
+    free(e->queue);
+    free(e);
+    free(t);
+}
+
+static const TransportOps LOOPBACK_OPS = {
+    .recv = LoopbackRecv,
+    .send = LoopbackSend,
+    .flush = NULL,
+    .close = LoopbackClose,
+    .membership = NULL,
+    .kernel_drops = LoopbackDrops,
+    .busy_poll = NULL,
+    .send_bulk = NULL,
+    .offload = NULL,
+};
+
+LoopbackHub *LoopbackHubCreate(void) {
+    return calloc(1, sizeof(LoopbackHub));
+}
+
+void LoopbackHubDestroy(LoopbackHub *hub) {
+    if (hub == NULL) {
+        return;
+    }
+    while (hub->n_endpoints > 0) {
+        TransportClose(hub->endpoints[0]);
+    }
+    free(hub);
+}
+
+Transport *TransportOpenLoopback(LoopbackHub *hub, const struct in_addr *addr4, const struct in6_addr *addr6) {
+    if (hub == NULL || (addr4 == NULL && addr6 == NULL) || hub->n_endpoints >= LOOPBACK_MAX_ENDPOINTS) {
+        return NULL;
+    }
+    Transport *t = calloc(1, sizeof(Transport));
+    LoopbackEndpoint *e = calloc(1, sizeof(LoopbackEndpoint));
+    LoopbackDatagram *queue = calloc(LOOPBACK_QUEUE_LEN, sizeof(LoopbackDatagram));
+    if (t == NULL || e == NULL || queue == NULL) {
+        free(t);
+        free(e);
+        free(queue);
+        return NULL;
+    }
+
+    e->hub = hub;
+    e->queue = queue;
+    if (addr4 != NULL) {
+        e->addr4 = *addr4;
+    }
+    if (addr6 != NULL) {
+        e->addr6 = *addr6;
+    }
+    e->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    t->kind = TRANSPORT_LOOPBACK;
+    t->ops = &LOOPBACK_OPS;
+    t->impl = e;
+    t->has_inet4 = addr4 != NULL;
+    t->has_inet6 = addr6 != NULL;
+    if (e->event_fd >= 0) {
+        t->poll_fds[t->n_poll_fds++] = e->event_fd;
+    }
+    hub->endpoints[hub->n_endpoints++] = t;
+    return t;
+}
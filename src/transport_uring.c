@@ -0,0 +1,508 @@
+// Copyright 2025 Michał Jankowski
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "sock_prep.h"
+#include "transport.h"
+
+// io_uring backend, driven through the raw syscalls (no liburing dependency).
+// Receives use one multishot RECVMSG per socket that pulls buffers from a
+// provided buffer ring, so a steady stream costs no syscalls at all. Sends
+// are staged as SQEs and submitted in one io_uring_enter per flush.
+
+#define URING_SQ_ENTRIES 256
+#define URING_CQ_ENTRIES 1024
+#define URING_RECV_BUFFERS 256  // power of two, required by the buffer ring
+#define URING_PAYLOAD_SIZE 2048
+#define URING_RECV_BUFFER_SIZE \
+    (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) + URING_PAYLOAD_SIZE)
+#define URING_SEND_SLOTS 256
+#define URING_BGID 0
+
+enum UringTag {
+    TAG_RECV4 = 1,
+    TAG_RECV6 = 2,
+    TAG_SEND = 3,
+};
+
+typedef struct {
+    char buf[URING_PAYLOAD_SIZE];
+    struct sockaddr_storage dest;
+    struct iovec iov;
+    struct msghdr msg;
+    int next_free;
+} SendSlot;
+
+typedef struct {
+    int ring_fd;
+    int udp4;
+    int udp6;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned int sqe_tail;  // local tail, published on submit
+    unsigned int pending;  // SQEs prepared but not submitted yet
+
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    unsigned short buf_ring_tail;
+    char *recv_buffers;
+    struct msghdr recv_msg;  // layout template for multishot recvmsg
+
+    SendSlot *slots;
+    int free_slot;  // head of the free list, -1 = exhausted
+} UringTransport;
+
+static int UringSetup(unsigned int entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int UringEnter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int UringRegister(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static struct io_uring_sqe *UringGetSqe(UringTransport *u) {
+    unsigned int head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sqe_tail - head >= u->sq_entries) {
+        return NULL;
+    }
+    unsigned int idx = u->sqe_tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->sqe_tail++;
+    u->pending++;
+    return sqe;
+}
+
+static int UringSubmit(Transport *t, unsigned int min_complete) {
+    UringTransport *u = t->impl;
+    if (u->pending == 0 && min_complete == 0) {
+        return 0;
+    }
+    __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+    t->stats.syscalls++;
+    int ret = UringEnter(u->ring_fd, u->pending, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0) {
+        return -errno;
+    }
+    u->pending -= (unsigned int) ret < u->pending ? (unsigned int) ret : u->pending;
+    return ret;
+}
+
+static void UringRecycleBuffer(UringTransport *u, unsigned short bid) {
+    struct io_uring_buf *b = &u->buf_ring->bufs[u->buf_ring_tail & (URING_RECV_BUFFERS - 1)];
+    b->addr = (uint64_t) (uintptr_t) (u->recv_buffers + (size_t) bid * URING_RECV_BUFFER_SIZE);
+    b->len = URING_RECV_BUFFER_SIZE;
+    b->bid = bid;
+    u->buf_ring_tail++;
+    __atomic_store_n(&u->buf_ring->tail, u->buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+static int UringArmRecv(UringTransport *u, int fd, enum UringTag tag) {
+    struct io_uring_sqe *sqe = UringGetSqe(u);
+    if (sqe == NULL) {
+        return -EBUSY;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) &u->recv_msg;
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = tag;
+    return 0;
+}
+
+static struct io_uring_cqe *UringPeekCqe(UringTransport *u) {
+    unsigned int head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &u->cqes[head & *u->cq_mask];
+}
+
+static void UringAdvanceCqe(UringTransport *u) {
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static void UringReleaseSlot(UringTransport *u, int slot) {
+    u->slots[slot].next_free = u->free_slot;
+    u->free_slot = slot;
+}
+
+static ssize_t UringRecv(
+    Transport *t,
+    char *buf,
+    size_t buf_size,
+    struct sockaddr_storage *src_addr,
+    socklen_t *src_addr_size
+) {
+    UringTransport *u = t->impl;
+    struct io_uring_cqe *cqe;
+
+    while ((cqe = UringPeekCqe(u)) != NULL) {
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        unsigned int flags = cqe->flags;
+        UringAdvanceCqe(u);
+
+        enum UringTag tag = (enum UringTag) (user_data & 0xFF);
+        if (tag == TAG_SEND) {
+            UringReleaseSlot(u, (int) (user_data >> 8));
+            if (res >= 0) {
+                t->stats.tx_datagrams++;
+            }
+            continue;
+        }
+        if (tag != TAG_RECV4 && tag != TAG_RECV6) {
+            continue;
+        }
+
+        if (!(flags & IORING_CQE_F_MORE)) {
+            // multishot terminated (buffers ran out, error, ...) - arm again
+            UringArmRecv(u, tag == TAG_RECV4 ? u->udp4 : u->udp6, tag);
+            UringSubmit(t, 0);
+        }
+        if (res < 0 || !(flags & IORING_CQE_F_BUFFER)) {
+            continue;
+        }
+
+        unsigned short bid = (unsigned short) (flags >> IORING_CQE_BUFFER_SHIFT);
+        char *raw = u->recv_buffers + (size_t) bid * URING_RECV_BUFFER_SIZE;
+        struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) raw;
+        char *name = raw + sizeof(*out);
+        char *payload = name + u->recv_msg.msg_namelen + u->recv_msg.msg_controllen;
+
+        socklen_t name_len = out->namelen < *src_addr_size ? out->namelen : *src_addr_size;
+        memcpy(src_addr, name, name_len);
+        *src_addr_size = name_len;
+
+        size_t available = (size_t) res - (size_t) (payload - raw);
+        size_t len = out->payloadlen < available ? out->payloadlen : available;
+        if (len > buf_size) {
+            len = buf_size;
+        }
+        memcpy(buf, payload, len);
+        UringRecycleBuffer(u, bid);
+        t->stats.rx_datagrams++;
+        return (ssize_t) len;
+    }
+    return 0;
+}
+
+static ssize_t UringSend(
+    Transport *t,
+    const char *buf,
+    size_t len,
+    const struct sockaddr *dest_addr,
+    socklen_t dest_addr_size
+) {
+    UringTransport *u = t->impl;
+    int fd = dest_addr->sa_family == AF_INET ? u->udp4 : u->udp6;
+    if (fd < 0) {
+        return -EAFNOSUPPORT;
+    } else if (len > URING_PAYLOAD_SIZE || dest_addr_size > sizeof(struct sockaddr_storage)) {
+        return -EMSGSIZE;
+    }
+
+    if (u->free_slot < 0) {
+        // reclaim completed sends sitting at the head of the completion queue
+        UringSubmit(t, 0);
+        struct io_uring_cqe *cqe;
+        while ((cqe = UringPeekCqe(u)) != NULL && (cqe->user_data & 0xFF) == TAG_SEND) {
+            UringReleaseSlot(u, (int) (cqe->user_data >> 8));
+            if (cqe->res >= 0) {
+                t->stats.tx_datagrams++;
+            }
+            UringAdvanceCqe(u);
+        }
+        if (u->free_slot < 0) {
+            return -ENOBUFS;
+        }
+    }
+
+    struct io_uring_sqe *sqe = UringGetSqe(u);
+    if (sqe == NULL) {
+        UringSubmit(t, 0);
+        if ((sqe = UringGetSqe(u)) == NULL) {
+            return -EBUSY;
+        }
+    }
+
+    int slot_id = u->free_slot;
+    SendSlot *slot = &u->slots[slot_id];
+    u->free_slot = slot->next_free;
+
+    memcpy(slot->buf, buf, len);
+    memcpy(&slot->dest, dest_addr, dest_addr_size);
+    slot->iov.iov_base = slot->buf;
+    slot->iov.iov_len = len;
+    memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->msg.msg_name = &slot->dest;
+    slot->msg.msg_namelen = dest_addr_size;
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) &slot->msg;
+    sqe->len = 1;
+    sqe->user_data = ((uint64_t) slot_id << 8) | TAG_SEND;
+    return (ssize_t) len;
+}
+
+static int UringFlush(Transport *t) {
+    int ret = UringSubmit(t, 0);
+    return ret < 0 ? ret : 0;
+}
+
+static int UringMembership(Transport *t, const struct sockaddr *group, int ifindex, int join) {
+    UringTransport *u = t->impl;
+    if (group->sa_family == AF_INET && u->udp4 >= 0) {
+        return SetInet4Membership(u->udp4, &((const struct sockaddr_in *) group)->sin_addr, ifindex, join);
+    } else if (group->sa_family == AF_INET6 && u->udp6 >= 0) {
+        return SetInet6Membership(u->udp6, &((const struct sockaddr_in6 *) group)->sin6_addr, ifindex, join);
+    }
+    return -1;
+}
+
+static void UringClose(Transport *t) {
+    UringTransport *u = t->impl;
+    UringSubmit(t, 0);
+    if (u->ring_fd >= 0) {
+        close(u->ring_fd);
+    }
+    if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED) {
+        munmap(u->sq_ring, u->sq_ring_size);
+    }
+    if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring) {
+        munmap(u->cq_ring, u->cq_ring_size);
+    }
+    if (u->sqes != NULL && u->sqes != MAP_FAILED) {
+        munmap(u->sqes, u->sqes_size);
+    }
+    if (u->buf_ring != NULL && u->buf_ring != MAP_FAILED) {
+        munmap(u->buf_ring, u->buf_ring_size);
+    }
+    if (u->udp4 >= 0) {
+        close(u->udp4);
+    }
+    if (u->udp6 >= 0) {
+        close(u->udp6);
+    }
+    free(u->recv_buffers);
+    free(u->slots);
+    free(u);
+    free(t);
+}
+
+static unsigned long UringKernelDrops(Transport *t) {
+    UringTransport *u = t->impl;
+    return SocketDrops(u->udp4) + SocketDrops(u->udp6);
+}
+
+static int UringBusyPoll(Transport *t, unsigned int usecs) {
+    UringTransport *u = t->impl;
+    return SetBusyPoll(u->udp4, usecs) < 0 || SetBusyPoll(u->udp6, usecs) < 0 ? -1 : 0;
+}
+
+static const TransportOps URING_OPS = {
+    .recv = UringRecv,
+    .send = UringSend,
+    .flush = UringFlush,
+    .close = UringClose,
+    .membership = UringMembership,
+    .kernel_drops = UringKernelDrops,
+    .busy_poll = UringBusyPoll,
+    .send_bulk = NULL,
+    .offload = NULL,
+};
+
+static int UringMapRings(UringTransport *u, struct io_uring_params *p) {
+    u->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+    u->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_size > u->sq_ring_size) {
+            u->sq_ring_size = u->cq_ring_size;
+        }
+        u->cq_ring_size = u->sq_ring_size;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->ring_fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        return -1;
+    }
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          u->ring_fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            return -2;
+        }
+    }
+    u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->ring_fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        return -3;
+    }
+
+    char *sq = u->sq_ring;
+    char *cq = u->cq_ring;
+    u->sq_head = (unsigned int *) (sq + p->sq_off.head);
+    u->sq_tail = (unsigned int *) (sq + p->sq_off.tail);
+    u->sq_mask = (unsigned int *) (sq + p->sq_off.ring_mask);
+    u->sq_array = (unsigned int *) (sq + p->sq_off.array);
+    u->sq_entries = p->sq_entries;
+    u->sqe_tail = *u->sq_tail;
+    u->cq_head = (unsigned int *) (cq + p->cq_off.head);
+    u->cq_tail = (unsigned int *) (cq + p->cq_off.tail);
+    u->cq_mask = (unsigned int *) (cq + p->cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + p->cq_off.cqes);
+    return 0;
+}
+
+static int UringSetupBufferRing(UringTransport *u) {
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+    u->buf_ring_size = (size + (size_t) page - 1) & ~((size_t) page - 1);
+    u->buf_ring = mmap(NULL, u->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->buf_ring == MAP_FAILED) {
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) u->buf_ring;
+    reg.ring_entries = URING_RECV_BUFFERS;
+    reg.bgid = URING_BGID;
+    if (UringRegister(u->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -2;
+    }
+
+    u->recv_buffers = malloc((size_t) URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE);
+    if (u->recv_buffers == NULL) {
+        return -3;
+    }
+    u->buf_ring_tail = 0;
+    for (unsigned short bid = 0; bid < URING_RECV_BUFFERS; bid++) {
+        UringRecycleBuffer(u, bid);
+    }
+
+    memset(&u->recv_msg, 0, sizeof(u->recv_msg));
+    u->recv_msg.msg_namelen = sizeof(struct sockaddr_storage);
+    return 0;
+}
+
+Transport *TransportOpenUring(const char *ifname) {
+    Transport *t = calloc(1, sizeof(Transport));
+    UringTransport *u = calloc(1, sizeof(UringTransport));
+    if (t == NULL || u == NULL) {
+        free(t);
+        free(u);
+        return NULL;
+    }
+    t->kind = TRANSPORT_URING;
+    t->ops = &URING_OPS;
+    t->impl = u;
+    u->udp4 = -1;
+    u->udp6 = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = URING_CQ_ENTRIES;
+    if ((u->ring_fd = UringSetup(URING_SQ_ENTRIES, &params)) < 0 && errno == EINVAL) {
+        // older kernel, retry with just the features we strictly need
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = URING_CQ_ENTRIES;
+        u->ring_fd = UringSetup(URING_SQ_ENTRIES, &params);
+    }
+    if (u->ring_fd < 0) {
+        perror("[WARN] io_uring_setup");
+        UringClose(t);
+        return NULL;
+    }
+
+    int ret;
+    if ((ret = UringMapRings(u, &params)) < 0) {
+        fprintf(stderr, "[WARN] io_uring: failed to map rings, code %i\n", ret);
+        UringClose(t);
+        return NULL;
+    }
+    if ((ret = UringSetupBufferRing(u)) < 0) {
+        fprintf(stderr, "[WARN] io_uring: failed to set up provided buffer ring, code %i\n", ret);
+        UringClose(t);
+        return NULL;
+    }
+
+    u->slots = calloc(URING_SEND_SLOTS, sizeof(SendSlot));
+    if (u->slots == NULL) {
+        UringClose(t);
+        return NULL;
+    }
+    u->free_slot = -1;
+    for (int i = URING_SEND_SLOTS - 1; i >= 0; i--) {
+        UringReleaseSlot(u, i);
+    }
+
+    if ((u->udp4 = GetInet4SocketUDP(ifname)) < 0) {
+        fprintf(stderr, "[WARN] Failed to start IPv4/UDP communication, code %i\n", u->udp4);
+        u->udp4 = -1;
+    } else {
+        UringArmRecv(u, u->udp4, TAG_RECV4);
+    }
+    if ((u->udp6 = GetInet6SocketUDP(ifname)) < 0) {
+        fprintf(stderr, "[WARN] Failed to start IPv6/UDP communication, code %i\n", u->udp6);
+        u->udp6 = -1;
+    } else {
+        UringArmRecv(u, u->udp6, TAG_RECV6);
+    }
+    if (u->udp4 < 0 && u->udp6 < 0) {
+        UringClose(t);
+        return NULL;
+    }
+    if ((ret = UringSubmit(t, 0)) < 0) {
+        fprintf(stderr, "[WARN] io_uring: failed to arm receives, code %i\n", ret);
+        UringClose(t);
+        return NULL;
+    }
+
+    t->has_inet4 = u->udp4 >= 0;
+    t->has_inet6 = u->udp6 >= 0;
+    t->poll_fds[0] = u->ring_fd;  // the ring fd turns readable once completions are posted
+    t->n_poll_fds = 1;
+    return t;
+}
@@ -0,0 +1,239 @@
+// Copyright 2025 Michał Jankowski
+#include <string.h>
+#include <sys/random.h>
+
+#include "x25519.h"
+
+// Field elements mod p = 2^255 - 19 as five 51-bit limbs. Sums and
+// differences are not carried, the multiplication takes limbs of up to
+// 54 bits and carries its result back to 51 bits (plus a little).
+typedef uint64_t Fe[5];
+typedef unsigned __int128 u128;
+
+#define MASK51 0x7ffffffffffffULL
+
+static inline uint64_t Load64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static inline void Store64(uint8_t *p, uint64_t v) {
+    for (unsigned int i = 0; i < 8; i++) {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+static void FeFromBytes(Fe h, const uint8_t s[32]) {
+    h[0] = Load64(s) & MASK51;
+    h[1] = (Load64(s + 6) >> 3) & MASK51;
+    h[2] = (Load64(s + 12) >> 6) & MASK51;
+    h[3] = (Load64(s + 19) >> 1) & MASK51;
+    h[4] = (Load64(s + 24) >> 12) & MASK51;  // the top bit is ignored
+}
+
+static void FeCarry(Fe h) {
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+    h[2] += h[1] >> 51;
+    h[1] &= MASK51;
+    h[3] += h[2] >> 51;
+    h[2] &= MASK51;
+    h[4] += h[3] >> 51;
+    h[3] &= MASK51;
+    h[0] += 19 * (h[4] >> 51);
+    h[4] &= MASK51;
+}
+
+// Fully reduced, little-endian.
+static void FeToBytes(uint8_t s[32], const Fe f) {
+    Fe h;
+    memcpy(h, f, sizeof(h));
+    FeCarry(h);
+    FeCarry(h);
+    // h < 2^255 + small now, subtract p once if h >= p
+    uint64_t q = (h[0] + 19) >> 51;
+    q = (h[1] + q) >> 51;
+    q = (h[2] + q) >> 51;
+    q = (h[3] + q) >> 51;
+    q = (h[4] + q) >> 51;
+    h[0] += 19 * q;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+    h[2] += h[1] >> 51;
+    h[1] &= MASK51;
+    h[3] += h[2] >> 51;
+    h[2] &= MASK51;
+    h[4] += h[3] >> 51;
+    h[3] &= MASK51;
+    h[4] &= MASK51;  // drops 2^255, what was subtracted with the 19
+    Store64(s, h[0] | (h[1] << 51));
+    Store64(s + 8, (h[1] >> 13) | (h[2] << 38));
+    Store64(s + 16, (h[2] >> 26) | (h[3] << 25));
+    Store64(s + 24, (h[3] >> 39) | (h[4] << 12));
+}
+
+static void FeAdd(Fe h, const Fe f, const Fe g) {
+    for (unsigned int i = 0; i < 5; i++) {
+        h[i] = f[i] + g[i];
+    }
+}
+
+// h = f - g, with 4p added so no limb goes negative
+static void FeSub(Fe h, const Fe f, const Fe g) {
+    h[0] = f[0] + 0x1fffffffffffb4ULL - g[0];
+    for (unsigned int i = 1; i < 5; i++) {
+        h[i] = f[i] + 0x1ffffffffffffcULL - g[i];
+    }
+}
+
+static void FeMul(Fe h, const Fe f, const Fe g) {
+    uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+    uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+
+    u128 r0 = (u128) f0 * g0 + (u128) f1 * g4_19 + (u128) f2 * g3_19 + (u128) f3 * g2_19 + (u128) f4 * g1_19;
+    u128 r1 = (u128) f0 * g1 + (u128) f1 * g0 + (u128) f2 * g4_19 + (u128) f3 * g3_19 + (u128) f4 * g2_19;
+    u128 r2 = (u128) f0 * g2 + (u128) f1 * g1 + (u128) f2 * g0 + (u128) f3 * g4_19 + (u128) f4 * g3_19;
+    u128 r3 = (u128) f0 * g3 + (u128) f1 * g2 + (u128) f2 * g1 + (u128) f3 * g0 + (u128) f4 * g4_19;
+    u128 r4 = (u128) f0 * g4 + (u128) f1 * g3 + (u128) f2 * g2 + (u128) f3 * g1 + (u128) f4 * g0;
+
+    r1 += (uint64_t) (r0 >> 51);
+    h[0] = (uint64_t) r0 & MASK51;
+    r2 += (uint64_t) (r1 >> 51);
+    h[1] = (uint64_t) r1 & MASK51;
+    r3 += (uint64_t) (r2 >> 51);
+    h[2] = (uint64_t) r2 & MASK51;
+    r4 += (uint64_t) (r3 >> 51);
+    h[3] = (uint64_t) r3 & MASK51;
+    uint64_t c = (uint64_t) (r4 >> 51);
+    h[4] = (uint64_t) r4 & MASK51;
+    h[0] += c * 19;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+}
+
+static void FeSquare(Fe h, const Fe f) {
+    FeMul(h, f, f);
+}
+
+static void FeSquareTimes(Fe h, const Fe f, unsigned int n) {
+    FeSquare(h, f);
+    for (unsigned int i = 1; i < n; i++) {
+        FeSquare(h, h);
+    }
+}
+
+static void FeMulSmall(Fe h, const Fe f, uint64_t n) {
+    u128 r[5];
+    for (unsigned int i = 0; i < 5; i++) {
+        r[i] = (u128) f[i] * n;
+    }
+    for (unsigned int i = 0; i < 4; i++) {
+        r[i + 1] += (uint64_t) (r[i] >> 51);
+        h[i] = (uint64_t) r[i] & MASK51;
+    }
+    h[4] = (uint64_t) r[4] & MASK51;
+    h[0] += 19 * (uint64_t) (r[4] >> 51);
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+}
+
+// z^(p - 2) = 1/z
+static void FeInvert(Fe out, const Fe z) {
+    Fe z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+    FeSquare(z2, z);
+    FeSquareTimes(t, z2, 2);
+    FeMul(z9, t, z);
+    FeMul(z11, z9, z2);
+    FeSquare(t, z11);
+    FeMul(z2_5_0, t, z9);
+    FeSquareTimes(t, z2_5_0, 5);
+    FeMul(z2_10_0, t, z2_5_0);
+    FeSquareTimes(t, z2_10_0, 10);
+    FeMul(z2_20_0, t, z2_10_0);
+    FeSquareTimes(t, z2_20_0, 20);
+    FeMul(t, t, z2_20_0);
+    FeSquareTimes(t, t, 10);
+    FeMul(z2_50_0, t, z2_10_0);
+    FeSquareTimes(t, z2_50_0, 50);
+    FeMul(z2_100_0, t, z2_50_0);
+    FeSquareTimes(t, z2_100_0, 100);
+    FeMul(t, t, z2_100_0);
+    FeSquareTimes(t, t, 50);
+    FeMul(t, t, z2_50_0);
+    FeSquareTimes(t, t, 5);
+    FeMul(out, t, z11);
+}
+
+static void FeSwap(Fe f, Fe g, uint64_t swap) {
+    uint64_t mask = 0 - swap;
+    for (unsigned int i = 0; i < 5; i++) {
+        uint64_t t = mask & (f[i] ^ g[i]);
+        f[i] ^= t;
+        g[i] ^= t;
+    }
+}
+
+void X25519(uint8_t out[X25519_KEY_SIZE], const uint8_t scalar[X25519_KEY_SIZE], const uint8_t point[X25519_KEY_SIZE]) {
+    uint8_t k[32];
+    memcpy(k, scalar, sizeof(k));
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+
+    Fe x1, x2 = {1}, z2 = {0}, x3, z3 = {1};
+    Fe a, aa, b, bb, e, c, d, da, cb, t;
+    FeFromBytes(x1, point);
+    memcpy(x3, x1, sizeof(x3));
+    uint64_t swap = 0;
+    for (int pos = 254; pos >= 0; pos--) {
+        uint64_t bit = (k[pos / 8] >> (pos & 7)) & 1;
+        swap ^= bit;
+        FeSwap(x2, x3, swap);
+        FeSwap(z2, z3, swap);
+        swap = bit;
+
+        FeAdd(a, x2, z2);
+        FeSquare(aa, a);
+        FeSub(b, x2, z2);
+        FeSquare(bb, b);
+        FeSub(e, aa, bb);
+        FeAdd(c, x3, z3);
+        FeSub(d, x3, z3);
+        FeMul(da, d, a);
+        FeMul(cb, c, b);
+        FeAdd(t, da, cb);
+        FeSquare(x3, t);
+        FeSub(t, da, cb);
+        FeSquare(t, t);
+        FeMul(z3, x1, t);
+        FeMul(x2, aa, bb);
+        FeMulSmall(t, e, 121665);
+        FeAdd(t, aa, t);
+        FeMul(z2, e, t);
+    }
+    FeSwap(x2, x3, swap);
+    FeSwap(z2, z3, swap);
+
+    FeInvert(z2, z2);
+    FeMul(x2, x2, z2);
+    FeToBytes(out, x2);
+    memset(k, 0, sizeof(k));
+}
+
+void X25519Public(uint8_t public_key[X25519_KEY_SIZE], const uint8_t secret_key[X25519_KEY_SIZE]) {
+    static const uint8_t BASE_POINT[X25519_KEY_SIZE] = {9};
+    X25519(public_key, secret_key, BASE_POINT);
+}
+
+// A fresh key pair from the kernel's random pool, -1 when it has none.
+int X25519Keypair(uint8_t public_key[X25519_KEY_SIZE], uint8_t secret_key[X25519_KEY_SIZE]) {
+    if (getrandom(secret_key, X25519_KEY_SIZE, 0) != X25519_KEY_SIZE) {
+        return -1;
+    }
+    X25519Public(public_key, secret_key);
+    return 0;
+}
@@ -0,0 +1,16 @@
+// Copyright 2025 Michał Jankowski
+#ifndef SRC_X25519_H_
+#define SRC_X25519_H_
+
+#include <stdint.h>
+
+// X25519 Diffie-Hellman (RFC 7748), constant time: a Montgomery ladder
+// over 51-bit limbs with 128-bit products.
+
+#define X25519_KEY_SIZE 32
+
+void X25519(uint8_t out[X25519_KEY_SIZE], const uint8_t scalar[X25519_KEY_SIZE], const uint8_t point[X25519_KEY_SIZE]);
+void X25519Public(uint8_t public_key[X25519_KEY_SIZE], const uint8_t secret_key[X25519_KEY_SIZE]);
+int X25519Keypair(uint8_t public_key[X25519_KEY_SIZE], uint8_t secret_key[X25519_KEY_SIZE]);
+
+#endif  // SRC_X25519_H_
@@ -0,0 +1,128 @@
+// Copyright 2025 Michał Jankowski
+// Converts a c_comm trace dump (/trace dump, SIGUSR1, CommTraceDump()) into
+// Chrome trace JSON, for chrome://tracing or ui.perfetto.dev. One track per
+// traced thread, dispatches are spans, everything else instant events.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static const char *const MESSAGE_NAMES[] = {
+    "scan", "scan_response", "cleartext", "disconnect", "channel", "ping", "pong", "gossip", "batch", "encrypted",
+};
+static const char *const REASON_NAMES[] = {
+    "found", "gossip", "left", "failed", "replaced", "dropped",
+};
+static const char *const ERROR_NAMES[] = {
+    "?", "open", "transport", "scan", "send", "publish", "path",
+};
+static const char *const LANE_NAMES[] = {"control", "bulk"};
+
+#define NAME(table, i) ((i) < sizeof(table) / sizeof(table[0]) ? (table)[i] : "?")
+
+typedef struct {
+    uint64_t start_ticks;
+    uint64_t start_ns;
+    double ns_per_tick;
+} Clock;
+
+static double ToUs(const Clock *clock, uint64_t ticks) {
+    double delta = (double) (int64_t) (ticks - clock->start_ticks) * clock->ns_per_tick;
+    return ((double) clock->start_ns + delta) / 1000.0;
+}
+
+static void PrintEvent(FILE *out, const Clock *clock, uint32_t tid, const TraceEvent *e, int first) {
+    fprintf(out, "%s\n{\"pid\":1,\"tid\":%u,\"ts\":%.3f,", first ? "" : ",", tid, ToUs(clock, e->ts));
+    switch (e->type) {
+        case TRACE_RECV:
+            fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"recv\",\"args\":{\"family\":%u,\"bytes\":%lu}}",
+                    e->code, (unsigned long) e->a);
+            break;
+        case TRACE_DISPATCH:
+            fprintf(out, "\"ph\":\"X\",\"dur\":%.3f,\"name\":\"%s\",\"args\":{\"peer\":%d,\"bytes\":%lu}}",
+                    (double) e->b * clock->ns_per_tick / 1000.0, NAME(MESSAGE_NAMES, e->code), e->peer,
+                    (unsigned long) e->a);
+            break;
+        case TRACE_PEER_INSERT:
+        case TRACE_PEER_EVICT:
+            fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"peer %s\",\"args\":{\"peer\":%d,\"reason\":\"%s\"}}",
+                    e->type == TRACE_PEER_INSERT ? "insert" : "evict", e->peer, NAME(REASON_NAMES, e->code));
+            break;
+        case TRACE_SEND:
+            fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"send\","
+                    "\"args\":{\"peer\":%d,\"lane\":\"%s\",\"bytes\":%lu,\"queued_ahead\":%lu}}",
+                    e->peer, NAME(LANE_NAMES, e->code), (unsigned long) e->a, (unsigned long) e->b);
+            break;
+        case TRACE_ERROR:
+            fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"error\",\"args\":{\"error\":\"%s\"}}",
+                    NAME(ERROR_NAMES, e->code));
+            break;
+        default:
+            fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"type %u\",\"args\":{\"code\":%u}}", e->type, e->code);
+            break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: trace2json DUMP [JSON]  (default: stdout)\n");
+        return EXIT_FAILURE;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror("[FAIL] Open dump");
+        return EXIT_FAILURE;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+        || header.version != TRACE_VERSION || header.event_size != sizeof(TraceEvent)) {
+        fprintf(stderr, "[FAIL] %s is not a c_comm trace (version %d)\n", argv[1], TRACE_VERSION);
+        return EXIT_FAILURE;
+    }
+    FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        perror("[FAIL] Open output");
+        return EXIT_FAILURE;
+    }
+
+    Clock clock = {header.start_ticks, header.start_ns, 1.0};
+    if (header.clock == TRACE_CLOCK_TSC && header.end_ticks > header.start_ticks) {
+        clock.ns_per_tick = (double) (header.end_ns - header.start_ns)
+                            / (double) (header.end_ticks - header.start_ticks);
+    }
+
+    unsigned long total = 0;
+    int first = 1;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (uint32_t i = 0; i < header.rings; i++) {
+        TraceRingHeader ring;
+        if (fread(&ring, sizeof(ring), 1, in) != 1) {
+            fprintf(stderr, "[WARN] Dump truncated after %u of %u rings\n", i, header.rings);
+            break;
+        }
+        fprintf(out, "%s\n{\"pid\":1,\"tid\":%u,\"ph\":\"M\",\"name\":\"thread_name\","
+                "\"args\":{\"name\":\"thread %u\"}}", first ? "" : ",", ring.tid, ring.tid);
+        first = 0;
+        if (ring.overwritten > 0) {
+            fprintf(stderr, "[WARN] Thread %u: %lu older events were overwritten\n",
+                    ring.tid, (unsigned long) ring.overwritten);
+        }
+        for (uint32_t j = 0; j < ring.events; j++) {
+            TraceEvent e;
+            if (fread(&e, sizeof(e), 1, in) != 1) {
+                fprintf(stderr, "[WARN] Dump truncated in thread %u\n", ring.tid);
+                break;
+            }
+            PrintEvent(out, &clock, ring.tid, &e, 0);
+            total++;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    fclose(in);
+    if (out != stdout) {
+        fclose(out);
+    }
+    fprintf(stderr, "%lu events from %u threads\n", total, header.rings);
+    return EXIT_SUCCESS;
+}